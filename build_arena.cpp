@@ -0,0 +1,320 @@
+#include <DetourAlloc.h>
+#include <RecastAlloc.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#include "build_arena.h"
+
+/// bytes before every block, keep the blocks 16 bytes aligned
+static const size_t HEADER_SIZE = 16;
+/// bytes of a new arena chunk, larger if the block need
+static const size_t ARENA_CHUNK = 1 << 20;
+/// the first chunk is kept when the outermost scope end if not larger
+static const size_t ARENA_KEEP = 4 << 20;
+
+struct BlockHeader
+{
+    size_t size;        /// requested
+    unsigned char hint; /// RecastNavMesh::MemoryHint
+    bool arena;
+    bool freed; /// freed in the arena, skipped when rewind
+};
+
+static_assert(sizeof(BlockHeader) <= HEADER_SIZE, "block header too large");
+
+struct ArenaChunk
+{
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+};
+
+/// where the arena was when a scope created
+struct ArenaMark
+{
+    int chunk; /// -1 if none bumped
+    size_t used;
+};
+
+/// the arena of a thread, a stack of chunks
+struct Arena
+{
+    std::vector<ArenaChunk> chunks;
+    int current;                  /// chunk bumped now, -1 if none
+    std::vector<ArenaMark> marks; /// of the scopes alive, innermost last
+
+    Arena() : current(-1) {}
+    ~Arena();
+
+    void *bump(size_t total);
+    /// release the blocks after the innermost mark and drop it
+    void rewind();
+    /// free the chunks but the first, and the first if too large
+    void trim();
+};
+
+static thread_local Arena t_arena;
+static std::atomic<bool> g_installed(false);
+static std::atomic<bool> g_enabled(true);
+
+static std::atomic<size_t> g_bytes[RecastNavMesh::MEMORY_HINTS];
+static std::atomic<size_t> g_peak[RecastNavMesh::MEMORY_HINTS];
+static std::atomic<size_t> g_total_bytes(0);
+static std::atomic<size_t> g_total_peak(0);
+static std::atomic<size_t> g_arena_bytes(0);
+static std::atomic<size_t> g_arena_peak(0);
+static std::atomic<unsigned long long> g_allocs(0);
+static std::atomic<unsigned long long> g_arena_allocs(0);
+static std::atomic<unsigned long long> g_reclaimed(0);
+
+static size_t align_size(size_t size)
+{
+    return (size + HEADER_SIZE - 1) & ~(HEADER_SIZE - 1);
+}
+
+static void raise_peak(std::atomic<size_t> &peak, size_t bytes)
+{
+    size_t old = peak.load(std::memory_order_relaxed);
+    while (old < bytes
+           && !peak.compare_exchange_weak(old, bytes,
+                                          std::memory_order_relaxed))
+    {
+    }
+}
+
+static void count_alloc(int hint, size_t size)
+{
+    const size_t bytes =
+        g_bytes[hint].fetch_add(size, std::memory_order_relaxed) + size;
+    const size_t total =
+        g_total_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    raise_peak(g_peak[hint], bytes);
+    raise_peak(g_total_peak, total);
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void count_free(int hint, size_t size)
+{
+    g_bytes[hint].fetch_sub(size, std::memory_order_relaxed);
+    g_total_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+Arena::~Arena()
+{
+    for (const ArenaChunk &chunk : chunks)
+    {
+        g_arena_bytes.fetch_sub(chunk.capacity, std::memory_order_relaxed);
+        free(chunk.base);
+    }
+}
+
+void *Arena::bump(size_t total)
+{
+    if (current >= 0)
+    {
+        ArenaChunk &chunk = chunks[current];
+        if (chunk.capacity - chunk.used >= total)
+        {
+            void *ptr = chunk.base + chunk.used;
+            chunk.used += total;
+            return ptr;
+        }
+    }
+
+    // chunks after current are empty, reuse the next if large enough
+    const int next = current + 1;
+    if (next < (int)chunks.size() && chunks[next].capacity < total)
+    {
+        for (size_t i = next; i < chunks.size(); i++)
+        {
+            g_arena_bytes.fetch_sub(chunks[i].capacity,
+                                    std::memory_order_relaxed);
+            free(chunks[i].base);
+        }
+        chunks.resize(next);
+    }
+    if (next == (int)chunks.size())
+    {
+        ArenaChunk chunk;
+        chunk.capacity = total > ARENA_CHUNK ? total : ARENA_CHUNK;
+        chunk.base     = (unsigned char *)malloc(chunk.capacity);
+        chunk.used     = 0;
+        if (!chunk.base) return nullptr;
+
+        chunks.push_back(chunk);
+        raise_peak(g_arena_peak,
+                   g_arena_bytes.fetch_add(chunk.capacity,
+                                           std::memory_order_relaxed)
+                       + chunk.capacity);
+    }
+
+    current           = next;
+    ArenaChunk &chunk = chunks[current];
+    chunk.used        = total;
+    return chunk.base;
+}
+
+void Arena::rewind()
+{
+    const int chunk   = marks.back().chunk;
+    const size_t used = marks.back().used;
+    marks.pop_back();
+
+    // blocks not freed are released here, uncount them
+    for (int i = chunk < 0 ? 0 : chunk; i <= current; i++)
+    {
+        const ArenaChunk &c = chunks[i];
+        size_t offset       = i == chunk ? used : 0;
+        while (offset < c.used)
+        {
+            const BlockHeader *header =
+                (const BlockHeader *)(c.base + offset);
+            if (!header->freed)
+            {
+                count_free(header->hint, header->size);
+                g_reclaimed.fetch_add(header->size, std::memory_order_relaxed);
+            }
+            offset += HEADER_SIZE + align_size(header->size);
+        }
+    }
+
+    current = chunk;
+    if (chunk >= 0) chunks[chunk].used = used;
+}
+
+void Arena::trim()
+{
+    size_t keep = chunks.empty() || chunks[0].capacity > ARENA_KEEP ? 0 : 1;
+    for (size_t i = keep; i < chunks.size(); i++)
+    {
+        g_arena_bytes.fetch_sub(chunks[i].capacity, std::memory_order_relaxed);
+        free(chunks[i].base);
+    }
+    chunks.resize(keep);
+}
+
+static void *alloc_block(size_t size, int hint, bool arena_ok)
+{
+    Arena &arena        = t_arena;
+    BlockHeader *header = nullptr;
+    bool in_arena       = false;
+    if (arena_ok && !arena.marks.empty())
+    {
+        header   = (BlockHeader *)arena.bump(HEADER_SIZE + align_size(size));
+        in_arena = header != nullptr;
+    }
+    if (!header) header = (BlockHeader *)malloc(HEADER_SIZE + size);
+    if (!header) return nullptr;
+
+    header->size  = size;
+    header->hint  = (unsigned char)hint;
+    header->arena = in_arena;
+    header->freed = false;
+
+    count_alloc(hint, size);
+    if (in_arena) g_arena_allocs.fetch_add(1, std::memory_order_relaxed);
+    return (unsigned char *)header + HEADER_SIZE;
+}
+
+static void free_block(void *ptr)
+{
+    if (!ptr) return;
+
+    BlockHeader *header = (BlockHeader *)((unsigned char *)ptr - HEADER_SIZE);
+    count_free(header->hint, header->size);
+    if (!header->arena)
+    {
+        free(header);
+        return;
+    }
+
+    // temp blocks are mostly freed in reverse order, give back the last one
+    // unless bumped before the innermost scope
+    header->freed = true;
+    Arena &arena  = t_arena;
+    if (arena.current < 0 || arena.marks.empty()) return;
+
+    ArenaChunk &chunk      = arena.chunks[arena.current];
+    const ArenaMark &mark  = arena.marks.back();
+    const size_t end       = HEADER_SIZE + align_size(header->size);
+    const unsigned char *p = (unsigned char *)header;
+    if (p + end == chunk.base + chunk.used
+        && (arena.current != mark.chunk || p >= chunk.base + mark.used))
+        chunk.used -= end;
+}
+
+static void *rc_alloc(size_t size, rcAllocHint hint)
+{
+    return alloc_block(size, RecastNavMesh::MEMORY_RC_PERM + hint, true);
+}
+
+static void *dt_alloc(size_t size, dtAllocHint hint)
+{
+    // perm blocks are the nav mesh data and the query pools
+    return alloc_block(size, RecastNavMesh::MEMORY_DT_PERM + hint,
+                       hint == DT_ALLOC_TEMP);
+}
+
+BuildArena::Scope::Scope()
+{
+    _active = g_installed.load(std::memory_order_relaxed)
+           && g_enabled.load(std::memory_order_relaxed);
+    if (!_active) return;
+
+    Arena &arena = t_arena;
+    ArenaMark mark;
+    mark.chunk = arena.current;
+    mark.used  = mark.chunk >= 0 ? arena.chunks[mark.chunk].used : 0;
+    arena.marks.push_back(mark);
+}
+
+BuildArena::Scope::~Scope()
+{
+    if (!_active) return;
+
+    Arena &arena = t_arena;
+    arena.rewind();
+    if (arena.marks.empty()) arena.trim();
+}
+
+void BuildArena::install()
+{
+    static std::once_flag once;
+    std::call_once(once, [] {
+        rcAllocSetCustom(rc_alloc, free_block);
+        dtAllocSetCustom(dt_alloc, free_block);
+        g_installed = true;
+    });
+}
+
+void BuildArena::set_enabled(bool enable)
+{
+    g_enabled = enable;
+}
+
+void BuildArena::get_stat(RecastNavMesh::MemoryStat &stat)
+{
+    for (int i = 0; i < RecastNavMesh::MEMORY_HINTS; i++)
+    {
+        stat.bytes[i] = g_bytes[i].load(std::memory_order_relaxed);
+        stat.peak[i]  = g_peak[i].load(std::memory_order_relaxed);
+    }
+    stat.total_bytes  = g_total_bytes.load(std::memory_order_relaxed);
+    stat.total_peak   = g_total_peak.load(std::memory_order_relaxed);
+    stat.arena_bytes  = g_arena_bytes.load(std::memory_order_relaxed);
+    stat.arena_peak   = g_arena_peak.load(std::memory_order_relaxed);
+    stat.allocs       = g_allocs.load(std::memory_order_relaxed);
+    stat.arena_allocs = g_arena_allocs.load(std::memory_order_relaxed);
+    stat.reclaimed    = g_reclaimed.load(std::memory_order_relaxed);
+}
+
+void BuildArena::reset_peak()
+{
+    for (int i = 0; i < RecastNavMesh::MEMORY_HINTS; i++)
+        g_peak[i] = g_bytes[i].load(std::memory_order_relaxed);
+    g_total_peak = g_total_bytes.load(std::memory_order_relaxed);
+    g_arena_peak = g_arena_bytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+
+#include "recast_navmesh.h"
+
+/**
+ * allocation hooks of Recast and Detour. Every block is counted by it's hint,
+ * and while a Scope is alive on a thread the Recast blocks and the Detour
+ * temp blocks of that thread are bumped from it's own arena instead of the
+ * heap. The arena rewind when the scope end, releasing at once whatever the
+ * build did not free(eg. on an early return). Detour perm blocks(the nav mesh
+ * data) always come from the heap, they outlive the build.
+ *
+ * A block from an arena must be freed, if at all, by the same thread before
+ * the scope end. The hooks replace any set by rcAllocSetCustom and
+ * dtAllocSetCustom before, nothing is hooked(or counted) until install
+ */
+class BuildArena
+{
+public:
+    /**
+     * mark the arena of the calling thread and rewind to it when destroyed,
+     * nested scopes rewind to their own mark. Inert if the hooks are not
+     * installed or the arena is disabled when created
+     */
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+
+    private:
+        bool _active;
+    };
+
+public:
+    /**
+     * install the hooks, once per process. Must run before any Recast or
+     * Detour allocation, a block allocated through the old hooks would be
+     * freed through these
+     */
+    static void install();
+
+    /// use the arenas for the scopes created from now on, default true
+    static void set_enabled(bool enable);
+
+    static void get_stat(RecastNavMesh::MemoryStat &stat);
+
+    /// restart the peaks from the bytes alive now
+    static void reset_peak();
+};
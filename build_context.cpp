@@ -0,0 +1,196 @@
+#include <cstring>
+
+#include "build_context.h"
+
+static size_t heightfield_bytes(const rcHeightfield *hf)
+{
+    if (!hf) return 0;
+
+    size_t bytes = hf->width * hf->height * sizeof(rcSpan *);
+    for (const rcSpanPool *pool = hf->pools; pool; pool = pool->next)
+    {
+        bytes += sizeof(rcSpanPool);
+    }
+    return bytes;
+}
+
+static size_t compact_bytes(const rcCompactHeightfield *chf)
+{
+    if (!chf) return 0;
+
+    size_t bytes = chf->width * chf->height * sizeof(rcCompactCell);
+    bytes += chf->spanCount * (sizeof(rcCompactSpan) + sizeof(unsigned char));
+    if (chf->dist) bytes += chf->spanCount * sizeof(unsigned short);
+    return bytes;
+}
+
+static size_t contour_bytes(const rcContourSet *cset)
+{
+    if (!cset) return 0;
+
+    size_t bytes = cset->nconts * sizeof(rcContour);
+    for (int i = 0; i < cset->nconts; i++)
+    {
+        const rcContour &cont = cset->conts[i];
+        bytes += (cont.nverts + cont.nrverts) * 4 * sizeof(int);
+    }
+    return bytes;
+}
+
+static size_t polymesh_bytes(const rcPolyMesh *pmesh)
+{
+    if (!pmesh) return 0;
+
+    // verts, polys(with neighbours), regs, flags and areas
+    return pmesh->nverts * 3 * sizeof(unsigned short)
+         + pmesh->maxpolys * pmesh->nvp * 2 * sizeof(unsigned short)
+         + pmesh->maxpolys * (sizeof(unsigned short) * 2 + 1);
+}
+
+static size_t detail_bytes(const rcPolyMeshDetail *dmesh)
+{
+    if (!dmesh) return 0;
+
+    return dmesh->nmeshes * 4 * sizeof(unsigned int)
+         + dmesh->nverts * 3 * sizeof(float) + dmesh->ntris * 4;
+}
+
+BuildContext::BuildContext(const RecastNavMesh::LogSink *sink)
+    : rcContext(true)
+{
+    _sink   = sink;
+    _parent = nullptr;
+
+    _heightfield_bytes = 0;
+    _compact_bytes     = 0;
+    _contour_bytes     = 0;
+    _polymesh_bytes    = 0;
+    _detail_bytes      = 0;
+    _peak_bytes        = 0;
+
+    doResetTimers();
+}
+
+BuildContext::BuildContext(BuildContext *parent) : BuildContext(parent->_sink)
+{
+    _parent = parent;
+}
+
+BuildContext::~BuildContext()
+{
+    if (_parent) _parent->merge(*this);
+}
+
+void BuildContext::doLog(const rcLogCategory category, const char *msg,
+                         const int /*len*/)
+{
+    if (_parent)
+    {
+        _parent->doLog(category, msg, 0);
+        return;
+    }
+    if (!_sink || !*_sink) return;
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    (*_sink)(category, msg);
+}
+
+void BuildContext::doResetTimers()
+{
+    for (int i = 0; i < RC_MAX_TIMERS; i++) _acc[i] = -1;
+}
+
+void BuildContext::doStartTimer(const rcTimerLabel label)
+{
+    _start[label] = Clock::now();
+}
+
+void BuildContext::doStopTimer(const rcTimerLabel label)
+{
+    const long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             Clock::now() - _start[label])
+                             .count();
+    if (_acc[label] == -1)
+        _acc[label] = us;
+    else
+        _acc[label] += us;
+}
+
+int BuildContext::doGetAccumulatedTime(const rcTimerLabel label) const
+{
+    return (int)_acc[label];
+}
+
+void BuildContext::merge(const BuildContext &child)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+    for (int i = 0; i < RC_MAX_TIMERS; i++)
+    {
+        if (child._acc[i] == -1) continue;
+
+        if (_acc[i] == -1)
+            _acc[i] = child._acc[i];
+        else
+            _acc[i] += child._acc[i];
+    }
+
+    _heightfield_bytes = rcMax(_heightfield_bytes, child._heightfield_bytes);
+    _compact_bytes     = rcMax(_compact_bytes, child._compact_bytes);
+    _contour_bytes     = rcMax(_contour_bytes, child._contour_bytes);
+    _polymesh_bytes    = rcMax(_polymesh_bytes, child._polymesh_bytes);
+    _detail_bytes      = rcMax(_detail_bytes, child._detail_bytes);
+    _peak_bytes        = rcMax(_peak_bytes, child._peak_bytes);
+}
+
+void BuildContext::record_memory(const rcHeightfield *solid, size_t triareas,
+                                 const rcCompactHeightfield *chf,
+                                 const rcContourSet *cset,
+                                 const rcPolyMesh *pmesh,
+                                 const rcPolyMeshDetail *dmesh)
+{
+    const size_t hf = heightfield_bytes(solid);
+    const size_t cf = compact_bytes(chf);
+    const size_t cs = contour_bytes(cset);
+    const size_t pm = polymesh_bytes(pmesh);
+    const size_t dm = detail_bytes(dmesh);
+
+    _heightfield_bytes = rcMax(_heightfield_bytes, hf);
+    _compact_bytes     = rcMax(_compact_bytes, cf);
+    _contour_bytes     = rcMax(_contour_bytes, cs);
+    _polymesh_bytes    = rcMax(_polymesh_bytes, pm);
+    _detail_bytes      = rcMax(_detail_bytes, dm);
+    _peak_bytes        = rcMax(_peak_bytes, hf + triareas + cf + cs + pm + dm);
+}
+
+float BuildContext::ms(rcTimerLabel label) const
+{
+    return _acc[label] > 0 ? _acc[label] / 1000.0f : 0.f;
+}
+
+void BuildContext::get_stat(RecastNavMesh::BuildStat &stat) const
+{
+    // nested timers(eg. RC_TIMER_BUILD_CONTOURS_TRACE) are already included
+    // by their parent
+    stat.total_ms     = ms(RC_TIMER_TOTAL);
+    stat.rasterize_ms = ms(RC_TIMER_RASTERIZE_TRIANGLES);
+    stat.filter_ms    = ms(RC_TIMER_FILTER_LOW_OBSTACLES)
+                   + ms(RC_TIMER_FILTER_BORDER)
+                   + ms(RC_TIMER_FILTER_WALKABLE);
+    stat.compact_ms = ms(RC_TIMER_BUILD_COMPACTHEIGHTFIELD);
+    stat.erode_ms   = ms(RC_TIMER_ERODE_AREA);
+    stat.mark_ms    = ms(RC_TIMER_MARK_BOX_AREA)
+                 + ms(RC_TIMER_MARK_CYLINDER_AREA)
+                 + ms(RC_TIMER_MARK_CONVEXPOLY_AREA);
+    stat.distance_field_ms = ms(RC_TIMER_BUILD_DISTANCEFIELD);
+    stat.regions_ms        = ms(RC_TIMER_BUILD_REGIONS);
+    stat.contours_ms       = ms(RC_TIMER_BUILD_CONTOURS);
+    stat.polymesh_ms       = ms(RC_TIMER_BUILD_POLYMESH);
+    stat.detail_ms         = ms(RC_TIMER_BUILD_POLYMESHDETAIL);
+
+    stat.heightfield_bytes = _heightfield_bytes;
+    stat.compact_bytes     = _compact_bytes;
+    stat.contour_bytes     = _contour_bytes;
+    stat.polymesh_bytes    = _polymesh_bytes;
+    stat.detail_bytes      = _detail_bytes;
+    stat.peak_bytes        = _peak_bytes;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Recast.h>
+
+#include <chrono>
+#include <mutex>
+
+#include "recast_navmesh.h"
+
+/**
+ * rcContext with working timers and the log forwarded to a sink, so a build
+ * can report RecastNavMesh::BuildStat. The base rcContext drop both.
+ *
+ * Every worker thread of a tiled build use it's own context with the build's
+ * context as parent, logs are passed to the parent's sink under a lock and
+ * the timers are merged into the parent when the worker is done
+ */
+class BuildContext : public rcContext
+{
+public:
+    /// @param sink may be empty, must outlive the context
+    explicit BuildContext(const RecastNavMesh::LogSink *sink);
+    explicit BuildContext(BuildContext *parent);
+    virtual ~BuildContext();
+
+    /// record the intermediate results alive at the same time
+    void record_memory(const rcHeightfield *solid, size_t triareas,
+                       const rcCompactHeightfield *chf,
+                       const rcContourSet *cset, const rcPolyMesh *pmesh,
+                       const rcPolyMeshDetail *dmesh);
+
+    /**
+     * fill the stage times and memory sizes, stage times of a tiled build
+     * are summed over all tiles
+     */
+    void get_stat(RecastNavMesh::BuildStat &stat) const;
+
+protected:
+    virtual void doResetLog() {}
+    virtual void doLog(const rcLogCategory category, const char *msg,
+                       const int len);
+    virtual void doResetTimers();
+    virtual void doStartTimer(const rcTimerLabel label);
+    virtual void doStopTimer(const rcTimerLabel label);
+    virtual int doGetAccumulatedTime(const rcTimerLabel label) const;
+
+private:
+    void merge(const BuildContext &child);
+    float ms(rcTimerLabel label) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    const RecastNavMesh::LogSink *_sink;
+    BuildContext *_parent;
+    std::mutex _mutex; /// sink and merge from worker threads
+
+    Clock::time_point _start[RC_MAX_TIMERS];
+    long long _acc[RC_MAX_TIMERS]; /// accumulated microseconds, -1 if unused
+
+    size_t _heightfield_bytes;
+    size_t _compact_bytes;
+    size_t _contour_bytes;
+    size_t _polymesh_bytes;
+    size_t _detail_bytes;
+    size_t _peak_bytes;
+};
@@ -0,0 +1,884 @@
+#include <Recast.h>
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#include "build_geom.h"
+#include "thread_pool.h"
+
+static const int GEOM_CACHE_MAGIC =
+    'G' << 24 | 'E' << 16 | 'O' << 8 | 'M'; //'GEOM';
+static const int GEOM_CACHE_VERSION = 2;
+
+/// tris of a chunk of the chunky tri mesh, as InputGeom
+static const int TRIS_PER_CHUNK = 256;
+/// obj text parsed by one task at least
+static const size_t MIN_PARSE_CHUNK = 1 << 20;
+/// obj text read at a time by scan_obj
+static const size_t SCAN_BLOCK = 4 << 20;
+
+struct GeomCacheHeader
+{
+    int magic;
+    int version;
+    unsigned long long src_hash; /// path of the obj file the cache built from
+    long long src_size;
+    long long src_mtime; /// nanoseconds
+    int vert_count;
+    int tri_count;
+    int node_count;      /// rcChunkyTriMesh::nnodes
+    int chunk_tri_count; /// rcChunkyTriMesh::ntris
+    int max_tris_per_chunk;
+    float bmin[3];
+    float bmax[3];
+};
+
+/// tris and verts of a piece of obj text, face indices still local
+struct ObjChunk
+{
+    std::vector<float> verts;
+    std::vector<int> tris;
+    std::vector<int> limits; /// verts of the chunk before the face line
+    std::vector<unsigned char> relative; /// bit k set if index k is local
+    int valid; /// tris with every index in range
+};
+
+static void reset_chunky(rcChunkyTriMesh &cm)
+{
+    delete[] cm.nodes;
+    delete[] cm.tris;
+    cm.nodes           = 0;
+    cm.nnodes          = 0;
+    cm.tris            = 0;
+    cm.ntris           = 0;
+    cm.maxTrisPerChunk = 0;
+}
+
+static bool file_stat(const std::string &path, long long &size,
+                      long long &mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st)) return false;
+
+    // nanoseconds where the platform has them, an edit within the same
+    // second as the last load is caught too
+    size = (long long)st.st_size;
+#if defined(__APPLE__)
+    mtime = (long long)st.st_mtimespec.tv_sec * 1000000000LL
+          + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    mtime = (long long)st.st_mtime * 1000000000LL;
+#else
+    mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+/// FNV-1a of the path, tell the obj files of the same name apart
+static unsigned long long path_hash(const std::string &path)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (char c : path)
+    {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// bytes of a cache file with the counts of header, counts checked first
+static long long cache_size_of(const GeomCacheHeader &header)
+{
+    const long long tri_size = 3 * (sizeof(int) + sizeof(float));
+    return (long long)sizeof(GeomCacheHeader)
+         + header.vert_count * 3LL * (long long)sizeof(float)
+         + header.tri_count * tri_size
+         + header.node_count * (long long)sizeof(rcChunkyTriMeshNode)
+         + header.chunk_tri_count * 3LL * (long long)sizeof(int);
+}
+
+/// cache of path in dir, named after the obj file
+static std::string cache_path_of(const std::string &dir,
+                                 const std::string &path)
+{
+    const size_t slash = path.find_last_of("/\\");
+    std::string name =
+        slash == std::string::npos ? path : path.substr(slash + 1);
+
+    std::string cache_path = dir;
+    const char last        = cache_path.back();
+    if (last != '/' && last != '\\') cache_path.push_back('/');
+    return cache_path + name + GEOM_CACHE_SUFFIX;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Those code are ported from Recast Navigation, please Keep them consistent
+
+static const char *parseRow(const char *buf, const char *bufEnd, char *row,
+                            int len)
+{
+    bool start = true;
+    bool done  = false;
+    int n      = 0;
+    while (!done && buf < bufEnd)
+    {
+        char c = *buf;
+        buf++;
+        // multirow
+        switch (c)
+        {
+        case '\\': break;
+        case '\n':
+            if (start) break;
+            done = true;
+            break;
+        case '\r': break;
+        case '\t':
+        case ' ':
+            if (start) break;
+            // else falls through
+        default:
+            start    = false;
+            row[n++] = c;
+            if (n >= len - 1) done = true;
+            break;
+        }
+    }
+    row[n] = '\0';
+    return buf;
+}
+
+/// parseFace of rcMeshLoaderObj, negative indices are flagged in relative
+static int parseFace(char *row, int *data, bool *relative, int n, int vcnt)
+{
+    int j = 0;
+    while (*row != '\0')
+    {
+        // Skip initial white space
+        while (*row != '\0' && (*row == ' ' || *row == '\t')) row++;
+        char *s = row;
+        // Find vertex delimiter and terminated the string there for
+        // conversion.
+        while (*row != '\0' && *row != ' ' && *row != '\t')
+        {
+            if (*row == '/') *row = '\0';
+            row++;
+        }
+        if (*s == '\0') continue;
+        int vi      = atoi(s);
+        relative[j] = vi < 0;
+        data[j++]   = vi < 0 ? vi + vcnt : vi - 1;
+        if (j >= n) return j;
+    }
+    return j;
+}
+
+/**
+ * the row loop of rcMeshLoaderObj::load over [begin, end)
+ * @param vert_fn called with the 3 floats of every vert row
+ * @param face_fn called with every face row, after the leading 'f'
+ */
+template <typename VertFn, typename FaceFn>
+static void parse_rows(const char *begin, const char *end, VertFn vert_fn,
+                       FaceFn face_fn)
+{
+    char row[512];
+
+    const char *src = begin;
+    while (src < end)
+    {
+        // Parse one row
+        row[0] = '\0';
+        src    = parseRow(src, end, row, sizeof(row) / sizeof(char));
+        // Skip comments
+        if (row[0] == '#') continue;
+        if (row[0] == 'v' && row[1] != 'n' && row[1] != 't')
+        {
+            // Vertex pos
+            float v[3] = {0, 0, 0};
+            char *p    = row + 1;
+            for (int k = 0; k < 3; k++)
+            {
+                char *next = p;
+                v[k]       = strtof(p, &next);
+                if (next == p) break;
+                p = next;
+            }
+            vert_fn(v);
+        }
+        if (row[0] == 'f')
+        {
+            // Faces
+            face_fn(row + 1);
+        }
+    }
+}
+
+static void parse_chunk(const char *begin, const char *end, ObjChunk &chunk)
+{
+    int face[32];
+    bool relative[32];
+
+    parse_rows(
+        begin, end,
+        [&chunk](const float *v) {
+            chunk.verts.insert(chunk.verts.end(), v, v + 3);
+        },
+        [&](char *row) {
+            const int vcnt = (int)chunk.verts.size() / 3;
+            const int nv   = parseFace(row, face, relative, 32, vcnt);
+            for (int i = 2; i < nv; ++i)
+            {
+                const int a = face[0];
+                const int b = face[i - 1];
+                const int c = face[i];
+                chunk.tris.push_back(a);
+                chunk.tris.push_back(b);
+                chunk.tris.push_back(c);
+                chunk.limits.push_back(vcnt);
+                chunk.relative.push_back(
+                    (unsigned char)(relative[0] | relative[i - 1] << 1
+                                    | relative[i] << 2));
+            }
+        });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BuildGeom::BuildGeom()
+{
+    _from_cache = false;
+    _has_bounds = false;
+    memset(_mesh_bmin, 0, sizeof(_mesh_bmin));
+    memset(_mesh_bmax, 0, sizeof(_mesh_bmax));
+    memset(_nav_bmin, 0, sizeof(_nav_bmin));
+    memset(_nav_bmax, 0, sizeof(_nav_bmax));
+}
+
+void BuildGeom::reset()
+{
+    _mesh.verts.clear();
+    _mesh.tris.clear();
+    _mesh.normals.clear();
+    reset_chunky(_chunky);
+    _from_cache = false;
+    _path.clear();
+    _sources.clear();
+    _has_bounds = false;
+    _con_verts.clear();
+    _con_rads.clear();
+    _con_dirs.clear();
+    _con_areas.clear();
+    _con_flags.clear();
+    _con_ids.clear();
+    _volumes.clear();
+}
+
+bool BuildGeom::load(rcContext *ctx, const std::string &path,
+                     ThreadPool *pool, const std::string &cache_dir)
+{
+    reset();
+    _path = path;
+
+    size_t extensionPos = path.find_last_of('.');
+    if (extensionPos == std::string::npos) return false;
+
+    std::string extension = path.substr(extensionPos);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   ::tolower);
+    if (extension == ".gset")
+        return load_geom_set(ctx, path, pool, cache_dir);
+    if (extension == ".obj") return load_mesh(ctx, path, pool, cache_dir);
+
+    return false;
+}
+
+bool BuildGeom::load_mesh(rcContext *ctx, const std::string &path,
+                          ThreadPool *pool, const std::string &cache_dir)
+{
+    long long src_size = 0, src_mtime = 0;
+    if (!add_source(path, src_size, src_mtime))
+    {
+        ctx->log(RC_LOG_ERROR, "loadMesh: Could not load '%s'", path.c_str());
+        return false;
+    }
+
+    const bool use_cache = !cache_dir.empty();
+    const std::string cache_path =
+        use_cache ? cache_path_of(cache_dir, path) : std::string();
+    if (use_cache && read_cache(cache_path, path, src_size, src_mtime))
+    {
+        _from_cache = true;
+        ctx->log(RC_LOG_PROGRESS, "loadMesh: '%s' %d verts %d tris, cached",
+                 path.c_str(), _mesh.getVertCount(), _mesh.getTriCount());
+        return true;
+    }
+
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        ctx->log(RC_LOG_ERROR, "loadMesh: Could not load '%s'", path.c_str());
+        return false;
+    }
+
+    const size_t size = (size_t)src_size;
+    void *addr = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                      : nullptr;
+    close(fd); // the mapping keep a reference to the file
+    if (MAP_FAILED == addr)
+    {
+        ctx->log(RC_LOG_ERROR, "loadMesh: Could not map '%s'", path.c_str());
+        return false;
+    }
+
+    // read once from front to back
+    if (addr) madvise(addr, size, MADV_SEQUENTIAL);
+    parse_obj((const char *)addr, size, pool);
+    if (addr) munmap(addr, size);
+#else
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+    {
+        ctx->log(RC_LOG_ERROR, "loadMesh: Could not load '%s'", path.c_str());
+        return false;
+    }
+
+    std::vector<char> buf((size_t)src_size);
+    const size_t size = fread(buf.data(), 1, buf.size(), fp);
+    fclose(fp);
+    parse_obj(buf.data(), size, pool);
+#endif
+
+    calc_normals(pool);
+
+    const int nverts = _mesh.getVertCount();
+    const int ntris  = _mesh.getTriCount();
+    rcCalcBounds(_mesh.getVerts(), nverts, _mesh_bmin, _mesh_bmax);
+    if (!rcCreateChunkyTriMesh(_mesh.getVerts(), _mesh.getTris(), ntris,
+                               TRIS_PER_CHUNK, &_chunky))
+    {
+        ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Failed to build chunky "
+                               "mesh.");
+        return false;
+    }
+
+    ctx->log(RC_LOG_PROGRESS, "loadMesh: '%s' %d verts %d tris, parsed",
+             path.c_str(), nverts, ntris);
+
+    // a cache that can't be written only cost the next load a parse
+    if (use_cache && !write_cache(cache_path, path, src_size, src_mtime))
+    {
+        ctx->log(RC_LOG_WARNING, "loadMesh: Could not write cache '%s'",
+                 cache_path.c_str());
+    }
+
+    return true;
+}
+
+bool BuildGeom::load_triangles(rcContext *ctx, std::vector<float> &verts)
+{
+    reset();
+    _mesh.verts.swap(verts);
+
+    const int ntris = _mesh.getVertCount() / 3;
+    if (!ntris) return false;
+
+    _mesh.verts.resize(ntris * 9); // drop a partial triangle
+    _mesh.tris.resize(ntris * 3);
+    for (int i = 0; i < ntris * 3; i++) _mesh.tris[i] = i;
+
+    calc_normals(nullptr);
+    rcCalcBounds(_mesh.getVerts(), ntris * 3, _mesh_bmin, _mesh_bmax);
+    if (!rcCreateChunkyTriMesh(_mesh.getVerts(), _mesh.getTris(), ntris,
+                               TRIS_PER_CHUNK, &_chunky))
+    {
+        ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Failed to build chunky "
+                               "mesh.");
+        return false;
+    }
+    return true;
+}
+
+bool BuildGeom::scan_obj(rcContext *ctx, const std::string &path,
+                         const ObjVertFn &vert_fn, const ObjTriFn &tri_fn)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+    {
+        ctx->log(RC_LOG_ERROR, "loadMesh: Could not load '%s'", path.c_str());
+        return false;
+    }
+
+    int vcnt = 0;
+    int face[32];
+    bool relative[32];
+    auto on_vert = [&](const float *v) {
+        vcnt++;
+        vert_fn(v);
+    };
+    auto on_face = [&](char *row) {
+        const int nv = parseFace(row, face, relative, 32, vcnt);
+        for (int i = 2; i < nv; ++i)
+        {
+            const int tri[3] = {face[0], face[i - 1], face[i]};
+            if (tri[0] < 0 || tri[0] >= vcnt || tri[1] < 0 || tri[1] >= vcnt
+                || tri[2] < 0 || tri[2] >= vcnt)
+                continue;
+            tri_fn(tri);
+        }
+    };
+
+    // parse the whole rows in the block, the partial one at the end is
+    // moved to the front and completed by the next read
+    std::vector<char> buf(SCAN_BLOCK);
+    size_t keep = 0;
+    while (true)
+    {
+        const size_t n = fread(buf.data() + keep, 1, buf.size() - keep, fp);
+        const size_t size = keep + n;
+        const char *begin = buf.data();
+        const char *end   = begin + size;
+        if (n)
+        {
+            while (end > begin && end[-1] != '\n') end--;
+            if (end == begin)
+            {
+                // a row longer than the block
+                buf.resize(buf.size() * 2);
+                keep = size;
+                continue;
+            }
+        }
+
+        parse_rows(begin, end, on_vert, on_face);
+        if (!n) break;
+
+        keep = begin + size - end;
+        memmove(buf.data(), end, keep);
+    }
+
+    const bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+void BuildGeom::parse_obj(const char *buf, size_t size, ThreadPool *pool)
+{
+    // split after a newline, a row never cross two chunks
+    int nchunks = pool ? pool->size() * 4 : 1;
+    nchunks     = (int)std::min<size_t>(nchunks, size / MIN_PARSE_CHUNK + 1);
+
+    std::vector<size_t> bounds(nchunks + 1, size);
+    bounds[0] = 0;
+    for (int k = 1; k < nchunks; k++)
+    {
+        size_t pos = std::max(bounds[k - 1], size / nchunks * k);
+        while (pos < size && buf[pos - 1] != '\n') pos++;
+        bounds[k] = pos;
+    }
+
+    std::vector<ObjChunk> chunks(nchunks);
+    auto for_chunks = [&](const std::function<void(int)> &fn) {
+        if (!pool)
+        {
+            for (int k = 0; k < nchunks; k++) fn(k);
+            return;
+        }
+        pool->parallel_for(nchunks, 1, [&](int begin, int end) {
+            for (int k = begin; k < end; k++) fn(k);
+        });
+    };
+
+    for_chunks([&](int k) {
+        parse_chunk(buf + bounds[k], buf + bounds[k + 1], chunks[k]);
+    });
+
+    // vert index base of every chunk, then drop the faces out of range as
+    // rcMeshLoaderObj do(forward references included)
+    std::vector<int> vbase(nchunks + 1, 0);
+    for (int k = 0; k < nchunks; k++)
+        vbase[k + 1] = vbase[k] + (int)chunks[k].verts.size() / 3;
+
+    for_chunks([&](int k) {
+        ObjChunk &chunk = chunks[k];
+        const int base  = vbase[k];
+        const int ntris = (int)chunk.limits.size();
+
+        int valid = 0;
+        for (int t = 0; t < ntris; t++)
+        {
+            const int limit = base + chunk.limits[t];
+            int *tri        = &chunk.tris[t * 3];
+            bool ok         = true;
+            for (int j = 0; j < 3; j++)
+            {
+                if (chunk.relative[t] & (1 << j)) tri[j] += base;
+                if (tri[j] < 0 || tri[j] >= limit) ok = false;
+            }
+            if (!ok) continue;
+
+            // compact the valid tris to the front
+            memmove(&chunk.tris[valid * 3], tri, 3 * sizeof(int));
+            valid++;
+        }
+        chunk.valid = valid;
+    });
+
+    std::vector<int> tbase(nchunks + 1, 0);
+    for (int k = 0; k < nchunks; k++) tbase[k + 1] = tbase[k] + chunks[k].valid;
+
+    _mesh.verts.resize(vbase[nchunks] * 3);
+    _mesh.tris.resize(tbase[nchunks] * 3);
+    for_chunks([&](int k) {
+        const ObjChunk &chunk = chunks[k];
+        if (!chunk.verts.empty())
+        {
+            memcpy(&_mesh.verts[vbase[k] * 3], chunk.verts.data(),
+                   chunk.verts.size() * sizeof(float));
+        }
+        if (chunk.valid)
+        {
+            memcpy(&_mesh.tris[tbase[k] * 3], chunk.tris.data(),
+                   chunk.valid * 3 * sizeof(int));
+        }
+    });
+}
+
+void BuildGeom::calc_normals(ThreadPool *pool)
+{
+    const int ntris = _mesh.getTriCount();
+    _mesh.normals.resize(ntris * 3);
+
+    auto calc = [&](int begin, int end) {
+        const float *verts = _mesh.verts.data();
+        const int *tris    = _mesh.tris.data();
+        for (int i = begin * 3; i < end * 3; i += 3)
+        {
+            // Calculate normals, as rcMeshLoaderObj::load
+            const float *v0 = &verts[tris[i] * 3];
+            const float *v1 = &verts[tris[i + 1] * 3];
+            const float *v2 = &verts[tris[i + 2] * 3];
+            float e0[3], e1[3];
+            for (int j = 0; j < 3; ++j)
+            {
+                e0[j] = v1[j] - v0[j];
+                e1[j] = v2[j] - v0[j];
+            }
+            float *n = &_mesh.normals[i];
+            n[0]     = e0[1] * e1[2] - e0[2] * e1[1];
+            n[1]     = e0[2] * e1[0] - e0[0] * e1[2];
+            n[2]     = e0[0] * e1[1] - e0[1] * e1[0];
+            float d  = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (d > 0)
+            {
+                d = 1.0f / d;
+                n[0] *= d;
+                n[1] *= d;
+                n[2] *= d;
+            }
+        }
+    };
+
+    if (pool)
+        pool->parallel_for(ntris, 4096, calc);
+    else
+        calc(0, ntris);
+}
+
+bool BuildGeom::add_source(const std::string &path, long long &size,
+                           long long &mtime)
+{
+    if (!file_stat(path, size, mtime)) return false;
+
+    SourceStamp stamp;
+    stamp.path  = path;
+    stamp.size  = size;
+    stamp.mtime = mtime;
+    _sources.push_back(stamp);
+    return true;
+}
+
+bool BuildGeom::is_current(const std::string &path) const
+{
+    if (_sources.empty() || path != _path) return false;
+
+    for (const SourceStamp &stamp : _sources)
+    {
+        long long size = 0, mtime = 0;
+        if (!file_stat(stamp.path, size, mtime) || size != stamp.size
+            || mtime != stamp.mtime)
+            return false;
+    }
+    return true;
+}
+
+bool BuildGeom::read_cache(const std::string &path,
+                           const std::string &src_path, long long src_size,
+                           long long src_mtime)
+{
+    long long cache_size = 0, cache_mtime = 0;
+    if (!file_stat(path, cache_size, cache_mtime)) return false;
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) return false;
+
+    // the counts must add up to the file size before anything is allocated
+    static const int max_count = INT_MAX / 3;
+    GeomCacheHeader header;
+    size_t readLen = fread(&header, sizeof(GeomCacheHeader), 1, fp);
+    if (readLen != 1 || header.magic != GEOM_CACHE_MAGIC
+        || header.version != GEOM_CACHE_VERSION
+        || header.src_hash != path_hash(src_path)
+        || header.src_size != src_size || header.src_mtime != src_mtime
+        || header.vert_count < 0 || header.vert_count > max_count
+        || header.tri_count < 0 || header.tri_count > max_count
+        || header.node_count < 0 || header.node_count > max_count
+        || header.chunk_tri_count < 0 || header.chunk_tri_count > max_count
+        || header.max_tris_per_chunk < 0
+        || cache_size != cache_size_of(header))
+    {
+        fclose(fp);
+        return false;
+    }
+
+    _mesh.verts.resize(header.vert_count * 3);
+    _mesh.tris.resize(header.tri_count * 3);
+    _mesh.normals.resize(header.tri_count * 3);
+    _chunky.nodes           = new rcChunkyTriMeshNode[header.node_count];
+    _chunky.nnodes          = header.node_count;
+    _chunky.tris            = new int[header.chunk_tri_count * 3];
+    _chunky.ntris           = header.chunk_tri_count;
+    _chunky.maxTrisPerChunk = header.max_tris_per_chunk;
+    memcpy(_mesh_bmin, header.bmin, sizeof(_mesh_bmin));
+    memcpy(_mesh_bmax, header.bmax, sizeof(_mesh_bmax));
+
+    bool ok =
+        fread(_mesh.verts.data(), sizeof(float), _mesh.verts.size(), fp)
+            == _mesh.verts.size()
+        && fread(_mesh.tris.data(), sizeof(int), _mesh.tris.size(), fp)
+               == _mesh.tris.size()
+        && fread(_mesh.normals.data(), sizeof(float), _mesh.normals.size(),
+                 fp)
+               == _mesh.normals.size()
+        && fread(_chunky.nodes, sizeof(rcChunkyTriMeshNode), _chunky.nnodes,
+                 fp)
+               == (size_t)_chunky.nnodes
+        && fread(_chunky.tris, sizeof(int), _chunky.ntris * 3, fp)
+               == (size_t)_chunky.ntris * 3;
+    fclose(fp);
+
+    // every index must be in range, a leaf node own a range of the chunky
+    // tris and an inner node skip over it's children
+    for (size_t i = 0; ok && i < _mesh.tris.size(); ++i)
+        ok = _mesh.tris[i] >= 0 && _mesh.tris[i] < header.vert_count;
+    for (int i = 0; ok && i < _chunky.ntris * 3; ++i)
+        ok = _chunky.tris[i] >= 0 && _chunky.tris[i] < header.vert_count;
+    for (int i = 0; ok && i < _chunky.nnodes; ++i)
+    {
+        const rcChunkyTriMeshNode &node = _chunky.nodes[i];
+        if (node.i >= 0)
+        {
+            ok = node.n >= 0 && node.n <= _chunky.maxTrisPerChunk
+              && node.i <= _chunky.ntris - node.n;
+        }
+        else
+        {
+            ok = node.i != INT_MIN && -node.i <= _chunky.nnodes - i;
+        }
+    }
+
+    if (!ok)
+    {
+        _mesh.verts.clear();
+        _mesh.tris.clear();
+        _mesh.normals.clear();
+        reset_chunky(_chunky);
+    }
+    return ok;
+}
+
+bool BuildGeom::write_cache(const std::string &path,
+                            const std::string &src_path, long long src_size,
+                            long long src_mtime) const
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) return false;
+
+    GeomCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic              = GEOM_CACHE_MAGIC;
+    header.version            = GEOM_CACHE_VERSION;
+    header.src_hash           = path_hash(src_path);
+    header.src_size           = src_size;
+    header.src_mtime          = src_mtime;
+    header.vert_count         = _mesh.getVertCount();
+    header.tri_count          = _mesh.getTriCount();
+    header.node_count         = _chunky.nnodes;
+    header.chunk_tri_count    = _chunky.ntris;
+    header.max_tris_per_chunk = _chunky.maxTrisPerChunk;
+    memcpy(header.bmin, _mesh_bmin, sizeof(_mesh_bmin));
+    memcpy(header.bmax, _mesh_bmax, sizeof(_mesh_bmax));
+
+    bool ok =
+        fwrite(&header, sizeof(GeomCacheHeader), 1, fp) == 1
+        && fwrite(_mesh.verts.data(), sizeof(float), _mesh.verts.size(), fp)
+               == _mesh.verts.size()
+        && fwrite(_mesh.tris.data(), sizeof(int), _mesh.tris.size(), fp)
+               == _mesh.tris.size()
+        && fwrite(_mesh.normals.data(), sizeof(float), _mesh.normals.size(),
+                  fp)
+               == _mesh.normals.size()
+        && fwrite(_chunky.nodes, sizeof(rcChunkyTriMeshNode), _chunky.nnodes,
+                  fp)
+               == (size_t)_chunky.nnodes
+        && fwrite(_chunky.tris, sizeof(int), _chunky.ntris * 3, fp)
+               == (size_t)_chunky.ntris * 3;
+
+    // never leave a torn cache behind, it would fail the size check anyway
+    // but keep the disk clean
+    if (fclose(fp) || !ok)
+    {
+        remove(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Those code are ported from Recast Navigation, please Keep them consistent
+
+bool BuildGeom::load_geom_set(rcContext *ctx, const std::string &filepath,
+                              ThreadPool *pool, const std::string &cache_dir)
+{
+    long long gset_size = 0, gset_mtime = 0;
+    if (!add_source(filepath, gset_size, gset_mtime)) return false;
+
+    char *buf = 0;
+    FILE *fp  = fopen(filepath.c_str(), "rb");
+    if (!fp) return false;
+    if (fseek(fp, 0, SEEK_END) != 0)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    long bufSize = ftell(fp);
+    if (bufSize < 0)
+    {
+        fclose(fp);
+        return false;
+    }
+    if (fseek(fp, 0, SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return false;
+    }
+    buf = new char[bufSize];
+    size_t readLen = fread(buf, bufSize, 1, fp);
+    fclose(fp);
+    if (readLen != 1)
+    {
+        delete[] buf;
+        return false;
+    }
+
+    _con_verts.clear();
+    _volumes.clear();
+
+    const char *src    = buf;
+    const char *srcEnd = buf + bufSize;
+    char row[512];
+    while (src < srcEnd)
+    {
+        // Parse one row
+        row[0] = '\0';
+        src    = parseRow(src, srcEnd, row, sizeof(row) / sizeof(char));
+        if (row[0] == 'f')
+        {
+            // File name.
+            const char *name = row + 1;
+            // Skip white spaces
+            while (*name && isspace(*name)) name++;
+            if (*name)
+            {
+                if (!load_mesh(ctx, name, pool, cache_dir))
+                {
+                    delete[] buf;
+                    return false;
+                }
+            }
+        }
+        else if (row[0] == 'c')
+        {
+            // Off-mesh connection
+            if (_con_rads.size() < 256)
+            {
+                float v[6];
+                int bidir, area = 0, flags = 0;
+                float rad;
+                sscanf(row + 1, "%f %f %f  %f %f %f %f %d %d %d", &v[0],
+                       &v[1], &v[2], &v[3], &v[4], &v[5], &rad, &bidir, &area,
+                       &flags);
+                _con_verts.insert(_con_verts.end(), v, v + 6);
+                _con_rads.push_back(rad);
+                _con_dirs.push_back((unsigned char)bidir);
+                _con_areas.push_back((unsigned char)area);
+                _con_flags.push_back((unsigned short)flags);
+                _con_ids.push_back(1000 + (unsigned int)_con_ids.size());
+            }
+        }
+        else if (row[0] == 'v')
+        {
+            // Convex volumes
+            if (_volumes.size() < 256)
+            {
+                ConvexVolume vol;
+                memset(&vol, 0, sizeof(vol));
+                sscanf(row + 1, "%d %d %f %f", &vol.nverts, &vol.area,
+                       &vol.hmin, &vol.hmax);
+                vol.nverts = rcClamp(vol.nverts, 0, MAX_CONVEXVOL_PTS);
+                for (int i = 0; i < vol.nverts; ++i)
+                {
+                    row[0] = '\0';
+                    src = parseRow(src, srcEnd, row, sizeof(row) / sizeof(char));
+                    sscanf(row, "%f %f %f", &vol.verts[i * 3 + 0],
+                           &vol.verts[i * 3 + 1], &vol.verts[i * 3 + 2]);
+                }
+                _volumes.push_back(vol);
+            }
+        }
+        else if (row[0] == 's')
+        {
+            // Settings, only the nav mesh bounds are used
+            BuildSettings s;
+            _has_bounds = true;
+            sscanf(row + 1,
+                   "%f %f %f %f %f %f %f %f %f %f %f %f %f %d %f %f %f %f %f "
+                   "%f %f",
+                   &s.cellSize, &s.cellHeight, &s.agentHeight, &s.agentRadius,
+                   &s.agentMaxClimb, &s.agentMaxSlope, &s.regionMinSize,
+                   &s.regionMergeSize, &s.edgeMaxLen, &s.edgeMaxError,
+                   &s.vertsPerPoly, &s.detailSampleDist,
+                   &s.detailSampleMaxError, &s.partitionType, &_nav_bmin[0],
+                   &_nav_bmin[1], &_nav_bmin[2], &_nav_bmax[0], &_nav_bmax[1],
+                   &_nav_bmax[2], &s.tileSize);
+        }
+    }
+
+    delete[] buf;
+
+    return true;
+}
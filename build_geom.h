@@ -0,0 +1,172 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <ChunkyTriMesh.h>
+#include <InputGeom.h>
+
+class rcContext;
+class ThreadPool;
+
+/// the binary geometry cache of a obj file is named obj name + it
+#define GEOM_CACHE_SUFFIX ".geom"
+
+/**
+ * build input geometry, a replacement of InputGeom(same accessors, so the
+ * code ported from RecastDemo is kept as is). The obj file is mapped and
+ * parsed in chunks on a thread pool, the result is the same as
+ * rcMeshLoaderObj. If a cache directory is given the verts, tris, normals
+ * and chunky tri mesh are cached there to obj name + GEOM_CACHE_SUFFIX, later
+ * loads of the unchanged obj read the cache instead of parsing
+ */
+class BuildGeom
+{
+public:
+    /// accessors of rcMeshLoaderObj
+    class Mesh
+    {
+    public:
+        const float *getVerts() const { return verts.data(); }
+        const float *getNormals() const { return normals.data(); }
+        const int *getTris() const { return tris.data(); }
+        int getVertCount() const { return (int)verts.size() / 3; }
+        int getTriCount() const { return (int)tris.size() / 3; }
+
+    private:
+        friend class BuildGeom;
+        std::vector<float> verts;
+        std::vector<int> tris;
+        std::vector<float> normals;
+    };
+
+public:
+    BuildGeom();
+
+    /**
+     * load a obj or gset file
+     * @param pool parse on it if not nullptr
+     * @param cache_dir read the geometry cache in it if up to date, write it
+     *        if not. Empty to parse without a cache
+     */
+    bool load(rcContext *ctx, const std::string &path, ThreadPool *pool,
+              const std::string &cache_dir = std::string());
+
+    /**
+     * take triangles as the mesh, every triangle has it's own 3 verts
+     * @param verts 9 floats of every triangle, swapped out
+     * @return false if no triangle
+     */
+    bool load_triangles(rcContext *ctx, std::vector<float> &verts);
+
+    typedef std::function<void(const float *)> ObjVertFn;
+    typedef std::function<void(const int *)> ObjTriFn;
+    /**
+     * read a obj block by block without keeping it, the verts and tris are
+     * the same as load
+     * @param vert_fn called with 3 floats of every vert, in file order
+     * @param tri_fn called with 3 vert indices of every valid tri
+     */
+    static bool scan_obj(rcContext *ctx, const std::string &path,
+                         const ObjVertFn &vert_fn, const ObjTriFn &tri_fn);
+
+    /// true if the last load read the geometry cache
+    bool from_cache() const { return _from_cache; }
+
+    /**
+     * true if loaded from path and none of the files read(the gset and the
+     * obj it refer to) changed since
+     */
+    bool is_current(const std::string &path) const;
+
+    const Mesh *getMesh() const { return &_mesh; }
+    const float *getMeshBoundsMin() const { return _mesh_bmin; }
+    const float *getMeshBoundsMax() const { return _mesh_bmax; }
+    const float *getNavMeshBoundsMin() const
+    {
+        return _has_bounds ? _nav_bmin : _mesh_bmin;
+    }
+    const float *getNavMeshBoundsMax() const
+    {
+        return _has_bounds ? _nav_bmax : _mesh_bmax;
+    }
+    const rcChunkyTriMesh *getChunkyMesh() const { return &_chunky; }
+
+    int getOffMeshConnectionCount() const { return (int)_con_rads.size(); }
+    const float *getOffMeshConnectionVerts() const
+    {
+        return _con_verts.data();
+    }
+    const float *getOffMeshConnectionRads() const { return _con_rads.data(); }
+    const unsigned char *getOffMeshConnectionDirs() const
+    {
+        return _con_dirs.data();
+    }
+    const unsigned char *getOffMeshConnectionAreas() const
+    {
+        return _con_areas.data();
+    }
+    const unsigned short *getOffMeshConnectionFlags() const
+    {
+        return _con_flags.data();
+    }
+    const unsigned int *getOffMeshConnectionId() const
+    {
+        return _con_ids.data();
+    }
+
+    int getConvexVolumeCount() const { return (int)_volumes.size(); }
+    const ConvexVolume *getConvexVolumes() const { return _volumes.data(); }
+
+private:
+    /// a file read by load, as it was then
+    struct SourceStamp
+    {
+        std::string path;
+        long long size;
+        long long mtime; /// nanoseconds
+    };
+
+private:
+    void reset();
+    /// stamp path into _sources
+    bool add_source(const std::string &path, long long &size,
+                    long long &mtime);
+    bool load_mesh(rcContext *ctx, const std::string &path, ThreadPool *pool,
+                   const std::string &cache_dir);
+    bool load_geom_set(rcContext *ctx, const std::string &path,
+                       ThreadPool *pool, const std::string &cache_dir);
+
+    /// parse obj text into _mesh
+    void parse_obj(const char *buf, size_t size, ThreadPool *pool);
+    void calc_normals(ThreadPool *pool);
+
+    /// the cache is checked against everything the header claim
+    bool read_cache(const std::string &path, const std::string &src_path,
+                    long long src_size, long long src_mtime);
+    bool write_cache(const std::string &path, const std::string &src_path,
+                     long long src_size, long long src_mtime) const;
+
+private:
+    Mesh _mesh;
+    rcChunkyTriMesh _chunky;
+    float _mesh_bmin[3];
+    float _mesh_bmax[3];
+    bool _from_cache;
+    std::string _path;                /// given to the last load
+    std::vector<SourceStamp> _sources; /// files read by the last load
+
+    /// nav mesh bounds of the gset build settings
+    bool _has_bounds;
+    float _nav_bmin[3];
+    float _nav_bmax[3];
+
+    std::vector<float> _con_verts; /// 6 floats every connection
+    std::vector<float> _con_rads;
+    std::vector<unsigned char> _con_dirs;
+    std::vector<unsigned char> _con_areas;
+    std::vector<unsigned short> _con_flags;
+    std::vector<unsigned int> _con_ids;
+    std::vector<ConvexVolume> _volumes;
+};
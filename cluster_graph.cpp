@@ -0,0 +1,619 @@
+#include <DetourCommon.h>
+#include <DetourNavMeshQuery.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "cluster_graph.h"
+#include "thread_pool.h"
+
+static const int CLUSTERGRAPH_MAGIC =
+    'C' << 24 | 'G' << 16 | 'P' << 8 | 'H'; //'CGPH';
+static const int CLUSTERGRAPH_VERSION = 1;
+
+/// too many clusters is almost always a wrong cluster size
+static const int MAX_CLUSTERS = 1 << 22;
+
+struct ClusterGraphHeader
+{
+    int magic;
+    int version;
+    unsigned long long signature; /// of the mesh built from
+    float cluster_size;
+    float orig[3];
+    int width;
+    int height;
+    float min_cost;
+    int num_nodes;
+    int num_edges;
+    int num_polys;
+};
+
+typedef std::pair<float, dtPolyRef> PolyOpen;
+typedef std::pair<float, int> NodeOpen;
+
+static void poly_center(const dtMeshTile *tile, const dtPoly *poly,
+                        float *center)
+{
+    dtVset(center, 0, 0, 0);
+    for (int i = 0; i < (int)poly->vertCount; ++i)
+    {
+        dtVadd(center, center, &tile->verts[poly->verts[i] * 3]);
+    }
+    dtVscale(center, center, 1.f / poly->vertCount);
+}
+
+ClusterGraph::ClusterGraph()
+{
+    _signature    = 0;
+    _cluster_size = 0;
+    _width        = 0;
+    _height       = 0;
+    _min_cost     = 1;
+    dtVset(_orig, 0, 0, 0);
+}
+
+int ClusterGraph::cluster_of(const float *pos) const
+{
+    int x = (int)floorf((pos[0] - _orig[0]) / _cluster_size);
+    int z = (int)floorf((pos[2] - _orig[2]) / _cluster_size);
+    x     = dtClamp(x, 0, _width - 1);
+    z     = dtClamp(z, 0, _height - 1);
+    return x + z * _width;
+}
+
+int ClusterGraph::cluster_of(const dtMeshTile *tile, const dtPoly *poly) const
+{
+    float center[3];
+    poly_center(tile, poly, center);
+    return cluster_of(center);
+}
+
+unsigned long long ClusterGraph::signature(const dtNavMesh *mesh)
+{
+    // FNV-1a over the ref and size of every tile, a rebuilt tile get a new
+    // salt so it's ref changes
+    unsigned long long h = 14695981039346656037ULL;
+    auto mix = [&h](unsigned long long v) {
+        for (int i = 0; i < 8; ++i)
+        {
+            h ^= (v >> (i * 8)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+    };
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header) continue;
+
+        mix(mesh->getTileRef(tile));
+        mix((unsigned long long)tile->dataSize);
+    }
+    return h;
+}
+
+void ClusterGraph::search(const dtNavMesh *mesh, const dtQueryFilter *filter,
+                          int cluster, dtPolyRef start, dtPolyRef goal,
+                          const Adjacency *reverse, Visits &visits) const
+{
+    std::priority_queue<PolyOpen, std::vector<PolyOpen>,
+                        std::greater<PolyOpen> >
+        open;
+
+    Visit &first = visits[start];
+    first.cost   = 0;
+    first.parent = 0;
+    first.closed = false;
+    open.push(PolyOpen(0.f, start));
+
+    while (!open.empty())
+    {
+        PolyOpen top = open.top();
+        open.pop();
+
+        Visit &cur = visits[top.second];
+        if (cur.closed) continue;
+        cur.closed = true;
+        if (top.second == goal) break;
+
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly     = nullptr;
+        mesh->getTileAndPolyByRefUnsafe(top.second, &tile, &poly);
+        float center[3];
+        poly_center(tile, poly, center);
+
+        auto relax = [&](dtPolyRef ref) {
+            const dtMeshTile *ntile = nullptr;
+            const dtPoly *npoly     = nullptr;
+            if (dtStatusFailed(mesh->getTileAndPolyByRef(ref, &ntile, &npoly)))
+                return;
+            if (!filter->passFilter(ref, ntile, npoly)) return;
+
+            float ncenter[3];
+            poly_center(ntile, npoly, ncenter);
+            if (cluster_of(ncenter) != cluster) return;
+
+            // the cost of a step is paid by the poly it leave
+            const dtPoly *from = reverse ? npoly : poly;
+            float cost         = top.first
+                       + dtVdist(center, ncenter)
+                             * filter->getAreaCost(from->getArea());
+
+            auto found = visits.find(ref);
+            if (found != visits.end()
+                && (found->second.closed || found->second.cost <= cost))
+                return;
+
+            Visit &next = visits[ref];
+            next.cost   = cost;
+            next.parent = top.second;
+            next.closed = false;
+            open.push(PolyOpen(cost, ref));
+        };
+
+        if (reverse)
+        {
+            auto found = reverse->find(top.second);
+            if (found == reverse->end()) continue;
+            for (auto ref : found->second) relax(ref);
+        }
+        else
+        {
+            for (unsigned int i = poly->firstLink; i != DT_NULL_LINK;
+                 i              = tile->links[i].next)
+            {
+                if (tile->links[i].ref) relax(tile->links[i].ref);
+            }
+        }
+    }
+}
+
+void ClusterGraph::reverse_links(const dtNavMesh *mesh, int cluster,
+                                 Adjacency &reverse) const
+{
+    for (int i = _poly_offsets[cluster]; i < _poly_offsets[cluster + 1]; ++i)
+    {
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly     = nullptr;
+        if (dtStatusFailed(mesh->getTileAndPolyByRef(_polys[i], &tile, &poly)))
+            continue;
+
+        // out of cluster neighbours are dropped by search
+        for (unsigned int l = poly->firstLink; l != DT_NULL_LINK;
+             l              = tile->links[l].next)
+        {
+            dtPolyRef ref = tile->links[l].ref;
+            if (ref) reverse[ref].push_back(_polys[i]);
+        }
+    }
+}
+
+bool ClusterGraph::build(const dtNavMesh *mesh, const dtQueryFilter *filter,
+                         float cluster_size, ThreadPool *pool)
+{
+    _nodes.clear();
+    _edges.clear();
+    _node_offsets.clear();
+    _poly_offsets.clear();
+    _polys.clear();
+    _node_index.clear();
+    if (!mesh || cluster_size <= 0) return false;
+
+    // bounds of all tiles
+    float bmax[3];
+    dtVset(_orig, FLT_MAX, FLT_MAX, FLT_MAX);
+    dtVset(bmax, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header) continue;
+        dtVmin(_orig, tile->header->bmin);
+        dtVmax(bmax, tile->header->bmax);
+    }
+    if (_orig[0] > bmax[0]) return false;
+
+    _cluster_size = cluster_size;
+    _width  = dtMax(1, (int)ceilf((bmax[0] - _orig[0]) / cluster_size));
+    _height = dtMax(1, (int)ceilf((bmax[2] - _orig[2]) / cluster_size));
+    if ((long long)_width * _height > MAX_CLUSTERS) return false;
+    const int nclusters = _width * _height;
+
+    // polys of every cluster
+    std::vector<std::pair<int, dtPolyRef> > polys;
+    _min_cost = FLT_MAX;
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header) continue;
+
+        dtPolyRef base = mesh->getPolyRefBase(tile);
+        for (int j = 0; j < tile->header->polyCount; ++j)
+        {
+            const dtPoly *poly = &tile->polys[j];
+            polys.push_back(std::make_pair(cluster_of(tile, poly), base | j));
+            _min_cost =
+                dtMin(_min_cost, filter->getAreaCost(poly->getArea()));
+        }
+    }
+    if (polys.empty()) return false;
+    std::sort(polys.begin(), polys.end());
+
+    _poly_offsets.assign(nclusters + 1, 0);
+    _polys.resize(polys.size());
+    for (size_t i = 0; i < polys.size(); ++i)
+    {
+        _poly_offsets[polys[i].first + 1]++;
+        _polys[i] = polys[i].second;
+    }
+    for (int c = 0; c < nclusters; ++c)
+        _poly_offsets[c + 1] += _poly_offsets[c];
+
+    // nodes are the polys linked to another cluster, or linked from(one way
+    // off-mesh connection)
+    std::vector<std::pair<int, dtPolyRef> > borders;
+    std::vector<std::pair<dtPolyRef, dtPolyRef> > crossings;
+    for (size_t i = 0; i < polys.size(); ++i)
+    {
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly     = nullptr;
+        dtPolyRef ref          = polys[i].second;
+        mesh->getTileAndPolyByRefUnsafe(ref, &tile, &poly);
+        if (!filter->passFilter(ref, tile, poly)) continue;
+
+        for (unsigned int l = poly->firstLink; l != DT_NULL_LINK;
+             l              = tile->links[l].next)
+        {
+            dtPolyRef nref = tile->links[l].ref;
+            if (!nref) continue;
+
+            const dtMeshTile *ntile = nullptr;
+            const dtPoly *npoly     = nullptr;
+            mesh->getTileAndPolyByRefUnsafe(nref, &ntile, &npoly);
+            if (!filter->passFilter(nref, ntile, npoly)) continue;
+            int ncluster = cluster_of(ntile, npoly);
+            if (ncluster == polys[i].first) continue;
+
+            crossings.push_back(std::make_pair(ref, nref));
+            borders.push_back(polys[i]);
+            borders.push_back(std::make_pair(ncluster, nref));
+        }
+    }
+    std::sort(borders.begin(), borders.end());
+    borders.erase(std::unique(borders.begin(), borders.end()), borders.end());
+
+    _nodes.resize(borders.size());
+    _node_offsets.assign(nclusters + 1, 0);
+    for (size_t i = 0; i < borders.size(); ++i)
+    {
+        Node &node   = _nodes[i];
+        node.ref     = borders[i].second;
+        node.cluster = borders[i].first;
+
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly     = nullptr;
+        mesh->getTileAndPolyByRefUnsafe(node.ref, &tile, &poly);
+        poly_center(tile, poly, node.pos);
+
+        _node_index[node.ref] = (int)i;
+        _node_offsets[node.cluster + 1]++;
+    }
+    for (int c = 0; c < nclusters; ++c)
+        _node_offsets[c + 1] += _node_offsets[c];
+
+    // a crossing is paid by the poly it leave, same as search
+    std::vector<std::vector<Edge> > edges(_nodes.size());
+    for (auto &crossing : crossings)
+    {
+        const Node &from = _nodes[_node_index[crossing.first]];
+        const Node &to   = _nodes[_node_index[crossing.second]];
+
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly     = nullptr;
+        mesh->getTileAndPolyByRefUnsafe(from.ref, &tile, &poly);
+
+        Edge edge;
+        edge.to   = _node_index[crossing.second];
+        edge.cost = dtVdist(from.pos, to.pos)
+                  * filter->getAreaCost(poly->getArea());
+        edges[_node_index[crossing.first]].push_back(edge);
+    }
+
+    // inside a cluster, the cost from every node to the others
+    auto connect = [&](int begin, int end) {
+        Visits visits;
+        for (int c = begin; c < end; ++c)
+        {
+            for (int i = _node_offsets[c]; i < _node_offsets[c + 1]; ++i)
+            {
+                visits.clear();
+                search(mesh, filter, c, _nodes[i].ref, 0, nullptr, visits);
+                for (int j = _node_offsets[c]; j < _node_offsets[c + 1]; ++j)
+                {
+                    auto found = visits.find(_nodes[j].ref);
+                    if (i == j || found == visits.end()) continue;
+
+                    Edge edge;
+                    edge.to   = j;
+                    edge.cost = found->second.cost;
+                    edges[i].push_back(edge);
+                }
+            }
+        }
+    };
+    if (pool)
+        pool->parallel_for(nclusters, 16, connect);
+    else
+        connect(0, nclusters);
+
+    _signature = signature(mesh);
+
+    for (size_t i = 0; i < _nodes.size(); ++i)
+    {
+        _nodes[i].first_edge = (int)_edges.size();
+        _nodes[i].nedges     = (int)edges[i].size();
+        _edges.insert(_edges.end(), edges[i].begin(), edges[i].end());
+    }
+
+    return true;
+}
+
+bool ClusterGraph::save(FILE *fp) const
+{
+    // save a graph of no mesh make no sense
+    if (_poly_offsets.empty()) return false;
+
+    ClusterGraphHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic        = CLUSTERGRAPH_MAGIC;
+    header.version      = CLUSTERGRAPH_VERSION;
+    header.signature    = _signature;
+    header.cluster_size = _cluster_size;
+    dtVcopy(header.orig, _orig);
+    header.width     = _width;
+    header.height    = _height;
+    header.min_cost  = _min_cost;
+    header.num_nodes = (int)_nodes.size();
+    header.num_edges = (int)_edges.size();
+    header.num_polys = (int)_polys.size();
+
+    const int nclusters = _width * _height;
+    return fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(_nodes.data(), sizeof(Node), _nodes.size(), fp)
+               == _nodes.size()
+        && fwrite(_edges.data(), sizeof(Edge), _edges.size(), fp)
+               == _edges.size()
+        && fwrite(_node_offsets.data(), sizeof(int), nclusters + 1, fp)
+               == (size_t)nclusters + 1
+        && fwrite(_poly_offsets.data(), sizeof(int), nclusters + 1, fp)
+               == (size_t)nclusters + 1
+        && fwrite(_polys.data(), sizeof(dtPolyRef), _polys.size(), fp)
+               == _polys.size();
+}
+
+bool ClusterGraph::load(FILE *fp, const dtNavMesh *mesh)
+{
+    ClusterGraphHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1) return false;
+    if (header.magic != CLUSTERGRAPH_MAGIC
+        || header.version != CLUSTERGRAPH_VERSION)
+        return false;
+    if (!mesh || header.signature != signature(mesh)) return false;
+    if (header.width <= 0 || header.height <= 0
+        || (long long)header.width * header.height > MAX_CLUSTERS
+        || header.num_nodes < 0 || header.num_edges < 0
+        || header.num_polys < 0)
+        return false;
+
+    const int nclusters = header.width * header.height;
+    _nodes.resize(header.num_nodes);
+    _edges.resize(header.num_edges);
+    _node_offsets.resize(nclusters + 1);
+    _poly_offsets.resize(nclusters + 1);
+    _polys.resize(header.num_polys);
+    bool ok = fread(_nodes.data(), sizeof(Node), _nodes.size(), fp)
+                  == _nodes.size()
+           && fread(_edges.data(), sizeof(Edge), _edges.size(), fp)
+                  == _edges.size()
+           && fread(_node_offsets.data(), sizeof(int), nclusters + 1, fp)
+                  == (size_t)nclusters + 1
+           && fread(_poly_offsets.data(), sizeof(int), nclusters + 1, fp)
+                  == (size_t)nclusters + 1
+           && fread(_polys.data(), sizeof(dtPolyRef), _polys.size(), fp)
+                  == _polys.size();
+
+    _node_index.clear();
+    for (int i = 0; ok && i < header.num_nodes; ++i)
+    {
+        const Node &node = _nodes[i];
+        ok = node.cluster >= 0 && node.cluster < nclusters
+          && node.first_edge >= 0 && node.nedges >= 0
+          && node.first_edge + node.nedges <= header.num_edges;
+        _node_index[node.ref] = i;
+    }
+    for (int i = 0; ok && i < header.num_edges; ++i)
+    {
+        ok = _edges[i].to >= 0 && _edges[i].to < header.num_nodes;
+    }
+    for (int c = 0; ok && c <= nclusters; ++c)
+    {
+        ok = _node_offsets[c] >= 0 && _node_offsets[c] <= header.num_nodes
+          && _poly_offsets[c] >= 0 && _poly_offsets[c] <= header.num_polys;
+    }
+    if (!ok)
+    {
+        _nodes.clear();
+        _edges.clear();
+        _node_offsets.clear();
+        _poly_offsets.clear();
+        _polys.clear();
+        _node_index.clear();
+        return false;
+    }
+
+    _signature    = header.signature;
+    _cluster_size = header.cluster_size;
+    dtVcopy(_orig, header.orig);
+    _width    = header.width;
+    _height   = header.height;
+    _min_cost = header.min_cost;
+    return true;
+}
+
+dtStatus ClusterGraph::find_path(const dtNavMesh *mesh,
+                                 const dtQueryFilter *filter, dtPolyRef start,
+                                 dtPolyRef end, std::vector<dtPolyRef> &path,
+                                 int &npath) const
+{
+    npath = 0;
+    if (_poly_offsets.empty()) return DT_FAILURE;
+
+    const dtMeshTile *tile = nullptr;
+    const dtPoly *poly     = nullptr;
+    if (dtStatusFailed(mesh->getTileAndPolyByRef(start, &tile, &poly)))
+        return DT_FAILURE;
+    const int start_cluster = cluster_of(tile, poly);
+    if (dtStatusFailed(mesh->getTileAndPolyByRef(end, &tile, &poly)))
+        return DT_FAILURE;
+    float end_pos[3];
+    poly_center(tile, poly, end_pos);
+    const int end_cluster = cluster_of(end_pos);
+
+    // short query, the plain search is cheaper
+    if (start_cluster == end_cluster) return DT_FAILURE;
+
+    // cost from start to the nodes of it's cluster, and from the nodes of
+    // end's cluster to end
+    Visits from_start, to_end;
+    search(mesh, filter, start_cluster, start, 0, nullptr, from_start);
+    Adjacency reverse;
+    reverse_links(mesh, end_cluster, reverse);
+    search(mesh, filter, end_cluster, end, 0, &reverse, to_end);
+
+    // A* over the nodes, goal is a virtual node linked from every node of
+    // end's cluster
+    const int goal = (int)_nodes.size();
+    std::unordered_map<int, std::pair<float, int> > costs; /// cost, parent
+    std::priority_queue<NodeOpen, std::vector<NodeOpen>,
+                        std::greater<NodeOpen> >
+        open;
+    auto push = [&](int node, float cost, int parent) {
+        // the flags of a poly may have changed since the graph was built
+        if (goal != node)
+        {
+            const dtMeshTile *ntile = nullptr;
+            const dtPoly *npoly     = nullptr;
+            const dtPolyRef ref     = _nodes[node].ref;
+            if (dtStatusFailed(mesh->getTileAndPolyByRef(ref, &ntile, &npoly))
+                || !filter->passFilter(ref, ntile, npoly))
+                return;
+        }
+
+        auto found = costs.find(node);
+        if (found != costs.end() && found->second.first <= cost) return;
+        costs[node] = std::make_pair(cost, parent);
+
+        float h = goal == node ? 0
+                               : dtVdist(_nodes[node].pos, end_pos) * _min_cost;
+        open.push(NodeOpen(cost + h, node));
+    };
+
+    for (int i = _node_offsets[start_cluster];
+         i < _node_offsets[start_cluster + 1]; ++i)
+    {
+        auto found = from_start.find(_nodes[i].ref);
+        if (found != from_start.end()) push(i, found->second.cost, -1);
+    }
+
+    bool found_goal = false;
+    while (!open.empty())
+    {
+        NodeOpen top = open.top();
+        open.pop();
+        if (goal == top.second)
+        {
+            found_goal = true;
+            break;
+        }
+
+        const Node &node = _nodes[top.second];
+        const float cost = costs[top.second].first;
+        if (top.first > cost + dtVdist(node.pos, end_pos) * _min_cost + 1e-3f)
+            continue; // stale entry
+
+        if (node.cluster == end_cluster)
+        {
+            auto found = to_end.find(node.ref);
+            if (found != to_end.end())
+                push(goal, cost + found->second.cost, top.second);
+        }
+        for (int i = node.first_edge; i < node.first_edge + node.nedges; ++i)
+        {
+            push(_edges[i].to, cost + _edges[i].cost, top.second);
+        }
+    }
+    if (!found_goal) return DT_FAILURE;
+
+    std::vector<int> route;
+    for (int node = costs[goal].second; node >= 0; node = costs[node].second)
+    {
+        if (!mesh->isValidPolyRef(_nodes[node].ref)) return DT_FAILURE;
+        route.push_back(node);
+    }
+    std::reverse(route.begin(), route.end());
+
+    // refine the corridor segment by segment
+    auto append = [&](dtPolyRef ref) {
+        if (npath && path[npath - 1] == ref) return;
+        if (npath >= (int)path.size()) path.resize(dtMax(npath * 2, 256));
+        path[npath++] = ref;
+    };
+
+    std::vector<dtPolyRef> segment;
+    for (dtPolyRef ref = _nodes[route[0]].ref; ref;
+         ref           = from_start[ref].parent)
+    {
+        segment.push_back(ref);
+    }
+    for (auto iter = segment.rbegin(); iter != segment.rend(); ++iter)
+        append(*iter);
+
+    Visits visits;
+    for (size_t i = 1; i < route.size(); ++i)
+    {
+        const Node &from = _nodes[route[i - 1]];
+        const Node &to   = _nodes[route[i]];
+        if (from.cluster != to.cluster)
+        {
+            append(to.ref);
+            continue;
+        }
+
+        visits.clear();
+        search(mesh, filter, from.cluster, from.ref, to.ref, nullptr, visits);
+        auto found = visits.find(to.ref);
+        if (found == visits.end() || !found->second.closed)
+        {
+            npath = 0;
+            return DT_FAILURE; // out of date graph
+        }
+
+        segment.clear();
+        for (dtPolyRef ref = to.ref; ref; ref = visits[ref].parent)
+            segment.push_back(ref);
+        for (auto iter = segment.rbegin(); iter != segment.rend(); ++iter)
+            append(*iter);
+    }
+
+    for (dtPolyRef ref = _nodes[route.back()].ref; ref;
+         ref           = to_end[ref].parent)
+    {
+        append(ref);
+    }
+
+    return DT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include <DetourNavMesh.h>
+
+class dtQueryFilter;
+class ThreadPool;
+
+/**
+ * abstract graph over the borders of square clusters of the nav mesh, for
+ * hierarchical pathfinding. A node is a poly with a link into another
+ * cluster, nodes of the same cluster are connected by the cost of the best
+ * path inside the cluster. Long queries plan on the nodes first, then only
+ * search the polys of the clusters on the way, so the cost depend on the
+ * path length instead of the map size
+ */
+class ClusterGraph
+{
+public:
+    ClusterGraph();
+
+    /**
+     * build the graph of mesh, polys are assigned to a cluster by center
+     * @param cluster_size edge length of a cluster in world units
+     * @param pool the intra cluster costs are computed on it if not nullptr
+     */
+    bool build(const dtNavMesh *mesh, const dtQueryFilter *filter,
+               float cluster_size, ThreadPool *pool);
+
+    /// write the graph, with a signature of the mesh it built from
+    bool save(FILE *fp) const;
+
+    /// read a graph written by save, fail if not built from mesh
+    bool load(FILE *fp, const dtNavMesh *mesh);
+
+    /**
+     * find the poly corridor from start to end through the graph, refined
+     * segment by segment from the route on the graph
+     * @param path grown as needed
+     * @return DT_FAILURE if start and end are in the same cluster, no route
+     *         on the graph or the graph is out of date, then use
+     *         dtNavMeshQuery::findPath instead
+     */
+    dtStatus find_path(const dtNavMesh *mesh, const dtQueryFilter *filter,
+                       dtPolyRef start, dtPolyRef end,
+                       std::vector<dtPolyRef> &path, int &npath) const;
+
+    float cluster_size() const { return _cluster_size; }
+    int node_count() const { return (int)_nodes.size(); }
+    int edge_count() const { return (int)_edges.size(); }
+
+private:
+    struct Node
+    {
+        dtPolyRef ref;
+        int cluster;
+        float pos[3]; /// poly center
+        int first_edge;
+        int nedges;
+    };
+    struct Edge
+    {
+        int to;
+        float cost;
+    };
+    struct Visit
+    {
+        float cost;
+        dtPolyRef parent; /// prev poly, or next poly if searched backward
+        bool closed;
+    };
+    typedef std::unordered_map<dtPolyRef, Visit> Visits;
+    typedef std::unordered_map<dtPolyRef, std::vector<dtPolyRef> > Adjacency;
+
+    int cluster_of(const float *pos) const;
+    int cluster_of(const dtMeshTile *tile, const dtPoly *poly) const;
+
+    /**
+     * dijkstra over the polys of cluster from start, until goal closed if not
+     * 0. Follow the links backward if reverse(see reverse_links) is not
+     * nullptr, the cost is then the cost from a poly to start
+     */
+    void search(const dtNavMesh *mesh, const dtQueryFilter *filter,
+                int cluster, dtPolyRef start, dtPolyRef goal,
+                const Adjacency *reverse, Visits &visits) const;
+    /// incoming links of every poly of cluster from the same cluster
+    void reverse_links(const dtNavMesh *mesh, int cluster,
+                       Adjacency &reverse) const;
+
+    static unsigned long long signature(const dtNavMesh *mesh);
+
+private:
+    unsigned long long _signature; /// of the mesh built from
+    float _cluster_size;
+    float _orig[3]; /// min corner of the mesh
+    int _width;     /// clusters along x
+    int _height;    /// clusters along z
+    float _min_cost; /// min area cost, keep the heuristic admissible
+
+    std::vector<Node> _nodes;          /// sorted by cluster
+    std::vector<Edge> _edges;          /// sorted by from node
+    std::vector<int> _node_offsets;    /// first node of every cluster
+    std::vector<int> _poly_offsets;    /// first poly of every cluster
+    std::vector<dtPolyRef> _polys;     /// sorted by cluster
+    std::unordered_map<dtPolyRef, int> _node_index;
+};
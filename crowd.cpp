@@ -0,0 +1,642 @@
+#include <DetourCommon.h>
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iterator>
+
+#include "crowd.h"
+#include "node_pool_tuner.h"
+#include "thread_pool.h"
+
+/// corners looked ahead for steering, the first may be the agent itself
+static const int MAX_CORNERS = 3;
+/// polys moveAlongSurface may cross in one update
+static const int MAX_VISITED = 16;
+/// corners closer than this are reached, as dtPathCorridor::findCorners
+static const float MIN_TARGET_DIST = 0.01f;
+
+// velocity sampling, same weights as the dtObstacleAvoidanceParams defaults
+static const float WEIGHT_DES_VEL = 2.0f;
+static const float WEIGHT_CUR_VEL = 0.75f;
+static const float WEIGHT_TOI     = 2.5f;
+static const float HORIZ_TIME     = 2.5f;
+
+static const float PI = 3.14159265f;
+
+static unsigned long long cell_key(int ix, int iz)
+{
+    // biased so the key order is row by row, then column by column
+    return (unsigned long long)(unsigned)(iz + (1 << 30)) << 32
+         | (unsigned)(ix + (1 << 30));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Those code are ported from Recast Navigation, please Keep them consistent
+
+/// dtMergeCorridorStartMoved, on a corridor not limited in size
+static bool merge_corridor_start_moved(std::vector<unsigned int> &path,
+                                       const dtPolyRef *visited,
+                                       const int nvisited)
+{
+    int furthestPath    = -1;
+    int furthestVisited = -1;
+
+    // Find furthest common polygon.
+    for (int i = (int)path.size() - 1; i >= 0; --i)
+    {
+        bool found = false;
+        for (int j = nvisited - 1; j >= 0; --j)
+        {
+            if (path[i] == visited[j])
+            {
+                furthestPath    = i;
+                furthestVisited = j;
+                found           = true;
+            }
+        }
+        if (found) break;
+    }
+
+    // If no intersection found just return current path.
+    if (furthestPath == -1 || furthestVisited == -1) return false;
+
+    // Concatenate paths.
+
+    // Adjust beginning of the buffer to include the visited.
+    path.erase(path.begin(), path.begin() + furthestPath + 1);
+
+    // Store visited
+    path.insert(path.begin(),
+                std::reverse_iterator<const dtPolyRef *>(visited + nvisited),
+                std::reverse_iterator<const dtPolyRef *>(visited
+                                                         + furthestVisited));
+    return true;
+}
+
+/// sweepCircleCircle of dtObstacleAvoidanceQuery, xz only
+static bool sweep_circle_circle(const float *c0, const float r0,
+                                const float *v, const float *c1,
+                                const float r1, float &tmin, float &tmax)
+{
+    static const float EPS = 0.0001f;
+    float s[3];
+    dtVsub(s, c1, c0);
+    float r = r0 + r1;
+    float c = dtVdot2D(s, s) - r * r;
+    float a = dtVdot2D(v, v);
+    if (a < EPS) return false; // not moving
+
+    // Overlap, calc time to exit.
+    float b = dtVdot2D(v, s);
+    float d = b * b - a * c;
+    if (d < 0.0f) return false; // no intersection.
+    a        = 1.0f / a;
+    float rd = dtMathSqrtf(d);
+    tmin     = (b - rd) * a;
+    tmax     = (b + rd) * a;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Crowd::Crowd(RecastNavMesh *mesh, int max_agents, float max_radius)
+{
+    _mesh        = mesh;
+    _generation  = 0;
+    _max_agents  = max_agents > 0 ? max_agents : 0;
+    _count       = 0;
+    _query_range = max_radius * 12;
+    _cell_size   = _query_range > 0 ? _query_range : 1;
+
+    const int n = _max_agents;
+    _state.assign(n, AGENT_INVALID);
+    _replan.assign(n, 0);
+    _px.assign(n, 0);
+    _py.assign(n, 0);
+    _pz.assign(n, 0);
+    _vx.assign(n, 0);
+    _vz.assign(n, 0);
+    _dvx.assign(n, 0);
+    _dvz.assign(n, 0);
+    _nvx.assign(n, 0);
+    _nvz.assign(n, 0);
+    _tx.assign(n, 0);
+    _ty.assign(n, 0);
+    _tz.assign(n, 0);
+    _radius.assign(n, 0);
+    _max_speed.assign(n, 0);
+    _max_accel.assign(n, 0);
+    _ref.assign(n, 0);
+    _target_ref.assign(n, 0);
+    _corridor.resize(n);
+    _neighbours.assign(n * MAX_NEIGHBOURS, -1);
+    _nneighbours.assign(n, 0);
+
+    // lowest id is given out first
+    for (int i = n - 1; i >= 0; i--) _free.push_back(i);
+}
+
+Crowd::~Crowd()
+{
+    for (auto query : _queries)
+    {
+        if (query) dtFreeNavMeshQuery(query);
+    }
+    _queries.clear();
+}
+
+bool Crowd::valid_id(int id) const
+{
+    return id >= 0 && id < _max_agents && _state[id] != AGENT_INVALID;
+}
+
+bool Crowd::prepare_queries(const RecastNavMesh::MeshState *state,
+                            int partitions)
+{
+    if (!state->nav_mesh) return false;
+
+    // the mesh was replaced, every poly ref is out of date
+    if (_generation != state->generation)
+    {
+        for (auto &query : _queries)
+        {
+            if (query) dtFreeNavMeshQuery(query);
+            query = nullptr;
+        }
+        for (int i = 0; i < _max_agents; i++)
+        {
+            if (_state[i] == AGENT_INVALID) continue;
+            _ref[i]        = 0;
+            _target_ref[i] = 0;
+            _replan[i]     = _state[i] == AGENT_MOVING;
+            _corridor[i].clear();
+        }
+        _generation = state->generation;
+    }
+
+    if ((int)_queries.size() < partitions)
+    {
+        _queries.resize(partitions, nullptr);
+        _buffers.resize(partitions);
+    }
+
+    // init never shrink the node pool, a resized pool need a new query
+    const int max_nodes = _mesh->_node_pool->max_nodes();
+    for (int p = 0; p < partitions; p++)
+    {
+        dtNavMeshQuery *&query = _queries[p];
+        if (query && query->getNodePool()->getMaxNodes() == max_nodes)
+            continue;
+
+        if (query) dtFreeNavMeshQuery(query);
+        query = dtAllocNavMeshQuery();
+        if (!query
+            || dtStatusFailed(query->init(state->nav_mesh, max_nodes)))
+        {
+            if (query) dtFreeNavMeshQuery(query);
+            query = nullptr;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int Crowd::add_agent(const float *pos, const AgentParams &params)
+{
+    if (_free.empty()) return -1;
+
+    RecastNavMesh::QueryContext *ctx      = nullptr;
+    const RecastNavMesh::MeshState *state = _mesh->pin_mesh(ctx);
+    if (!prepare_queries(state, 1))
+    {
+        _mesh->release_query(ctx);
+        return -1;
+    }
+
+    dtNavMeshQuery *query = _queries[0];
+    dtPolyRef ref         = 0;
+    _mesh->find_nearest_poly(state, query, pos, ref);
+
+    float nearest[3];
+    const bool found =
+        ref && dtStatusSucceed(query->closestPointOnPoly(ref, pos, nearest, 0));
+    _mesh->release_query(ctx);
+    if (!found) return -1;
+
+    const int id = _free.back();
+    _free.pop_back();
+    _count++;
+
+    _state[id]       = AGENT_IDLE;
+    _replan[id]      = 0;
+    _px[id]          = nearest[0];
+    _py[id]          = nearest[1];
+    _pz[id]          = nearest[2];
+    _vx[id]          = 0;
+    _vz[id]          = 0;
+    _dvx[id]         = 0;
+    _dvz[id]         = 0;
+    _nvx[id]         = 0;
+    _nvz[id]         = 0;
+    _radius[id]      = params.radius;
+    _max_speed[id]   = params.max_speed;
+    _max_accel[id]   = params.max_accel;
+    _ref[id]         = ref;
+    _target_ref[id]  = 0;
+    _nneighbours[id] = 0;
+    _corridor[id].clear();
+
+    return id;
+}
+
+bool Crowd::remove_agent(int id)
+{
+    if (!valid_id(id)) return false;
+
+    _state[id] = AGENT_INVALID;
+    _corridor[id].clear();
+    _free.push_back(id);
+    _count--;
+
+    return true;
+}
+
+bool Crowd::set_target(int id, const float *pos)
+{
+    if (!valid_id(id)) return false;
+
+    _tx[id]         = pos[0];
+    _ty[id]         = pos[1];
+    _tz[id]         = pos[2];
+    _target_ref[id] = 0;
+    _state[id]      = AGENT_MOVING;
+    _replan[id]     = 1;
+
+    return true;
+}
+
+bool Crowd::reset_target(int id)
+{
+    if (!valid_id(id)) return false;
+
+    _state[id]  = AGENT_IDLE;
+    _replan[id] = 0;
+    _corridor[id].clear();
+
+    return true;
+}
+
+int Crowd::get_agent(int id, float *pos, float *vel) const
+{
+    if (!valid_id(id)) return AGENT_INVALID;
+
+    if (pos) dtVset(pos, _px[id], _py[id], _pz[id]);
+    if (vel) dtVset(vel, _vx[id], 0, _vz[id]);
+
+    return _state[id];
+}
+
+void Crowd::sort_agents()
+{
+    std::vector<std::pair<unsigned long long, int> > cells;
+    cells.reserve(_count);
+    for (int i = 0; i < _max_agents; i++)
+    {
+        if (_state[i] == AGENT_INVALID) continue;
+
+        const int ix = (int)floorf(_px[i] / _cell_size);
+        const int iz = (int)floorf(_pz[i] / _cell_size);
+        cells.push_back(std::make_pair(cell_key(ix, iz), i));
+    }
+    std::sort(cells.begin(), cells.end());
+
+    _order.resize(cells.size());
+    _keys.resize(cells.size());
+    for (size_t k = 0; k < cells.size(); k++)
+    {
+        _keys[k]  = cells[k].first;
+        _order[k] = cells[k].second;
+    }
+}
+
+void Crowd::run_partitions(int partitions, const PartitionFn &fn)
+{
+    // a partition is a run of agents sorted by cell, so it cover a compact
+    // area and every partition own a query
+    const int n = (int)_order.size();
+    _mesh->thread_pool()->parallel_for(partitions, 1, [&](int begin,
+                                                          int end) {
+        for (int p = begin; p < end; p++)
+        {
+            const int first = (int)((long long)n * p / partitions);
+            const int last  = (int)((long long)n * (p + 1) / partitions);
+            for (int k = first; k < last; k++) fn(p, _order[k]);
+        }
+    });
+}
+
+void Crowd::update(float dt)
+{
+    if (dt <= 0 || !_count) return;
+
+    sort_agents();
+
+    // a few partitions a thread, so the stealing can balance dense areas
+    const int threads    = _mesh->thread_pool()->size();
+    const int partitions = dtMin((int)_order.size(), threads * 4);
+
+    // pinned for the whole update, a mesh replaced meanwhile is not freed
+    // while the partitions still walk it
+    RecastNavMesh::QueryContext *ctx      = nullptr;
+    const RecastNavMesh::MeshState *state = _mesh->pin_mesh(ctx);
+    if (prepare_queries(state, partitions))
+    {
+        run_partitions(partitions, [&](int p, int i) {
+            steer(state, _queries[p], i, _buffers[p]);
+        });
+        // positions are read only from here until integrate
+        run_partitions(partitions, [&](int, int i) {
+            gather_neighbours(i);
+            plan_velocity(i);
+        });
+        run_partitions(partitions,
+                       [&](int p, int i) { integrate(_queries[p], i, dt); });
+    }
+    _mesh->release_query(ctx);
+}
+
+void Crowd::steer(const RecastNavMesh::MeshState *state,
+                  dtNavMeshQuery *query, int i,
+                  std::vector<unsigned int> &buffer)
+{
+    _dvx[i] = 0;
+    _dvz[i] = 0;
+
+    const dtNavMesh *nav = state->nav_mesh;
+    if (!nav) return;
+
+    // the poly of the agent is gone too if it's tile was rebuilt, locate it
+    // again and plan from there
+    float pos[3] = {_px[i], _py[i], _pz[i]};
+    if (!_ref[i] || !nav->isValidPolyRef(_ref[i]))
+    {
+        _ref[i] = 0;
+        _mesh->find_nearest_poly(state, query, pos, _ref[i]);
+        _replan[i] = 1;
+    }
+    if (_state[i] != AGENT_MOVING || !_ref[i]) return;
+
+    std::vector<unsigned int> &corridor = _corridor[i];
+
+    // polys of a rebuilt tile are gone
+    for (size_t k = 0; k < corridor.size() && !_replan[i]; k++)
+    {
+        if (!nav->isValidPolyRef(corridor[k])) _replan[i] = 1;
+    }
+
+    float target[3] = {_tx[i], _ty[i], _tz[i]};
+    if (_replan[i] || corridor.empty())
+    {
+        _replan[i] = 0;
+        _mesh->find_nearest_poly(state, query, target, _target_ref[i]);
+
+        int npolys          = 0;
+        unsigned int status = DT_FAILURE;
+        if (_target_ref[i])
+        {
+            status = _mesh->find_path(state, query, _ref[i], _target_ref[i],
+                                      pos, target, buffer, npolys);
+        }
+        if (dtStatusFailed(status) || !npolys)
+        {
+            _state[i] = AGENT_FAILED;
+            corridor.clear();
+            return;
+        }
+        corridor.assign(buffer.begin(), buffer.begin() + npolys);
+
+        // partial path, head for the nearest point of the last poly
+        if (corridor.back() != _target_ref[i])
+        {
+            float closest[3];
+            if (dtStatusSucceed(query->closestPointOnPoly(
+                    corridor.back(), target, closest, 0)))
+            {
+                dtVcopy(target, closest);
+                _tx[i] = target[0];
+                _ty[i] = target[1];
+                _tz[i] = target[2];
+            }
+            _target_ref[i] = corridor.back();
+        }
+    }
+
+    float corners[MAX_CORNERS * 3];
+    unsigned char flags[MAX_CORNERS];
+    int ncorners = 0;
+    query->findStraightPath(pos, target, corridor.data(),
+                            (int)corridor.size(), corners, flags, 0,
+                            &ncorners, MAX_CORNERS);
+
+    // skip the corners already reached
+    int c = 0;
+    while (c < ncorners - 1
+           && dtVdist2DSqr(pos, &corners[c * 3]) < dtSqr(MIN_TARGET_DIST))
+        c++;
+    if (!ncorners) return;
+
+    const float *corner = &corners[c * 3];
+    const float dx      = corner[0] - pos[0];
+    const float dz      = corner[2] - pos[2];
+    const float dist    = dtMathSqrtf(dx * dx + dz * dz);
+    if (dist < 0.0001f) return;
+
+    // slow down within 2 radius of the end
+    float speed = _max_speed[i];
+    if (flags[c] & DT_STRAIGHTPATH_END)
+        speed *= dtMin(1.0f, dist / (_radius[i] * 2));
+
+    _dvx[i] = dx / dist * speed;
+    _dvz[i] = dz / dist * speed;
+}
+
+void Crowd::gather_neighbours(int i)
+{
+    int *neis      = &_neighbours[i * MAX_NEIGHBOURS];
+    const float r2 = _query_range * _query_range;
+    float dists[MAX_NEIGHBOURS];
+    int n = 0;
+
+    const int ix0 = (int)floorf((_px[i] - _query_range) / _cell_size);
+    const int ix1 = (int)floorf((_px[i] + _query_range) / _cell_size);
+    const int iz0 = (int)floorf((_pz[i] - _query_range) / _cell_size);
+    const int iz1 = (int)floorf((_pz[i] + _query_range) / _cell_size);
+    for (int iz = iz0; iz <= iz1; iz++)
+    {
+        // cells of a row are next to each other in _order
+        const unsigned long long hi = cell_key(ix1, iz);
+        size_t k = std::lower_bound(_keys.begin(), _keys.end(),
+                                    cell_key(ix0, iz))
+                 - _keys.begin();
+        for (; k < _keys.size() && _keys[k] <= hi; k++)
+        {
+            const int j = _order[k];
+            if (j == i) continue;
+
+            const float dx = _px[j] - _px[i];
+            const float dz = _pz[j] - _pz[i];
+            const float d  = dx * dx + dz * dz;
+            if (d > r2) continue;
+
+            // keep the nearest, sorted by distance
+            if (n == MAX_NEIGHBOURS && d >= dists[n - 1]) continue;
+            int at = n < MAX_NEIGHBOURS ? n++ : n - 1;
+            while (at > 0 && dists[at - 1] > d)
+            {
+                dists[at] = dists[at - 1];
+                neis[at]  = neis[at - 1];
+                at--;
+            }
+            dists[at] = d;
+            neis[at]  = j;
+        }
+    }
+
+    _nneighbours[i] = n;
+}
+
+void Crowd::plan_velocity(int i)
+{
+    _nvx[i] = _dvx[i];
+    _nvz[i] = _dvz[i];
+    if (_state[i] != AGENT_MOVING || !_nneighbours[i]) return;
+
+    const float speed = _max_speed[i];
+    if (speed <= 0) return;
+
+    const float pos[3]  = {_px[i], 0, _pz[i]};
+    const float dvel[3] = {_dvx[i], 0, _dvz[i]};
+    const float vel[3]  = {_vx[i], 0, _vz[i]};
+    const int *neis     = &_neighbours[i * MAX_NEIGHBOURS];
+
+    // penalty of a candidate velocity, as dtObstacleAvoidanceQuery
+    auto penalty = [&](const float *vcand) {
+        const float vpen  = WEIGHT_DES_VEL * dtVdist2D(vcand, dvel) / speed;
+        const float vcpen = WEIGHT_CUR_VEL * dtVdist2D(vcand, vel) / speed;
+
+        float tmin = HORIZ_TIME;
+        for (int k = 0; k < _nneighbours[i]; k++)
+        {
+            const int j         = neis[k];
+            const float npos[3] = {_px[j], 0, _pz[j]};
+
+            // reciprocal, both agents are expected to take half the dodge
+            float vab[3] = {2 * vcand[0] - vel[0] - _vx[j], 0,
+                            2 * vcand[2] - vel[2] - _vz[j]};
+
+            float htmin, htmax;
+            if (!sweep_circle_circle(pos, _radius[i], vab, npos, _radius[j],
+                                     htmin, htmax))
+                continue;
+
+            // overlapping already, only penalize moving closer
+            if (htmin < 0.0f && htmax > 0.0f)
+            {
+                float s[3];
+                dtVsub(s, npos, pos);
+                if (dtVdot2D(vab, s) <= 0) continue;
+                htmin = 0;
+            }
+            if (htmin >= 0.0f && htmin < tmin) tmin = htmin;
+        }
+
+        const float tpen = WEIGHT_TOI * (1.0f / (0.1f + tmin / HORIZ_TIME));
+        return vpen + vcpen + tpen;
+    };
+
+    float best[3]      = {dvel[0], 0, dvel[2]};
+    float best_penalty = penalty(dvel);
+
+    // two rings of 8 directions, starting at the desired direction
+    const float base = atan2f(dvel[2], dvel[0]);
+    for (int ring = 1; ring <= 2; ring++)
+    {
+        const float s = speed / ring;
+        for (int k = 0; k < 8; k++)
+        {
+            const float a        = base + k * PI / 4;
+            const float vcand[3] = {cosf(a) * s, 0, sinf(a) * s};
+            const float pen      = penalty(vcand);
+            if (pen < best_penalty)
+            {
+                best_penalty = pen;
+                dtVcopy(best, vcand);
+            }
+        }
+    }
+
+    _nvx[i] = best[0];
+    _nvz[i] = best[2];
+}
+
+void Crowd::integrate(dtNavMeshQuery *query, int i, float dt)
+{
+    // reach the planned velocity, limited by the acceleration
+    float dvx = _nvx[i] - _vx[i];
+    float dvz = _nvz[i] - _vz[i];
+    const float ds   = dtMathSqrtf(dvx * dvx + dvz * dvz);
+    const float maxd = _max_accel[i] * dt;
+    if (ds > maxd && ds > 0)
+    {
+        dvx *= maxd / ds;
+        dvz *= maxd / ds;
+    }
+    _vx[i] += dvx;
+    _vz[i] += dvz;
+
+    if (!_ref[i] || (_vx[i] == 0 && _vz[i] == 0)) return;
+
+    const float pos[3]  = {_px[i], _py[i], _pz[i]};
+    const float next[3] = {pos[0] + _vx[i] * dt, pos[1],
+                           pos[2] + _vz[i] * dt};
+
+    float result[3];
+    dtPolyRef visited[MAX_VISITED];
+    int nvisited = 0;
+    if (dtStatusFailed(query->moveAlongSurface(_ref[i], pos, next,
+                                               _mesh->_filter, result,
+                                               visited, &nvisited,
+                                               MAX_VISITED))
+        || !nvisited)
+        return;
+
+    // the corridor start follow the agent, replan if it walked off
+    std::vector<unsigned int> &corridor = _corridor[i];
+    if (!corridor.empty()
+        && !merge_corridor_start_moved(corridor, visited, nvisited))
+        _replan[i] = 1;
+    _ref[i] = visited[nvisited - 1];
+
+    float h = 0;
+    if (dtStatusSucceed(query->getPolyHeight(_ref[i], result, &h)))
+        result[1] = h;
+    _px[i] = result[0];
+    _py[i] = result[1];
+    _pz[i] = result[2];
+
+    if (_state[i] != AGENT_MOVING) return;
+
+    const float target[3] = {_tx[i], _ty[i], _tz[i]};
+    if (dtVdist2DSqr(result, target) < dtSqr(_radius[i] * 0.5f))
+    {
+        _state[i] = AGENT_ARRIVED;
+        _vx[i]    = 0;
+        _vz[i]    = 0;
+        corridor.clear();
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "recast_navmesh.h"
+
+/**
+ * crowd of agents moving on a RecastNavMesh, in the spirit of dtCrowd: every
+ * agent keep a poly corridor to it's target, steer toward the next corner,
+ * avoid it's neighbours and slide along the mesh surface. Agent state is
+ * kept as structure of arrays, and every update sort the agents into a grid
+ * and split them into spatial partitions run in parallel on the thread pool
+ * of the mesh. Not thread safe, drive it from one thread(eg. the game tick).
+ * Every call pin the mesh it moves on, so load, build and swap_mesh of the
+ * mesh may run on other threads meanwhile
+ */
+class Crowd
+{
+public:
+    /// neighbours an agent avoid at most
+    static const int MAX_NEIGHBOURS = 6;
+
+    enum AgentState
+    {
+        AGENT_INVALID, /// no agent in the slot
+        AGENT_IDLE,    /// no target
+        AGENT_MOVING,
+        AGENT_ARRIVED,
+        AGENT_FAILED, /// no path to the target
+    };
+
+    struct AgentParams
+    {
+        float radius;
+        float max_speed;
+        float max_accel;
+    };
+
+public:
+    /**
+     * @param mesh the mesh to move on, must outlive the crowd
+     * @param max_agents slots of agents
+     * @param max_radius largest agent radius, neighbours are gathered within
+     *        12 times of it
+     */
+    Crowd(RecastNavMesh *mesh, int max_agents, float max_radius);
+    ~Crowd();
+
+    /**
+     * add an agent at the mesh point nearest to pos
+     * @return agent id, -1 if full or pos is off the mesh
+     */
+    int add_agent(const float *pos, const AgentParams &params);
+    bool remove_agent(int id);
+
+    /// move toward pos, replan at next update
+    bool set_target(int id, const float *pos);
+    /// stop, the agent keep still from next update
+    bool reset_target(int id);
+
+    /**
+     * advance every agent by dt seconds: replan and steer, gather
+     * neighbours and plan velocities, then move
+     */
+    void update(float dt);
+
+    /**
+     * get the state of an agent
+     * @param pos [out] 3 floats if not nullptr
+     * @param vel [out] 3 floats if not nullptr
+     * @return AgentState
+     */
+    int get_agent(int id, float *pos, float *vel) const;
+
+    int agent_count() const { return _count; }
+    int max_agents() const { return _max_agents; }
+
+private:
+    /// dtNavMeshQuery of every partition, re-init if the mesh replaced
+    bool prepare_queries(const RecastNavMesh::MeshState *state,
+                         int partitions);
+    /// sort the agents by grid cell into _order
+    void sort_agents();
+
+    /// fn(partition, agent) over every agent, partitions run in parallel
+    typedef std::function<void(int, int)> PartitionFn;
+    void run_partitions(int partitions, const PartitionFn &fn);
+
+    /// replan if needed, then desired velocity toward the next corner
+    void steer(const RecastNavMesh::MeshState *state, dtNavMeshQuery *query,
+               int i, std::vector<unsigned int> &buf);
+    void gather_neighbours(int i);
+    /// sample velocities around the desired one, away from neighbours
+    void plan_velocity(int i);
+    void integrate(dtNavMeshQuery *query, int i, float dt);
+
+    bool valid_id(int id) const;
+
+private:
+    RecastNavMesh *_mesh;
+    unsigned int _generation; /// mesh generation the queries init with
+    int _max_agents;
+    int _count;
+    float _query_range; /// neighbours gathered within
+    float _cell_size;
+
+    // agent state, structure of arrays indexed by agent id
+    std::vector<unsigned char> _state;
+    std::vector<unsigned char> _replan;
+    std::vector<float> _px, _py, _pz;   /// position
+    std::vector<float> _vx, _vz;        /// velocity
+    std::vector<float> _dvx, _dvz;      /// desired velocity
+    std::vector<float> _nvx, _nvz;      /// planned velocity
+    std::vector<float> _tx, _ty, _tz;   /// target
+    std::vector<float> _radius;
+    std::vector<float> _max_speed;
+    std::vector<float> _max_accel;
+    std::vector<unsigned int> _ref;        /// poly the agent is on
+    std::vector<unsigned int> _target_ref; /// poly of the target
+    std::vector<std::vector<unsigned int> > _corridor;
+    std::vector<int> _neighbours; /// MAX_NEIGHBOURS of every agent
+    std::vector<int> _nneighbours;
+    std::vector<int> _free; /// free slots, next at back
+
+    // spatial partitions of the last update
+    std::vector<int> _order;               /// active agents sorted by cell
+    std::vector<unsigned long long> _keys; /// cell of _order
+    std::vector<dtNavMeshQuery *> _queries;
+    std::vector<std::vector<unsigned int> > _buffers; /// path of partitions
+};
@@ -0,0 +1,379 @@
+#include <DetourAlloc.h>
+#include <DetourNavMeshBuilder.h>
+
+#include <cmath>
+#include <cstring>
+
+#include "lean_tile.h"
+
+/// an encoded tile start with it, every count is of what follows
+struct LeanTileHeader
+{
+    int x;
+    int y;
+    int layer;
+    unsigned int userId;
+    int polyCount; /// ground polys only
+    int vertCount; /// verts of the ground polys
+    int offMeshConCount;
+    int detailVertCount; /// 0 if the detail mesh is dropped
+    int detailTriCount;
+    int keepDetail;
+    float walkableHeight;
+    float walkableRadius;
+    float walkableClimb;
+    float bmin[3];
+    float bmax[3];
+    float cs;
+    float ch;
+};
+
+/// an off-mesh connection, with the area and flags of it's poly
+struct LeanOffMeshCon
+{
+    float pos[6];
+    float rad;
+    unsigned int userId;
+    unsigned short flags;
+    unsigned char area;
+    unsigned char dir;
+};
+
+/// the unused verts and neighbours of a poly in dtNavMeshCreateParams
+static const unsigned short LEAN_NULL_IDX = 0xffff;
+
+template <class T>
+static void put(std::vector<unsigned char> &out, const T *v, size_t n = 1)
+{
+    const unsigned char *p = (const unsigned char *)v;
+    out.insert(out.end(), p, p + sizeof(T) * n);
+}
+
+/// read n values of T and advance, false if past the end
+template <class T>
+static bool get(const unsigned char *&p, const unsigned char *end, T *v,
+                size_t n = 1)
+{
+    const size_t size = sizeof(T) * n;
+    if ((size_t)(end - p) < size) return false;
+
+    memcpy(v, p, size);
+    p += size;
+    return true;
+}
+
+static bool quantize(const float *v, const float *bmin, float cs, float ch,
+                     unsigned short *iv)
+{
+    const float q[3] = {(v[0] - bmin[0]) / cs, (v[1] - bmin[1]) / ch,
+                        (v[2] - bmin[2]) / cs};
+    for (int k = 0; k < 3; k++)
+    {
+        const float r = floorf(q[k] + 0.5f);
+        if (r < 0 || r > 0xffff) return false;
+        iv[k] = (unsigned short)r;
+    }
+    return true;
+}
+
+/// inverse of the portal mapping of dtCreateNavMeshData
+static unsigned short encode_nei(unsigned short nei)
+{
+    if (!nei) return LEAN_NULL_IDX;
+    if (!(nei & DT_EXT_LINK)) return nei - 1;
+
+    switch (nei & 0xff)
+    {
+    case 4: return 0x8000 | 0; // x-
+    case 2: return 0x8000 | 1; // z+
+    case 0: return 0x8000 | 2; // x+
+    case 6: return 0x8000 | 3; // z-
+    default: return LEAN_NULL_IDX;
+    }
+}
+
+bool encode_lean_tile(const dtMeshTile *tile, float ch, bool keep_detail,
+                      std::vector<unsigned char> &out)
+{
+    const dtMeshHeader *h = tile->header;
+    if (!h || h->bvQuantFactor <= 0 || ch <= 0) return false;
+
+    LeanTileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.x               = h->x;
+    header.y               = h->y;
+    header.layer           = h->layer;
+    header.userId          = h->userId;
+    header.polyCount       = h->offMeshBase;
+    header.vertCount       = h->vertCount - h->offMeshConCount * 2;
+    header.offMeshConCount = h->offMeshConCount;
+    header.keepDetail      = keep_detail;
+    header.walkableHeight  = h->walkableHeight;
+    header.walkableRadius  = h->walkableRadius;
+    header.walkableClimb   = h->walkableClimb;
+    memcpy(header.bmin, h->bmin, sizeof(header.bmin));
+    memcpy(header.bmax, h->bmax, sizeof(header.bmax));
+    header.cs = 1.f / h->bvQuantFactor;
+    header.ch = ch;
+    if (keep_detail)
+    {
+        for (int i = 0; i < header.polyCount; ++i)
+        {
+            header.detailVertCount += tile->detailMeshes[i].vertCount;
+            header.detailTriCount += tile->detailMeshes[i].triCount;
+        }
+    }
+    put(out, &header);
+
+    // poly verts are on the cell grid, so lossless as long as ch is the one
+    // the tile built with. Checked, a vert off the grid would move
+    const float step[3] = {header.cs, ch, header.cs};
+    const float eps[3]  = {header.cs * 0.01f, ch * 0.01f, header.cs * 0.01f};
+    for (int i = 0; i < header.vertCount; ++i)
+    {
+        const float *v = &tile->verts[i * 3];
+        unsigned short iv[3];
+        if (!quantize(v, header.bmin, header.cs, ch, iv)) return false;
+        for (int k = 0; k < 3; k++)
+        {
+            if (fabsf(header.bmin[k] + iv[k] * step[k] - v[k]) > eps[k])
+                return false;
+        }
+        put(out, iv, 3);
+    }
+
+    for (int i = 0; i < header.polyCount; ++i)
+    {
+        const dtPoly &poly        = tile->polys[i];
+        const unsigned char nv    = poly.vertCount;
+        const unsigned char area  = poly.getArea();
+        const unsigned short flag = poly.flags;
+        put(out, &nv);
+        put(out, &area);
+        put(out, &flag);
+        put(out, poly.verts, nv);
+        for (int j = 0; j < nv; ++j)
+        {
+            const unsigned short nei = encode_nei(poly.neis[j]);
+            put(out, &nei);
+        }
+    }
+
+    if (keep_detail)
+    {
+        for (int i = 0; i < header.polyCount; ++i)
+        {
+            const dtPolyDetail &pd = tile->detailMeshes[i];
+            put(out, &pd.vertCount);
+            put(out, &pd.triCount);
+        }
+        for (int i = 0; i < header.polyCount; ++i)
+        {
+            // sampled heights are off the grid, rounded to ch
+            const dtPolyDetail &pd = tile->detailMeshes[i];
+            for (int j = 0; j < pd.vertCount; ++j)
+            {
+                float v[3];
+                memcpy(v, &tile->detailVerts[(pd.vertBase + j) * 3],
+                       sizeof(v));
+                for (int k = 0; k < 3; k++)
+                {
+                    v[k] = fmaxf(v[k], header.bmin[k]);
+                    v[k] = fminf(v[k], header.bmax[k]);
+                }
+
+                unsigned short iv[3];
+                if (!quantize(v, header.bmin, header.cs, ch, iv)) return false;
+                put(out, iv, 3);
+            }
+            put(out, &tile->detailTris[pd.triBase * 4], pd.triCount * 4);
+        }
+    }
+
+    for (int i = 0; i < header.offMeshConCount; ++i)
+    {
+        const dtOffMeshConnection &con = tile->offMeshCons[i];
+        const dtPoly &poly             = tile->polys[con.poly];
+
+        LeanOffMeshCon lean;
+        memset(&lean, 0, sizeof(lean));
+        memcpy(lean.pos, con.pos, sizeof(lean.pos));
+        lean.rad    = con.rad;
+        lean.userId = con.userId;
+        lean.flags  = poly.flags;
+        lean.area   = poly.getArea();
+        lean.dir    = (con.flags & DT_OFFMESH_CON_BIDIR) ? 1 : 0;
+        put(out, &lean);
+    }
+
+    return true;
+}
+
+/// bytes the counts of header take at least after it, to check them before
+/// anything allocated
+static long long lean_size_of(const LeanTileHeader &header)
+{
+    // a poly has at least 3 verts and 3 neighbours after nv, area and flags
+    const long long min_poly = 2 + sizeof(unsigned short) * (1 + 3 * 2);
+    const long long vert     = 3 * sizeof(unsigned short);
+    long long size = header.vertCount * vert + header.polyCount * min_poly
+                   + header.offMeshConCount * (long long)sizeof(LeanOffMeshCon);
+    if (header.keepDetail)
+    {
+        size += header.polyCount * 2LL + header.detailVertCount * vert
+              + header.detailTriCount * 4LL;
+    }
+    return size;
+}
+
+unsigned char *decode_lean_tile(const unsigned char *data, size_t size,
+                                int &data_size)
+{
+    data_size              = 0;
+    const unsigned char *p = data, *end = data + size;
+
+    LeanTileHeader header;
+    if (!get(p, end, &header) || header.polyCount <= 0
+        || header.vertCount <= 0 || header.vertCount >= 0xffff
+        || header.offMeshConCount < 0 || header.detailVertCount < 0
+        || header.detailTriCount < 0
+        || lean_size_of(header) > (long long)(end - p))
+        return nullptr;
+
+    std::vector<unsigned short> verts(header.vertCount * 3);
+    if (!get(p, end, verts.data(), verts.size())) return nullptr;
+
+    const int nvp = DT_VERTS_PER_POLYGON;
+    std::vector<unsigned short> polys(header.polyCount * nvp * 2,
+                                      LEAN_NULL_IDX);
+    std::vector<unsigned short> poly_flags(header.polyCount);
+    std::vector<unsigned char> poly_areas(header.polyCount);
+    for (int i = 0; i < header.polyCount; ++i)
+    {
+        unsigned char nv = 0;
+        unsigned short *poly = &polys[i * nvp * 2];
+        if (!get(p, end, &nv) || nv < 3 || nv > nvp
+            || !get(p, end, &poly_areas[i]) || !get(p, end, &poly_flags[i])
+            || !get(p, end, poly, nv) || !get(p, end, poly + nvp, nv))
+            return nullptr;
+
+        for (int j = 0; j < nv; ++j)
+        {
+            if (poly[j] >= header.vertCount) return nullptr;
+        }
+    }
+
+    dtNavMeshCreateParams params;
+    memset(&params, 0, sizeof(params));
+
+    // the detail verts of dtNavMeshCreateParams start with the poly verts
+    std::vector<unsigned int> detail_meshes;
+    std::vector<float> detail_verts;
+    std::vector<unsigned char> detail_tris;
+    if (header.keepDetail)
+    {
+        std::vector<unsigned char> counts(header.polyCount * 2);
+        if (!get(p, end, counts.data(), counts.size())) return nullptr;
+
+        detail_meshes.resize(header.polyCount * 4);
+        detail_tris.resize(header.detailTriCount * 4);
+        unsigned int vbase = 0, tbase = 0, extra = 0;
+        for (int i = 0; i < header.polyCount; ++i)
+        {
+            const unsigned short *poly = &polys[i * nvp * 2];
+            const int ndv              = counts[i * 2];
+            const int ndt              = counts[i * 2 + 1];
+            int nv = 0;
+            while (nv < nvp && poly[nv] != LEAN_NULL_IDX) nv++;
+
+            extra += ndv;
+            if (extra > (unsigned int)header.detailVertCount
+                || tbase + ndt > (unsigned int)header.detailTriCount)
+                return nullptr;
+
+            for (int j = 0; j < nv + ndv; ++j)
+            {
+                unsigned short iv[3];
+                if (j < nv)
+                    memcpy(iv, &verts[poly[j] * 3], sizeof(iv));
+                else if (!get(p, end, iv, 3))
+                    return nullptr;
+
+                detail_verts.push_back(header.bmin[0] + iv[0] * header.cs);
+                detail_verts.push_back(header.bmin[1] + iv[1] * header.ch);
+                detail_verts.push_back(header.bmin[2] + iv[2] * header.cs);
+            }
+            if (!get(p, end, &detail_tris[tbase * 4], ndt * 4)) return nullptr;
+            for (int j = 0; j < ndt; ++j)
+            {
+                const unsigned char *t = &detail_tris[(tbase + j) * 4];
+                if (t[0] >= nv + ndv || t[1] >= nv + ndv || t[2] >= nv + ndv)
+                    return nullptr;
+            }
+
+            detail_meshes[i * 4 + 0] = vbase;
+            detail_meshes[i * 4 + 1] = nv + ndv;
+            detail_meshes[i * 4 + 2] = tbase;
+            detail_meshes[i * 4 + 3] = ndt;
+            vbase += nv + ndv;
+            tbase += ndt;
+        }
+
+        params.detailMeshes     = detail_meshes.data();
+        params.detailVerts      = detail_verts.data();
+        params.detailVertsCount = (int)detail_verts.size() / 3;
+        params.detailTris       = detail_tris.data();
+        params.detailTriCount   = header.detailTriCount;
+    }
+
+    const int ncons = header.offMeshConCount;
+    std::vector<float> con_verts(ncons * 6), con_rads(ncons);
+    std::vector<unsigned short> con_flags(ncons);
+    std::vector<unsigned char> con_areas(ncons), con_dirs(ncons);
+    std::vector<unsigned int> con_ids(ncons);
+    for (int i = 0; i < ncons; ++i)
+    {
+        LeanOffMeshCon con;
+        if (!get(p, end, &con)) return nullptr;
+
+        memcpy(&con_verts[i * 6], con.pos, sizeof(con.pos));
+        con_rads[i]  = con.rad;
+        con_flags[i] = con.flags;
+        con_areas[i] = con.area;
+        con_dirs[i]  = con.dir;
+        con_ids[i]   = con.userId;
+    }
+    if (p != end) return nullptr;
+
+    params.verts            = verts.data();
+    params.vertCount        = header.vertCount;
+    params.polys            = polys.data();
+    params.polyAreas        = poly_areas.data();
+    params.polyFlags        = poly_flags.data();
+    params.polyCount        = header.polyCount;
+    params.nvp              = nvp;
+    params.offMeshConVerts  = con_verts.data();
+    params.offMeshConRad    = con_rads.data();
+    params.offMeshConDir    = con_dirs.data();
+    params.offMeshConAreas  = con_areas.data();
+    params.offMeshConFlags  = con_flags.data();
+    params.offMeshConUserID = con_ids.data();
+    params.offMeshConCount  = ncons;
+    params.userId           = header.userId;
+    params.tileX            = header.x;
+    params.tileY            = header.y;
+    params.tileLayer        = header.layer;
+    params.walkableHeight   = header.walkableHeight;
+    params.walkableRadius   = header.walkableRadius;
+    params.walkableClimb    = header.walkableClimb;
+    memcpy(params.bmin, header.bmin, sizeof(params.bmin));
+    memcpy(params.bmax, header.bmax, sizeof(params.bmax));
+    params.cs          = header.cs;
+    params.ch          = header.ch;
+    params.buildBvTree = true;
+
+    unsigned char *tile_data = nullptr;
+    if (!dtCreateNavMeshData(&params, &tile_data, &data_size)) return nullptr;
+
+    return tile_data;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include <DetourNavMesh.h>
+
+/**
+ * encode a tile for MESH_FORMAT_LEAN(_DETAIL). Poly verts are stored as the
+ * 16 bits cell coordinates they were built from(relative to the tile bmin,
+ * cs and ch), polys only with their used verts and neighbours, the bv tree
+ * and links are left out as they are rebuilt when decoded
+ * @param ch cell height the tile built with, the height step of the verts
+ * @param keep_detail keep the detail verts(quantized as poly verts) and
+ *        triangles, else the detail mesh is dropped and the heights come
+ *        from the poly planes
+ * @param out [out] appended the encoded tile
+ * @return false if a poly vert can not be quantized into 16 bits or is not
+ *         on the cell grid of ch(eg. ch is not the one the tile built with)
+ */
+bool encode_lean_tile(const dtMeshTile *tile, float ch, bool keep_detail,
+                      std::vector<unsigned char> &out);
+
+/**
+ * rebuild the tile data of a encoded tile by dtCreateNavMeshData, thread safe
+ * @param data_size [out] size of the tile data
+ * @return tile data for dtNavMesh::addTile allocated by dtAlloc, nullptr if
+ *         corrupted
+ */
+unsigned char *decode_lean_tile(const unsigned char *data, size_t size,
+                                int &data_size);
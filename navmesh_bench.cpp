@@ -0,0 +1,384 @@
+/**
+ * Benchmark of build, load/save and query latency, the result is written as
+ * JSON so it can be diffed between releases
+ *
+ * navmesh_bench [-o result.json] [-n queries] [-s seed] [-t threads] a.obj ...
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "recast_navmesh.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchOption
+{
+    int queries;
+    unsigned int seed;
+    int threads;
+};
+
+static std::mt19937 engine;
+
+static float frand()
+{
+    return std::uniform_real_distribution<float>(0.f, 1.f)(engine);
+}
+
+static double elapsed_ms(const Clock::time_point &begin)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin)
+        .count();
+}
+
+static long long file_size(const char *path)
+{
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    return ifs ? (long long)ifs.tellg() : 0;
+}
+
+/// MB per second of bytes processed in ms
+static double throughput(long long bytes, double ms)
+{
+    return ms > 0 ? bytes / 1048576.0 / (ms / 1000.0) : 0;
+}
+
+static std::string json_string(const std::string &str)
+{
+    std::string out("\"");
+    for (char c : str)
+    {
+        if ('"' == c || '\\' == c) out.push_back('\\');
+        out.push_back(c);
+    }
+    out.push_back('"');
+    return out;
+}
+
+static std::string base_name(const std::string &path)
+{
+    size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+/**
+ * latency percentiles of one kind of query
+ * @param latency latency of every query in microseconds, sorted in place
+ */
+static void write_latency(std::ostream &os, std::vector<double> &latency,
+                          double total_ms, int failed)
+{
+    std::sort(latency.begin(), latency.end());
+
+    auto percentile = [&latency](double p) {
+        if (latency.empty()) return 0.0;
+        size_t index = std::min(latency.size() - 1,
+                                (size_t)(p * latency.size()));
+        return latency[index];
+    };
+
+    os << "{\"p50_us\": " << percentile(0.5)
+       << ", \"p99_us\": " << percentile(0.99)
+       << ", \"p999_us\": " << percentile(0.999)
+       << ", \"max_us\": " << (latency.empty() ? 0.0 : latency.back())
+       << ", \"qps\": "
+       << (total_ms > 0 ? latency.size() / (total_ms / 1000.0) : 0)
+       << ", \"failed\": " << failed << "}";
+}
+
+static void write_build_stat(std::ostream &os,
+                             const RecastNavMesh::BuildStat &stat)
+{
+    os << "{\"load_ms\": " << stat.load_ms
+       << ", \"geom_cached\": " << (stat.geom_cached ? "true" : "false")
+       << ", \"total_ms\": " << stat.total_ms
+       << ", \"rasterize_ms\": " << stat.rasterize_ms
+       << ", \"filter_ms\": " << stat.filter_ms
+       << ", \"compact_ms\": " << stat.compact_ms
+       << ", \"erode_ms\": " << stat.erode_ms
+       << ", \"mark_ms\": " << stat.mark_ms
+       << ", \"distance_field_ms\": " << stat.distance_field_ms
+       << ", \"regions_ms\": " << stat.regions_ms
+       << ", \"contours_ms\": " << stat.contours_ms
+       << ", \"polymesh_ms\": " << stat.polymesh_ms
+       << ", \"detail_ms\": " << stat.detail_ms
+       << ", \"peak_bytes\": " << stat.peak_bytes
+       << ", \"verts\": " << stat.verts << ", \"polys\": " << stat.polys
+       << ", \"tiles\": " << stat.tiles << "}";
+}
+
+static bool bench_build(std::ostream &os, const char *obj,
+                        const BenchOption &opt, const char *mesh_path)
+{
+    RecastNavMesh rnm;
+    RecastNavMesh::BuildStat solo_stat, tiled_stat;
+
+    Clock::time_point begin = Clock::now();
+    if (!rnm.build(obj, &solo_stat))
+    {
+        std::cerr << "build mesh data from " << obj << " fail" << std::endl;
+        return false;
+    }
+    double solo_ms = elapsed_ms(begin);
+
+    // the solo mesh is used by the query benchmark
+    if (!rnm.save(mesh_path))
+    {
+        std::cerr << "save mesh data to " << mesh_path << " fail" << std::endl;
+        return false;
+    }
+
+    RecastNavMesh tiled;
+    begin = Clock::now();
+    if (!tiled.build_tiled(obj, opt.threads, &tiled_stat))
+    {
+        std::cerr << "build tiled mesh data from " << obj << " fail"
+                  << std::endl;
+        return false;
+    }
+    double tiled_ms = elapsed_ms(begin);
+
+    // stage times of the tiled build are summed over the tiles
+    os << "{\"solo_ms\": " << solo_ms << ", \"tiled_ms\": " << tiled_ms
+       << ", \"solo\": ";
+    write_build_stat(os, solo_stat);
+    os << ", \"tiled\": ";
+    write_build_stat(os, tiled_stat);
+    os << "}";
+    return true;
+}
+
+static bool bench_format(std::ostream &os, const char *mesh_path, int format,
+                         bool use_mmap)
+{
+    RecastNavMesh rnm;
+    if (!rnm.load(mesh_path))
+    {
+        std::cerr << "load mesh data from " << mesh_path << " fail"
+                  << std::endl;
+        return false;
+    }
+
+    std::string path(mesh_path);
+    path.append(".").append(std::to_string(format));
+
+    Clock::time_point begin = Clock::now();
+    if (!rnm.save(path.c_str(), format))
+    {
+        std::cerr << "save mesh data to " << path << " fail" << std::endl;
+        return false;
+    }
+    double save_ms  = elapsed_ms(begin);
+    long long bytes = file_size(path.c_str());
+
+    RecastNavMesh loaded;
+    begin = Clock::now();
+    bool ok        = loaded.load(path.c_str(), use_mmap);
+    double load_ms = elapsed_ms(begin);
+    remove(path.c_str());
+    if (!ok)
+    {
+        std::cerr << "load mesh data from " << path << " fail" << std::endl;
+        return false;
+    }
+
+    os << "{\"format\": " << format
+       << ", \"mmap\": " << (use_mmap ? "true" : "false")
+       << ", \"bytes\": " << bytes << ", \"save_ms\": " << save_ms
+       << ", \"save_mb_s\": " << throughput(bytes, save_ms)
+       << ", \"load_ms\": " << load_ms
+       << ", \"load_mb_s\": " << throughput(bytes, load_ms) << "}";
+    return true;
+}
+
+static bool bench_query(std::ostream &os, const char *mesh_path,
+                        const BenchOption &opt)
+{
+    RecastNavMesh rnm;
+    if (!rnm.load(mesh_path))
+    {
+        std::cerr << "load mesh data from " << mesh_path << " fail"
+                  << std::endl;
+        return false;
+    }
+
+    // same seed, same pairs for every run of the same mesh
+    engine.seed(opt.seed);
+    std::vector<float> starts(opt.queries * 3), ends(opt.queries * 3);
+    for (int i = 0; i < opt.queries; i++)
+    {
+        if (!RecastNavMesh::is_succeed(rnm.random_point(frand, &starts[i * 3]))
+            || !RecastNavMesh::is_succeed(
+                rnm.random_point(frand, &ends[i * 3])))
+        {
+            std::cerr << "no random point on " << mesh_path << std::endl;
+            return false;
+        }
+    }
+
+    static const int max_size = 256;
+    float points[max_size * 3];
+
+    // the same pairs on the thread pool, before the cluster graph built
+    std::vector<float> batch_points(opt.queries * max_size * 3);
+    std::vector<int> offsets(opt.queries), sizes(opt.queries);
+    std::vector<unsigned int> batch_status(opt.queries);
+    rnm.set_threads(opt.threads);
+
+    Clock::time_point batch_begin = Clock::now();
+    rnm.follow_batch(opt.queries, starts.data(), ends.data(),
+                     batch_points.data(), max_size, offsets.data(),
+                     sizes.data(), batch_status.data());
+    double batch_ms = elapsed_ms(batch_begin);
+    os << ", \"follow_batch_qps\": "
+       << (batch_ms > 0 ? opt.queries / (batch_ms / 1000.0) : 0);
+
+    // follow, straight, then follow again on the cluster graph
+    static const char *kinds[] = {", \"follow\": ", ", \"straight\": ",
+                                  ", \"follow_cluster\": "};
+    for (int kind = 0; kind < 3; kind++)
+    {
+        if (2 == kind && !rnm.build_cluster_graph())
+        {
+            std::cerr << "build cluster graph of " << mesh_path << " fail"
+                      << std::endl;
+            return false;
+        }
+
+        int failed = 0;
+        std::vector<double> latency(opt.queries);
+
+        Clock::time_point total = Clock::now();
+        for (int i = 0; i < opt.queries; i++)
+        {
+            const float *s = &starts[i * 3];
+            const float *e = &ends[i * 3];
+
+            int use_size            = 0;
+            unsigned int status     = 0;
+            Clock::time_point begin = Clock::now();
+            if (1 != kind)
+            {
+                status = rnm.follow(s[0], s[1], s[2], e[0], e[1], e[2], points,
+                                    max_size, use_size);
+            }
+            else
+            {
+                status = rnm.straight(s[0], s[1], s[2], e[0], e[1], e[2],
+                                      points, max_size, use_size);
+            }
+            latency[i] = elapsed_ms(begin) * 1000.0;
+            if (!RecastNavMesh::is_succeed(status)) failed++;
+        }
+        double total_ms = elapsed_ms(total);
+
+        os << kinds[kind];
+        write_latency(os, latency, total_ms, failed);
+    }
+
+    return true;
+}
+
+static bool bench_mesh(std::ostream &os, const char *obj,
+                       const BenchOption &opt)
+{
+    std::cerr << "bench " << obj << std::endl;
+
+    std::string mesh_path = base_name(obj) + ".bench.mesh";
+
+    os << "    {\"name\": " << json_string(base_name(obj))
+       << ", \"build\": ";
+    if (!bench_build(os, obj, opt, mesh_path.c_str()))
+    {
+        remove(mesh_path.c_str());
+        return false;
+    }
+
+    os << ", \"formats\": [";
+    const int formats[] = {RecastNavMesh::MESH_FORMAT_SET,
+                           RecastNavMesh::MESH_FORMAT_MMAP,
+                           RecastNavMesh::MESH_FORMAT_MMAP,
+                           RecastNavMesh::MESH_FORMAT_COMPRESSED};
+    for (int i = 0; i < 4; i++)
+    {
+        if (i) os << ", ";
+        if (!bench_format(os, mesh_path.c_str(), formats[i], 2 == i))
+        {
+            remove(mesh_path.c_str());
+            return false;
+        }
+    }
+    os << "]";
+
+    bool ok = bench_query(os, mesh_path.c_str(), opt);
+    remove(mesh_path.c_str());
+    os << "}";
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOption opt;
+    opt.queries = 10000;
+    opt.seed    = 20200101;
+    opt.threads = 0;
+
+    const char *output = nullptr;
+    std::vector<const char *> objs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            opt.queries = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-s") && i + 1 < argc)
+            opt.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (0 == strcmp(argv[i], "-t") && i + 1 < argc)
+            opt.threads = atoi(argv[++i]);
+        else
+            objs.push_back(argv[i]);
+    }
+    if (objs.empty() || opt.queries <= 0)
+    {
+        std::cerr << "usage: navmesh_bench [-o result.json] [-n queries] "
+                     "[-s seed] [-t threads] a.obj ..."
+                  << std::endl;
+        return -1;
+    }
+
+    std::ostringstream os;
+    os << "{\n  \"seed\": " << opt.seed << ",\n  \"queries\": " << opt.queries
+       << ",\n  \"threads\": " << opt.threads << ",\n  \"meshes\": [\n";
+    for (size_t i = 0; i < objs.size(); i++)
+    {
+        if (i) os << ",\n";
+        if (!bench_mesh(os, objs[i], opt)) return -1;
+    }
+    os << "\n  ]\n}\n";
+
+    if (!output)
+    {
+        std::cout << os.str();
+        return 0;
+    }
+
+    std::ofstream ofs(output);
+    ofs << os.str();
+    if (!ofs)
+    {
+        std::cerr << "write result to " << output << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "node_pool_tuner.h"
+
+/// next power of two not less than v, at most MAX_NODES
+static int pool_size_of(int v)
+{
+    int size = NodePoolTuner::MIN_NODES;
+    while (size < v && size < NodePoolTuner::MAX_NODES) size <<= 1;
+    return size < NodePoolTuner::MAX_NODES ? size : NodePoolTuner::MAX_NODES;
+}
+
+/// bucket i hold the searches touched less than 2^i nodes
+static int bucket_of(int used_nodes)
+{
+    int bucket = 0;
+    while (used_nodes > 0 && bucket < RecastNavMesh::NODE_POOL_BUCKETS - 1)
+    {
+        used_nodes >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+NodePoolTuner::NodePoolTuner()
+{
+    configure(2048, false);
+}
+
+void NodePoolTuner::configure(int max_nodes, bool adaptive)
+{
+    if (max_nodes < MIN_NODES) max_nodes = MIN_NODES;
+    if (max_nodes > MAX_NODES) max_nodes = MAX_NODES;
+
+    _adaptive     = adaptive;
+    _max_nodes    = max_nodes;
+    _high_water   = 0;
+    _window_high  = 0;
+    _window_count = 0;
+
+    _searches     = 0;
+    _out_of_nodes = 0;
+    _resizes      = 0;
+    for (auto &count : _histogram) count = 0;
+}
+
+void NodePoolTuner::set_sink(const RecastNavMesh::NodePoolSink &sink)
+{
+    std::lock_guard<std::mutex> guard(_sink_mutex);
+    _sink = sink;
+}
+
+void NodePoolTuner::notify(int event, int max_nodes, int used_nodes)
+{
+    std::lock_guard<std::mutex> guard(_sink_mutex);
+    if (_sink) _sink(event, max_nodes, used_nodes);
+}
+
+void NodePoolTuner::resize(int expect, int max_nodes, int used_nodes)
+{
+    if (max_nodes == expect) return;
+    if (!_max_nodes.compare_exchange_strong(expect, max_nodes)) return;
+
+    _resizes++;
+    notify(RecastNavMesh::NODE_POOL_RESIZED, max_nodes, used_nodes);
+}
+
+void NodePoolTuner::record(int used_nodes, int pool_size, bool out_of_nodes)
+{
+    _searches++;
+    _histogram[bucket_of(used_nodes)]++;
+
+    int high = _high_water;
+    while (used_nodes > high
+           && !_high_water.compare_exchange_weak(high, used_nodes))
+    {
+    }
+    high = _window_high;
+    while (used_nodes > high
+           && !_window_high.compare_exchange_weak(high, used_nodes))
+    {
+    }
+
+    if (out_of_nodes)
+    {
+        _out_of_nodes++;
+        notify(RecastNavMesh::NODE_POOL_OUT_OF_NODES, pool_size, used_nodes);
+
+        // a pool already resized by another thread is not grown twice
+        if (_adaptive && pool_size >= _max_nodes)
+            resize(pool_size, pool_size_of(pool_size * 2), used_nodes);
+    }
+
+    // the thread closing the window decide whether to shrink, keep half the
+    // pool as headroom over the window's high water
+    if (++_window_count < WINDOW) return;
+    _window_count = 0;
+    high          = _window_high.exchange(0);
+    if (!_adaptive) return;
+
+    int current = _max_nodes;
+    if (high * 4 < current) resize(current, pool_size_of(high * 2), high);
+}
+
+void NodePoolTuner::get_stat(RecastNavMesh::NodePoolStat &stat) const
+{
+    stat.max_nodes    = _max_nodes;
+    stat.adaptive     = _adaptive;
+    stat.high_water   = _high_water;
+    stat.searches     = _searches;
+    stat.out_of_nodes = _out_of_nodes;
+    stat.resizes      = _resizes;
+    for (int i = 0; i < RecastNavMesh::NODE_POOL_BUCKETS; i++)
+        stat.histogram[i] = _histogram[i];
+}
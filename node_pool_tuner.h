@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "recast_navmesh.h"
+
+/**
+ * size of the dtNavMeshQuery node pools and statistics of the searches run
+ * on them. In adaptive mode the size grow when a search run out of nodes and
+ * shrink when a window of searches used much less, query contexts pick up
+ * the new size between queries. Thread safe
+ */
+class NodePoolTuner
+{
+public:
+    /// nodes of a pool, the node index of Detour is 16 bits
+    static const int MIN_NODES = 64;
+    static const int MAX_NODES = 65535;
+    /// searches looked at before shrinking
+    static const int WINDOW = 1024;
+
+    NodePoolTuner();
+
+    /**
+     * set the size and drop the statistics, not thread safe
+     * @param max_nodes clamped to [MIN_NODES, MAX_NODES]
+     */
+    void configure(int max_nodes, bool adaptive);
+    void set_sink(const RecastNavMesh::NodePoolSink &sink);
+
+    /// size a query context should have now
+    int max_nodes() const { return _max_nodes; }
+
+    /**
+     * record a search
+     * @param used_nodes nodes the search touched
+     * @param pool_size max nodes of the pool it run on
+     */
+    void record(int used_nodes, int pool_size, bool out_of_nodes);
+
+    void get_stat(RecastNavMesh::NodePoolStat &stat) const;
+
+private:
+    /// change the size from expect to max_nodes, once among all threads
+    void resize(int expect, int max_nodes, int used_nodes);
+    void notify(int event, int max_nodes, int used_nodes);
+
+private:
+    bool _adaptive;
+    std::atomic<int> _max_nodes;
+    std::atomic<int> _high_water;
+    std::atomic<int> _window_high; /// high water of the current window
+    std::atomic<int> _window_count;
+
+    std::atomic<unsigned long long> _searches;
+    std::atomic<unsigned long long> _out_of_nodes;
+    std::atomic<unsigned long long> _resizes;
+    std::atomic<unsigned long long>
+        _histogram[RecastNavMesh::NODE_POOL_BUCKETS];
+
+    std::mutex _sink_mutex;
+    RecastNavMesh::NodePoolSink _sink;
+};
@@ -0,0 +1,127 @@
+#include <cstring>
+
+#include "path_cache.h"
+
+PathCache::PathCache(int capacity)
+{
+    _hit      = 0;
+    _miss     = 0;
+    _capacity = capacity > 0 ? capacity : 0;
+
+    // split the capacity exactly, so never more entries than asked for
+    _shard_count = _capacity < SHARDS ? (_capacity > 0 ? _capacity : 1)
+                                      : SHARDS;
+    for (int i = 0; i < SHARDS; i++)
+    {
+        _shards[i].capacity = 0;
+        if (i < _shard_count)
+        {
+            _shards[i].capacity = _capacity / _shard_count
+                                + (i < _capacity % _shard_count ? 1 : 0);
+        }
+    }
+}
+
+size_t PathCache::KeyHash::operator()(const Key &key) const
+{
+    size_t h = std::hash<unsigned long long>()(
+        (unsigned long long)key.start << 32 ^ key.end);
+    return h ^ (std::hash<const void *>()(key.filter) << 1);
+}
+
+PathCache::Shard &PathCache::shard(const Key &key)
+{
+    return _shards[KeyHash()(key) % _shard_count];
+}
+
+int PathCache::get(const dtNavMesh *mesh, dtPolyRef start, dtPolyRef end,
+                   const void *filter, std::vector<dtPolyRef> &path,
+                   unsigned int &status)
+{
+    Key key = {start, end, filter};
+    Shard &s = shard(key);
+
+    std::lock_guard<std::mutex> guard(s.mutex);
+    auto found = s.index.find(key);
+    if (found == s.index.end())
+    {
+        _miss++;
+        return 0;
+    }
+
+    // a tile replaced since cached has a new salt, so the refs are invalid
+    auto iter = found->second;
+    for (auto ref : iter->path)
+    {
+        if (!mesh->isValidPolyRef(ref))
+        {
+            s.lru.erase(iter);
+            s.index.erase(found);
+            _miss++;
+            return 0;
+        }
+    }
+
+    s.lru.splice(s.lru.begin(), s.lru, iter);
+
+    int npath = (int)iter->path.size();
+    if ((int)path.size() < npath) path.resize(npath);
+    memcpy(path.data(), iter->path.data(), npath * sizeof(dtPolyRef));
+    status = iter->status;
+
+    _hit++;
+    return npath;
+}
+
+void PathCache::put(dtPolyRef start, dtPolyRef end, const void *filter,
+                    const dtPolyRef *path, int npath, unsigned int status)
+{
+    if (!_capacity || npath <= 0) return;
+
+    Key key = {start, end, filter};
+    Shard &s = shard(key);
+
+    std::lock_guard<std::mutex> guard(s.mutex);
+
+    // another thread may have put it already
+    auto found = s.index.find(key);
+    if (found != s.index.end())
+    {
+        s.lru.erase(found->second);
+        s.index.erase(found);
+    }
+
+    while (!s.lru.empty() && (int)s.lru.size() >= s.capacity)
+    {
+        s.index.erase(s.lru.back().key);
+        s.lru.pop_back();
+    }
+
+    Entry entry;
+    entry.key    = key;
+    entry.status = status;
+    entry.path.assign(path, path + npath);
+    s.lru.push_front(entry);
+    s.index[key] = s.lru.begin();
+}
+
+void PathCache::clear()
+{
+    for (int i = 0; i < SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> guard(_shards[i].mutex);
+        _shards[i].lru.clear();
+        _shards[i].index.clear();
+    }
+}
+
+int PathCache::size() const
+{
+    int size = 0;
+    for (int i = 0; i < SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> guard(_shards[i].mutex);
+        size += (int)_shards[i].lru.size();
+    }
+    return size;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <DetourNavMesh.h>
+
+/**
+ * bounded LRU cache of polygon corridors, keyed by start poly, end poly and
+ * the filter used. Split into shards so concurrent queries rarely contend on
+ * the same lock
+ */
+class PathCache
+{
+public:
+    explicit PathCache(int capacity);
+
+    /**
+     * look up a corridor, the tile of every poly in it must still be alive in
+     * mesh, otherwise the entry is dropped
+     * @param path grown if shorter than the corridor
+     * @return poly count copied into path, 0 if not found
+     */
+    int get(const dtNavMesh *mesh, dtPolyRef start, dtPolyRef end,
+            const void *filter, std::vector<dtPolyRef> &path,
+            unsigned int &status);
+
+    void put(dtPolyRef start, dtPolyRef end, const void *filter,
+             const dtPolyRef *path, int npath, unsigned int status);
+
+    /// drop all entries, eg. poly flags changed
+    void clear();
+
+    int capacity() const { return _capacity; }
+    int size() const;
+    unsigned long long hit() const { return _hit; }
+    unsigned long long miss() const { return _miss; }
+
+private:
+    struct Key
+    {
+        dtPolyRef start;
+        dtPolyRef end;
+        const void *filter;
+
+        bool operator==(const Key &other) const
+        {
+            return start == other.start && end == other.end
+                && filter == other.filter;
+        }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+    struct Entry
+    {
+        Key key;
+        unsigned int status;
+        std::vector<dtPolyRef> path;
+    };
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        int capacity;         /// the shard capacities add up to _capacity
+        std::list<Entry> lru; /// most recently used at front
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    };
+
+    static const int SHARDS = 16;
+
+    Shard &shard(const Key &key);
+
+private:
+    int _capacity;
+    int _shard_count; /// SHARDS, fewer if capacity is smaller
+    std::atomic<unsigned long long> _hit;
+    std::atomic<unsigned long long> _miss;
+    Shard _shards[SHARDS];
+};
@@ -0,0 +1,345 @@
+#include <DetourCommon.h>
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "node_pool_tuner.h"
+#include "path_cache.h"
+#include "path_scheduler.h"
+
+PathScheduler::PathScheduler(RecastNavMesh *mesh, int iterations)
+{
+    _mesh       = mesh;
+    _query      = nullptr;
+    _generation = 0;
+    _iterations = iterations > 0 ? iterations : 32;
+    _step       = 0.5f;
+
+    _seed   = 0;
+    _tick   = 0;
+    _active = false;
+
+    _finished    = 0;
+    _total_ticks = 0;
+}
+
+PathScheduler::~PathScheduler()
+{
+    if (_query) dtFreeNavMeshQuery(_query);
+    _query = nullptr;
+}
+
+PathScheduler::Handle PathScheduler::request(int type, float sx, float sy,
+                                             float sz, float ex, float ey,
+                                             float ez, int priority,
+                                             int max_size,
+                                             const Callback &callback)
+{
+    if (max_size <= 0) return 0;
+    if (type != REQUEST_STRAIGHT && type != REQUEST_FOLLOW) return 0;
+
+    if (0 == ++_seed) ++_seed; // 0 is invalid handle
+
+    Request req;
+    req.handle    = _seed;
+    req.type      = type;
+    req.priority  = priority;
+    req.max_size  = max_size;
+    req.tick      = _tick;
+    req.start_ref = 0;
+    req.callback  = callback;
+    dtVset(req.spos, sx, sy, sz);
+    dtVset(req.epos, ex, ey, ez);
+
+    queue(req);
+
+    return req.handle;
+}
+
+void PathScheduler::queue(const Request &req)
+{
+    // keep sorted so the highest priority and earliest request is at back
+    auto pos = std::upper_bound(
+        _pending.begin(), _pending.end(), req,
+        [](const Request &a, const Request &b) {
+            return a.priority < b.priority
+                || (a.priority == b.priority && a.handle > b.handle);
+        });
+    _pending.insert(pos, req);
+}
+
+bool PathScheduler::cancel(Handle handle)
+{
+    if (_active && _running.handle == handle)
+    {
+        // just drop the sliced search, next init will reset the query
+        _active = false;
+        return true;
+    }
+
+    for (auto iter = _pending.begin(); iter != _pending.end(); iter++)
+    {
+        if (iter->handle == handle)
+        {
+            _pending.erase(iter);
+            return true;
+        }
+    }
+
+    return _results.erase(handle) > 0;
+}
+
+int PathScheduler::queue_depth() const
+{
+    return (int)_pending.size() + (_active ? 1 : 0);
+}
+
+float PathScheduler::avg_ticks() const
+{
+    return _finished ? (float)_total_ticks / _finished : 0.f;
+}
+
+unsigned int PathScheduler::fetch(Handle handle, float *points, int max_size,
+                                  int &use_size)
+{
+    use_size = 0;
+
+    auto found = _results.find(handle);
+    if (found == _results.end())
+    {
+        if (_active && _running.handle == handle) return DT_IN_PROGRESS;
+        for (const auto &req : _pending)
+        {
+            if (req.handle == handle) return DT_IN_PROGRESS;
+        }
+        return DT_FAILURE;
+    }
+
+    const Result &result = found->second;
+
+    use_size = dtMin((int)result.points.size() / 3, max_size);
+    memcpy(points, result.points.data(), use_size * 3 * sizeof(float));
+
+    unsigned int status = result.status;
+    _results.erase(found);
+
+    return status;
+}
+
+void PathScheduler::finish(Request &req, unsigned int status,
+                           const unsigned int *polys, int npolys)
+{
+    Result result;
+    result.status = status;
+    result.ticks  = _tick - req.tick;
+
+    if (!dtStatusFailed(status) && npolys > 0)
+    {
+        int use_size = 0;
+        result.points.resize(req.max_size * 3);
+        if (REQUEST_FOLLOW == req.type)
+        {
+            bool truncated = false;
+            use_size = _mesh->smooth(_query, _smooth, req.spos, req.epos, polys,
+                                     npolys, req.start_ref,
+                                     result.points.data(), req.max_size, _step,
+                                     truncated);
+            if (truncated) result.status |= DT_BUFFER_TOO_SMALL;
+        }
+        else
+        {
+            // In case of partial path, make sure the end point is clamped to
+            // the last polygon.
+            float epos[3];
+            dtVcopy(epos, req.epos);
+            if (dtStatusDetail(status, DT_PARTIAL_RESULT))
+            {
+                _query->closestPointOnPoly(polys[npolys - 1], req.epos, epos,
+                                           0);
+            }
+            dtStatus st = _query->findStraightPath(
+                req.spos, epos, polys, npolys, result.points.data(), nullptr,
+                nullptr, &use_size, req.max_size);
+            if (dtStatusFailed(st))
+                result.status = st;
+            else
+                result.status |= st & DT_BUFFER_TOO_SMALL;
+        }
+        result.points.resize(use_size * 3);
+    }
+
+    _finished++;
+    _total_ticks += result.ticks;
+
+    if (req.callback)
+    {
+        req.callback(req.handle, result);
+    }
+    else
+    {
+        _results[req.handle] = result;
+    }
+}
+
+bool PathScheduler::start(const RecastNavMesh::MeshState *state,
+                          Request &req)
+{
+    const dtQueryFilter *filter = _mesh->_filter;
+
+    dtPolyRef end_ref = 0;
+    _mesh->find_nearest_poly(state, _query, req.spos, req.start_ref);
+    _mesh->find_nearest_poly(state, _query, req.epos, end_ref);
+    if (!req.start_ref || !end_ref)
+    {
+        finish(req, DT_FAILURE, nullptr, 0);
+        return false;
+    }
+
+    // a cached corridor need no search at all
+    PathCache *cache = state->path_cache;
+    if (cache)
+    {
+        unsigned int status = 0;
+        int npolys = cache->get(state->nav_mesh, req.start_ref, end_ref,
+                                filter, _polys, status);
+        if (npolys)
+        {
+            finish(req, status, _polys.data(), npolys);
+            return false;
+        }
+    }
+
+    _end_ref = end_ref;
+    dtStatus status = _query->initSlicedFindPath(req.start_ref, end_ref,
+                                                 req.spos, req.epos, filter);
+    if (dtStatusFailed(status))
+    {
+        finish(req, status, nullptr, 0);
+        return false;
+    }
+
+    return true;
+}
+
+bool PathScheduler::prepare_query(const RecastNavMesh::MeshState *state)
+{
+    // the mesh was replaced(or never loaded when query created)
+    NodePoolTuner *node_pool = _mesh->_node_pool;
+    if (!_query || _generation != state->generation)
+    {
+        // the search is on the old mesh, plan it again on the new one. The
+        // ticks keep counting from the first queued
+        if (_active)
+        {
+            _active = false;
+            queue(_running);
+        }
+        if (!state->nav_mesh) return false;
+
+        if (!_query) _query = dtAllocNavMeshQuery();
+        if (!_query
+            || dtStatusFailed(
+                _query->init(state->nav_mesh, node_pool->max_nodes())))
+        {
+            return false;
+        }
+        _generation = state->generation;
+    }
+    // node pool resized, init never shrink the pool so use a new query.
+    // Wait until the running search done
+    else if (!_active
+             && _query->getNodePool()->getMaxNodes() != node_pool->max_nodes())
+    {
+        dtNavMeshQuery *query = dtAllocNavMeshQuery();
+        if (query
+            && dtStatusSucceed(
+                query->init(state->nav_mesh, node_pool->max_nodes())))
+        {
+            dtFreeNavMeshQuery(_query);
+            _query = query;
+        }
+        else if (query)
+        {
+            dtFreeNavMeshQuery(query);
+        }
+    }
+
+    return true;
+}
+
+int PathScheduler::update(int budget_us)
+{
+    _tick++;
+
+    // pinned for the whole update, a mesh replaced meanwhile is not freed
+    // while the sliced search still walk it
+    RecastNavMesh::QueryContext *ctx      = nullptr;
+    const RecastNavMesh::MeshState *state = _mesh->pin_mesh(ctx);
+    if (!prepare_query(state))
+    {
+        _mesh->release_query(ctx);
+        return 0;
+    }
+
+    NodePoolTuner *node_pool = _mesh->_node_pool;
+
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline =
+        Clock::now() + std::chrono::microseconds(budget_us);
+
+    // at least one slice every update, even if the budget is too small
+    int finished = 0;
+    do
+    {
+        if (!_active)
+        {
+            if (_pending.empty()) break;
+
+            _running = _pending.back();
+            _pending.pop_back();
+            if (!start(state, _running))
+            {
+                finished++;
+                continue;
+            }
+            _active = true;
+        }
+
+        int iters = 0;
+        dtStatus status = _query->updateSlicedFindPath(_iterations, &iters);
+        if (dtStatusInProgress(status)) continue;
+
+        const int max_nodes = _query->getNodePool()->getMaxNodes();
+        node_pool->record(_query->getNodePool()->getNodeCount(), max_nodes,
+                          dtStatusDetail(status, DT_OUT_OF_NODES));
+
+        // every poly of the corridor is a node of the pool
+        int npolys = 0;
+        if ((int)_polys.size() < max_nodes) _polys.resize(max_nodes);
+        if (dtStatusSucceed(status))
+        {
+            const unsigned int detail = status & DT_STATUS_DETAIL_MASK;
+            status = _query->finalizeSlicedFindPath(_polys.data(), &npolys,
+                                                    (int)_polys.size());
+            status |= detail;
+        }
+
+        PathCache *cache = state->path_cache;
+        if (cache && !dtStatusFailed(status))
+        {
+            cache->put(_running.start_ref, _end_ref, _mesh->_filter,
+                       _polys.data(), npolys, status);
+        }
+
+        _active = false;
+        finish(_running, status, _polys.data(), npolys);
+        finished++;
+    } while (Clock::now() < deadline);
+
+    _mesh->release_query(ctx);
+    return finished;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "recast_navmesh.h"
+
+/**
+ * time-sliced pathfinding, requests are queued by priority and advanced by
+ * Detour sliced search within a time budget every tick, so one long search
+ * never stall the caller. Not thread safe, drive it from one thread(eg. the
+ * game tick). update pin the mesh it searches, so load, build and swap_mesh
+ * of the mesh may run on other threads meanwhile
+ */
+class PathScheduler
+{
+public:
+    typedef unsigned int Handle;
+
+    enum RequestType
+    {
+        REQUEST_STRAIGHT, /// see RecastNavMesh::straight
+        REQUEST_FOLLOW,   /// see RecastNavMesh::follow
+    };
+
+    struct Result
+    {
+        unsigned int status; /// use RecastNavMesh::is_xx to check
+        int ticks;           /// update called before it finished
+        std::vector<float> points;
+    };
+
+    /// called in update when a request finished
+    typedef std::function<void(Handle, const Result &)> Callback;
+
+public:
+    /**
+     * @param mesh the mesh to query, must outlive the scheduler
+     * @param iterations search iterations between two budget check
+     */
+    explicit PathScheduler(RecastNavMesh *mesh, int iterations = 32);
+    ~PathScheduler();
+
+    /**
+     * queue a pathfinding request
+     * @param priority higher run first, same priority run in request order
+     * @param max_size max point count of the result
+     * @param callback called when finished, the result is not kept then
+     * @return handle of the request, 0 if fail
+     */
+    Handle request(int type, float sx, float sy, float sz, float ex, float ey,
+                   float ez, int priority = 0, int max_size = 256,
+                   const Callback &callback = nullptr);
+
+    /**
+     * drop a request, queued or running
+     */
+    bool cancel(Handle handle);
+
+    /**
+     * advance the queued requests until budget used up. A request running
+     * when the mesh replaced is planned again on the new mesh
+     * @param budget_us time budget in microseconds
+     * @return requests finished in this update
+     */
+    int update(int budget_us);
+
+    /**
+     * get the result of a request without callback, the result is released
+     * once fetched
+     * @return DT_IN_PROGRESS if not finished, DT_FAILURE if handle unknown,
+     * otherwise the status of the path
+     */
+    unsigned int fetch(Handle handle, float *points, int max_size,
+                       int &use_size);
+
+    /// step size of REQUEST_FOLLOW, see RecastNavMesh::follow
+    void set_follow_step(float step) { _step = step; }
+
+    /// requests waiting or running
+    int queue_depth() const;
+    /// average update ticks every finished request needed
+    float avg_ticks() const;
+
+private:
+    struct Request
+    {
+        Handle handle;
+        int type;
+        int priority;
+        int max_size;
+        int tick; /// the tick it was queued
+        float spos[3];
+        float epos[3];
+        unsigned int start_ref;
+        Callback callback;
+    };
+
+    /// (re-)init the query if the mesh replaced or the node pool resized
+    bool prepare_query(const RecastNavMesh::MeshState *state);
+    bool start(const RecastNavMesh::MeshState *state, Request &req);
+    /// insert into _pending by priority and request order
+    void queue(const Request &req);
+    void finish(Request &req, unsigned int status, const unsigned int *polys,
+                int npolys);
+
+private:
+    RecastNavMesh *_mesh;
+    dtNavMeshQuery *_query;
+    unsigned int _generation; /// mesh generation the query was init with
+    int _iterations;
+    float _step;
+
+    Handle _seed;
+    int _tick;
+    bool _active; /// _running is searching
+    Request _running;
+    unsigned int _end_ref; /// end poly of _running
+    std::vector<unsigned int> _polys;  /// corridor of _running
+    std::vector<unsigned int> _smooth; /// working corridor of smooth
+    std::vector<Request> _pending; /// sorted, next to run at back
+    std::unordered_map<Handle, Result> _results;
+
+    long long _finished;
+    long long _total_ticks;
+};
@@ -0,0 +1,207 @@
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+
+#include <cfloat>
+#include <cmath>
+
+#include "point_grid.h"
+
+/// tiles stacked at a location, as MAX_LAYERS of the tile cache
+static const int MAX_TILES_AT = 32;
+
+PointGrid::PointGrid(float cell_size) : _cell_size(cell_size)
+{
+}
+
+void PointGrid::clear()
+{
+    _tiles.clear();
+}
+
+void PointGrid::sync(const dtNavMesh *mesh)
+{
+    if (!mesh)
+    {
+        clear();
+        return;
+    }
+
+    const int max_tiles = mesh->getMaxTiles();
+    _tiles.resize(max_tiles);
+    for (int i = 0; i < max_tiles; i++)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        dtTileRef ref = tile && tile->header ? mesh->getTileRef(tile) : 0;
+
+        TileGrid &grid = _tiles[i];
+        if (grid.ref == ref) continue;
+
+        grid.ref = ref;
+        grid.offsets.clear();
+        grid.entries.clear();
+        if (ref) build_tile(mesh, tile, grid);
+    }
+}
+
+void PointGrid::build_tile(const dtNavMesh *mesh, const dtMeshTile *tile,
+                           TileGrid &grid) const
+{
+    const dtMeshHeader *header = tile->header;
+    const float cs             = _cell_size;
+
+    grid.bmin[0] = header->bmin[0];
+    grid.bmin[1] = header->bmin[1];
+    grid.bmin[2] = header->bmin[2];
+    grid.width   = (int)ceilf((header->bmax[0] - header->bmin[0]) / cs);
+    grid.height  = (int)ceilf((header->bmax[2] - header->bmin[2]) / cs);
+    if (grid.width < 1) grid.width = 1;
+    if (grid.height < 1) grid.height = 1;
+
+    // bounds of every ground poly, the height from the detail mesh too as
+    // it may be off the poly verts by the detail sample distance
+    struct Bounds
+    {
+        int x0, z0, x1, z1;
+        float ymin, ymax;
+    };
+    std::vector<Bounds> bounds(header->polyCount);
+    const int cells = grid.width * grid.height;
+    std::vector<int> counts(cells + 1, 0);
+
+    for (int i = 0; i < header->polyCount; i++)
+    {
+        const dtPoly *poly = &tile->polys[i];
+        Bounds &b          = bounds[i];
+        b.x0 = -1;
+        if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION) continue;
+
+        float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (int j = 0; j < poly->vertCount; j++)
+        {
+            const float *v = &tile->verts[poly->verts[j] * 3];
+            for (int k = 0; k < 3; k++)
+            {
+                bmin[k] = fminf(bmin[k], v[k]);
+                bmax[k] = fmaxf(bmax[k], v[k]);
+            }
+        }
+        const dtPolyDetail *pd = &tile->detailMeshes[i];
+        for (int j = 0; j < pd->vertCount; j++)
+        {
+            const float y = tile->detailVerts[(pd->vertBase + j) * 3 + 1];
+            bmin[1] = fminf(bmin[1], y);
+            bmax[1] = fmaxf(bmax[1], y);
+        }
+
+        b.x0 = (int)floorf((bmin[0] - grid.bmin[0]) / cs);
+        b.z0 = (int)floorf((bmin[2] - grid.bmin[2]) / cs);
+        b.x1 = (int)floorf((bmax[0] - grid.bmin[0]) / cs);
+        b.z1 = (int)floorf((bmax[2] - grid.bmin[2]) / cs);
+        b.x0 = b.x0 < 0 ? 0 : b.x0;
+        b.z0 = b.z0 < 0 ? 0 : b.z0;
+        b.x1 = b.x1 >= grid.width ? grid.width - 1 : b.x1;
+        b.z1 = b.z1 >= grid.height ? grid.height - 1 : b.z1;
+        b.ymin = bmin[1];
+        b.ymax = bmax[1];
+
+        for (int z = b.z0; z <= b.z1; z++)
+            for (int x = b.x0; x <= b.x1; x++) counts[z * grid.width + x]++;
+    }
+
+    // counts to offsets, then fill every cell contiguously
+    grid.offsets.resize(cells + 1);
+    int total = 0;
+    for (int c = 0; c < cells; c++)
+    {
+        grid.offsets[c] = total;
+        total += counts[c];
+        counts[c] = grid.offsets[c];
+    }
+    grid.offsets[cells] = total;
+    grid.entries.resize(total);
+
+    const dtPolyRef base = mesh->getPolyRefBase(tile);
+    for (int i = 0; i < header->polyCount; i++)
+    {
+        const Bounds &b = bounds[i];
+        if (b.x0 < 0) continue;
+
+        Entry entry = {base | (dtPolyRef)i, b.ymin, b.ymax};
+        for (int z = b.z0; z <= b.z1; z++)
+            for (int x = b.x0; x <= b.x1; x++)
+                grid.entries[counts[z * grid.width + x]++] = entry;
+    }
+}
+
+bool PointGrid::locate(const dtNavMesh *mesh, const dtNavMeshQuery *query,
+                       const dtQueryFilter *filter, const float *pos,
+                       const float *ext, dtPolyRef &ref) const
+{
+    ref = 0;
+    if (!mesh || _tiles.empty()) return false;
+
+    int tx, ty;
+    mesh->calcTileLoc(pos, &tx, &ty);
+    const dtMeshTile *tiles[MAX_TILES_AT];
+    const int ntiles = mesh->getTilesAt(tx, ty, tiles, MAX_TILES_AT);
+
+    const float ylo = pos[1] - ext[1];
+    const float yhi = pos[1] + ext[1];
+    float best      = FLT_MAX;
+    for (int i = 0; i < ntiles; i++)
+    {
+        const dtTileRef tile_ref = mesh->getTileRef(tiles[i]);
+        const unsigned int index = mesh->decodePolyIdTile(tile_ref);
+        if (index >= _tiles.size() || _tiles[index].ref != tile_ref)
+        {
+            return false; // changed since the last sync
+        }
+
+        const TileGrid &grid = _tiles[index];
+        const int x = (int)floorf((pos[0] - grid.bmin[0]) / _cell_size);
+        const int z = (int)floorf((pos[2] - grid.bmin[2]) / _cell_size);
+        if (x < 0 || z < 0 || x >= grid.width || z >= grid.height) continue;
+
+        const int cell = z * grid.width + x;
+        for (int e = grid.offsets[cell]; e < grid.offsets[cell + 1]; e++)
+        {
+            const Entry &entry = grid.entries[e];
+            if (entry.ymax < ylo || entry.ymin > yhi) continue;
+
+            const dtMeshTile *tile = nullptr;
+            const dtPoly *poly     = nullptr;
+            mesh->getTileAndPolyByRefUnsafe(entry.ref, &tile, &poly);
+            if (!filter->passFilter(entry.ref, tile, poly)) continue;
+
+            // fail if pos is outside the poly on xz
+            float h = 0;
+            if (dtStatusFailed(query->getPolyHeight(entry.ref, pos, &h)))
+                continue;
+
+            const float d = fabsf(h - pos[1]);
+            if (d <= ext[1] && d < best)
+            {
+                best = d;
+                ref  = entry.ref;
+            }
+        }
+    }
+
+    return ref != 0;
+}
+
+int PointGrid::tile_count() const
+{
+    int count = 0;
+    for (const TileGrid &grid : _tiles)
+        if (grid.ref) count++;
+    return count;
+}
+
+int PointGrid::entry_count() const
+{
+    int count = 0;
+    for (const TileGrid &grid : _tiles) count += (int)grid.entries.size();
+    return count;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include <DetourNavMesh.h>
+
+class dtNavMeshQuery;
+class dtQueryFilter;
+
+/**
+ * 2D grid over every tile of a nav mesh, a cell list the ground polys whose
+ * bounds overlap it with their height range. Resolve a point on the mesh to
+ * its poly with one cell lookup instead of the bv-tree walk of
+ * dtNavMeshQuery::findNearestPoly. The grid of a tile is rebuilt by sync
+ * when the tile is added, replaced or removed
+ */
+class PointGrid
+{
+public:
+    /// @param cell_size edge length of a cell in world units
+    explicit PointGrid(float cell_size);
+
+    /// drop the grid of every tile, call it when the mesh is replaced
+    void clear();
+
+    /**
+     * rebuild the grid of every tile whose ref changed since the last sync,
+     * not thread safe with locate
+     */
+    void sync(const dtNavMesh *mesh);
+
+    /**
+     * find the poly right below or above pos, within ext[1] in height.
+     * Thread safe
+     * @return false if pos is off the mesh or a tile is out of sync, then
+     *         use dtNavMeshQuery::findNearestPoly instead
+     */
+    bool locate(const dtNavMesh *mesh, const dtNavMeshQuery *query,
+                const dtQueryFilter *filter, const float *pos,
+                const float *ext, dtPolyRef &ref) const;
+
+    float cell_size() const { return _cell_size; }
+    /// tiles synced and poly entries of all cells
+    int tile_count() const;
+    int entry_count() const;
+
+private:
+    struct Entry
+    {
+        dtPolyRef ref;
+        float ymin;
+        float ymax;
+    };
+    struct TileGrid
+    {
+        dtTileRef ref; /// 0 if no tile
+        float bmin[3];
+        int width;  /// cells along x
+        int height; /// cells along z
+        std::vector<int> offsets; /// first entry of every cell, and the end
+        std::vector<Entry> entries;
+    };
+
+    void build_tile(const dtNavMesh *mesh, const dtMeshTile *tile,
+                    TileGrid &grid) const;
+
+private:
+    float _cell_size;
+    std::vector<TileGrid> _tiles; /// by tile index
+};
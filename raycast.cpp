@@ -0,0 +1,309 @@
+#include <DetourCommon.h>
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+
+#include <cfloat>
+#include <cmath>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define RAYCAST_SSE2
+#endif
+
+#include "raycast.h"
+
+/// lanes of the edge terms, DT_VERTS_PER_POLYGON padded to a whole register
+static const int EDGE_LANES = 8;
+
+/**
+ * edges of a poly in the order dtIntersectSegmentPoly2D visit them, edge m
+ * go from vert j to vert i with j = m - 1(or the last vert for m = 0)
+ */
+struct PolyEdges
+{
+    float jx[EDGE_LANES];
+    float jz[EDGE_LANES];
+    float ix[EDGE_LANES];
+    float iz[EDGE_LANES];
+    int seg[EDGE_LANES]; /// j, the edge index of Detour
+};
+
+/**
+ * n = dtVperp2D(edge, p0 - vj), d = dtVperp2D(dir, edge) and t = n / d of
+ * every edge, the same float operations as the scalar code
+ */
+static void edge_terms(const PolyEdges &e, const float *p0, const float *dir,
+                       float *n, float *d, float *t)
+{
+#if defined(__AVX__)
+    const __m256 jx = _mm256_loadu_ps(e.jx), jz = _mm256_loadu_ps(e.jz);
+    const __m256 ex = _mm256_sub_ps(_mm256_loadu_ps(e.ix), jx);
+    const __m256 ez = _mm256_sub_ps(_mm256_loadu_ps(e.iz), jz);
+    const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(p0[0]), jx);
+    const __m256 dz = _mm256_sub_ps(_mm256_set1_ps(p0[2]), jz);
+
+    const __m256 vn = _mm256_sub_ps(_mm256_mul_ps(ez, dx),
+                                    _mm256_mul_ps(ex, dz));
+    const __m256 vd =
+        _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(dir[2]), ex),
+                      _mm256_mul_ps(_mm256_set1_ps(dir[0]), ez));
+    _mm256_storeu_ps(n, vn);
+    _mm256_storeu_ps(d, vd);
+    _mm256_storeu_ps(t, _mm256_div_ps(vn, vd));
+#elif defined(RAYCAST_SSE2)
+    const __m128 px = _mm_set1_ps(p0[0]), pz = _mm_set1_ps(p0[2]);
+    const __m128 rx = _mm_set1_ps(dir[0]), rz = _mm_set1_ps(dir[2]);
+    for (int k = 0; k < EDGE_LANES; k += 4)
+    {
+        const __m128 jx = _mm_loadu_ps(e.jx + k), jz = _mm_loadu_ps(e.jz + k);
+        const __m128 ex = _mm_sub_ps(_mm_loadu_ps(e.ix + k), jx);
+        const __m128 ez = _mm_sub_ps(_mm_loadu_ps(e.iz + k), jz);
+        const __m128 dx = _mm_sub_ps(px, jx);
+        const __m128 dz = _mm_sub_ps(pz, jz);
+
+        const __m128 vn = _mm_sub_ps(_mm_mul_ps(ez, dx), _mm_mul_ps(ex, dz));
+        const __m128 vd = _mm_sub_ps(_mm_mul_ps(rz, ex), _mm_mul_ps(rx, ez));
+        _mm_storeu_ps(n + k, vn);
+        _mm_storeu_ps(d + k, vd);
+        _mm_storeu_ps(t + k, _mm_div_ps(vn, vd));
+    }
+#else
+    for (int k = 0; k < EDGE_LANES; k++)
+    {
+        const float ex = e.ix[k] - e.jx[k], ez = e.iz[k] - e.jz[k];
+        const float dx = p0[0] - e.jx[k], dz = p0[2] - e.jz[k];
+        n[k] = ez * dx - ex * dz;
+        d[k] = dir[2] * ex - dir[0] * ez;
+        t[k] = n[k] / d[k];
+    }
+#endif
+}
+
+/// dtIntersectSegmentPoly2D, on the edge terms computed in parallel
+static bool intersect_segment_poly(const PolyEdges &e, int nverts,
+                                   const float *p0, const float *dir,
+                                   float &tmin, float &tmax, int &seg_min,
+                                   int &seg_max)
+{
+    static const float EPS = 0.000001f;
+
+    tmin    = 0;
+    tmax    = 1;
+    seg_min = -1;
+    seg_max = -1;
+
+    float n[EDGE_LANES], d[EDGE_LANES], t[EDGE_LANES];
+    edge_terms(e, p0, dir, n, d, t);
+
+    for (int m = 0; m < nverts; m++)
+    {
+        if (fabsf(d[m]) < EPS)
+        {
+            // segment parallel to the edge, and outside of it
+            if (n[m] < 0) return false;
+            continue;
+        }
+        if (d[m] < 0)
+        {
+            // entering across this edge
+            if (t[m] > tmin)
+            {
+                tmin    = t[m];
+                seg_min = e.seg[m];
+                if (tmin > tmax) return false;
+            }
+        }
+        else
+        {
+            // leaving across this edge
+            if (t[m] < tmax)
+            {
+                tmax    = t[m];
+                seg_max = e.seg[m];
+                if (tmax < tmin) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void load_edges(const dtMeshTile *tile, const dtPoly *poly,
+                       PolyEdges &e)
+{
+    const int nv = poly->vertCount;
+    for (int m = 0; m < EDGE_LANES; m++)
+    {
+        // pad with the first edge, the lanes past nv are never read
+        const int i   = m < nv ? m : 0;
+        const int j   = i == 0 ? nv - 1 : i - 1;
+        const float *vi = &tile->verts[poly->verts[i] * 3];
+        const float *vj = &tile->verts[poly->verts[j] * 3];
+        e.ix[m]  = vi[0];
+        e.iz[m]  = vi[2];
+        e.jx[m]  = vj[0];
+        e.jz[m]  = vj[2];
+        e.seg[m] = j;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Those code are ported from Recast Navigation, please Keep them consistent
+
+dtStatus simd_raycast(const dtNavMesh *mesh, const dtQueryFilter *filter,
+                      dtPolyRef start_ref, const float *spos,
+                      const float *epos, float &t, float *normal,
+                      dtPolyRef &last_ref)
+{
+    t        = 0;
+    last_ref = 0;
+    dtVset(normal, 0, 0, 0);
+
+    if (!mesh->isValidPolyRef(start_ref)) return DT_FAILURE | DT_INVALID_PARAM;
+
+    float dir[3];
+    dtVsub(dir, epos, spos);
+
+    PolyEdges edges;
+    dtPolyRef curRef = start_ref;
+    while (curRef)
+    {
+        // Cast ray against current polygon.
+
+        // The API input has been checked already, skip checking internal
+        // data.
+        const dtMeshTile *tile = 0;
+        const dtPoly *poly     = 0;
+        mesh->getTileAndPolyByRefUnsafe(curRef, &tile, &poly);
+
+        load_edges(tile, poly, edges);
+
+        float tmin, tmax;
+        int segMin, segMax;
+        if (!intersect_segment_poly(edges, poly->vertCount, spos, dir, tmin,
+                                    tmax, segMin, segMax))
+        {
+            // Could not hit the polygon, keep the old t and report hit.
+            return DT_SUCCESS;
+        }
+
+        // Keep track of furthest t so far.
+        if (tmax > t) t = tmax;
+
+        // Store visited polygons.
+        last_ref = curRef;
+
+        // Ray end is completely inside the polygon.
+        if (segMax == -1)
+        {
+            t = FLT_MAX;
+            return DT_SUCCESS;
+        }
+
+        // Follow neighbours.
+        dtPolyRef nextRef = 0;
+
+        for (unsigned int i = poly->firstLink; i != DT_NULL_LINK;
+             i = tile->links[i].next)
+        {
+            const dtLink *link = &tile->links[i];
+
+            // Find link which contains this edge.
+            if ((int)link->edge != segMax) continue;
+
+            // Get pointer to the next polygon.
+            const dtMeshTile *nextTile = 0;
+            const dtPoly *nextPoly     = 0;
+            mesh->getTileAndPolyByRefUnsafe(link->ref, &nextTile, &nextPoly);
+
+            // Skip off-mesh connections.
+            if (nextPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+                continue;
+
+            // Skip links based on filter.
+            if (!filter->passFilter(link->ref, nextTile, nextPoly)) continue;
+
+            // If the link is internal, just return the ref.
+            if (link->side == 0xff)
+            {
+                nextRef = link->ref;
+                break;
+            }
+
+            // If the link is at tile boundary,
+
+            // Check if the link spans the whole edge, and accept.
+            if (link->bmin == 0 && link->bmax == 255)
+            {
+                nextRef = link->ref;
+                break;
+            }
+
+            // Check for partial edge links.
+            const int v0 = poly->verts[link->edge];
+            const int v1 = poly->verts[(link->edge + 1) % poly->vertCount];
+            const float *left  = &tile->verts[v0 * 3];
+            const float *right = &tile->verts[v1 * 3];
+
+            // Check that the intersection lies inside the link portal.
+            if (link->side == 0 || link->side == 4)
+            {
+                // Calculate link size.
+                const float s = 1.0f / 255.0f;
+                float lmin = left[2] + (right[2] - left[2]) * (link->bmin * s);
+                float lmax = left[2] + (right[2] - left[2]) * (link->bmax * s);
+                if (lmin > lmax) dtSwap(lmin, lmax);
+
+                // Find Z intersection.
+                float z = spos[2] + (epos[2] - spos[2]) * tmax;
+                if (z >= lmin && z <= lmax)
+                {
+                    nextRef = link->ref;
+                    break;
+                }
+            }
+            else if (link->side == 2 || link->side == 6)
+            {
+                // Calculate link size.
+                const float s = 1.0f / 255.0f;
+                float lmin = left[0] + (right[0] - left[0]) * (link->bmin * s);
+                float lmax = left[0] + (right[0] - left[0]) * (link->bmax * s);
+                if (lmin > lmax) dtSwap(lmin, lmax);
+
+                // Find X intersection.
+                float x = spos[0] + (epos[0] - spos[0]) * tmax;
+                if (x >= lmin && x <= lmax)
+                {
+                    nextRef = link->ref;
+                    break;
+                }
+            }
+        }
+
+        if (!nextRef)
+        {
+            // No neighbour, we hit a wall.
+
+            // Calculate hit normal.
+            const int a = segMax;
+            const int b = segMax + 1 < poly->vertCount ? segMax + 1 : 0;
+            const float *va = &tile->verts[poly->verts[a] * 3];
+            const float *vb = &tile->verts[poly->verts[b] * 3];
+            const float dx  = vb[0] - va[0];
+            const float dz  = vb[2] - va[2];
+            normal[0]       = dz;
+            normal[1]       = 0;
+            normal[2]       = -dx;
+            dtVnormalize(normal);
+
+            return DT_SUCCESS;
+        }
+
+        // No hit, advance to neighbour polygon.
+        curRef = nextRef;
+    }
+
+    return DT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <DetourNavMesh.h>
+
+class dtQueryFilter;
+
+/**
+ * dtNavMeshQuery::raycast without options, the poly walk is the same but the
+ * edges of a poly are intersected with the ray all at once with SSE(or AVX
+ * if enabled by the compiler flags), so the result is the same as the scalar
+ * raycast. Thread safe
+ * @param t [out] hit fraction along the segment, FLT_MAX if end reached
+ * @param normal [out] normal of the wall hit, 3 floats, zero if none
+ * @param last_ref [out] last poly visited
+ */
+dtStatus simd_raycast(const dtNavMesh *mesh, const dtQueryFilter *filter,
+                      dtPolyRef start_ref, const float *spos,
+                      const float *epos, float &t, float *normal,
+                      dtPolyRef &last_ref);
@@ -1,15 +1,45 @@
 #include <Recast.h>
 #include <iostream>
-#include <InputGeom.h>
 #include <DetourCommon.h>
 #include <DetourNavMesh.h>
 #include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
 #include <DetourNavMeshBuilder.h>
 
+#include <climits>
 #include <cmath>
+#include <cstdio>
 #include <cstring> /* for memset */
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fastlz.h>
 
 #include "recast_navmesh.h"
+#include "build_arena.h"
+#include "build_context.h"
+#include "build_geom.h"
+#include "cluster_graph.h"
+#include "lean_tile.h"
+#include "node_pool_tuner.h"
+#include "path_cache.h"
+#include "point_grid.h"
+#include "raycast.h"
+#include "stream_geom.h"
+#include "thread_pool.h"
+#include "tile_cache.h"
+#include "tile_stream.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Those code are ported from Recast Navigation, please Keep them consistent
@@ -18,6 +48,25 @@ static const int NAVMESHSET_MAGIC =
     'M' << 24 | 'S' << 16 | 'E' << 8 | 'T'; //'MSET';
 static const int NAVMESHSET_VERSION = 1;
 
+// MESH_FORMAT_MMAP, the header is followed by a tile offset table and every
+// tile is aligned at NAVMESHSET_ALIGN so it can be used in place
+static const int NAVMESHSET_VERSION_MMAP = 2;
+static const int NAVMESHSET_ALIGN        = 4096;
+
+// MESH_FORMAT_COMPRESSED, the header is followed by a tile table and every
+// tile is compressed by fastlz independently, stored one after another
+static const int NAVMESHSET_VERSION_COMPRESSED = 3;
+
+// MESH_FORMAT_LEAN(_DETAIL), every tile is a NavMeshTileHeader followed by
+// the encode_lean_tile bytes, dataSize is the encoded size
+static const int NAVMESHSET_VERSION_LEAN = 5;
+
+// the cluster graph is saved alongside the mesh file
+static const char *CLUSTER_GRAPH_SUFFIX = ".graph";
+
+// triangles buffered by build_streaming before spilled to disk
+static const size_t STREAM_BUDGET = 64 << 20;
+
 struct NavMeshSetHeader
 {
     int magic;
@@ -32,6 +81,21 @@ struct NavMeshTileHeader
     int dataSize;
 };
 
+struct NavMeshTileEntry
+{
+    dtTileRef tileRef;
+    int dataSize;
+    unsigned long long offset; /// from the beginning of file
+};
+
+struct NavMeshCompressedEntry
+{
+    dtTileRef tileRef;
+    int dataSize;              /// size after decompressed
+    int compressedSize;        /// size in file
+    unsigned long long offset; /// from the beginning of file
+};
+
 inline bool inRange(const float *v1, const float *v2, const float r, const float h)
 {
     const float dx = v2[0] - v1[0];
@@ -188,10 +252,44 @@ static bool getSteerTarget(dtNavMeshQuery *navQuery, const float *startPos,
 }
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * query state of one thread, a dtNavMeshQuery(with it's node pool) bound to
+ * the current nav mesh. Acquired from the pool by every query and reused
+ * across calls, so concurrent queries never share one
+ */
+struct RecastNavMesh::QueryContext
+{
+    std::atomic<bool> busy;
+    /// epoch pinned by the running query, 0 if idle
+    std::atomic<unsigned long long> epoch;
+    const MeshState *state; /// pinned by the running query
+
+    dtNavMeshQuery *query;
+    int max_nodes;           /// node pool size of query
+    unsigned int generation; /// mesh query was init with
+
+    /// per query arena, grown on demand and never shrunk, so no allocation
+    /// once warmed up
+    std::vector<dtPolyRef> polys;  /// corridor found
+    std::vector<dtPolyRef> smooth; /// corridor walked by smooth
+    std::vector<float> straight;   /// corners, to count a truncated path
+};
+
 RecastNavMesh::RecastNavMesh(/* args */)
 {
-    _nav_mesh  = nullptr;
-    _nav_query = nullptr;
+    _state = new MeshState();
+    _epoch = 1;
+    for (auto &slot : _query_slots) slot = nullptr;
+    _retired_count = 0;
+    _swaps         = 0;
+    _reclaimed     = 0;
+
+    _path_cache_capacity = 0;
+    _point_grid_cell     = -1;
+    _node_pool = new NodePoolTuner();
+    _geom      = nullptr;
+
+    _threads = 0;
 
     _filter        = default_filter();
     _setting       = default_setting();
@@ -202,8 +300,19 @@ RecastNavMesh::RecastNavMesh(const float *poly_pick_ext,
                              const struct Setting *setting,
                              const class dtQueryFilter *filter)
 {
-    _nav_mesh  = nullptr;
-    _nav_query = nullptr;
+    _state = new MeshState();
+    _epoch = 1;
+    for (auto &slot : _query_slots) slot = nullptr;
+    _retired_count = 0;
+    _swaps         = 0;
+    _reclaimed     = 0;
+
+    _path_cache_capacity = 0;
+    _point_grid_cell     = -1;
+    _node_pool = new NodePoolTuner();
+    _geom      = nullptr;
+
+    _threads = 0;
 
     _filter        = filter ? filter : default_filter();
     _setting       = setting ? setting : default_setting();
@@ -212,12 +321,21 @@ RecastNavMesh::RecastNavMesh(const float *poly_pick_ext,
 
 RecastNavMesh::~RecastNavMesh()
 {
-    if (_nav_mesh)
-    {
-        dtFreeNavMesh(_nav_mesh);
-    }
-
-    _nav_mesh = nullptr;
+    _thread_pool.reset();
+
+    // no query is running, everything can go at once
+    clear_query_pool();
+    for (MeshState *state : _retired) free_state(state);
+    _retired.clear();
+    for (auto &retired : _retired_graphs) delete retired.second;
+    _retired_graphs.clear();
+    free_state(_state);
+    _state = nullptr;
+
+    delete _node_pool;
+    _node_pool = nullptr;
+    delete _geom;
+    _geom = nullptr;
 }
 
 const float *RecastNavMesh::default_poly_pick_ext() const
@@ -271,7 +389,7 @@ const dtQueryFilter *RecastNavMesh::default_filter() const
 }
 
 // ported from RecastDemo bool Sample_SoloMesh::handleBuild()
-bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
+bool RecastNavMesh::raw_build(BuildGeom *m_geom, BuildContext *m_ctx)
 {
     // set variable compatible to original RecastDemo code unchange
     bool m_keepInterResults             = false;
@@ -288,6 +406,10 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
     dtStatus status                     = DT_SUCCESS;
     rcConfig m_cfg;
 
+    // the intermediate results, leaked by the early returns too, are
+    // released with the arena
+    BuildArena::Scope arena;
+
     float m_tileSize             = _setting->tileSize;
     float m_cellSize             = _setting->cellSize;
     float m_cellHeight           = _setting->cellHeight;
@@ -383,7 +505,7 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
     // Allocate array that can hold triangle area types.
     // If you have multiple meshes you need to process, allocate
     // and array which can hold the max number of triangles you need to process.
-    m_triareas = new unsigned char[ntris];
+    m_triareas = (unsigned char *)rcAlloc(ntris, RC_ALLOC_TEMP);
     if (!m_triareas)
     {
         m_ctx->log(RC_LOG_ERROR,
@@ -405,9 +527,11 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
         return false;
     }
 
+    m_ctx->record_memory(m_solid, ntris, nullptr, nullptr, nullptr, nullptr);
+
     if (!m_keepInterResults)
     {
-        delete[] m_triareas;
+        rcFree(m_triareas);
         m_triareas = 0;
     }
 
@@ -447,6 +571,8 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
         return false;
     }
 
+    m_ctx->record_memory(m_solid, 0, m_chf, nullptr, nullptr, nullptr);
+
     if (!m_keepInterResults)
     {
         rcFreeHeightField(m_solid);
@@ -599,6 +725,8 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
         return false;
     }
 
+    m_ctx->record_memory(nullptr, 0, m_chf, m_cset, m_pmesh, m_dmesh);
+
     if (!m_keepInterResults)
     {
         rcFreeCompactHeightfield(m_chf);
@@ -622,26 +750,7 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
         int navDataSize        = 0;
 
         // Update poly flags from areas.
-        for (int i = 0; i < m_pmesh->npolys; ++i)
-        {
-            if (m_pmesh->areas[i] == RC_WALKABLE_AREA)
-                m_pmesh->areas[i] = SAMPLE_POLYAREA_GROUND;
-
-            if (m_pmesh->areas[i] == SAMPLE_POLYAREA_GROUND
-                || m_pmesh->areas[i] == SAMPLE_POLYAREA_GRASS
-                || m_pmesh->areas[i] == SAMPLE_POLYAREA_ROAD)
-            {
-                m_pmesh->flags[i] = SAMPLE_POLYFLAGS_WALK;
-            }
-            else if (m_pmesh->areas[i] == SAMPLE_POLYAREA_WATER)
-            {
-                m_pmesh->flags[i] = SAMPLE_POLYFLAGS_SWIM;
-            }
-            else if (m_pmesh->areas[i] == SAMPLE_POLYAREA_DOOR)
-            {
-                m_pmesh->flags[i] = SAMPLE_POLYFLAGS_WALK | SAMPLE_POLYFLAGS_DOOR;
-            }
-        }
+        update_poly_flags(m_pmesh);
 
         dtNavMeshCreateParams params;
         memset(&params, 0, sizeof(params));
@@ -691,6 +800,7 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
         if (dtStatusFailed(status))
         {
             dtFree(navData);
+            dtFreeNavMesh(m_navMesh);
             m_ctx->log(RC_LOG_ERROR, "Could not init Detour navmesh");
             return false;
         }
@@ -705,310 +815,2809 @@ bool RecastNavMesh::raw_build(InputGeom *m_geom, rcContext *m_ctx)
 
     m_ctx->stopTimer(RC_TIMER_TOTAL);
 
-    // Show performance stats.
-    // duLogBuildTimes(*ctx, m_ctx->getAccumulatedTime(RC_TIMER_TOTAL));
+    // Show performance stats, see build for the details.
+    m_ctx->log(RC_LOG_PROGRESS, ">> Total build time: %.1fms",
+               m_ctx->getAccumulatedTime(RC_TIMER_TOTAL) / 1000.0f);
     m_ctx->log(RC_LOG_PROGRESS, ">> Polymesh: %d vertices  %d polygons",
                m_pmesh->nverts, m_pmesh->npolys);
 
-    // m_totalBuildTimeMs = m_ctx->getAccumulatedTime(RC_TIMER_TOTAL) / 1000.0f;
+    rcFreePolyMesh(m_pmesh);
+    rcFreePolyMeshDetail(m_dmesh);
 
-    _nav_mesh = m_navMesh;
+    set_nav_mesh(m_navMesh);
     return true;
 }
 
+void RecastNavMesh::update_poly_flags(rcPolyMesh *m_pmesh)
+{
+    for (int i = 0; i < m_pmesh->npolys; ++i)
+    {
+        if (m_pmesh->areas[i] == RC_WALKABLE_AREA)
+            m_pmesh->areas[i] = SAMPLE_POLYAREA_GROUND;
+
+        if (m_pmesh->areas[i] == SAMPLE_POLYAREA_GROUND
+            || m_pmesh->areas[i] == SAMPLE_POLYAREA_GRASS
+            || m_pmesh->areas[i] == SAMPLE_POLYAREA_ROAD)
+        {
+            m_pmesh->flags[i] = SAMPLE_POLYFLAGS_WALK;
+        }
+        else if (m_pmesh->areas[i] == SAMPLE_POLYAREA_WATER)
+        {
+            m_pmesh->flags[i] = SAMPLE_POLYFLAGS_SWIM;
+        }
+        else if (m_pmesh->areas[i] == SAMPLE_POLYAREA_DOOR)
+        {
+            m_pmesh->flags[i] = SAMPLE_POLYFLAGS_WALK | SAMPLE_POLYFLAGS_DOOR;
+        }
+    }
+}
+
 /**
- * load mesh data pre generated from Recast
- * @param path a mesh data file
+ * intermediate results of one tile, released when going out of scope so the
+ * early returns of build_tile_mesh don't leak
  */
-bool RecastNavMesh::load(const char *path)
+struct TileBuildData
 {
-    // ported from RecastDemo dtNavMesh* Sample::loadAll(const char* path)
-    FILE *fp = fopen(path, "rb");
-    if (!fp) return 0;
+    unsigned char *triareas;
+    rcHeightfield *solid;
+    rcCompactHeightfield *chf;
+    rcContourSet *cset;
+    rcPolyMesh *pmesh;
+    rcPolyMeshDetail *dmesh;
+
+    TileBuildData()
+        : triareas(nullptr), solid(nullptr), chf(nullptr), cset(nullptr),
+          pmesh(nullptr), dmesh(nullptr)
+    {
+    }
+    ~TileBuildData()
+    {
+        rcFree(triareas);
+        rcFreeHeightField(solid);
+        rcFreeCompactHeightfield(chf);
+        rcFreeContourSet(cset);
+        rcFreePolyMesh(pmesh);
+        rcFreePolyMeshDetail(dmesh);
+    }
+};
 
-    // Read header.
-    NavMeshSetHeader header;
-    size_t readLen = fread(&header, sizeof(NavMeshSetHeader), 1, fp);
-    if (readLen != 1)
+// ported from RecastDemo unsigned char* Sample_TileMesh::buildTileMesh()
+unsigned char *RecastNavMesh::build_tile_mesh(BuildGeom *m_geom,
+                                              BuildContext *m_ctx,
+                                              const int tx,
+                                              const int ty, const float *bmin,
+                                              const float *bmax,
+                                              int &dataSize, bool &empty) const
+{
+    dataSize = 0;
+    empty    = false;
+    if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
     {
-        fclose(fp);
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Input mesh is not specified.");
         return 0;
     }
-    if (header.magic != NAVMESHSET_MAGIC)
+
+    // released after tile, before the arena
+    BuildArena::Scope arena;
+    TileBuildData tile;
+    rcConfig m_cfg;
+
+    const float *verts                = m_geom->getMesh()->getVerts();
+    const int nverts                  = m_geom->getMesh()->getVertCount();
+    const rcChunkyTriMesh *chunkyMesh = m_geom->getChunkyMesh();
+
+    // Init build configuration from GUI
+    memset(&m_cfg, 0, sizeof(m_cfg));
+    m_cfg.cs                 = _setting->cellSize;
+    m_cfg.ch                 = _setting->cellHeight;
+    m_cfg.walkableSlopeAngle = _setting->agentMaxSlope;
+    m_cfg.walkableHeight     = (int)ceilf(_setting->agentHeight / m_cfg.ch);
+    m_cfg.walkableClimb      = (int)floorf(_setting->agentMaxClimb / m_cfg.ch);
+    m_cfg.walkableRadius     = (int)ceilf(_setting->agentRadius / m_cfg.cs);
+    m_cfg.maxEdgeLen = (int)(_setting->edgeMaxLen / _setting->cellSize);
+    m_cfg.maxSimplificationError = _setting->edgeMaxError;
+    m_cfg.minRegionArea   = (int)rcSqr(_setting->regionMinSize);
+    m_cfg.mergeRegionArea = (int)rcSqr(_setting->regionMergeSize);
+    m_cfg.maxVertsPerPoly = (int)_setting->vertsPerPoly;
+    m_cfg.tileSize        = (int)_setting->tileSize;
+    m_cfg.borderSize = m_cfg.walkableRadius + 3; // Reserve enough padding.
+    m_cfg.width      = m_cfg.tileSize + m_cfg.borderSize * 2;
+    m_cfg.height     = m_cfg.tileSize + m_cfg.borderSize * 2;
+    m_cfg.detailSampleDist = _setting->detailSampleDist < 0.9f
+                               ? 0
+                               : _setting->cellSize * _setting->detailSampleDist;
+    m_cfg.detailSampleMaxError =
+        _setting->cellHeight * _setting->detailSampleMaxError;
+
+    // Expand the heighfield bounding box by border size to find the extents
+    // of geometry we need to build this tile.
+    rcVcopy(m_cfg.bmin, bmin);
+    rcVcopy(m_cfg.bmax, bmax);
+    m_cfg.bmin[0] -= m_cfg.borderSize * m_cfg.cs;
+    m_cfg.bmin[2] -= m_cfg.borderSize * m_cfg.cs;
+    m_cfg.bmax[0] += m_cfg.borderSize * m_cfg.cs;
+    m_cfg.bmax[2] += m_cfg.borderSize * m_cfg.cs;
+
+    // Allocate voxel heightfield where we rasterize our input data to.
+    tile.solid = rcAllocHeightfield();
+    if (!tile.solid)
     {
-        fclose(fp);
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
         return 0;
     }
-    if (header.version != NAVMESHSET_VERSION)
+    if (!rcCreateHeightfield(m_ctx, *tile.solid, m_cfg.width, m_cfg.height,
+                             m_cfg.bmin, m_cfg.bmax, m_cfg.cs, m_cfg.ch))
     {
-        fclose(fp);
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildNavigation: Could not create solid heightfield.");
         return 0;
     }
 
-    dtNavMesh *mesh = dtAllocNavMesh();
-    if (!mesh)
+    // Allocate array that can hold triangle flags.
+    tile.triareas = (unsigned char *)rcAlloc(chunkyMesh->maxTrisPerChunk,
+                                             RC_ALLOC_TEMP);
+    if (!tile.triareas)
     {
-        fclose(fp);
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'triareas'.");
         return 0;
     }
-    dtStatus status = mesh->init(&header.params);
-    if (dtStatusFailed(status))
+
+    float tbmin[2], tbmax[2];
+    tbmin[0] = m_cfg.bmin[0];
+    tbmin[1] = m_cfg.bmin[2];
+    tbmax[0] = m_cfg.bmax[0];
+    tbmax[1] = m_cfg.bmax[2];
+    // a tile may overlap any number of chunks, as many as the nodes at most
+    std::vector<int> cid(chunkyMesh->nnodes);
+    const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax,
+                                                cid.data(), (int)cid.size());
+    if (!ncid)
     {
-        fclose(fp);
+        empty = true;
         return 0;
     }
 
-    // Read tiles.
-    for (int i = 0; i < header.numTiles; ++i)
+    for (int i = 0; i < ncid; ++i)
     {
-        NavMeshTileHeader tileHeader;
-        readLen = fread(&tileHeader, sizeof(tileHeader), 1, fp);
-        if (readLen != 1)
-        {
-            fclose(fp);
+        const rcChunkyTriMeshNode &node = chunkyMesh->nodes[cid[i]];
+        const int *ctris                = &chunkyMesh->tris[node.i * 3];
+        const int nctris                = node.n;
+
+        memset(tile.triareas, 0, nctris * sizeof(unsigned char));
+        rcMarkWalkableTriangles(m_ctx, m_cfg.walkableSlopeAngle, verts, nverts,
+                                ctris, nctris, tile.triareas);
+        if (!rcRasterizeTriangles(m_ctx, verts, nverts, ctris, tile.triareas,
+                                  nctris, *tile.solid, m_cfg.walkableClimb))
             return 0;
-        }
-
-        if (!tileHeader.tileRef || !tileHeader.dataSize) break;
+    }
 
-        unsigned char *data =
-            (unsigned char *)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
-        if (!data) break;
-        memset(data, 0, tileHeader.dataSize);
-        readLen = fread(data, tileHeader.dataSize, 1, fp);
-        if (readLen != 1)
-        {
-            dtFree(data);
-            fclose(fp);
-            return 0;
-        }
+    // Once all geometry is rasterized, we do initial pass of filtering to
+    // remove unwanted overhangs caused by the conservative rasterization
+    // as well as filter spans where the character cannot possibly stand.
+    rcFilterLowHangingWalkableObstacles(m_ctx, m_cfg.walkableClimb, *tile.solid);
+    rcFilterLedgeSpans(m_ctx, m_cfg.walkableHeight, m_cfg.walkableClimb,
+                       *tile.solid);
+    rcFilterWalkableLowHeightSpans(m_ctx, m_cfg.walkableHeight, *tile.solid);
 
-        mesh->addTile(data, tileHeader.dataSize, DT_TILE_FREE_DATA,
-                      tileHeader.tileRef, 0);
+    // Compact the heightfield so that it is faster to handle from now on.
+    tile.chf = rcAllocCompactHeightfield();
+    if (!tile.chf)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
+        return 0;
+    }
+    if (!rcBuildCompactHeightfield(m_ctx, m_cfg.walkableHeight,
+                                   m_cfg.walkableClimb, *tile.solid, *tile.chf))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
+        return 0;
     }
 
-    fclose(fp);
-
-    if (_nav_mesh)
+    // Erode the walkable area by agent radius.
+    if (!rcErodeWalkableArea(m_ctx, m_cfg.walkableRadius, *tile.chf))
     {
-        dtFreeNavMesh(_nav_mesh);
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not erode.");
+        return 0;
     }
-    _nav_mesh = mesh;
 
-    return true;
-}
+    // (Optional) Mark areas.
+    const ConvexVolume *vols = m_geom->getConvexVolumes();
+    for (int i = 0; i < m_geom->getConvexVolumeCount(); ++i)
+        rcMarkConvexPolyArea(m_ctx, vols[i].verts, vols[i].nverts, vols[i].hmin,
+                             vols[i].hmax, (unsigned char)vols[i].area,
+                             *tile.chf);
 
-/**
- * generated mesh data from a obj/gset file
- * @param from a obj/gset file
- */
-bool RecastNavMesh::build(const char *from)
-{
-    if (_nav_mesh)
+    // Partition the heightfield, see raw_build for the pros and cons of each
+    // method. Layers is usually the best choice for tiled navmesh.
+    if (_setting->partitionType == SAMPLE_PARTITION_WATERSHED)
+    {
+        if (!rcBuildDistanceField(m_ctx, *tile.chf))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildNavigation: Could not build distance field.");
+            return 0;
+        }
+        if (!rcBuildRegions(m_ctx, *tile.chf, m_cfg.borderSize,
+                            m_cfg.minRegionArea, m_cfg.mergeRegionArea))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildNavigation: Could not build watershed regions.");
+            return 0;
+        }
+    }
+    else if (_setting->partitionType == SAMPLE_PARTITION_MONOTONE)
     {
-        delete _nav_mesh;
-        _nav_mesh = nullptr;
+        if (!rcBuildRegionsMonotone(m_ctx, *tile.chf, m_cfg.borderSize,
+                                    m_cfg.minRegionArea, m_cfg.mergeRegionArea))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildNavigation: Could not build monotone regions.");
+            return 0;
+        }
+    }
+    else // SAMPLE_PARTITION_LAYERS
+    {
+        if (!rcBuildLayerRegions(m_ctx, *tile.chf, m_cfg.borderSize,
+                                 m_cfg.minRegionArea))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildNavigation: Could not build layer regions.");
+            return 0;
+        }
     }
 
-    rcContext m_ctx;
-    InputGeom m_geom;
-
-    if (!m_geom.load(&m_ctx, from))
+    // Create contours.
+    tile.cset = rcAllocContourSet();
+    if (!tile.cset)
     {
-        m_ctx.log(RC_LOG_ERROR,
-                  "buildNavigation: Input mesh is not specified.");
-        return false;
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'cset'.");
+        return 0;
+    }
+    if (!rcBuildContours(m_ctx, *tile.chf, m_cfg.maxSimplificationError,
+                         m_cfg.maxEdgeLen, *tile.cset))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not create contours.");
+        return 0;
     }
 
-    return raw_build(&m_geom, &m_ctx);
-}
+    // empty tile, nothing walkable here
+    if (tile.cset->nconts == 0)
+    {
+        empty = true;
+        return 0;
+    }
 
-/**
- * save mesh data to file, ported from RecastDemo
- * void Sample::saveAll(const char* path, const dtNavMesh* mesh)
- */
-bool RecastNavMesh::save(const char *path)
-{
-    const dtNavMesh *mesh = _nav_mesh;
-    if (!mesh)
+    // Build polygon navmesh from the contours.
+    tile.pmesh = rcAllocPolyMesh();
+    if (!tile.pmesh)
     {
-        std::cerr << "No mesh data to save" << std::endl;
-        return false;
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'pmesh'.");
+        return 0;
+    }
+    if (!rcBuildPolyMesh(m_ctx, *tile.cset, m_cfg.maxVertsPerPoly, *tile.pmesh))
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildNavigation: Could not triangulate contours.");
+        return 0;
     }
 
-    FILE *fp = fopen(path, "wb");
-    if (!fp)
+    // Build detail mesh.
+    tile.dmesh = rcAllocPolyMeshDetail();
+    if (!tile.dmesh)
     {
-        std::cerr << "Could not open " << path << " for writing" << std::endl;
-        return false;
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'dmesh'.");
+        return 0;
+    }
+    if (!rcBuildPolyMeshDetail(m_ctx, *tile.pmesh, *tile.chf,
+                               m_cfg.detailSampleDist,
+                               m_cfg.detailSampleMaxError, *tile.dmesh))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build detail mesh.");
+        return 0;
     }
 
-    // Store header.
-    NavMeshSetHeader header;
-    header.magic    = NAVMESHSET_MAGIC;
-    header.version  = NAVMESHSET_VERSION;
-    header.numTiles = 0;
-    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    // The GUI may allow more max points per polygon than Detour can handle.
+    // Only build the detour navmesh if we do not exceed the limit.
+    if (m_cfg.maxVertsPerPoly > DT_VERTS_PER_POLYGON)
     {
-        const dtMeshTile *tile = mesh->getTile(i);
-        if (!tile || !tile->header || !tile->dataSize) continue;
-        header.numTiles++;
+        m_ctx->log(RC_LOG_ERROR, "Too many vertices per poly %d (max: %d).",
+                   m_cfg.maxVertsPerPoly, DT_VERTS_PER_POLYGON);
+        return 0;
     }
-    memcpy(&header.params, mesh->getParams(), sizeof(dtNavMeshParams));
-    fwrite(&header, sizeof(NavMeshSetHeader), 1, fp);
 
-    // Store tiles.
-    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    // contours too small to make a poly, as empty as no contour
+    if (tile.pmesh->npolys == 0)
     {
-        const dtMeshTile *tile = mesh->getTile(i);
-        if (!tile || !tile->header || !tile->dataSize) continue;
+        empty = true;
+        return 0;
+    }
 
-        NavMeshTileHeader tileHeader;
-        tileHeader.tileRef  = mesh->getTileRef(tile);
-        tileHeader.dataSize = tile->dataSize;
-        fwrite(&tileHeader, sizeof(tileHeader), 1, fp);
+    if (tile.pmesh->nverts >= 0xffff)
+    {
+        // The vertex indices are ushorts, and cannot point to more than 0xffff vertices.
+        m_ctx->log(RC_LOG_ERROR, "Too many vertices per tile %d (max: %d).",
+                   tile.pmesh->nverts, 0xffff);
+        return 0;
+    }
 
-        fwrite(tile->data, tile->dataSize, 1, fp);
+    // every intermediate result is alive until the tile done
+    m_ctx->record_memory(tile.solid, chunkyMesh->maxTrisPerChunk, tile.chf,
+                         tile.cset, tile.pmesh, tile.dmesh);
+
+    // Update poly flags from areas.
+    update_poly_flags(tile.pmesh);
+
+    dtNavMeshCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.verts            = tile.pmesh->verts;
+    params.vertCount        = tile.pmesh->nverts;
+    params.polys            = tile.pmesh->polys;
+    params.polyAreas        = tile.pmesh->areas;
+    params.polyFlags        = tile.pmesh->flags;
+    params.polyCount        = tile.pmesh->npolys;
+    params.nvp              = tile.pmesh->nvp;
+    params.detailMeshes     = tile.dmesh->meshes;
+    params.detailVerts      = tile.dmesh->verts;
+    params.detailVertsCount = tile.dmesh->nverts;
+    params.detailTris       = tile.dmesh->tris;
+    params.detailTriCount   = tile.dmesh->ntris;
+    params.offMeshConVerts  = m_geom->getOffMeshConnectionVerts();
+    params.offMeshConRad    = m_geom->getOffMeshConnectionRads();
+    params.offMeshConDir    = m_geom->getOffMeshConnectionDirs();
+    params.offMeshConAreas  = m_geom->getOffMeshConnectionAreas();
+    params.offMeshConFlags  = m_geom->getOffMeshConnectionFlags();
+    params.offMeshConUserID = m_geom->getOffMeshConnectionId();
+    params.offMeshConCount  = m_geom->getOffMeshConnectionCount();
+    params.walkableHeight   = _setting->agentHeight;
+    params.walkableRadius   = _setting->agentRadius;
+    params.walkableClimb    = _setting->agentMaxClimb;
+    params.tileX            = tx;
+    params.tileY            = ty;
+    params.tileLayer        = 0;
+    rcVcopy(params.bmin, tile.pmesh->bmin);
+    rcVcopy(params.bmax, tile.pmesh->bmax);
+    params.cs          = m_cfg.cs;
+    params.ch          = m_cfg.ch;
+    params.buildBvTree = true;
+
+    unsigned char *navData = 0;
+    if (!dtCreateNavMeshData(&params, &navData, &dataSize))
+    {
+        m_ctx->log(RC_LOG_ERROR, "Could not build Detour navmesh.");
+        return 0;
     }
 
-    fclose(fp);
+    return navData;
+}
 
-    return true;
+/**
+ * area of every span of a heightfield in column order. The filters clear
+ * areas and rcFilterLowHangingWalkableObstacles set them too, so a profile
+ * start from the rasterized ones by restoring them
+ */
+static void save_span_areas(const rcHeightfield &solid,
+                            std::vector<unsigned char> &areas)
+{
+    areas.clear();
+    for (int i = 0; i < solid.width * solid.height; ++i)
+    {
+        for (const rcSpan *s = solid.spans[i]; s; s = s->next)
+            areas.push_back((unsigned char)s->area);
+    }
 }
 
-int RecastNavMesh::smooth(float *m_spos, float *m_epos, unsigned int *m_polys,
-                          int m_npolys, unsigned int m_startRef,
-                          float *m_smoothPath, int size, float step)
+static void restore_span_areas(rcHeightfield &solid,
+                               const std::vector<unsigned char> &areas)
 {
-    // ported form RecastDemo void NavMeshTesterTool::recalc()
-    // setup some variable to keep potaled code unchange
-    const dtQueryFilter &m_filter = *_filter;
-    const dtNavMesh *m_navMesh    = _nav_mesh;
-    dtNavMeshQuery *m_navQuery    = _nav_query;
+    size_t k = 0;
+    for (int i = 0; i < solid.width * solid.height; ++i)
+    {
+        for (rcSpan *s = solid.spans[i]; s; s = s->next) s->area = areas[k++];
+    }
+}
 
-    // Iterate over the path to find smooth path on the detail mesh surface.
-    dtPolyRef polys[MAX_POLYS];
-    memcpy(polys, m_polys, sizeof(dtPolyRef) * m_npolys);
-    int npolys = m_npolys;
+// raw_build from Step 3 on, with a heightfield rasterized already and left
+// filtered for the Setting of this
+bool RecastNavMesh::build_profile(BuildGeom *m_geom, BuildContext *m_ctx,
+                                  rcHeightfield &solid)
+{
+    BuildArena::Scope arena;
+    TileBuildData tile; // solid is shared, not owned here
+    rcConfig m_cfg;
 
-    float iterPos[3], targetPos[3];
-    m_navQuery->closestPointOnPoly(m_startRef, m_spos, iterPos, 0);
-    m_navQuery->closestPointOnPoly(polys[npolys - 1], m_epos, targetPos, 0);
+    memset(&m_cfg, 0, sizeof(m_cfg));
+    m_cfg.cs                 = _setting->cellSize;
+    m_cfg.ch                 = _setting->cellHeight;
+    m_cfg.walkableHeight     = (int)ceilf(_setting->agentHeight / m_cfg.ch);
+    m_cfg.walkableClimb      = (int)floorf(_setting->agentMaxClimb / m_cfg.ch);
+    m_cfg.walkableRadius     = (int)ceilf(_setting->agentRadius / m_cfg.cs);
+    m_cfg.maxEdgeLen = (int)(_setting->edgeMaxLen / _setting->cellSize);
+    m_cfg.maxSimplificationError = _setting->edgeMaxError;
+    m_cfg.minRegionArea   = (int)rcSqr(_setting->regionMinSize);
+    m_cfg.mergeRegionArea = (int)rcSqr(_setting->regionMergeSize);
+    m_cfg.maxVertsPerPoly = (int)_setting->vertsPerPoly;
+    m_cfg.detailSampleDist =
+        _setting->detailSampleDist < 0.9f
+            ? 0
+            : _setting->cellSize * _setting->detailSampleDist;
+    m_cfg.detailSampleMaxError =
+        _setting->cellHeight * _setting->detailSampleMaxError;
 
-    int m_nsmoothPath       = 0;
-    const int MAX_SMOOTH    = size;
-    const float STEP_SIZE   = step;
-    static const float SLOP = 0.01f;
+    m_ctx->startTimer(RC_TIMER_TOTAL);
 
-    dtVcopy(&m_smoothPath[m_nsmoothPath * 3], iterPos);
-    m_nsmoothPath++;
+    rcFilterLowHangingWalkableObstacles(m_ctx, m_cfg.walkableClimb, solid);
+    rcFilterLedgeSpans(m_ctx, m_cfg.walkableHeight, m_cfg.walkableClimb,
+                       solid);
+    rcFilterWalkableLowHeightSpans(m_ctx, m_cfg.walkableHeight, solid);
 
-    // Move towards target a small advancement at a time until target reached or
-    // when ran out of memory to store the path.
-    while (npolys && m_nsmoothPath < MAX_SMOOTH)
+    tile.chf = rcAllocCompactHeightfield();
+    if (!tile.chf)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Out of memory 'chf'.");
+        return false;
+    }
+    if (!rcBuildCompactHeightfield(m_ctx, m_cfg.walkableHeight,
+                                   m_cfg.walkableClimb, solid, *tile.chf))
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildProfiles: Could not build compact data.");
+        return false;
+    }
+
+    if (!rcErodeWalkableArea(m_ctx, m_cfg.walkableRadius, *tile.chf))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Could not erode.");
+        return false;
+    }
+
+    const ConvexVolume *vols = m_geom->getConvexVolumes();
+    for (int i = 0; i < m_geom->getConvexVolumeCount(); ++i)
+        rcMarkConvexPolyArea(m_ctx, vols[i].verts, vols[i].nverts, vols[i].hmin,
+                             vols[i].hmax, (unsigned char)vols[i].area,
+                             *tile.chf);
+
+    // see raw_build for the pros and cons of each method
+    if (_setting->partitionType == SAMPLE_PARTITION_WATERSHED)
+    {
+        if (!rcBuildDistanceField(m_ctx, *tile.chf))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildProfiles: Could not build distance field.");
+            return false;
+        }
+        if (!rcBuildRegions(m_ctx, *tile.chf, 0, m_cfg.minRegionArea,
+                            m_cfg.mergeRegionArea))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildProfiles: Could not build watershed regions.");
+            return false;
+        }
+    }
+    else if (_setting->partitionType == SAMPLE_PARTITION_MONOTONE)
+    {
+        if (!rcBuildRegionsMonotone(m_ctx, *tile.chf, 0, m_cfg.minRegionArea,
+                                    m_cfg.mergeRegionArea))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildProfiles: Could not build monotone regions.");
+            return false;
+        }
+    }
+    else // SAMPLE_PARTITION_LAYERS
+    {
+        if (!rcBuildLayerRegions(m_ctx, *tile.chf, 0, m_cfg.minRegionArea))
+        {
+            m_ctx->log(RC_LOG_ERROR,
+                       "buildProfiles: Could not build layer regions.");
+            return false;
+        }
+    }
+
+    tile.cset = rcAllocContourSet();
+    if (!tile.cset)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Out of memory 'cset'.");
+        return false;
+    }
+    if (!rcBuildContours(m_ctx, *tile.chf, m_cfg.maxSimplificationError,
+                         m_cfg.maxEdgeLen, *tile.cset))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Could not create contours.");
+        return false;
+    }
+
+    tile.pmesh = rcAllocPolyMesh();
+    if (!tile.pmesh)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Out of memory 'pmesh'.");
+        return false;
+    }
+    if (!rcBuildPolyMesh(m_ctx, *tile.cset, m_cfg.maxVertsPerPoly, *tile.pmesh))
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildProfiles: Could not triangulate contours.");
+        return false;
+    }
+
+    tile.dmesh = rcAllocPolyMeshDetail();
+    if (!tile.dmesh)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Out of memory 'dmesh'.");
+        return false;
+    }
+    if (!rcBuildPolyMeshDetail(m_ctx, *tile.pmesh, *tile.chf,
+                               m_cfg.detailSampleDist,
+                               m_cfg.detailSampleMaxError, *tile.dmesh))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Could not build detail mesh.");
+        return false;
+    }
+
+    // the shared heightfield is alive with every profile
+    m_ctx->record_memory(&solid, 0, tile.chf, tile.cset, tile.pmesh,
+                         tile.dmesh);
+
+    if (m_cfg.maxVertsPerPoly > DT_VERTS_PER_POLYGON)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildProfiles: Too many verts per poly.");
+        return false;
+    }
+
+    update_poly_flags(tile.pmesh);
+
+    dtNavMeshCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.verts            = tile.pmesh->verts;
+    params.vertCount        = tile.pmesh->nverts;
+    params.polys            = tile.pmesh->polys;
+    params.polyAreas        = tile.pmesh->areas;
+    params.polyFlags        = tile.pmesh->flags;
+    params.polyCount        = tile.pmesh->npolys;
+    params.nvp              = tile.pmesh->nvp;
+    params.detailMeshes     = tile.dmesh->meshes;
+    params.detailVerts      = tile.dmesh->verts;
+    params.detailVertsCount = tile.dmesh->nverts;
+    params.detailTris       = tile.dmesh->tris;
+    params.detailTriCount   = tile.dmesh->ntris;
+    params.offMeshConVerts  = m_geom->getOffMeshConnectionVerts();
+    params.offMeshConRad    = m_geom->getOffMeshConnectionRads();
+    params.offMeshConDir    = m_geom->getOffMeshConnectionDirs();
+    params.offMeshConAreas  = m_geom->getOffMeshConnectionAreas();
+    params.offMeshConFlags  = m_geom->getOffMeshConnectionFlags();
+    params.offMeshConUserID = m_geom->getOffMeshConnectionId();
+    params.offMeshConCount  = m_geom->getOffMeshConnectionCount();
+    params.walkableHeight   = _setting->agentHeight;
+    params.walkableRadius   = _setting->agentRadius;
+    params.walkableClimb    = _setting->agentMaxClimb;
+    rcVcopy(params.bmin, tile.pmesh->bmin);
+    rcVcopy(params.bmax, tile.pmesh->bmax);
+    params.cs          = m_cfg.cs;
+    params.ch          = m_cfg.ch;
+    params.buildBvTree = true;
+
+    unsigned char *navData = 0;
+    int navDataSize        = 0;
+    if (!dtCreateNavMeshData(&params, &navData, &navDataSize))
+    {
+        m_ctx->log(RC_LOG_ERROR, "Could not build Detour navmesh.");
+        return false;
+    }
+
+    dtNavMesh *mesh = dtAllocNavMesh();
+    if (!mesh)
+    {
+        dtFree(navData);
+        m_ctx->log(RC_LOG_ERROR, "Could not create Detour navmesh");
+        return false;
+    }
+    if (dtStatusFailed(mesh->init(navData, navDataSize, DT_TILE_FREE_DATA)))
+    {
+        dtFree(navData);
+        dtFreeNavMesh(mesh);
+        m_ctx->log(RC_LOG_ERROR, "Could not init Detour navmesh");
+        return false;
+    }
+
+    m_ctx->stopTimer(RC_TIMER_TOTAL);
+    m_ctx->log(RC_LOG_PROGRESS, ">> Profile polymesh: %d vertices  %d polygons",
+               tile.pmesh->nverts, tile.pmesh->npolys);
+
+    set_nav_mesh(mesh);
+    return true;
+}
+
+// ported from RecastDemo bool Sample_TileMesh::handleBuild() and
+// void Sample_TileMesh::buildAllTiles(), tiles are built on a worker pool
+bool RecastNavMesh::raw_build_tiled(BuildGeom *m_geom, BuildContext *m_ctx,
+                                    int threads)
+{
+    if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildTiledNavigation: Input mesh is not specified.");
+        return false;
+    }
+    if (_setting->tileSize <= 0 || _setting->cellSize <= 0)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Invalid tile size.");
+        return false;
+    }
+
+    const float *bmin = m_geom->getNavMeshBoundsMin();
+    const float *bmax = m_geom->getNavMeshBoundsMax();
+
+    int gw = 0, gh = 0;
+    rcCalcGridSize(bmin, bmax, _setting->cellSize, &gw, &gh);
+    const int ts = (int)_setting->tileSize;
+    const int tw = (gw + ts - 1) / ts;
+    const int th = (gh + ts - 1) / ts;
+
+    // Max tiles and max polys affect how the tile IDs are caculated.
+    // There are 22 bits available for identifying a tile and a polygon.
+    int tileBits = rcMin((int)dtIlog2(dtNextPow2(tw * th)), 14);
+    int polyBits = 22 - tileBits;
+
+    dtNavMeshParams params;
+    memset(&params, 0, sizeof(params));
+    rcVcopy(params.orig, bmin);
+    params.tileWidth  = _setting->tileSize * _setting->cellSize;
+    params.tileHeight = _setting->tileSize * _setting->cellSize;
+    params.maxTiles   = 1 << tileBits;
+    params.maxPolys   = 1 << polyBits;
+
+    dtNavMesh *m_navMesh = dtAllocNavMesh();
+    if (!m_navMesh)
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildTiledNavigation: Could not allocate navmesh.");
+        return false;
+    }
+
+    dtStatus status = m_navMesh->init(&params);
+    if (dtStatusFailed(status))
+    {
+        dtFreeNavMesh(m_navMesh);
+        m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init navmesh.");
+        return false;
+    }
+
+    m_ctx->resetTimers();
+    m_ctx->startTimer(RC_TIMER_TOTAL);
+
+    m_ctx->log(RC_LOG_PROGRESS, "Building tiled navigation:");
+    m_ctx->log(RC_LOG_PROGRESS, " - %d x %d tiles", tw, th);
+
+    // tiles are handed out one by one as their cost vary a lot, idle workers
+    // steal the rest. dtNavMesh::addTile is not thread safe so finished tiles
+    // are added under a lock
+    std::atomic<int> failed(0);
+    std::mutex mesh_mutex;
+    const float tcs = _setting->tileSize * _setting->cellSize;
+    ThreadPool pool(rcMin(threads > 0 ? threads : 0, tw * th));
+    pool.parallel_for(tw * th, 1, [&](int begin, int end) {
+        // rcContext keep timers and logs, not shareable between threads. The
+        // timers are merged into m_ctx when ctx destroyed
+        BuildContext ctx(m_ctx);
+        for (int i = begin; i < end; i++)
+        {
+            const int x = i % tw;
+            const int y = i / tw;
+
+            float tbmin[3], tbmax[3];
+            tbmin[0] = bmin[0] + x * tcs;
+            tbmin[1] = bmin[1];
+            tbmin[2] = bmin[2] + y * tcs;
+            tbmax[0] = bmin[0] + (x + 1) * tcs;
+            tbmax[1] = bmax[1];
+            tbmax[2] = bmin[2] + (y + 1) * tcs;
+
+            int dataSize = 0;
+            bool empty   = false;
+            unsigned char *data = build_tile_mesh(m_geom, &ctx, x, y, tbmin,
+                                                  tbmax, dataSize, empty);
+            if (!data)
+            {
+                if (!empty) failed++;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> guard(mesh_mutex);
+            dtStatus st =
+                m_navMesh->addTile(data, dataSize, DT_TILE_FREE_DATA, 0, 0);
+            if (dtStatusFailed(st))
+            {
+                dtFree(data);
+                failed++;
+            }
+        }
+    });
+
+    m_ctx->stopTimer(RC_TIMER_TOTAL);
+    m_ctx->log(RC_LOG_PROGRESS, ">> Total build time: %.1fms",
+               m_ctx->getAccumulatedTime(RC_TIMER_TOTAL) / 1000.0f);
+
+    // a mesh with holes is not kept, the current one stay
+    if (failed)
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildTiledNavigation: %d tiles failed to build or add.",
+                   failed.load());
+        dtFreeNavMesh(m_navMesh);
+        return false;
+    }
+
+    set_nav_mesh(m_navMesh);
+
+    return true;
+}
+
+bool RecastNavMesh::raw_rebuild(BuildGeom *m_geom, BuildContext *m_ctx,
+                                const float *bmin, const float *bmax,
+                                int threads)
+{
+    MeshState *state = current();
+    if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
+    {
+        m_ctx->log(RC_LOG_ERROR, "rebuild: Input mesh is not specified.");
+        return false;
+    }
+    if (!state->nav_mesh)
+    {
+        m_ctx->log(RC_LOG_ERROR, "rebuild: No mesh to rebuild.");
+        return false;
+    }
+    if (state->tile_cache)
+    {
+        // the compressed layers would be stale, use build_tile_cache instead
+        m_ctx->log(RC_LOG_ERROR, "rebuild: Mesh built with tile cache.");
+        return false;
+    }
+    if (state->tile_stream)
+    {
+        // an evicted tile would be reloaded from the file, not the rebuilt one
+        m_ctx->log(RC_LOG_ERROR, "rebuild: Mesh is streaming.");
+        return false;
+    }
+
+    // tiles must be laid out the same way build_tiled would do now, a solo
+    // mesh or one built with another tile size can't be patched
+    dtNavMesh *mesh               = state->nav_mesh;
+    const dtNavMeshParams *params = mesh->getParams();
+    const float tcs = _setting->tileSize * _setting->cellSize;
+    if (tcs <= 0 || fabsf(params->tileWidth - tcs) > 1e-4f
+        || fabsf(params->tileHeight - tcs) > 1e-4f)
+    {
+        m_ctx->log(RC_LOG_ERROR, "rebuild: Mesh not tiled by current setting.");
+        return false;
+    }
+
+    // a tile rasterize the geometry within its border too, so an edit near
+    // the edge of one tile may change its neighbours
+    const int walkableRadius =
+        (int)ceilf(_setting->agentRadius / _setting->cellSize);
+    const float border = (walkableRadius + 3) * _setting->cellSize;
+
+    const int tx0 = (int)floorf((bmin[0] - border - params->orig[0]) / tcs);
+    const int ty0 = (int)floorf((bmin[2] - border - params->orig[2]) / tcs);
+    const int tx1 = (int)floorf((bmax[0] + border - params->orig[0]) / tcs);
+    const int ty1 = (int)floorf((bmax[2] + border - params->orig[2]) / tcs);
+    if (tx1 < tx0 || ty1 < ty0)
+    {
+        m_ctx->log(RC_LOG_ERROR, "rebuild: Invalid bounds.");
+        return false;
+    }
+
+    const int tw = tx1 - tx0 + 1;
+    const int th = ty1 - ty0 + 1;
+    m_ctx->log(RC_LOG_PROGRESS, "Rebuilding %d x %d tiles at (%d,%d)", tw, th,
+               tx0, ty0);
+
+    // build the new tiles first, the live mesh is only touched when swapping
+    const float *gbmin = m_geom->getNavMeshBoundsMin();
+    const float *gbmax = m_geom->getNavMeshBoundsMax();
+    std::vector<unsigned char *> datas(tw * th, nullptr);
+    std::vector<int> sizes(tw * th, 0);
+    std::vector<char> empties(tw * th, 0);
+
+    ThreadPool pool(rcMin(threads > 0 ? threads : 0, tw * th));
+    pool.parallel_for(tw * th, 1, [&](int begin, int end) {
+        BuildContext ctx(m_ctx);
+        for (int i = begin; i < end; i++)
+        {
+            const int x = tx0 + i % tw;
+            const int y = ty0 + i / tw;
+
+            float tbmin[3], tbmax[3];
+            tbmin[0] = params->orig[0] + x * tcs;
+            tbmin[1] = gbmin[1];
+            tbmin[2] = params->orig[2] + y * tcs;
+            tbmax[0] = params->orig[0] + (x + 1) * tcs;
+            tbmax[1] = gbmax[1];
+            tbmax[2] = params->orig[2] + (y + 1) * tcs;
+
+            bool empty = false;
+            datas[i]   = build_tile_mesh(m_geom, &ctx, x, y, tbmin, tbmax,
+                                         sizes[i], empty);
+            empties[i] = empty;
+        }
+    });
+
+    // corridors through a replaced tile are dropped by the path cache as the
+    // tile salt changed, all other tiles are left untouched
+    int failed = 0;
+    for (int i = 0; i < tw * th; i++)
+    {
+        const int x = tx0 + i % tw;
+        const int y = ty0 + i / tw;
+
+        // a tile failed to build keep the old one, the mesh stay walkable
+        if (!datas[i] && !empties[i])
+        {
+            failed++;
+            continue;
+        }
+
+        dtTileRef ref = mesh->getTileRefAt(x, y, 0);
+        if (ref) mesh->removeTile(ref, 0, 0);
+        if (!datas[i]) continue; // nothing walkable there now
+
+        dtStatus status =
+            mesh->addTile(datas[i], sizes[i], DT_TILE_FREE_DATA, 0, 0);
+        if (dtStatusFailed(status))
+        {
+            dtFree(datas[i]);
+            failed++;
+        }
+    }
+
+    if (failed)
+    {
+        m_ctx->log(RC_LOG_WARNING, "rebuild: %d tiles failed to build or add.",
+                   failed);
+    }
+
+    // only the grids of the replaced tiles are rebuilt
+    if (state->point_grid) state->point_grid->sync(mesh);
+
+    return 0 == failed;
+}
+
+/// fseek to offset from the beginning, past 2GB where long is 32 bits
+static int seek_set(FILE *fp, unsigned long long offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (long long)offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/**
+ * load mesh data pre generated from Recast
+ * @param path a mesh data file
+ * @param use_mmap map MESH_FORMAT_MMAP file into memory instead of reading it
+ */
+bool RecastNavMesh::load(const char *path, bool use_mmap)
+{
+    if (!load_mesh(path, use_mmap)) return false;
+
+    // the graph saved alongside is ignored if not built from this mesh
+    std::string graph_path(path);
+    graph_path.append(CLUSTER_GRAPH_SUFFIX);
+    FILE *fp = fopen(graph_path.c_str(), "rb");
+    if (!fp) return true;
+
+    // queries may see the mesh already, they plan without the graph until
+    // it's attached
+    MeshState *state    = current();
+    ClusterGraph *graph = new ClusterGraph();
+    if (graph->load(fp, state->nav_mesh))
+        state->cluster_graph = graph;
+    else
+        delete graph;
+    fclose(fp);
+
+    return true;
+}
+
+bool RecastNavMesh::load_mesh(const char *path, bool use_mmap)
+{
+    // ported from RecastDemo dtNavMesh* Sample::loadAll(const char* path)
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    // Read header.
+    NavMeshSetHeader header;
+    size_t readLen = fread(&header, sizeof(NavMeshSetHeader), 1, fp);
+    if (readLen != 1)
+    {
+        fclose(fp);
+        return 0;
+    }
+    if (header.magic == TILECACHESET_MAGIC)
+    {
+        fclose(fp);
+        return load_tile_cache(path);
+    }
+    if (header.magic != NAVMESHSET_MAGIC)
+    {
+        fclose(fp);
+        return 0;
+    }
+    if (header.version != NAVMESHSET_VERSION
+        && header.version != NAVMESHSET_VERSION_MMAP
+        && header.version != NAVMESHSET_VERSION_COMPRESSED
+        && header.version != NAVMESHSET_VERSION_LEAN)
+    {
+        fclose(fp);
+        return 0;
+    }
+
+    if (header.version == NAVMESHSET_VERSION_COMPRESSED)
+    {
+        fclose(fp);
+        return load_compressed(path);
+    }
+    if (header.version == NAVMESHSET_VERSION_LEAN)
+    {
+        fclose(fp);
+        return load_lean(path);
+    }
+
+#ifndef _WIN32
+    if (use_mmap && header.version == NAVMESHSET_VERSION_MMAP)
+    {
+        fclose(fp);
+        return load_mmap(path);
+    }
+#endif
+
+    dtNavMesh *mesh = dtAllocNavMesh();
+    if (!mesh)
+    {
+        fclose(fp);
+        return 0;
+    }
+    dtStatus status = mesh->init(&header.params);
+    if (dtStatusFailed(status))
+    {
+        dtFreeNavMesh(mesh);
+        fclose(fp);
+        return 0;
+    }
+
+    // tile offset table of MESH_FORMAT_MMAP
+    std::vector<NavMeshTileEntry> entries;
+    if (header.version == NAVMESHSET_VERSION_MMAP)
+    {
+        entries.resize(header.numTiles);
+        if (header.numTiles > 0
+            && fread(entries.data(), sizeof(NavMeshTileEntry), header.numTiles,
+                     fp) != (size_t)header.numTiles)
+        {
+            dtFreeNavMesh(mesh);
+            fclose(fp);
+            return 0;
+        }
+    }
+
+    // Read tiles.
+    for (int i = 0; i < header.numTiles; ++i)
+    {
+        NavMeshTileHeader tileHeader;
+        if (header.version == NAVMESHSET_VERSION_MMAP)
+        {
+            tileHeader.tileRef  = entries[i].tileRef;
+            tileHeader.dataSize = entries[i].dataSize;
+            if (seek_set(fp, entries[i].offset))
+            {
+                dtFreeNavMesh(mesh);
+                fclose(fp);
+                return 0;
+            }
+        }
+        else
+        {
+            readLen = fread(&tileHeader, sizeof(tileHeader), 1, fp);
+            if (readLen != 1)
+            {
+                dtFreeNavMesh(mesh);
+                fclose(fp);
+                return 0;
+            }
+        }
+
+        if (!tileHeader.tileRef || !tileHeader.dataSize) break;
+
+        unsigned char *data =
+            (unsigned char *)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
+        if (!data) break;
+        memset(data, 0, tileHeader.dataSize);
+        readLen = fread(data, tileHeader.dataSize, 1, fp);
+        if (readLen != 1)
+        {
+            dtFree(data);
+            dtFreeNavMesh(mesh);
+            fclose(fp);
+            return 0;
+        }
+
+        mesh->addTile(data, tileHeader.dataSize, DT_TILE_FREE_DATA,
+                      tileHeader.tileRef, 0);
+    }
+
+    fclose(fp);
+
+    set_nav_mesh(mesh);
+
+    return true;
+}
+
+/**
+ * load MESH_FORMAT_COMPRESSED file. All compressed tiles are read by one
+ * sequential read, then decompressed on the thread pool straight into the
+ * buffers handed to dtNavMesh
+ */
+bool RecastNavMesh::load_compressed(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    NavMeshSetHeader header;
+    if (fread(&header, sizeof(NavMeshSetHeader), 1, fp) != 1
+        || header.magic != NAVMESHSET_MAGIC
+        || header.version != NAVMESHSET_VERSION_COMPRESSED
+        || header.numTiles < 0)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<NavMeshCompressedEntry> entries(header.numTiles);
+    if (header.numTiles > 0
+        && fread(entries.data(), sizeof(NavMeshCompressedEntry),
+                 header.numTiles, fp)
+               != (size_t)header.numTiles)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    // tiles are stored one after another, right after the table
+    const unsigned long long begin =
+        sizeof(NavMeshSetHeader)
+        + header.numTiles * sizeof(NavMeshCompressedEntry);
+    unsigned long long end = begin;
+    for (const auto &entry : entries)
+    {
+        if (entry.offset < begin || entry.dataSize <= 0
+            || entry.compressedSize <= 0)
+        {
+            fclose(fp);
+            return false;
+        }
+        end = rcMax(end, entry.offset + entry.compressedSize);
+    }
+
+    std::vector<unsigned char> blob((size_t)(end - begin));
+    if (!blob.empty() && fread(blob.data(), blob.size(), 1, fp) != 1)
+    {
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    dtNavMesh *mesh = dtAllocNavMesh();
+    if (!mesh || dtStatusFailed(mesh->init(&header.params)))
+    {
+        if (mesh) dtFreeNavMesh(mesh);
+        return false;
+    }
+
+    std::vector<unsigned char *> datas(header.numTiles, nullptr);
+    std::atomic<int> failed(0);
+    thread_pool()->parallel_for(header.numTiles, 1, [&](int b, int e) {
+        for (int i = b; i < e; i++)
+        {
+            const NavMeshCompressedEntry &entry = entries[i];
+            unsigned char *data =
+                (unsigned char *)dtAlloc(entry.dataSize, DT_ALLOC_PERM);
+            if (!data)
+            {
+                failed++;
+                continue;
+            }
+
+            int size = fastlz_decompress(&blob[entry.offset - begin],
+                                         entry.compressedSize, data,
+                                         entry.dataSize);
+            if (size != entry.dataSize)
+            {
+                dtFree(data);
+                failed++;
+                continue;
+            }
+            datas[i] = data;
+        }
+    });
+
+    if (failed)
+    {
+        for (auto data : datas) dtFree(data);
+        dtFreeNavMesh(mesh);
+        return false;
+    }
+
+    // dtNavMesh::addTile is not thread safe
+    for (int i = 0; i < header.numTiles; i++)
+    {
+        dtStatus status =
+            mesh->addTile(datas[i], entries[i].dataSize, DT_TILE_FREE_DATA,
+                          entries[i].tileRef, 0);
+        if (dtStatusFailed(status)) dtFree(datas[i]);
+    }
+
+    set_nav_mesh(mesh);
+
+    return true;
+}
+
+/**
+ * load MESH_FORMAT_LEAN(_DETAIL) file. The encoded tiles are read in one go,
+ * then rebuilt by dtCreateNavMeshData on the thread pool
+ */
+bool RecastNavMesh::load_lean(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    NavMeshSetHeader header;
+    if (fread(&header, sizeof(NavMeshSetHeader), 1, fp) != 1
+        || header.magic != NAVMESHSET_MAGIC
+        || header.version != NAVMESHSET_VERSION_LEAN || header.numTiles < 0)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<NavMeshTileHeader> tiles(header.numTiles);
+    std::vector<std::vector<unsigned char>> encoded(header.numTiles);
+    for (int i = 0; i < header.numTiles; i++)
+    {
+        NavMeshTileHeader &tile = tiles[i];
+        if (fread(&tile, sizeof(tile), 1, fp) != 1 || !tile.tileRef
+            || tile.dataSize <= 0)
+        {
+            fclose(fp);
+            return false;
+        }
+
+        encoded[i].resize(tile.dataSize);
+        if (fread(encoded[i].data(), tile.dataSize, 1, fp) != 1)
+        {
+            fclose(fp);
+            return false;
+        }
+    }
+    fclose(fp);
+
+    dtNavMesh *mesh = dtAllocNavMesh();
+    if (!mesh || dtStatusFailed(mesh->init(&header.params)))
+    {
+        if (mesh) dtFreeNavMesh(mesh);
+        return false;
+    }
+
+    std::vector<unsigned char *> datas(header.numTiles, nullptr);
+    std::vector<int> sizes(header.numTiles, 0);
+    std::atomic<int> failed(0);
+    thread_pool()->parallel_for(header.numTiles, 1, [&](int b, int e) {
+        for (int i = b; i < e; i++)
+        {
+            datas[i] = decode_lean_tile(encoded[i].data(), encoded[i].size(),
+                                        sizes[i]);
+            if (!datas[i]) failed++;
+        }
+    });
+
+    if (failed)
+    {
+        for (auto data : datas) dtFree(data);
+        dtFreeNavMesh(mesh);
+        return false;
+    }
+
+    // dtNavMesh::addTile is not thread safe
+    for (int i = 0; i < header.numTiles; i++)
+    {
+        dtStatus status = mesh->addTile(datas[i], sizes[i], DT_TILE_FREE_DATA,
+                                        tiles[i].tileRef, 0);
+        if (dtStatusFailed(status)) dtFree(datas[i]);
+    }
+
+    set_nav_mesh(mesh);
+
+    return true;
+}
+
+#ifndef _WIN32
+/**
+ * map a MESH_FORMAT_MMAP file and add the tiles in place, saving the read,
+ * the allocation and the copy of every tile. The mapping is private
+ * (copy-on-write) as dtNavMesh::addTile write the links and the poly
+ * firstLink into every tile, so the poly and link pages of all tiles are
+ * copied at load. The detail mesh and bv tree pages are read from disk on
+ * the first query touching them(findNearestPoly, getPolyHeight...)
+ */
+bool RecastNavMesh::load_mmap(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(NavMeshSetHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = (size_t)st.st_size;
+    void *addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keep a reference to the file
+    if (MAP_FAILED == addr) return false;
+
+    unsigned char *base = (unsigned char *)addr;
+
+    const NavMeshSetHeader *header = (const NavMeshSetHeader *)base;
+    const NavMeshTileEntry *entries =
+        (const NavMeshTileEntry *)(base + sizeof(NavMeshSetHeader));
+    if (header->magic != NAVMESHSET_MAGIC
+        || header->version != NAVMESHSET_VERSION_MMAP || header->numTiles < 0
+        || sizeof(NavMeshSetHeader)
+                   + header->numTiles * sizeof(NavMeshTileEntry)
+               > size)
+    {
+        munmap(addr, size);
+        return false;
+    }
+
+    dtNavMesh *mesh = dtAllocNavMesh();
+    if (!mesh || dtStatusFailed(mesh->init(&header->params)))
+    {
+        if (mesh) dtFreeNavMesh(mesh);
+        munmap(addr, size);
+        return false;
+    }
+
+    for (int i = 0; i < header->numTiles; ++i)
+    {
+        const NavMeshTileEntry &entry = entries[i];
+        if (!entry.tileRef || entry.dataSize <= 0) break;
+        if (entry.offset + entry.dataSize > size)
+        {
+            dtFreeNavMesh(mesh);
+            munmap(addr, size);
+            return false;
+        }
+
+        // no DT_TILE_FREE_DATA, the data belong to the mapping
+        mesh->addTile(base + entry.offset, entry.dataSize, 0, entry.tileRef,
+                      0);
+    }
+
+    set_nav_mesh(mesh, addr, size);
+
+    return true;
+}
+#endif
+
+/**
+ * load MESH_FORMAT_TILE_CACHE file, the nav mesh tiles are rebuilt from the
+ * compressed layers
+ */
+bool RecastNavMesh::load_tile_cache(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    dtNavMesh *mesh       = nullptr;
+    TileCache *tile_cache = new TileCache();
+    if (!tile_cache->load(fp, mesh))
+    {
+        if (mesh) dtFreeNavMesh(mesh);
+        delete tile_cache;
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    set_nav_mesh(mesh, nullptr, 0, tile_cache);
+
+    return true;
+}
+
+/**
+ * open MESH_FORMAT_MMAP file for streaming, only the tile offset table is
+ * read here
+ */
+bool RecastNavMesh::load_streaming(const char *path, size_t budget)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    NavMeshSetHeader header;
+    if (fread(&header, sizeof(NavMeshSetHeader), 1, fp) != 1
+        || header.magic != NAVMESHSET_MAGIC
+        || header.version != NAVMESHSET_VERSION_MMAP || header.numTiles < 0)
+    {
+        std::cerr << "Streaming need a MESH_FORMAT_MMAP file " << path
+                  << std::endl;
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<NavMeshTileEntry> table(header.numTiles);
+    if (header.numTiles > 0
+        && fread(table.data(), sizeof(NavMeshTileEntry), header.numTiles, fp)
+               != (size_t)header.numTiles)
+    {
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    std::vector<TileStream::Entry> entries(header.numTiles);
+    for (int i = 0; i < header.numTiles; i++)
+    {
+        entries[i].ref    = table[i].tileRef;
+        entries[i].size   = table[i].dataSize;
+        entries[i].offset = table[i].offset;
+    }
+
+    dtNavMesh *mesh = dtAllocNavMesh();
+    if (!mesh) return false;
+    if (dtStatusFailed(mesh->init(&header.params)))
+    {
+        dtFreeNavMesh(mesh);
+        return false;
+    }
+
+    TileStream *tile_stream = new TileStream();
+    if (!tile_stream->open(path, mesh, entries, budget))
+    {
+        delete tile_stream;
+        dtFreeNavMesh(mesh);
+        return false;
+    }
+
+    set_nav_mesh(mesh, nullptr, 0, nullptr, tile_stream);
+
+    return true;
+}
+
+void RecastNavMesh::set_nav_mesh(dtNavMesh *mesh, void *map_addr,
+                                 size_t map_size, TileCache *tile_cache,
+                                 TileStream *tile_stream)
+{
+    MeshState *state   = new MeshState();
+    state->nav_mesh    = mesh;
+    state->map_addr    = map_addr;
+    state->map_size    = map_size;
+    state->tile_cache  = tile_cache;
+    state->tile_stream = tile_stream;
+
+    publish(state);
+}
+
+void RecastNavMesh::publish(MeshState *state)
+{
+    MeshState *old    = current();
+    state->generation = old->generation + 1;
+    state->retired    = 0;
+
+    // refs of the new mesh may equal those of the old one, the corridors and
+    // the grid start over. Done before published, the queries on the old
+    // mesh keep using the old ones
+    delete state->path_cache;
+    state->path_cache = nullptr;
+    if (_path_cache_capacity > 0)
+        state->path_cache = new PathCache(_path_cache_capacity);
+    delete state->point_grid;
+    state->point_grid = nullptr;
+    if (_point_grid_cell >= 0)
+    {
+        state->point_grid = new PointGrid(_point_grid_cell);
+        state->point_grid->sync(state->nav_mesh);
+    }
+
+    _state = state;
+    _swaps++;
+    retire(old);
+}
+
+void RecastNavMesh::retire(MeshState *state)
+{
+    {
+        std::lock_guard<std::mutex> guard(_retire_mutex);
+
+        // a query pinned this epoch or later loaded the new state, as the
+        // state was swapped before
+        state->retired = ++_epoch;
+        _retired.push_back(state);
+        _retired_count = (int)_retired.size();
+    }
+
+    reclaim();
+}
+
+void RecastNavMesh::replace_graph(MeshState *state, ClusterGraph *graph)
+{
+    // as retire, a query pinned before the epoch may still plan on the old
+    // graph it loaded
+    ClusterGraph *old = state->cluster_graph.exchange(graph);
+    if (!old) return;
+    {
+        std::lock_guard<std::mutex> guard(_retire_mutex);
+        _retired_graphs.push_back(std::make_pair(++_epoch, old));
+    }
+
+    reclaim();
+}
+
+void RecastNavMesh::reclaim_retired()
+{
+    reclaim();
+}
+
+void RecastNavMesh::reclaim()
+{
+    std::lock_guard<std::mutex> guard(_retire_mutex);
+
+    unsigned long long oldest = ULLONG_MAX;
+    for (auto &slot : _query_slots)
+    {
+        const QueryContext *ctx = slot;
+        if (!ctx) continue;
+
+        const unsigned long long epoch = ctx->epoch;
+        if (epoch && epoch < oldest) oldest = epoch;
+    }
+
+    // a query pinned before a state retired may still use it
+    size_t kept = 0;
+    for (MeshState *state : _retired)
+    {
+        if (state->retired <= oldest)
+        {
+            free_state(state);
+            _reclaimed++;
+        }
+        else
+        {
+            _retired[kept++] = state;
+        }
+    }
+    _retired.resize(kept);
+
+    size_t kept_graphs = 0;
+    for (auto &retired : _retired_graphs)
+    {
+        if (retired.first <= oldest)
+            delete retired.second;
+        else
+            _retired_graphs[kept_graphs++] = retired;
+    }
+    _retired_graphs.resize(kept_graphs);
+    _retired_count = (int)kept;
+}
+
+void RecastNavMesh::free_state(MeshState *state)
+{
+    if (state->nav_mesh) dtFreeNavMesh(state->nav_mesh);
+    delete state->tile_cache;
+    delete state->tile_stream;
+    delete state->cluster_graph.load();
+    delete state->path_cache;
+    delete state->point_grid;
+
+    // the mesh may point into the mapping, unmap after mesh freed
+#ifndef _WIN32
+    if (state->map_addr) munmap(state->map_addr, state->map_size);
+#endif
+
+    delete state;
+}
+
+bool RecastNavMesh::swap_mesh(RecastNavMesh &from)
+{
+    if (&from == this) return false;
+
+    MeshState *state = from.current();
+    if (!state->nav_mesh) return false;
+
+    // from is not queried, it's state is taken as is and replaced by an empty
+    // one. The caches of from are replaced by those of this at publish
+    MeshState *empty  = new MeshState();
+    empty->generation = state->generation + 1;
+    from._state       = empty;
+    from.clear_query_pool();
+
+    publish(state);
+    return true;
+}
+
+void RecastNavMesh::get_swap_stat(SwapStat &stat) const
+{
+    stat.swaps     = _swaps;
+    stat.reclaimed = _reclaimed;
+    stat.retired   = _retired_count;
+}
+
+void RecastNavMesh::get_mesh_stat(MeshStat &stat) const
+{
+    memset(&stat, 0, sizeof(stat));
+    const dtNavMesh *mesh = current()->nav_mesh;
+    if (!mesh) return;
+
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+
+        const dtMeshHeader *header = tile->header;
+        stat.tiles++;
+        stat.polys += header->polyCount;
+        stat.data_bytes += tile->dataSize;
+        stat.detail_bytes +=
+            header->detailMeshCount * sizeof(dtPolyDetail)
+            + header->detailVertCount * 3 * sizeof(float)
+            + header->detailTriCount * 4;
+    }
+}
+
+void RecastNavMesh::install_build_arena()
+{
+    BuildArena::install();
+}
+
+void RecastNavMesh::get_memory_stat(MemoryStat &stat)
+{
+    BuildArena::get_stat(stat);
+}
+
+void RecastNavMesh::reset_memory_peak()
+{
+    BuildArena::reset_peak();
+}
+
+void RecastNavMesh::set_build_arena(bool enable)
+{
+    BuildArena::set_enabled(enable);
+}
+
+/**
+ * generated mesh data from a obj/gset file
+ * @param from a obj/gset file
+ * @param stat [out] stage times, memory and output size of the build
+ */
+bool RecastNavMesh::build(const char *from, BuildStat *stat)
+{
+    BuildContext m_ctx(&_log_sink);
+    BuildGeom m_geom;
+
+    auto begin = std::chrono::steady_clock::now();
+    if (!m_geom.load(&m_ctx, from, thread_pool().get(), _geom_cache))
+    {
+        m_ctx.log(RC_LOG_ERROR,
+                  "buildNavigation: Input mesh is not specified.");
+        return false;
+    }
+    float load_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count()
+                    / 1000.0f;
+
+    if (!raw_build(&m_geom, &m_ctx)) return false;
+
+    if (stat)
+    {
+        get_build_stat(m_ctx, *stat);
+        stat->load_ms     = load_ms;
+        stat->geom_cached = m_geom.from_cache();
+    }
+    return true;
+}
+
+/**
+ * generated tiled mesh data from a obj/gset file, using multi threads
+ * @param from a obj/gset file
+ * @param threads worker count, 0 to use all hardware threads
+ * @param stat [out] stage times, memory and output size of the build
+ */
+bool RecastNavMesh::build_tiled(const char *from, int threads,
+                                BuildStat *stat)
+{
+    BuildContext m_ctx(&_log_sink);
+    BuildGeom *m_geom = new BuildGeom();
+
+    auto begin = std::chrono::steady_clock::now();
+    if (!m_geom->load(&m_ctx, from, thread_pool().get(), _geom_cache))
+    {
+        m_ctx.log(RC_LOG_ERROR,
+                  "buildTiledNavigation: Input mesh is not specified.");
+        delete m_geom;
+        return false;
+    }
+    float load_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count()
+                    / 1000.0f;
+
+    if (!raw_build_tiled(m_geom, &m_ctx, threads))
+    {
+        delete m_geom;
+        return false;
+    }
+
+    if (stat)
+    {
+        get_build_stat(m_ctx, *stat);
+        stat->load_ms     = load_ms;
+        stat->geom_cached = m_geom->from_cache();
+    }
+
+    // kept for rebuild, so an edit doesn't parse the whole obj again
+    delete _geom;
+    _geom = m_geom;
+    return true;
+}
+
+/**
+ * generated the meshes of several agent profiles from one obj/gset file,
+ * parsed and rasterized once
+ * @param from a obj/gset file
+ * @param meshes every one built with it's own Setting
+ * @param stats [out] count stats, one per mesh
+ */
+bool RecastNavMesh::build_profiles(const char *from,
+                                   RecastNavMesh *const *meshes, int count,
+                                   BuildStat *stats)
+{
+    if (count <= 0 || !meshes[0]) return false;
+
+    BuildContext m_ctx(&meshes[0]->_log_sink);
+    const Setting *first = meshes[0]->_setting;
+    int walkableClimb    = INT_MAX;
+    for (int i = 0; i < count; ++i)
+    {
+        const Setting *s = meshes[i] ? meshes[i]->_setting : nullptr;
+        if (!s || s->cellSize != first->cellSize
+            || s->cellHeight != first->cellHeight
+            || s->agentMaxSlope != first->agentMaxSlope)
+        {
+            m_ctx.log(RC_LOG_ERROR,
+                      "buildProfiles: Profile %d does not share the cell "
+                      "size, cell height and max slope of profile 0.",
+                      i);
+            return false;
+        }
+        walkableClimb =
+            rcMin(walkableClimb, (int)floorf(s->agentMaxClimb / s->cellHeight));
+    }
+
+    BuildGeom m_geom;
+    auto begin = std::chrono::steady_clock::now();
+    if (!m_geom.load(&m_ctx, from, meshes[0]->thread_pool().get(),
+                     meshes[0]->_geom_cache))
+    {
+        m_ctx.log(RC_LOG_ERROR, "buildProfiles: Input mesh is not specified.");
+        return false;
+    }
+    float load_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count()
+                    / 1000.0f;
+
+    const float *verts = m_geom.getMesh()->getVerts();
+    const int nverts   = m_geom.getMesh()->getVertCount();
+    const int *tris    = m_geom.getMesh()->getTris();
+    const int ntris    = m_geom.getMesh()->getTriCount();
+
+    // the same grid as raw_build
+    float bmin[3], bmax[3];
+    int width = 0, height = 0;
+    rcVcopy(bmin, m_geom.getNavMeshBoundsMin());
+    rcVcopy(bmax, m_geom.getNavMeshBoundsMax());
+    rcCalcGridSize(bmin, bmax, first->cellSize, &width, &height);
+
+    m_ctx.log(RC_LOG_PROGRESS, "Building %d profiles:", count);
+    m_ctx.log(RC_LOG_PROGRESS, " - %d x %d cells", width, height);
+    m_ctx.log(RC_LOG_PROGRESS, " - %.1fK verts, %.1fK tris", nverts / 1000.0f,
+              ntris / 1000.0f);
+
+    BuildArena::Scope arena;
+    TileBuildData shared;
+    shared.solid = rcAllocHeightfield();
+    if (!shared.solid)
+    {
+        m_ctx.log(RC_LOG_ERROR, "buildProfiles: Out of memory 'solid'.");
+        return false;
+    }
+    if (!rcCreateHeightfield(&m_ctx, *shared.solid, width, height, bmin, bmax,
+                             first->cellSize, first->cellHeight))
+    {
+        m_ctx.log(RC_LOG_ERROR,
+                  "buildProfiles: Could not create solid heightfield.");
+        return false;
+    }
+
+    // spans are merged within the finest climb, so no profile sees a step
+    // merged away that it could not climb
+    shared.triareas = (unsigned char *)rcAlloc(ntris, RC_ALLOC_TEMP);
+    if (!shared.triareas)
+    {
+        m_ctx.log(RC_LOG_ERROR, "buildProfiles: Out of memory 'triareas'.");
+        return false;
+    }
+    memset(shared.triareas, 0, ntris * sizeof(unsigned char));
+    rcMarkWalkableTriangles(&m_ctx, first->agentMaxSlope, verts, nverts, tris,
+                            ntris, shared.triareas);
+    if (!rcRasterizeTriangles(&m_ctx, verts, nverts, tris, shared.triareas,
+                              ntris, *shared.solid, walkableClimb))
+    {
+        m_ctx.log(RC_LOG_ERROR,
+                  "buildProfiles: Could not rasterize triangles.");
+        return false;
+    }
+    rcFree(shared.triareas);
+    shared.triareas = nullptr;
+
+    std::vector<unsigned char> areas;
+    save_span_areas(*shared.solid, areas);
+
+    BuildStat rasterized;
+    memset(&rasterized, 0, sizeof(rasterized));
+    m_ctx.get_stat(rasterized);
+
+    for (int i = 0; i < count; ++i)
+    {
+        RecastNavMesh *mesh = meshes[i];
+        if (i) restore_span_areas(*shared.solid, areas);
+
+        BuildContext ctx(&mesh->_log_sink);
+        if (!mesh->build_profile(&m_geom, &ctx, *shared.solid)) return false;
+
+        if (stats)
+        {
+            mesh->get_build_stat(ctx, stats[i]);
+            stats[i].load_ms      = load_ms;
+            stats[i].rasterize_ms = rasterized.rasterize_ms;
+            stats[i].geom_cached  = m_geom.from_cache();
+        }
+    }
+    return true;
+}
+
+bool RecastNavMesh::build_streaming(const char *from, const char *to,
+                                    int threads, size_t budget,
+                                    BuildStat *stat)
+{
+    BuildContext m_ctx(&_log_sink);
+    if (_setting->tileSize <= 0 || _setting->cellSize <= 0)
+    {
+        m_ctx.log(RC_LOG_ERROR, "streamBuild: Invalid tile size.");
+        return false;
+    }
+
+    // scratch files are put beside the output, where the space is expected
+    StreamGeom geom(budget ? budget : STREAM_BUDGET);
+    auto begin = std::chrono::steady_clock::now();
+    if (!geom.scan(&m_ctx, from, to)) return false;
+
+    const float *bmin = geom.bmin();
+    const float *bmax = geom.bmax();
+
+    int gw = 0, gh = 0;
+    rcCalcGridSize(bmin, bmax, _setting->cellSize, &gw, &gh);
+    const int ts    = (int)_setting->tileSize;
+    const int tw    = (gw + ts - 1) / ts;
+    const int th    = (gh + ts - 1) / ts;
+    const float tcs = _setting->tileSize * _setting->cellSize;
+
+    // the same padding as build_tile_mesh
+    const int borderSize =
+        (int)ceilf(_setting->agentRadius / _setting->cellSize) + 3;
+    if (!geom.bucket(&m_ctx, tcs, borderSize * _setting->cellSize, tw, th))
+        return false;
+
+    float load_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count()
+                    / 1000.0f;
+
+    // the same params as raw_build_tiled
+    int tileBits = rcMin((int)dtIlog2(dtNextPow2(tw * th)), 14);
+    int polyBits = 22 - tileBits;
+
+    dtNavMeshParams params;
+    memset(&params, 0, sizeof(params));
+    rcVcopy(params.orig, bmin);
+    params.tileWidth  = tcs;
+    params.tileHeight = tcs;
+    params.maxTiles   = 1 << tileBits;
+    params.maxPolys   = 1 << polyBits;
+
+    // no tile is added, only to encode the tile refs a fresh mesh would
+    // give when the file loaded
+    dtNavMesh *ids = dtAllocNavMesh();
+    if (!ids || dtStatusFailed(ids->init(&params)))
+    {
+        dtFreeNavMesh(ids);
+        m_ctx.log(RC_LOG_ERROR, "streamBuild: Could not init navmesh.");
+        return false;
+    }
+
+    FILE *fp = fopen(to, "wb");
+    if (!fp)
+    {
+        dtFreeNavMesh(ids);
+        m_ctx.log(RC_LOG_ERROR, "streamBuild: Could not open '%s'", to);
+        return false;
+    }
+
+    // numTiles is written once all tiles done
+    NavMeshSetHeader header;
+    header.magic    = NAVMESHSET_MAGIC;
+    header.version  = NAVMESHSET_VERSION;
+    header.numTiles = 0;
+    memcpy(&header.params, &params, sizeof(dtNavMeshParams));
+    bool ok = 1 == fwrite(&header, sizeof(NavMeshSetHeader), 1, fp);
+
+    m_ctx.resetTimers();
+    m_ctx.startTimer(RC_TIMER_TOTAL);
+
+    m_ctx.log(RC_LOG_PROGRESS, "Building streaming navigation:");
+    m_ctx.log(RC_LOG_PROGRESS, " - %d x %d tiles", tw, th);
+
+    int verts = 0, polys = 0;
+    std::atomic<int> failed(0);
+    std::mutex file_mutex;
+    ThreadPool pool(rcMin(threads > 0 ? threads : 0, tw * th));
+    pool.parallel_for(tw * th, 1, [&](int b, int e) {
+        BuildContext ctx(&m_ctx);
+        std::vector<float> tris;
+        for (int i = b; i < e; i++)
+        {
+            const int x = i % tw;
+            const int y = i / tw;
+
+            BuildGeom tile_geom;
+            if (!geom.read(i, tris))
+            {
+                failed++;
+                continue;
+            }
+            if (tris.size() < 9) continue; // nothing in this tile
+            if (!tile_geom.load_triangles(&ctx, tris))
+            {
+                failed++;
+                continue;
+            }
+
+            float tbmin[3], tbmax[3];
+            tbmin[0] = bmin[0] + x * tcs;
+            tbmin[1] = bmin[1];
+            tbmin[2] = bmin[2] + y * tcs;
+            tbmax[0] = bmin[0] + (x + 1) * tcs;
+            tbmax[1] = bmax[1];
+            tbmax[2] = bmin[2] + (y + 1) * tcs;
+
+            int dataSize = 0;
+            bool empty   = false;
+            unsigned char *data = build_tile_mesh(&tile_geom, &ctx, x, y,
+                                                  tbmin, tbmax, dataSize,
+                                                  empty);
+            if (!data)
+            {
+                if (!empty) failed++;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> guard(file_mutex);
+            if (header.numTiles < params.maxTiles)
+            {
+                NavMeshTileHeader tileHeader;
+                tileHeader.tileRef  = ids->encodePolyId(1, header.numTiles, 0);
+                tileHeader.dataSize = dataSize;
+                if (1 != fwrite(&tileHeader, sizeof(tileHeader), 1, fp)
+                    || 1 != fwrite(data, dataSize, 1, fp))
+                {
+                    ok = false;
+                }
+
+                const dtMeshHeader *tile = (const dtMeshHeader *)data;
+                verts += tile->vertCount;
+                polys += tile->polyCount;
+                header.numTiles++;
+            }
+            else
+            {
+                failed++;
+            }
+            dtFree(data);
+        }
+    });
+    dtFreeNavMesh(ids);
+
+    if (fseek(fp, 0, SEEK_SET)
+        || 1 != fwrite(&header, sizeof(NavMeshSetHeader), 1, fp))
+    {
+        ok = false;
+    }
+    if (fclose(fp)) ok = false;
+    if (!ok)
+    {
+        m_ctx.log(RC_LOG_ERROR, "streamBuild: Could not write '%s'", to);
+        remove(to);
+        return false;
+    }
+
+    // a mesh with holes where tiles failed is not a result
+    if (failed)
+    {
+        m_ctx.log(RC_LOG_ERROR, "streamBuild: %d tiles failed to build or add.",
+                  failed.load());
+        remove(to);
+        return false;
+    }
+
+    m_ctx.stopTimer(RC_TIMER_TOTAL);
+    m_ctx.log(RC_LOG_PROGRESS, ">> Total build time: %.1fms",
+              m_ctx.getAccumulatedTime(RC_TIMER_TOTAL) / 1000.0f);
+
+    if (stat)
+    {
+        // the mesh is never loaded, count from the tiles written
+        memset(stat, 0, sizeof(*stat));
+        m_ctx.get_stat(*stat);
+        stat->load_ms = load_ms;
+        stat->verts   = verts;
+        stat->polys   = polys;
+        stat->tiles   = header.numTiles;
+    }
+    return true;
+}
+
+void RecastNavMesh::set_log_sink(const LogSink &sink)
+{
+    _log_sink = sink;
+}
+
+void RecastNavMesh::set_geom_cache(const char *dir)
+{
+    _geom_cache = dir ? dir : "";
+}
+
+void RecastNavMesh::get_build_stat(const BuildContext &ctx,
+                                   BuildStat &stat) const
+{
+    memset(&stat, 0, sizeof(stat));
+    ctx.get_stat(stat);
+
+    const dtNavMesh *mesh = current()->nav_mesh;
+    for (int i = 0; mesh && i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header) continue;
+
+        stat.tiles++;
+        stat.verts += tile->header->vertCount;
+        stat.polys += tile->header->polyCount;
+    }
+}
+
+/**
+ * generated tiled mesh data through a dtTileCache, so obstacles can be added
+ * and removed at runtime
+ * @param from a obj/gset file
+ * @param max_obstacles max obstacles exist at the same time
+ * @param threads worker count, 0 to use all hardware threads
+ */
+bool RecastNavMesh::build_tile_cache(const char *from, int max_obstacles,
+                                     int threads)
+{
+    BuildContext m_ctx(&_log_sink);
+    BuildGeom m_geom;
+
+    if (!m_geom.load(&m_ctx, from, thread_pool().get(), _geom_cache))
+    {
+        m_ctx.log(RC_LOG_ERROR, "buildTileCache: Input mesh is not specified.");
+        return false;
+    }
+
+    dtNavMesh *mesh       = nullptr;
+    TileCache *tile_cache = new TileCache();
+    ThreadPool pool(threads);
+    if (!tile_cache->build(&m_geom, &m_ctx, _setting, max_obstacles, &pool,
+                           mesh))
+    {
+        if (mesh) dtFreeNavMesh(mesh);
+        delete tile_cache;
+        return false;
+    }
+
+    set_nav_mesh(mesh, nullptr, 0, tile_cache);
+
+    return true;
+}
+
+unsigned int RecastNavMesh::add_obstacle(const float *pos, float radius,
+                                         float height, unsigned int &ref)
+{
+    ref = 0;
+    TileCache *tile_cache = current()->tile_cache;
+    if (!tile_cache) return DT_FAILURE | DT_INVALID_PARAM;
+
+    return tile_cache->add_obstacle(pos, radius, height, ref);
+}
+
+unsigned int RecastNavMesh::add_box_obstacle(const float *bmin,
+                                             const float *bmax,
+                                             unsigned int &ref)
+{
+    ref = 0;
+    TileCache *tile_cache = current()->tile_cache;
+    if (!tile_cache) return DT_FAILURE | DT_INVALID_PARAM;
+
+    return tile_cache->add_box_obstacle(bmin, bmax, ref);
+}
+
+unsigned int RecastNavMesh::remove_obstacle(unsigned int ref)
+{
+    TileCache *tile_cache = current()->tile_cache;
+    if (!tile_cache) return DT_FAILURE | DT_INVALID_PARAM;
+
+    return tile_cache->remove_obstacle(ref);
+}
+
+unsigned int RecastNavMesh::update_obstacles(int budget_us)
+{
+    // corridors through a rebuilt tile are dropped by the cache itself as the
+    // tile salt changed
+    MeshState *state = current();
+    if (!state->tile_cache || !state->nav_mesh) return DT_SUCCESS;
+
+    dtStatus status = state->tile_cache->update(state->nav_mesh, budget_us);
+    if (state->point_grid) state->point_grid->sync(state->nav_mesh);
+    return status;
+}
+
+int RecastNavMesh::add_interest(const float *pos, float radius)
+{
+    TileStream *tile_stream = current()->tile_stream;
+    if (!tile_stream) return -1;
+
+    return tile_stream->add_interest(pos, radius);
+}
+
+bool RecastNavMesh::move_interest(int id, const float *pos)
+{
+    TileStream *tile_stream = current()->tile_stream;
+    if (!tile_stream) return false;
+
+    return tile_stream->move_interest(id, pos);
+}
+
+bool RecastNavMesh::remove_interest(int id)
+{
+    TileStream *tile_stream = current()->tile_stream;
+    if (!tile_stream) return false;
+
+    return tile_stream->remove_interest(id);
+}
+
+int RecastNavMesh::update_streaming()
+{
+    // corridors through an evicted tile are dropped by the cache itself as
+    // the tile is gone
+    MeshState *state = current();
+    if (!state->tile_stream || !state->nav_mesh) return 0;
+
+    int changed = state->tile_stream->update(state->nav_mesh);
+    if (changed && state->point_grid)
+        state->point_grid->sync(state->nav_mesh);
+    return changed;
+}
+
+void RecastNavMesh::get_stream_stat(StreamStat &stat) const
+{
+    memset(&stat, 0, sizeof(stat));
+    const TileStream *tile_stream = current()->tile_stream;
+    if (!tile_stream) return;
+
+    stat.tiles          = tile_stream->tile_count();
+    stat.resident       = tile_stream->resident_count();
+    stat.pending        = tile_stream->pending();
+    stat.resident_bytes = tile_stream->resident_bytes();
+    stat.budget         = tile_stream->budget();
+    stat.loads          = tile_stream->loads();
+    stat.evictions      = tile_stream->evictions();
+    stat.failures       = tile_stream->failures();
+    stat.failed         = tile_stream->failed_count();
+}
+
+/**
+ * rebuild the tiles overlapping [bmin, bmax] from a obj/gset file and swap
+ * them into the current mesh
+ */
+bool RecastNavMesh::rebuild(const float *bmin, const float *bmax,
+                            const char *from, int threads)
+{
+    BuildContext m_ctx(&_log_sink);
+
+    // several edits of the same file rebuilt region by region load it once
+    if (!_geom || !_geom->is_current(from))
+    {
+        delete _geom;
+        _geom = new BuildGeom();
+        if (!_geom->load(&m_ctx, from, thread_pool().get(), _geom_cache))
+        {
+            m_ctx.log(RC_LOG_ERROR, "rebuild: Input mesh is not specified.");
+            delete _geom;
+            _geom = nullptr;
+            return false;
+        }
+    }
+
+    if (!raw_rebuild(_geom, &m_ctx, bmin, bmax, threads)) return false;
+
+    // the refs of the replaced tiles changed, the graph is out of date
+    const ClusterGraph *graph = current()->cluster_graph;
+    if (!graph) return true;
+    return build_cluster_graph(graph->cluster_size());
+}
+
+static bool save_mmap_tiles(FILE *fp, const dtNavMesh *mesh, int numTiles)
+{
+    // offset table first, then every tile start at a page boundary
+    std::vector<NavMeshTileEntry> entries;
+    unsigned long long offset = sizeof(NavMeshSetHeader)
+                              + numTiles * sizeof(NavMeshTileEntry);
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+
+        NavMeshTileEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.tileRef  = mesh->getTileRef(tile);
+        entry.dataSize = tile->dataSize;
+        entry.offset   = (offset + NAVMESHSET_ALIGN - 1) & ~(NAVMESHSET_ALIGN - 1);
+        entries.push_back(entry);
+
+        offset = entry.offset + entry.dataSize;
+    }
+    if (!entries.empty()
+        && entries.size() != fwrite(entries.data(), sizeof(NavMeshTileEntry),
+                                    entries.size(), fp))
+        return false;
+
+    static const unsigned char padding[NAVMESHSET_ALIGN] = {0};
+
+    offset = sizeof(NavMeshSetHeader) + numTiles * sizeof(NavMeshTileEntry);
+    for (const auto &entry : entries)
+    {
+        const size_t pad = (size_t)(entry.offset - offset);
+        if (pad && 1 != fwrite(padding, pad, 1, fp)) return false;
+
+        const dtMeshTile *tile = mesh->getTileByRef(entry.tileRef);
+        if (1 != fwrite(tile->data, tile->dataSize, 1, fp)) return false;
+
+        offset = entry.offset + entry.dataSize;
+    }
+
+    return true;
+}
+
+static bool save_compressed_tiles(FILE *fp, const dtNavMesh *mesh,
+                                  int numTiles, ThreadPool *pool)
+{
+    std::vector<const dtMeshTile *> tiles;
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+        tiles.push_back(tile);
+    }
+
+    std::vector<std::vector<unsigned char>> buffers(tiles.size());
+    pool->parallel_for((int)tiles.size(), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            const dtMeshTile *tile = tiles[i];
+
+            // fastlz need the output 5% larger than input and at least 66 bytes
+            buffers[i].resize(rcMax(66, tile->dataSize + tile->dataSize / 20));
+            int size = fastlz_compress(tile->data, tile->dataSize,
+                                       buffers[i].data());
+            buffers[i].resize(size);
+        }
+    });
+
+    std::vector<NavMeshCompressedEntry> entries;
+    unsigned long long offset =
+        sizeof(NavMeshSetHeader) + numTiles * sizeof(NavMeshCompressedEntry);
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        if (buffers[i].empty()) return false;
+
+        NavMeshCompressedEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.tileRef        = mesh->getTileRef(tiles[i]);
+        entry.dataSize       = tiles[i]->dataSize;
+        entry.compressedSize = (int)buffers[i].size();
+        entry.offset         = offset;
+        entries.push_back(entry);
+
+        offset += entry.compressedSize;
+    }
+
+    // a failed write may still let fclose succeed, check every one
+    if (!entries.empty()
+        && entries.size() != fwrite(entries.data(),
+                                    sizeof(NavMeshCompressedEntry),
+                                    entries.size(), fp))
+        return false;
+    for (const auto &buffer : buffers)
+    {
+        if (1 != fwrite(buffer.data(), buffer.size(), 1, fp)) return false;
+    }
+
+    return true;
+}
+
+/**
+ * store the tiles of MESH_FORMAT_LEAN(_DETAIL), encoded on the thread pool
+ * @param ch cell height the verts are quantized by
+ */
+static bool save_lean_tiles(FILE *fp, const dtNavMesh *mesh, float ch,
+                            bool keep_detail, ThreadPool *pool)
+{
+    std::vector<const dtMeshTile *> tiles;
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+        tiles.push_back(tile);
+    }
+
+    std::vector<std::vector<unsigned char>> buffers(tiles.size());
+    std::atomic<int> failed(0);
+    pool->parallel_for((int)tiles.size(), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            if (!encode_lean_tile(tiles[i], ch, keep_detail, buffers[i]))
+                failed++;
+        }
+    });
+    if (failed)
+    {
+        std::cerr << "Mesh verts not on the 16 bits grid of cell height " << ch
+                  << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        NavMeshTileHeader tileHeader;
+        tileHeader.tileRef  = mesh->getTileRef(tiles[i]);
+        tileHeader.dataSize = (int)buffers[i].size();
+        if (1 != fwrite(&tileHeader, sizeof(tileHeader), 1, fp)
+            || 1 != fwrite(buffers[i].data(), buffers[i].size(), 1, fp))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * save mesh data to file, ported from RecastDemo
+ * void Sample::saveAll(const char* path, const dtNavMesh* mesh)
+ */
+bool RecastNavMesh::save(const char *path, int format)
+{
+    if (!save_mesh(path, format)) return false;
+
+    // a graph left by an older mesh would be ignored by load anyway
+    std::string graph_path(path);
+    graph_path.append(CLUSTER_GRAPH_SUFFIX);
+    const ClusterGraph *graph = current()->cluster_graph;
+    if (!graph)
+    {
+        remove(graph_path.c_str());
+        return true;
+    }
+
+    FILE *fp = fopen(graph_path.c_str(), "wb");
+    if (!fp)
+    {
+        std::cerr << "Could not open " << graph_path << " for writing"
+                  << std::endl;
+        return false;
+    }
+    bool ok = graph->save(fp);
+    fclose(fp);
+
+    return ok;
+}
+
+bool RecastNavMesh::build_cluster_graph(float cluster_size)
+{
+    // queries keep planning on the old graph until the new one is built
+    MeshState *state = current();
+    if (!state->nav_mesh)
+    {
+        replace_graph(state, nullptr);
+        return false;
+    }
+
+    if (cluster_size <= 0)
+        cluster_size = _setting->tileSize * _setting->cellSize;
+
+    ClusterGraph *graph = new ClusterGraph();
+    if (!graph->build(state->nav_mesh, _filter, cluster_size,
+                      thread_pool().get()))
+    {
+        delete graph;
+        graph = nullptr;
+    }
+
+    replace_graph(state, graph);
+    return graph != nullptr;
+}
+
+bool RecastNavMesh::save_mesh(const char *path, int format)
+{
+    const MeshState *state = current();
+    const dtNavMesh *mesh  = state->nav_mesh;
+    if (!mesh)
+    {
+        std::cerr << "No mesh data to save" << std::endl;
+        return false;
+    }
+    if (format != MESH_FORMAT_SET && format != MESH_FORMAT_MMAP
+        && format != MESH_FORMAT_COMPRESSED && format != MESH_FORMAT_TILE_CACHE
+        && format != MESH_FORMAT_LEAN && format != MESH_FORMAT_LEAN_DETAIL)
+    {
+        std::cerr << "Unknow mesh format " << format << std::endl;
+        return false;
+    }
+    if (state->tile_stream)
+    {
+        std::cerr << "Streaming mesh has only the resident tiles" << std::endl;
+        return false;
+    }
+    if (format == MESH_FORMAT_TILE_CACHE && !state->tile_cache)
+    {
+        std::cerr << "Mesh not built with tile cache" << std::endl;
+        return false;
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    if (format == MESH_FORMAT_TILE_CACHE)
+    {
+        bool ok = state->tile_cache->save(fp);
+        if (fclose(fp)) ok = false;
+        if (!ok) remove(path); // never leave a truncated file
+        return ok;
+    }
+
+    // Store header.
+    NavMeshSetHeader header;
+    header.magic    = NAVMESHSET_MAGIC;
+    header.version  = NAVMESHSET_VERSION;
+    if (format == MESH_FORMAT_MMAP) header.version = NAVMESHSET_VERSION_MMAP;
+    if (format == MESH_FORMAT_COMPRESSED)
+        header.version = NAVMESHSET_VERSION_COMPRESSED;
+    if (format == MESH_FORMAT_LEAN || format == MESH_FORMAT_LEAN_DETAIL)
+        header.version = NAVMESHSET_VERSION_LEAN;
+    header.numTiles = 0;
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+        header.numTiles++;
+    }
+    memcpy(&header.params, mesh->getParams(), sizeof(dtNavMeshParams));
+    const bool header_ok =
+        1 == fwrite(&header, sizeof(NavMeshSetHeader), 1, fp);
+
+    if (format == MESH_FORMAT_MMAP)
+    {
+        bool ok = header_ok && save_mmap_tiles(fp, mesh, header.numTiles);
+        if (fclose(fp)) ok = false;
+        if (!ok) remove(path); // never leave a truncated file to be mapped
+        return ok;
+    }
+    if (format == MESH_FORMAT_COMPRESSED)
+    {
+        bool ok = header_ok
+               && save_compressed_tiles(fp, mesh, header.numTiles,
+                                        thread_pool().get());
+        if (fclose(fp)) ok = false;
+        if (!ok) remove(path); // never leave a truncated file
+        return ok;
+    }
+    if (format == MESH_FORMAT_LEAN || format == MESH_FORMAT_LEAN_DETAIL)
+    {
+        bool ok = header_ok
+               && save_lean_tiles(fp, mesh, _setting->cellHeight,
+                                  format == MESH_FORMAT_LEAN_DETAIL,
+                                  thread_pool().get());
+        if (fclose(fp)) ok = false;
+        if (!ok) remove(path); // never leave a truncated file
+        return ok;
+    }
+
+    // Store tiles.
+    for (int i = 0; i < mesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile *tile = mesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+
+        NavMeshTileHeader tileHeader;
+        tileHeader.tileRef  = mesh->getTileRef(tile);
+        tileHeader.dataSize = tile->dataSize;
+        fwrite(&tileHeader, sizeof(tileHeader), 1, fp);
+
+        fwrite(tile->data, tile->dataSize, 1, fp);
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+const RecastNavMesh::MeshState *RecastNavMesh::pin_mesh(QueryContext *&ctx)
+{
+    // start at a slot by thread, so a thread mostly get the same context and
+    // threads rarely race for one. No lock, a busy slot is skipped
+    const size_t start =
+        std::hash<std::thread::id>()(std::this_thread::get_id());
+    ctx = nullptr;
+    for (size_t n = 0; !ctx; n++)
+    {
+        std::atomic<QueryContext *> &slot = _query_slots[(start + n)
+                                                         % QUERY_SLOTS];
+        QueryContext *slot_ctx = slot;
+        if (!slot_ctx)
+        {
+            // more threads than ever before are querying
+            QueryContext *created = new QueryContext();
+            created->busy         = true;
+            created->epoch        = 0;
+            created->state        = nullptr;
+            created->query        = nullptr;
+            created->max_nodes    = 0;
+            created->generation   = 0;
+            if (slot.compare_exchange_strong(slot_ctx, created))
+                ctx = created;
+            else
+                delete created;
+            continue;
+        }
+
+        bool busy = false;
+        if (slot_ctx->busy.compare_exchange_strong(busy, true))
+            ctx = slot_ctx;
+        else if ((n + 1) % QUERY_SLOTS == 0)
+            std::this_thread::yield(); // all busy
+    }
+
+    // pin before loading the state, so a state seen is not freed until the
+    // pin is cleared at release
+    ctx->epoch       = _epoch.load();
+    MeshState *state = _state;
+    ctx->state       = state;
+    return state;
+}
+
+RecastNavMesh::QueryContext *RecastNavMesh::acquire_query()
+{
+    QueryContext *ctx      = nullptr;
+    const MeshState *state = pin_mesh(ctx);
+    if (!state->nav_mesh)
+    {
+        release_query(ctx);
+        return nullptr;
+    }
+
+    // the mesh was replaced, or the node pool resized. dtNavMeshQuery::init
+    // rebind the mesh and keep the node pool, but never shrink it so a new
+    // query is needed if the size changed
+    const int max_nodes = _node_pool->max_nodes();
+    if (ctx->query && ctx->generation == state->generation
+        && ctx->max_nodes == max_nodes)
+        return ctx;
+
+    if (ctx->query && ctx->max_nodes != max_nodes)
+    {
+        dtFreeNavMeshQuery(ctx->query);
+        ctx->query = nullptr;
+    }
+    if (!ctx->query) ctx->query = dtAllocNavMeshQuery();
+    if (!ctx->query
+        || dtStatusFailed(ctx->query->init(state->nav_mesh, max_nodes)))
+    {
+        if (ctx->query) dtFreeNavMeshQuery(ctx->query);
+        ctx->query = nullptr;
+        release_query(ctx);
+        return nullptr;
+    }
+    ctx->max_nodes  = max_nodes;
+    ctx->generation = state->generation;
+    return ctx;
+}
+
+void RecastNavMesh::release_query(QueryContext *ctx)
+{
+    // never reclaim here, freeing a mesh may block the query, see
+    // reclaim_retired
+    ctx->state = nullptr;
+    ctx->epoch = 0;
+    ctx->busy  = false;
+}
+
+void RecastNavMesh::clear_query_pool()
+{
+    // only when no query is running
+    for (auto &slot : _query_slots)
     {
-        // Find location to steer towards.
-        float steerPos[3];
-        unsigned char steerPosFlag;
-        dtPolyRef steerPosRef;
+        QueryContext *ctx = slot;
+        if (!ctx) continue;
 
-        if (!getSteerTarget(m_navQuery, iterPos, targetPos, SLOP, polys, npolys,
-                            steerPos, steerPosFlag, steerPosRef))
-            break;
+        if (ctx->query) dtFreeNavMeshQuery(ctx->query);
+        delete ctx;
+        slot = nullptr;
+    }
+}
 
-        bool endOfPath = (steerPosFlag & DT_STRAIGHTPATH_END) ? true : false;
-        bool offMeshConnection =
-            (steerPosFlag & DT_STRAIGHTPATH_OFFMESH_CONNECTION) ? true : false;
-
-        // Find movement delta.
-        float delta[3], len;
-        dtVsub(delta, steerPos, iterPos);
-        len = dtMathSqrtf(dtVdot(delta, delta));
-        // If the steer target is end of path or off-mesh link, do not move past the location.
-        if ((endOfPath || offMeshConnection) && len < STEP_SIZE)
-            len = 1;
-        else
-            len = STEP_SIZE / len;
-        float moveTgt[3];
-        dtVmad(moveTgt, iterPos, delta, len);
-
-        // Move
-        float result[3];
-        dtPolyRef visited[16];
-        int nvisited = 0;
-        m_navQuery->moveAlongSurface(polys[0], iterPos, moveTgt, &m_filter,
-                                     result, visited, &nvisited, 16);
-
-        npolys = fixupCorridor(polys, npolys, MAX_POLYS, visited, nvisited);
-        npolys = fixupShortcuts(polys, npolys, m_navQuery);
-
-        float h = 0;
-        m_navQuery->getPolyHeight(polys[0], result, &h);
-        result[1] = h;
-        dtVcopy(iterPos, result);
-
-        // Handle end of path and off-mesh links when close enough.
-        if (endOfPath && inRange(iterPos, steerPos, SLOP, 1.0f))
+/**
+ * walk one STEP_SIZE along the corridor, ported form RecastDemo
+ * void NavMeshTesterTool::recalc(). The points reached are put in st.pending
+ * @return false if the end of path reached or can't move any more
+ */
+bool RecastNavMesh::smooth_step(dtNavMeshQuery *m_navQuery,
+                                SmoothState &st) const
+{
+    // setup some variable to keep potaled code unchange
+    const dtQueryFilter &m_filter = *_filter;
+    const dtNavMesh *m_navMesh    = m_navQuery->getAttachedNavMesh();
+    dtPolyRef *polys              = st.polys;
+    int &npolys                   = st.npolys;
+    float *iterPos                = st.iter_pos;
+    const float *targetPos        = st.target_pos;
+    const float STEP_SIZE         = st.step;
+    static const float SLOP       = 0.01f;
+
+    st.npending = 0;
+    if (!npolys) return false;
+
+    // Find location to steer towards.
+    float steerPos[3];
+    unsigned char steerPosFlag;
+    dtPolyRef steerPosRef;
+
+    if (!getSteerTarget(m_navQuery, iterPos, targetPos, SLOP, polys, npolys,
+                        steerPos, steerPosFlag, steerPosRef))
+        return false;
+
+    bool endOfPath = (steerPosFlag & DT_STRAIGHTPATH_END) ? true : false;
+    bool offMeshConnection =
+        (steerPosFlag & DT_STRAIGHTPATH_OFFMESH_CONNECTION) ? true : false;
+
+    // Find movement delta.
+    float delta[3], len;
+    dtVsub(delta, steerPos, iterPos);
+    len = dtMathSqrtf(dtVdot(delta, delta));
+    // If the steer target is end of path or off-mesh link, do not move past the location.
+    if ((endOfPath || offMeshConnection) && len < STEP_SIZE)
+        len = 1;
+    else
+        len = STEP_SIZE / len;
+    float moveTgt[3];
+    dtVmad(moveTgt, iterPos, delta, len);
+
+    // Move
+    float result[3];
+    dtPolyRef visited[16];
+    int nvisited = 0;
+    m_navQuery->moveAlongSurface(polys[0], iterPos, moveTgt, &m_filter, result,
+                                 visited, &nvisited, 16);
+
+    npolys = fixupCorridor(polys, npolys, st.max_polys, visited, nvisited);
+    npolys = fixupShortcuts(polys, npolys, m_navQuery);
+
+    float h = 0;
+    m_navQuery->getPolyHeight(polys[0], result, &h);
+    result[1] = h;
+    dtVcopy(iterPos, result);
+
+    // Handle end of path and off-mesh links when close enough.
+    if (endOfPath && inRange(iterPos, steerPos, SLOP, 1.0f))
+    {
+        // Reached end of path.
+        dtVcopy(iterPos, targetPos);
+        dtVcopy(&st.pending[st.npending++ * 3], iterPos);
+        st.count++;
+        return false;
+    }
+    else if (offMeshConnection && inRange(iterPos, steerPos, SLOP, 1.0f))
+    {
+        // Reached off-mesh connection.
+        float startPos[3], endPos[3];
+
+        // Advance the path up to and over the off-mesh connection.
+        dtPolyRef prevRef = 0, polyRef = polys[0];
+        int npos = 0;
+        while (npos < npolys && polyRef != steerPosRef)
         {
-            // Reached end of path.
-            dtVcopy(iterPos, targetPos);
-            if (m_nsmoothPath < MAX_SMOOTH)
-            {
-                dtVcopy(&m_smoothPath[m_nsmoothPath * 3], iterPos);
-                m_nsmoothPath++;
-            }
-            break;
+            prevRef = polyRef;
+            polyRef = polys[npos];
+            npos++;
         }
-        else if (offMeshConnection && inRange(iterPos, steerPos, SLOP, 1.0f))
-        {
-            // Reached off-mesh connection.
-            float startPos[3], endPos[3];
+        for (int i = npos; i < npolys; ++i) polys[i - npos] = polys[i];
+        npolys -= npos;
 
-            // Advance the path up to and over the off-mesh connection.
-            dtPolyRef prevRef = 0, polyRef = polys[0];
-            int npos = 0;
-            while (npos < npolys && polyRef != steerPosRef)
+        // Handle the connection.
+        dtStatus status = m_navMesh->getOffMeshConnectionPolyEndPoints(
+            prevRef, polyRef, startPos, endPos);
+        if (dtStatusSucceed(status))
+        {
+            dtVcopy(&st.pending[st.npending++ * 3], startPos);
+            st.count++;
+            // Hack to make the dotted path not visible during off-mesh connection.
+            if (st.count & 1)
             {
-                prevRef = polyRef;
-                polyRef = polys[npos];
-                npos++;
+                dtVcopy(&st.pending[st.npending++ * 3], startPos);
+                st.count++;
             }
-            for (int i = npos; i < npolys; ++i) polys[i - npos] = polys[i];
-            npolys -= npos;
+            // Move position at the other side of the off-mesh link.
+            dtVcopy(iterPos, endPos);
+            float eh = 0.0f;
+            m_navQuery->getPolyHeight(polys[0], iterPos, &eh);
+            iterPos[1] = eh;
+        }
+    }
+
+    // Store results.
+    dtVcopy(&st.pending[st.npending++ * 3], iterPos);
+    st.count++;
+
+    return true;
+}
+
+void RecastNavMesh::grow_corridor(std::vector<unsigned int> &buffer,
+                                  SmoothState &st)
+{
+    // fixupCorridor may prepend the polys visited by one step(at most 16)
+    if ((int)buffer.size() < st.npolys + 16) buffer.resize(st.npolys + 16);
+
+    st.polys     = buffer.data();
+    st.max_polys = (int)buffer.size();
+}
+
+int RecastNavMesh::smooth(dtNavMeshQuery *m_navQuery,
+                          std::vector<unsigned int> &buffer, float *m_spos,
+                          float *m_epos, const unsigned int *m_polys,
+                          int m_npolys, unsigned int m_startRef,
+                          float *m_smoothPath, int size, float step,
+                          bool &truncated) const
+{
+    // ported form RecastDemo void NavMeshTesterTool::recalc()
+    // Iterate over the path to find smooth path on the detail mesh surface.
+    buffer.assign(m_polys, m_polys + m_npolys);
+
+    SmoothState st;
+    st.npolys    = m_npolys;
+    st.step      = step;
+    st.count     = 0;
+    st.npending  = 0;
+    grow_corridor(buffer, st);
+    m_navQuery->closestPointOnPoly(m_startRef, m_spos, st.iter_pos, 0);
+    m_navQuery->closestPointOnPoly(st.polys[m_npolys - 1], m_epos,
+                                   st.target_pos, 0);
+
+    const int MAX_SMOOTH = size;
+    int m_nsmoothPath    = 0;
+    truncated            = MAX_SMOOTH <= 0;
+    if (MAX_SMOOTH <= 0) return 0;
+
+    dtVcopy(&m_smoothPath[m_nsmoothPath * 3], st.iter_pos);
+    m_nsmoothPath++;
+    st.count++;
 
-            // Handle the connection.
-            dtStatus status = m_navMesh->getOffMeshConnectionPolyEndPoints(
-                prevRef, polyRef, startPos, endPos);
-            if (dtStatusSucceed(status))
+    // Move towards target a small advancement at a time until target reached or
+    // when ran out of memory to store the path.
+    bool active = true;
+    while (active && !truncated)
+    {
+        grow_corridor(buffer, st);
+        active = smooth_step(m_navQuery, st);
+        for (int i = 0; i < st.npending && !truncated; i++)
+        {
+            if (m_nsmoothPath >= MAX_SMOOTH)
             {
-                if (m_nsmoothPath < MAX_SMOOTH)
-                {
-                    dtVcopy(&m_smoothPath[m_nsmoothPath * 3], startPos);
-                    m_nsmoothPath++;
-                    // Hack to make the dotted path not visible during off-mesh connection.
-                    if (m_nsmoothPath & 1)
-                    {
-                        dtVcopy(&m_smoothPath[m_nsmoothPath * 3], startPos);
-                        m_nsmoothPath++;
-                    }
-                }
-                // Move position at the other side of the off-mesh link.
-                dtVcopy(iterPos, endPos);
-                float eh = 0.0f;
-                m_navQuery->getPolyHeight(polys[0], iterPos, &eh);
-                iterPos[1] = eh;
+                truncated = true;
+                break;
             }
+            dtVcopy(&m_smoothPath[m_nsmoothPath * 3], &st.pending[i * 3]);
+            m_nsmoothPath++;
         }
+        // a step not reaching the end always emit more points
+        if (active && m_nsmoothPath >= MAX_SMOOTH) truncated = true;
+    }
+
+    return m_nsmoothPath;
+}
+
+RecastNavMesh::PathIterator::PathIterator()
+{
+    _owner       = nullptr;
+    _generation  = 0;
+    _active      = false;
+    _pending_pos = 0;
+
+    memset(&_state, 0, sizeof(_state));
+}
+
+bool RecastNavMesh::PathIterator::done() const
+{
+    return !_active && _pending_pos >= _state.npending;
+}
+
+int RecastNavMesh::PathIterator::next(float *points, int max_size)
+{
+    int size = 0;
 
-        // Store results.
-        if (m_nsmoothPath < MAX_SMOOTH)
+    // points left by last call
+    while (size < max_size && _pending_pos < _state.npending)
+    {
+        dtVcopy(&points[size++ * 3], &_state.pending[_pending_pos++ * 3]);
+    }
+    if (size >= max_size || !_active || !_owner) return size;
+
+    QueryContext *ctx = _owner->acquire_query();
+    if (!ctx) return size;
+
+    // the corridor refs are of the replaced mesh, stop there
+    if (ctx->state->generation != _generation)
+    {
+        _active = false;
+        _owner->release_query(ctx);
+        return size;
+    }
+
+    while (size < max_size && _active)
+    {
+        grow_corridor(_polys, _state);
+        _active      = _owner->smooth_step(ctx->query, _state);
+        _pending_pos = 0;
+        while (size < max_size && _pending_pos < _state.npending)
         {
-            dtVcopy(&m_smoothPath[m_nsmoothPath * 3], iterPos);
-            m_nsmoothPath++;
+            dtVcopy(&points[size++ * 3], &_state.pending[_pending_pos++ * 3]);
         }
     }
 
-    return m_nsmoothPath;
+    _owner->release_query(ctx);
+    return size;
 }
 
 /**
@@ -1021,29 +3630,36 @@ unsigned int RecastNavMesh::follow(float sx, float sy, float sz, float ex,
                                    int max_size, int &use_size, float step)
 {
     use_size = 0;
-    // ported form RecastDemo void NavMeshTesterTool::recalc()
-    if (!_nav_mesh) return DT_FAILURE;
+    QueryContext *ctx = acquire_query();
+    if (!ctx) return DT_FAILURE;
 
-    if (!_nav_query)
-    {
-        _nav_query = dtAllocNavMeshQuery();
-        if (!_nav_query->init(_nav_mesh, 2048)) return DT_FAILURE;
-    }
+    unsigned int status = raw_follow(ctx, sx, sy, sz, ex, ey, ez, points,
+                                     max_size, use_size, step);
+
+    release_query(ctx);
+    return status;
+}
 
+unsigned int RecastNavMesh::raw_follow(QueryContext *ctx, float sx, float sy,
+                                       float sz, float ex, float ey, float ez,
+                                       float *points, int max_size,
+                                       int &use_size, float step) const
+{
+    dtNavMeshQuery *query = ctx->query;
+
+    // ported form RecastDemo void NavMeshTesterTool::recalc()
     float m_spos[] = {sx, sy, sz};
     float m_epos[] = {ex, ey, ez};
 
     dtPolyRef m_startRef;
     dtPolyRef m_endRef;
-    _nav_query->findNearestPoly(m_spos, _poly_pick_ext, _filter, &m_startRef, 0);
-    _nav_query->findNearestPoly(m_epos, _poly_pick_ext, _filter, &m_endRef, 0);
+    find_nearest_poly(ctx->state, query, m_spos, m_startRef);
+    find_nearest_poly(ctx->state, query, m_epos, m_endRef);
     if (!m_startRef || !m_endRef) return 0;
 
     int m_npolys = 0;
-    dtPolyRef m_polys[MAX_POLYS];
-    dtStatus status =
-        _nav_query->findPath(m_startRef, m_endRef, m_spos, m_epos, _filter,
-                             m_polys, &m_npolys, MAX_POLYS);
+    dtStatus status = find_path(ctx->state, query, m_startRef, m_endRef,
+                                m_spos, m_epos, ctx->polys, m_npolys);
     if (dtStatusFailed(status))
     {
         return DT_FAILURE;
@@ -1051,12 +3667,266 @@ unsigned int RecastNavMesh::follow(float sx, float sy, float sz, float ex,
 
     if (!m_npolys) return status;
 
-    use_size = smooth(m_spos, m_epos, m_polys, m_npolys, m_startRef, points,
-                      max_size, step);
+    bool truncated = false;
+    use_size = smooth(query, ctx->smooth, m_spos, m_epos, ctx->polys.data(),
+                      m_npolys, m_startRef, points, max_size, step, truncated);
+    if (truncated) status |= DT_BUFFER_TOO_SMALL;
+
+    return status;
+}
+
+unsigned int RecastNavMesh::find_path(const MeshState *state,
+                                      dtNavMeshQuery *query,
+                                      unsigned int start_ref,
+                                      unsigned int end_ref, const float *spos,
+                                      const float *epos,
+                                      std::vector<unsigned int> &polys,
+                                      int &npolys) const
+{
+    npolys = 0;
+
+    const dtNavMesh *nav_mesh = state->nav_mesh;
+    TileStream *tile_stream   = state->tile_stream;
+    PathCache *path_cache     = state->path_cache;
+    const ClusterGraph *graph = state->cluster_graph;
+
+    // prefetch the tiles along the way, a path through tiles not resident
+    // is partial until they added
+    if (tile_stream) tile_stream->touch_segment(spos, epos);
+
+    // every poly of a corridor from findPath is a node of the pool, so it
+    // never need more
+    const int max_nodes = query->getNodePool()->getMaxNodes();
+    if ((int)polys.size() < max_nodes) polys.resize(max_nodes);
+
+    if (path_cache)
+    {
+        unsigned int status = 0;
+        npolys = path_cache->get(nav_mesh, start_ref, end_ref, _filter, polys,
+                                 status);
+        if (npolys)
+        {
+            if (tile_stream)
+                tile_stream->touch_polys(nav_mesh, polys.data(), npolys);
+            return status;
+        }
+    }
+
+    // plan on the cluster graph first, fall back to the plain search if same
+    // cluster, no route or the graph out of date
+    dtStatus status = DT_FAILURE;
+    if (graph)
+    {
+        status = graph->find_path(nav_mesh, _filter, start_ref, end_ref,
+                                  polys, npolys);
+    }
+    if (dtStatusFailed(status))
+    {
+        status = query->findPath(start_ref, end_ref, spos, epos, _filter,
+                                 polys.data(), &npolys, (int)polys.size());
+        _node_pool->record(query->getNodePool()->getNodeCount(), max_nodes,
+                           dtStatusDetail(status, DT_OUT_OF_NODES));
+    }
+
+    // keep the tiles of the corridor hot. A partial corridor may stop at a
+    // tile not resident, request the tiles around it's end so a retry get
+    // further. Not cached as it will change
+    if (tile_stream)
+        tile_stream->touch_polys(nav_mesh, polys.data(), npolys);
+    const bool streaming =
+        tile_stream && dtStatusDetail(status, DT_PARTIAL_RESULT);
+    if (streaming && npolys > 0)
+    {
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly     = nullptr;
+        if (dtStatusSucceed(nav_mesh->getTileAndPolyByRef(
+                polys[npolys - 1], &tile, &poly)))
+        {
+            const dtMeshHeader *header = tile->header;
+            const float tile_width     = nav_mesh->getParams()->tileWidth;
+            float center[3], ext[3];
+            for (int k = 0; k < 3; k++)
+            {
+                center[k] = (header->bmin[k] + header->bmax[k]) * 0.5f;
+                ext[k]    = (header->bmax[k] - header->bmin[k]) * 0.5f
+                         + tile_width;
+            }
+            tile_stream->touch(center, ext);
+        }
+    }
+
+    if (path_cache && !dtStatusFailed(status) && !streaming)
+    {
+        path_cache->put(start_ref, end_ref, _filter, polys.data(), npolys,
+                        status);
+    }
+
+    return status;
+}
+
+void RecastNavMesh::set_path_cache(int capacity)
+{
+    _path_cache_capacity = capacity > 0 ? capacity : 0;
+
+    MeshState *state = current();
+    delete state->path_cache;
+    state->path_cache = capacity > 0 ? new PathCache(capacity) : nullptr;
+}
+
+void RecastNavMesh::set_point_grid(float cell_size)
+{
+    if (cell_size == 0) cell_size = _setting->cellSize * 8;
+    _point_grid_cell = cell_size;
+
+    MeshState *state = current();
+    delete state->point_grid;
+    state->point_grid = nullptr;
+    if (cell_size < 0) return;
+
+    state->point_grid = new PointGrid(cell_size);
+    state->point_grid->sync(state->nav_mesh);
+}
+
+void RecastNavMesh::find_nearest_poly(const MeshState *state,
+                                      dtNavMeshQuery *query, const float *pos,
+                                      unsigned int &ref) const
+{
+    // request the tiles, the query go on with what is resident now
+    if (state->tile_stream) state->tile_stream->touch(pos, _poly_pick_ext);
+
+    if (state->point_grid
+        && state->point_grid->locate(state->nav_mesh, query, _filter, pos,
+                                     _poly_pick_ext, ref))
+    {
+        return;
+    }
+
+    ref = 0;
+    query->findNearestPoly(pos, _poly_pick_ext, _filter, &ref, 0);
+}
+
+void RecastNavMesh::get_path_cache_stat(PathCacheStat &stat) const
+{
+    memset(&stat, 0, sizeof(stat));
+    const PathCache *path_cache = current()->path_cache;
+    if (!path_cache) return;
+
+    stat.hit      = path_cache->hit();
+    stat.miss     = path_cache->miss();
+    stat.size     = path_cache->size();
+    stat.capacity = path_cache->capacity();
+}
+
+unsigned int RecastNavMesh::set_poly_flags(unsigned int ref,
+                                           unsigned short flags)
+{
+    MeshState *state = current();
+    if (!state->nav_mesh) return DT_FAILURE;
+
+    dtStatus status = state->nav_mesh->setPolyFlags(ref, flags);
+
+    // the corridors through this poly may not pass the filter any more, the
+    // cluster graph check the flags of every node it cross on each query
+    if (dtStatusSucceed(status) && state->path_cache)
+        state->path_cache->clear();
+
+    return status;
+}
+
+/**
+ * pathfinding(follow), but the points are pulled from iter on demand
+ */
+unsigned int RecastNavMesh::follow(float sx, float sy, float sz, float ex,
+                                   float ey, float ez, PathIterator &iter,
+                                   float step)
+{
+    iter._owner       = this;
+    iter._active      = false;
+    iter._pending_pos = 0;
+    memset(&iter._state, 0, sizeof(iter._state));
+
+    QueryContext *ctx = acquire_query();
+    if (!ctx) return DT_FAILURE;
+
+    dtNavMeshQuery *query = ctx->query;
+    iter._generation      = ctx->state->generation;
+
+    float m_spos[] = {sx, sy, sz};
+    float m_epos[] = {ex, ey, ez};
+
+    dtPolyRef m_startRef;
+    dtPolyRef m_endRef;
+    find_nearest_poly(ctx->state, query, m_spos, m_startRef);
+    find_nearest_poly(ctx->state, query, m_epos, m_endRef);
+    if (!m_startRef || !m_endRef)
+    {
+        release_query(ctx);
+        return 0;
+    }
+
+    int m_npolys = 0;
+    dtStatus status = find_path(ctx->state, query, m_startRef, m_endRef,
+                                m_spos, m_epos, iter._polys, m_npolys);
+    if (dtStatusFailed(status) || !m_npolys)
+    {
+        release_query(ctx);
+        return dtStatusFailed(status) ? DT_FAILURE : status;
+    }
 
+    SmoothState &st = iter._state;
+    st.npolys       = m_npolys;
+    st.step         = step;
+    grow_corridor(iter._polys, st);
+    query->closestPointOnPoly(m_startRef, m_spos, st.iter_pos, 0);
+    query->closestPointOnPoly(st.polys[m_npolys - 1], m_epos, st.target_pos,
+                              0);
+
+    // the start point is the first point
+    dtVcopy(st.pending, st.iter_pos);
+    st.npending  = 1;
+    st.count     = 1;
+    iter._active = true;
+
+    release_query(ctx);
     return status;
 }
 
+unsigned int RecastNavMesh::corridor(float sx, float sy, float sz, float ex,
+                                     float ey, float ez, unsigned int *polys,
+                                     int max_polys, int &npolys)
+{
+    npolys = 0;
+    QueryContext *ctx = acquire_query();
+    if (!ctx) return DT_FAILURE;
+
+    dtNavMeshQuery *query = ctx->query;
+    float m_spos[] = {sx, sy, sz};
+    float m_epos[] = {ex, ey, ez};
+
+    dtPolyRef m_startRef;
+    dtPolyRef m_endRef;
+    find_nearest_poly(ctx->state, query, m_spos, m_startRef);
+    find_nearest_poly(ctx->state, query, m_epos, m_endRef);
+    if (!m_startRef || !m_endRef)
+    {
+        release_query(ctx);
+        return DT_FAILURE;
+    }
+
+    int m_npolys = 0;
+    dtStatus status = find_path(ctx->state, query, m_startRef, m_endRef,
+                                m_spos, m_epos, ctx->polys, m_npolys);
+    if (!dtStatusFailed(status))
+    {
+        npolys = dtMin(m_npolys, dtMax(max_polys, 0));
+        if (npolys) memcpy(polys, ctx->polys.data(), npolys * sizeof(*polys));
+        if (npolys < m_npolys) status |= DT_BUFFER_TOO_SMALL;
+    }
+
+    release_query(ctx);
+    return dtStatusFailed(status) ? DT_FAILURE : status;
+}
+
 bool RecastNavMesh::is_succeed(unsigned int status)
 {
     return dtStatusSucceed(status);
@@ -1065,6 +3935,14 @@ bool RecastNavMesh::is_partia(unsigned int status)
 {
     return dtStatusDetail(status, DT_PARTIAL_RESULT);
 }
+bool RecastNavMesh::is_truncated(unsigned int status)
+{
+    return dtStatusDetail(status, DT_BUFFER_TOO_SMALL);
+}
+bool RecastNavMesh::is_in_progress(unsigned int status)
+{
+    return dtStatusInProgress(status);
+}
 
 /**
  * pathfinding(straight)
@@ -1073,32 +3951,102 @@ bool RecastNavMesh::is_partia(unsigned int status)
  */
 unsigned int RecastNavMesh::straight(float sx, float sy, float sz, float ex,
                                      float ey, float ez, float *points,
-                                     int max_size, int &use_size, int option)
+                                     int max_size, int &use_size, int option,
+                                     int *path_size)
 {
     use_size = 0;
-    // ported form RecastDemo void NavMeshTesterTool::recalc()
-    if (!_nav_mesh) return DT_FAILURE;
+    if (path_size) *path_size = 0;
+    QueryContext *ctx = acquire_query();
+    if (!ctx) return DT_FAILURE;
+
+    unsigned int status = raw_straight(ctx, sx, sy, sz, ex, ey, ez, points,
+                                       max_size, use_size, option, path_size);
+
+    release_query(ctx);
+    return status;
+}
+
+unsigned int RecastNavMesh::random_point(float (*frand)(), float *point)
+{
+    QueryContext *ctx = acquire_query();
+    if (!ctx) return DT_FAILURE;
+
+    dtPolyRef ref = 0;
+    unsigned int status =
+        ctx->query->findRandomPoint(_filter, frand, &ref, point);
+
+    release_query(ctx);
+    return status;
+}
+
+unsigned int RecastNavMesh::raycast(float sx, float sy, float sz, float ex,
+                                    float ey, float ez, float &t,
+                                    float *normal, unsigned int *last_ref)
+{
+    t = 0;
+    memset(normal, 0, sizeof(float) * 3);
+    if (last_ref) *last_ref = 0;
+    QueryContext *ctx = acquire_query();
+    if (!ctx) return DT_FAILURE;
+
+    float spos[] = {sx, sy, sz};
+    float epos[] = {ex, ey, ez};
+
+    dtPolyRef start_ref = 0;
+    find_nearest_poly(ctx->state, ctx->query, spos, start_ref);
+    if (!start_ref)
+    {
+        release_query(ctx);
+        return DT_FAILURE;
+    }
 
-    if (!_nav_query)
+    // only the last visited poly is wanted, but the whole path must fit
+    std::vector<dtPolyRef> &path = ctx->polys;
+    if (path.empty()) path.resize(256);
+
+    dtRaycastHit hit;
+    unsigned int status = 0;
+    while (true)
     {
-        _nav_query = dtAllocNavMeshQuery();
-        if (!_nav_query->init(_nav_mesh, 2048)) return DT_FAILURE;
+        memset(&hit, 0, sizeof(hit));
+        hit.path    = path.data();
+        hit.maxPath = (int)path.size();
+        status = ctx->query->raycast(start_ref, spos, epos, _filter, 0, &hit);
+        if (!is_truncated(status)) break;
+
+        path.resize(path.size() * 2);
     }
 
+    t = hit.t;
+    dtVcopy(normal, hit.hitNormal);
+    if (last_ref && hit.pathCount) *last_ref = path[hit.pathCount - 1];
+
+    release_query(ctx);
+    return status;
+}
+
+unsigned int RecastNavMesh::raw_straight(QueryContext *ctx, float sx,
+                                         float sy, float sz, float ex,
+                                         float ey, float ez, float *points,
+                                         int max_size, int &use_size,
+                                         int option, int *path_size) const
+{
+    dtNavMeshQuery *query = ctx->query;
+
+    // ported form RecastDemo void NavMeshTesterTool::recalc()
     float m_spos[] = {sx, sy, sz};
     float m_epos[] = {ex, ey, ez};
 
     dtPolyRef m_startRef;
     dtPolyRef m_endRef;
-    _nav_query->findNearestPoly(m_spos, _poly_pick_ext, _filter, &m_startRef, 0);
-    _nav_query->findNearestPoly(m_epos, _poly_pick_ext, _filter, &m_endRef, 0);
+    find_nearest_poly(ctx->state, query, m_spos, m_startRef);
+    find_nearest_poly(ctx->state, query, m_epos, m_endRef);
     if (!m_startRef || !m_endRef) return 0;
 
     int m_npolys = 0;
-    dtPolyRef m_polys[MAX_POLYS];
-    dtStatus status =
-        _nav_query->findPath(m_startRef, m_endRef, m_spos, m_epos, _filter,
-                             m_polys, &m_npolys, MAX_POLYS);
+    dtStatus status = find_path(ctx->state, query, m_startRef, m_endRef,
+                                m_spos, m_epos, ctx->polys, m_npolys);
+    const dtPolyRef *m_polys = ctx->polys.data();
 
     if (!m_npolys) return status;
 
@@ -1107,8 +4055,8 @@ unsigned int RecastNavMesh::straight(float sx, float sy, float sz, float ex,
     dtVcopy(epos, m_epos);
     if (m_polys[m_npolys - 1] != m_endRef)
     {
-        status = _nav_query->closestPointOnPoly(m_polys[m_npolys - 1], m_epos,
-                                                epos, 0);
+        status = query->closestPointOnPoly(m_polys[m_npolys - 1], m_epos, epos,
+                                           0);
         if (dtStatusFailed(status)) return status;
     }
 
@@ -1117,9 +4065,174 @@ unsigned int RecastNavMesh::straight(float sx, float sy, float sz, float ex,
     ///  #dtStraightPathFlags) [opt]
     ///  @param[out]	straightPathRefs	The reference id of the polygon that
     ///  is being entered at each point. [opt]
-    status = _nav_query->findStraightPath(m_spos, epos, m_polys, m_npolys,
-                                          points, nullptr, nullptr, &use_size,
-                                          max_size, option);
+    status = query->findStraightPath(m_spos, epos, m_polys, m_npolys, points,
+                                     nullptr, nullptr, &use_size, max_size,
+                                     option);
+    if (!path_size) return status;
+
+    // count the whole path in the arena, only if the caller ask
+    *path_size = use_size;
+    std::vector<float> &corners = ctx->straight;
+    while (dtStatusSucceed(status)
+           && dtStatusDetail(status, DT_BUFFER_TOO_SMALL))
+    {
+        corners.resize(dtMax((int)corners.size(), *path_size * 3) * 2);
+        status = query->findStraightPath(
+            m_spos, epos, m_polys, m_npolys, corners.data(), nullptr, nullptr,
+            path_size, (int)corners.size() / 3, option);
+    }
+    if (*path_size > use_size) status |= DT_BUFFER_TOO_SMALL;
 
     return status;
 }
+
+void RecastNavMesh::set_node_pool(int max_nodes, bool adaptive)
+{
+    _node_pool->configure(max_nodes, adaptive);
+}
+
+void RecastNavMesh::set_node_pool_sink(const NodePoolSink &sink)
+{
+    _node_pool->set_sink(sink);
+}
+
+void RecastNavMesh::get_node_pool_stat(NodePoolStat &stat) const
+{
+    _node_pool->get_stat(stat);
+}
+
+void RecastNavMesh::set_threads(int threads)
+{
+    std::lock_guard<std::mutex> guard(_pool_mutex);
+
+    // a build or batch still running hold the old pool, it's destroyed by
+    // the last of them
+    _threads = threads;
+    _thread_pool.reset();
+}
+
+std::shared_ptr<ThreadPool> RecastNavMesh::thread_pool()
+{
+    std::lock_guard<std::mutex> guard(_pool_mutex);
+    if (!_thread_pool) _thread_pool = std::make_shared<ThreadPool>(_threads);
+
+    return _thread_pool;
+}
+
+int RecastNavMesh::run_batch(
+    int count, float *points, int max_size, int *offsets, int *sizes,
+    unsigned int *status,
+    const std::function<unsigned int(QueryContext *, int, float *, int &)>
+        &query)
+{
+    if (count <= 0) return 0;
+
+    std::shared_ptr<ThreadPool> pool = thread_pool();
+
+    // small chunks so the stealing can balance long and short paths, but
+    // large enough to amortize acquiring a query context
+    const int grain = rcMax(1, count / (pool->size() * 8));
+    pool->parallel_for(count, grain, [&](int begin, int end) {
+        QueryContext *ctx = acquire_query();
+        for (int i = begin; i < end; i++)
+        {
+            sizes[i] = 0;
+            status[i] =
+                ctx ? query(ctx, i, points + i * max_size * 3, sizes[i])
+                    : DT_FAILURE;
+        }
+        if (ctx) release_query(ctx);
+    });
+
+    // every path was written at a fixed slot, pack them one after another.
+    // The destination never pass the source slot, so moving forward is safe
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        offsets[i] = total;
+        if (sizes[i] && total != i * max_size)
+        {
+            memmove(points + total * 3, points + i * max_size * 3,
+                    sizes[i] * 3 * sizeof(float));
+        }
+        total += sizes[i];
+    }
+
+    return total;
+}
+
+int RecastNavMesh::follow_batch(int count, const float *starts,
+                                const float *ends, float *points, int max_size,
+                                int *offsets, int *sizes, unsigned int *status,
+                                float step)
+{
+    return run_batch(
+        count, points, max_size, offsets, sizes, status,
+        [&](QueryContext *ctx, int i, float *out, int &use_size) {
+            const float *s = starts + i * 3;
+            const float *e = ends + i * 3;
+            return raw_follow(ctx, s[0], s[1], s[2], e[0], e[1], e[2], out,
+                              max_size, use_size, step);
+        });
+}
+
+int RecastNavMesh::straight_batch(int count, const float *starts,
+                                  const float *ends, float *points,
+                                  int max_size, int *offsets, int *sizes,
+                                  unsigned int *status, int option)
+{
+    return run_batch(
+        count, points, max_size, offsets, sizes, status,
+        [&](QueryContext *ctx, int i, float *out, int &use_size) {
+            const float *s = starts + i * 3;
+            const float *e = ends + i * 3;
+            return raw_straight(ctx, s[0], s[1], s[2], e[0], e[1], e[2], out,
+                                max_size, use_size, option, nullptr);
+        });
+}
+
+int RecastNavMesh::raycast_batch(int count, const float *starts,
+                                 const float *ends, float *t, float *normals,
+                                 unsigned int *last_refs, unsigned int *status)
+{
+    if (count <= 0) return 0;
+
+    std::shared_ptr<ThreadPool> pool = thread_pool();
+
+    // a ray is much cheaper than a path, chunks are larger than run_batch
+    std::atomic<int> succeed(0);
+    const int grain = rcMax(16, count / (pool->size() * 8));
+    pool->parallel_for(count, grain, [&](int begin, int end) {
+        QueryContext *ctx = acquire_query();
+        int ok            = 0;
+        for (int i = begin; i < end; i++)
+        {
+            float spos[] = {starts[i], starts[count + i],
+                            starts[count * 2 + i]};
+            float epos[] = {ends[i], ends[count + i], ends[count * 2 + i]};
+            float normal[3]     = {0, 0, 0};
+            dtPolyRef start_ref = 0;
+            dtPolyRef last_ref  = 0;
+
+            t[i]      = 0;
+            status[i] = DT_FAILURE;
+            if (ctx) find_nearest_poly(ctx->state, ctx->query, spos, start_ref);
+            if (start_ref)
+            {
+                status[i] = simd_raycast(ctx->state->nav_mesh, _filter,
+                                         start_ref, spos, epos, t[i], normal,
+                                         last_ref);
+            }
+
+            normals[i]             = normal[0];
+            normals[count + i]     = normal[1];
+            normals[count * 2 + i] = normal[2];
+            last_refs[i]           = last_ref;
+            if (dtStatusSucceed(status[i])) ok++;
+        }
+        if (ctx) release_query(ctx);
+        succeed += ok;
+    });
+
+    return succeed;
+}
@@ -1,16 +1,45 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 class dtNavMesh;
-class InputGeom;
+class BuildGeom;
 class rcContext;
+class BuildContext;
 class dtQueryFilter;
 class dtNavMeshQuery;
+class ThreadPool;
+class PathCache;
+class TileCache;
+class TileStream;
+class ClusterGraph;
+class NodePoolTuner;
+class PointGrid;
+struct rcHeightfield;
+struct rcPolyMesh;
 
 /**
  * Recast Navigation mesh toolset for path-finding, building mesh data
+ *
+ * follow and straight are thread safe once the mesh is loaded(or built), every
+ * calling thread get it's own dtNavMeshQuery from a pool while the dtNavMesh is
+ * shared read-only. load, build and swap_mesh may run while other threads
+ * query, the new mesh is published at once and the queries running finish on
+ * the old one, freed by the next of them(or reclaim_retired) after the last
+ * query returned. They must not run concurrently with each other or any
+ * other call.
  */
 class RecastNavMesh
 {
+    friend class PathScheduler;
+    friend class Crowd;
+
 public:
     /// These are just sample areas to use consistent values across the samples.
     /// The use should specify these base on his needs.
@@ -66,7 +95,201 @@ public:
         int partitionType;
     };
 
-    static const int MAX_POLYS = 256;
+    /// mesh data file format, see save
+    enum MeshFormat
+    {
+        MESH_FORMAT_SET         = 1, /// RecastDemo compatible tile set
+        MESH_FORMAT_MMAP        = 2, /// page aligned tiles with offset table
+        MESH_FORMAT_COMPRESSED  = 3, /// every tile compressed independently
+        MESH_FORMAT_TILE_CACHE  = 4, /// compressed layers of build_tile_cache
+        MESH_FORMAT_LEAN        = 5, /// 16 bits verts, no detail mesh
+        MESH_FORMAT_LEAN_DETAIL = 6, /// MESH_FORMAT_LEAN, with detail mesh
+    };
+
+    /// statistics of the polygon corridor cache, see set_path_cache
+    struct PathCacheStat
+    {
+        unsigned long long hit;
+        unsigned long long miss;
+        int size;     /// corridors cached now
+        int capacity; /// max corridors cached
+    };
+
+    /// meshes replaced under running queries, see swap_mesh
+    struct SwapStat
+    {
+        unsigned long long swaps;     /// meshes published
+        unsigned long long reclaimed; /// replaced meshes freed
+        int retired; /// replaced but still pinned by a query
+    };
+
+    /// tiles resident of a streaming mesh, see load_streaming
+    struct StreamStat
+    {
+        int tiles;             /// tiles in the file
+        int resident;          /// tiles in the mesh now
+        int pending;           /// requested but not added yet
+        size_t resident_bytes; /// bytes of the tiles in the mesh
+        size_t budget;
+        unsigned long long loads;
+        unsigned long long evictions;
+        unsigned long long failures; /// tile reads or adds failed
+        int failed; /// tiles given up after failing again and again
+    };
+
+    /// tiles of the current mesh, see get_mesh_stat
+    struct MeshStat
+    {
+        int tiles;
+        int polys;
+        size_t data_bytes;   /// tile data, what the tiles take in memory
+        size_t detail_bytes; /// of the data, the detail meshes
+    };
+
+    /// allocation hints of Recast and Detour, see MemoryStat
+    enum MemoryHint
+    {
+        MEMORY_RC_PERM, /// RC_ALLOC_PERM
+        MEMORY_RC_TEMP, /// RC_ALLOC_TEMP
+        MEMORY_DT_PERM, /// DT_ALLOC_PERM
+        MEMORY_DT_TEMP, /// DT_ALLOC_TEMP
+        MEMORY_HINTS,
+    };
+
+    /// bytes allocated by Recast and Detour, all threads, see get_memory_stat
+    struct MemoryStat
+    {
+        size_t bytes[MEMORY_HINTS]; /// alive now
+        size_t peak[MEMORY_HINTS];  /// most alive at once since reset
+        size_t total_bytes;         /// of all hints
+        size_t total_peak;
+        size_t arena_bytes; /// reserved by the build arenas now
+        size_t arena_peak;
+        unsigned long long allocs;
+        unsigned long long arena_allocs; /// bumped from a build arena
+        /// not freed by the builds, released when their arena rewound
+        unsigned long long reclaimed;
+    };
+
+    /// events of the query node pools, see set_node_pool_sink
+    enum NodePoolEvent
+    {
+        NODE_POOL_RESIZED      = 1, /// adaptive mode changed the size
+        NODE_POOL_OUT_OF_NODES = 2, /// a search ended by DT_OUT_OF_NODES
+    };
+
+    /// searches counted by touched nodes, bucket i for less than 2^i nodes
+    static const int NODE_POOL_BUCKETS = 17;
+
+    /// statistics of the query node pools, see set_node_pool
+    struct NodePoolStat
+    {
+        int max_nodes; /// size of every pool now
+        bool adaptive;
+        int high_water; /// most nodes a search touched
+        unsigned long long searches;
+        unsigned long long out_of_nodes;
+        unsigned long long resizes;
+        unsigned long long histogram[NODE_POOL_BUCKETS];
+    };
+
+    /**
+     * receive node pool events, called from the querying threads
+     * @param event see NodePoolEvent
+     * @param max_nodes the new size if resized, else size of the pool
+     * @param used_nodes nodes touched by the search caused the event
+     */
+    typedef std::function<void(int event, int max_nodes, int used_nodes)>
+        NodePoolSink;
+
+    /**
+     * statistics of a build, see build. Stage times of a tiled build are
+     * summed over all tiles(cpu time), total_ms is the wall time
+     */
+    struct BuildStat
+    {
+        float load_ms; /// obj parse, or geometry cache read if geom_cached
+        float total_ms;
+        float rasterize_ms;
+        float filter_ms;
+        float compact_ms;
+        float erode_ms;
+        float mark_ms; /// convex volumes
+        float distance_field_ms;
+        float regions_ms;
+        float contours_ms;
+        float polymesh_ms;
+        float detail_ms;
+
+        /// size of every intermediate result, the largest tile if tiled
+        size_t heightfield_bytes;
+        size_t compact_bytes;
+        size_t contour_bytes;
+        size_t polymesh_bytes;
+        size_t detail_bytes;
+        /// intermediate results alive at the same time, per tile if tiled
+        size_t peak_bytes;
+
+        int verts; /// output nav mesh
+        int polys;
+        int tiles;
+        bool geom_cached;
+    };
+
+    /**
+     * receive build logs
+     * @param category 1 progress, 2 warning, 3 error(see rcLogCategory)
+     */
+    typedef std::function<void(int category, const char *msg)> LogSink;
+
+private:
+    /// state of walking along a corridor, see smooth_step
+    struct SmoothState
+    {
+        unsigned int *polys; /// corridor
+        int npolys;
+        int max_polys;
+        float iter_pos[3];
+        float target_pos[3];
+        float step;
+        int count;        /// points emitted so far
+        int npending;     /// points emitted by the last step
+        float pending[9]; /// at most 3 points per step
+    };
+
+public:
+    /**
+     * resumable follow path, hold the corridor and the current position so
+     * the smoothed points are computed only when pulled. The path is not
+     * limited by any output buffer. Must not outlive the RecastNavMesh, if
+     * the mesh is replaced the iteration stop there(done)
+     */
+    class PathIterator
+    {
+    public:
+        PathIterator();
+
+        /// no more points
+        bool done() const;
+
+        /**
+         * get the next smoothed points, thread safe as long as every thread
+         * use it's own iterator
+         * @param points output buffer of max_size * 3 floats
+         * @return point count written, less than max_size only if done
+         */
+        int next(float *points, int max_size);
+
+    private:
+        friend class RecastNavMesh;
+
+        RecastNavMesh *_owner;
+        unsigned int _generation; /// mesh the corridor is on
+        bool _active;     /// still walking along the corridor
+        int _pending_pos; /// next point to return in _state.pending
+        SmoothState _state;
+        std::vector<unsigned int> _polys;
+    };
 
 public:
     RecastNavMesh();
@@ -82,28 +305,184 @@ public:
 
     static bool is_succeed(unsigned int status);
     static bool is_partia(unsigned int status);
+    /// the path is longer than the points buffer, only the head is written
+    static bool is_truncated(unsigned int status);
+    /// succeed but not done yet, eg. update_obstacles out of budget
+    static bool is_in_progress(unsigned int status);
     ////////////////////////////////////////////////////////////////////////////
 
     /**
      * load mesh data pre generated from Recast
      * @param path a mesh data file
+     * @param use_mmap map a MESH_FORMAT_MMAP file into memory and use the
+     *        tiles in place, pages are only read when touched. Ignored for
+     *        other format
+     */
+    bool load(const char *path, bool use_mmap = false);
+
+    /**
+     * open a MESH_FORMAT_MMAP file for streaming, only the tile offset table
+     * is read. Tiles are read by a background io thread as queries or
+     * interest regions touch them, and added at update_streaming. A query
+     * touching a tile not added yet see no mesh there, it's tiles are
+     * requested and the query succeed once they added. A tile failed to read
+     * is requested again after 2, 4, 8.. updates and given up after a few
+     * tries, see StreamStat
+     * @param budget bytes of tiles resident at most, the coldest tiles are
+     *        evicted when exceeded
+     */
+    bool load_streaming(const char *path, size_t budget);
+
+    /**
+     * generated mesh data from a obj/gset file. The current mesh keep
+     * serving queries until the new one is built, and is kept if fail
+     * @param from a obj/gset file
+     * @param stat [out] stage times, memory and output size of the build
+     */
+    bool build(const char *from, BuildStat *stat = nullptr);
+
+    /**
+     * generated tiled mesh data from a obj/gset file. The bounds are split by
+     * Setting::tileSize and every tile is built on a worker pool. The
+     * geometry is kept for rebuild
+     * @param from a obj/gset file
+     * @param threads worker count, 0 to use all hardware threads
+     * @param stat [out] stage times, memory and output size of the build
+     */
+    bool build_tiled(const char *from, int threads = 0,
+                     BuildStat *stat = nullptr);
+
+    /**
+     * generated the meshes of several agent profiles from a obj/gset file in
+     * one pass. The file is parsed, the walkable triangles marked and the
+     * heightfield rasterized once, every profile then filter, compact, erode
+     * and triangulate it starting from the same rasterized spans. Spans are
+     * merged within the smallest agentMaxClimb of all profiles, so a profile
+     * of a larger climb may differ from a build alone. Every mesh
+     * get it's own dtNavMesh published as build does, save each to emit it's
+     * file. Logs go to the sink of meshes[0]
+     * @param from a obj/gset file
+     * @param meshes every one built with it's own Setting, all must share
+     *        cellSize, cellHeight and agentMaxSlope
+     * @param stats [out] count stats, one per mesh. load_ms and rasterize_ms
+     *        are of the shared pass, the same in every stat
+     */
+    static bool build_profiles(const char *from, RecastNavMesh *const *meshes,
+                               int count, BuildStat *stats = nullptr);
+
+    /**
+     * generated tiled mesh data from a obj too large for memory, straight to
+     * a MESH_FORMAT_SET file. The obj is streamed into per tile buckets on
+     * disk beside the output, then every tile is built from it's own bucket
+     * and written once done, the memory is bounded by tile size and worker
+     * count rather than the world. The mesh is not loaded, load(to) for it.
+     * Fail and remove to if any tile failed to build
+     * @param from a obj file
+     * @param to the mesh file
+     * @param threads worker count, 0 to use all hardware threads
+     * @param budget bytes of triangles buffered before spilled to disk, 0 to
+     *        use 64MB
+     * @param stat [out] stage times, memory and output size of the build
+     */
+    bool build_streaming(const char *from, const char *to, int threads = 0,
+                         size_t budget = 0, BuildStat *stat = nullptr);
+
+    /**
+     * publish the mesh of from(with it's tile cache, tile stream and cluster
+     * graph) to the queries of this, from is left empty. Lock free for the
+     * queries, those running finish on the old mesh which is freed at the
+     * next publish or reclaim_retired once the last of them returned, never
+     * by a query thread. So a mesh can be built or loaded by another
+     * RecastNavMesh off the serving threads and swapped in between queries
+     * @return false if from has no mesh
      */
-    bool load(const char *path);
+    bool swap_mesh(RecastNavMesh &from);
+
+    /// get the meshes published and freed so far
+    void get_swap_stat(SwapStat &stat) const;
 
     /**
-     * generated mesh data from a obj/gset file
+     * free the replaced meshes(and cluster graphs) no query use any more, on
+     * the calling thread. Queries never free them, it may join the io thread
+     * of a stream or unmap a file. They are freed at the next publish(build,
+     * load, swap_mesh) anyway, call this e.g. once a frame to free sooner
+     */
+    void reclaim_retired();
+
+    /**
+     * set the sink of build logs(build, build_tiled, build_streaming,
+     * build_tile_cache and rebuild), called from the worker threads of a
+     * tiled build but never concurrently
+     * @param sink nullptr to drop the logs
+     */
+    void set_log_sink(const LogSink &sink);
+
+    /**
+     * cache the parsed geometry of the obj files built from in dir, later
+     * builds of an unchanged obj read the cache instead of parsing. Off by
+     * default, nothing is written next to the input
+     * @param dir an existing directory, nullptr or empty to disable
+     */
+    void set_geom_cache(const char *dir);
+
+    /**
+     * rebuild only the tiles overlapping an edited region and swap them into
+     * the current mesh, every other tile is left as is. The mesh must be tiled
+     * with the current Setting(eg. from build_tiled), must not run
+     * concurrently with queries. The geometry kept by the last build_tiled
+     * or rebuild is reused if from has not changed since, else from is
+     * loaded and kept instead. A tile failed to build keep the old one
+     * @param bmin min corner of the region changed
+     * @param bmax max corner of the region changed
+     * @param from the edited obj/gset file
+     * @param threads worker count, 0 to use all hardware threads
+     */
+    bool rebuild(const float *bmin, const float *bmax, const char *from,
+                 int threads = 0);
+
+    /**
+     * generated tiled mesh data from a obj/gset file through a dtTileCache,
+     * the compressed heightfield layers of every tile are kept so obstacles
+     * can be added and removed at runtime. Layers are rasterized on a worker
+     * pool
      * @param from a obj/gset file
+     * @param max_obstacles max obstacles exist at the same time
+     * @param threads worker count, 0 to use all hardware threads
+     */
+    bool build_tile_cache(const char *from, int max_obstacles = 128,
+                          int threads = 0);
+
+    /**
+     * save mesh data to file, the cluster graph if any is saved alongside to
+     * path + ".graph"
+     * @param format file format, see MeshFormat. MESH_FORMAT_TILE_CACHE only
+     *        for mesh from build_tile_cache(or loaded from such a file).
+     *        MESH_FORMAT_LEAN(_DETAIL) quantize the verts by the cell size
+     *        and height of the setting, lossless if the mesh built with them.
+     *        Without the detail mesh the heights on a poly come from it's
+     *        plane when loaded, the tiles take less memory
      */
-    bool build(const char *from);
+    bool save(const char *path, int format = MESH_FORMAT_SET);
+
+    /// get the tiles of the current mesh, all zero if none
+    void get_mesh_stat(MeshStat &stat) const;
 
     /**
-     * save mesh data to file
+     * build an abstract graph over the borders of square clusters of the
+     * current mesh. follow and straight between different clusters then plan
+     * on the graph first and only search the polys of the clusters on the
+     * way, instead of a findPath limited by the node pool. Dropped when the
+     * mesh is replaced, rebuilt by rebuild, saved and loaded with the mesh
+     * @param cluster_size edge length of a cluster in world units, 0 to use
+     *        the tile size of Setting
      */
-    bool save(const char *path);
+    bool build_cluster_graph(float cluster_size = 0);
 
     /**
-     * pathfinding(follow)
-     * right-handle coordinate, x axis right, y axis up
+     * pathfinding(follow), thread safe
+     * right-handle coordinate, x axis right, y axis up. The corridor is not
+     * limited, if the path need more than max_size points the head is
+     * written and is_truncated is set(use PathIterator for the whole path)
      * @return status, use is_xx function to check fail.
      */
     unsigned int follow(float sx, float sy, float sz, float ex, float ey,
@@ -111,28 +490,403 @@ public:
                         float step = 0.5f);
 
     /**
-     * pathfinding(straight)
-     * right-handle coordinate, x axis right, y axis up
+     * pathfinding(follow), thread safe. Only find the corridor, the smoothed
+     * points are computed when pulled from iter
+     * @param iter reset and hold the path, see PathIterator::next
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int follow(float sx, float sy, float sz, float ex, float ey,
+                        float ez, PathIterator &iter, float step = 0.5f);
+
+    /**
+     * pathfinding(straight), thread safe
+     * right-handle coordinate, x axis right, y axis up. The corridor is not
+     * limited, if the path need more than max_size points the head is
+     * written and is_truncated is set
      * @param option Query options. (see: #dtStraightPathOptions)
+     * @param path_size [out] point count of the whole path, larger than
+     *        use_size if truncated
      * @return status, use is_xx function to check fail.
      */
     unsigned int straight(float sx, float sy, float sz, float ex, float ey,
                           float ez, float *points, int max_size, int &use_size,
-                          int option = 0);
+                          int option = 0, int *path_size = nullptr);
+
+    /**
+     * pathfinding, thread safe. Only the poly corridor, e.g. to pick the
+     * polys for set_poly_flags. If the corridor has more than max_polys polys
+     * the head is written and is_truncated is set
+     * @param polys [out] poly refs from start to end, max_polys refs
+     * @param npolys [out] refs written to polys
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int corridor(float sx, float sy, float sz, float ex, float ey,
+                          float ez, unsigned int *polys, int max_polys,
+                          int &npolys);
+
+    /**
+     * pick a random point on the mesh, thread safe if frand is
+     * @param frand random number in [0, 1)
+     * @param point [out] 3 floats
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int random_point(float (*frand)(), float *point);
+
+    /**
+     * cast a ray along the mesh surface from start toward end, stop at the
+     * first wall(dtNavMeshQuery::raycast), thread safe
+     * @param t [out] hit fraction along the segment, FLT_MAX if end reached
+     * @param normal [out] normal of the wall hit, 3 floats, zero if none
+     * @param last_ref [out] last poly the ray went through if not nullptr
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int raycast(float sx, float sy, float sz, float ex, float ey,
+                         float ez, float &t, float *normal,
+                         unsigned int *last_ref = nullptr);
+
+    /**
+     * batch raycast, rays are spread over the thread pool and the edges of a
+     * poly are intersected with a ray in one go with SSE/AVX. The result is
+     * the same as raycast. Every array is structure of arrays, all x first,
+     * then all y and all z
+     * @param count ray count
+     * @param starts start points, count * 3 floats
+     * @param ends end points, count * 3 floats
+     * @param t [out] hit fraction of every ray, count floats
+     * @param normals [out] hit normal of every ray, count * 3 floats
+     * @param last_refs [out] last poly of every ray, count refs
+     * @param status [out] status of every ray, use is_xx function to check
+     * @return rays succeed
+     */
+    int raycast_batch(int count, const float *starts, const float *ends,
+                      float *t, float *normals, unsigned int *last_refs,
+                      unsigned int *status);
+
+    /**
+     * batch pathfinding(follow), queries are spread over a work-stealing
+     * thread pool and every worker use it's own dtNavMeshQuery
+     * @param count query count
+     * @param starts start points, count * 3 floats
+     * @param ends end points, count * 3 floats
+     * @param points output buffer of count * max_size * 3 floats. Paths are
+     *        packed one after another, path i start at points[offsets[i] * 3]
+     * @param max_size max point count of one path
+     * @param offsets [out] first point index of every path, count ints
+     * @param sizes [out] point count of every path, count ints
+     * @param status [out] status of every path, use is_xx function to check
+     * @return total point count written to points
+     */
+    int follow_batch(int count, const float *starts, const float *ends,
+                     float *points, int max_size, int *offsets, int *sizes,
+                     unsigned int *status, float step = 0.5f);
+
+    /**
+     * batch pathfinding(straight), see follow_batch for the parameters
+     * @param option Query options. (see: #dtStraightPathOptions)
+     * @return total point count written to points
+     */
+    int straight_batch(int count, const float *starts, const float *ends,
+                       float *points, int max_size, int *offsets, int *sizes,
+                       unsigned int *status, int option = 0);
+
+    /**
+     * enable a LRU cache of polygon corridors keyed by start poly, end poly
+     * and filter, so repeated queries skip findPath. Entries through a
+     * replaced tile are dropped, set_poly_flags drop all entries.
+     * Not thread safe, call it before querying
+     * @param capacity max corridors cached, 0 to disable
+     */
+    void set_path_cache(int capacity);
+
+    /**
+     * get the hit/miss counters of the corridor cache of the current mesh,
+     * all zero if disabled. Every mesh loaded or built start a new cache
+     */
+    void get_path_cache_stat(PathCacheStat &stat) const;
+
+    /**
+     * set the flags of a poly, use this instead of dtNavMesh::setPolyFlags so
+     * the corridor cache get invalidated
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int set_poly_flags(unsigned int ref, unsigned short flags);
+
+    /**
+     * add a cylinder obstacle, only for mesh from build_tile_cache(or loaded
+     * from MESH_FORMAT_TILE_CACHE). The mesh is not changed until
+     * update_obstacles
+     * @param pos bottom center of the cylinder
+     * @param ref [out] obstacle ref to remove it
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int add_obstacle(const float *pos, float radius, float height,
+                              unsigned int &ref);
+
+    /**
+     * add a axis aligned box obstacle, see add_obstacle
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int add_box_obstacle(const float *bmin, const float *bmax,
+                                  unsigned int &ref);
+
+    /**
+     * remove an obstacle, the mesh is not changed until update_obstacles
+     * @return status, use is_xx function to check fail.
+     */
+    unsigned int remove_obstacle(unsigned int ref);
+
+    /**
+     * rebuild the tiles affected by obstacle changes, one tile at a time until
+     * the budget used up. Call it every frame, must not run concurrently
+     * with queries
+     * @param budget_us time budget in microseconds
+     * @return status, use is_xx function to check fail. is_in_progress if
+     *         changes are left for the next call
+     */
+    unsigned int update_obstacles(int budget_us);
+
+    /**
+     * keep the tiles within radius of pos resident, only for mesh from
+     * load_streaming. Take effect at update_streaming
+     * @return interest id, -1 if not streaming
+     */
+    int add_interest(const float *pos, float radius);
+    bool move_interest(int id, const float *pos);
+    bool remove_interest(int id);
+
+    /**
+     * add the tiles read by the io thread and evict the cold ones over the
+     * budget, tiles touched since the last update or inside an interest
+     * region are kept. Call it every frame, must not run concurrently with
+     * queries
+     * @return tiles added and removed
+     */
+    int update_streaming();
+
+    /// get the tiles resident, all zero if not streaming
+    void get_stream_stat(StreamStat &stat) const;
+
+    /**
+     * set the node pool size of every query context(and PathScheduler),
+     * contexts pick up the new size at their next query. Adaptive mode double
+     * the size when a search run out of nodes, and halve it towards the high
+     * water of the last searches when much larger than needed.
+     * Not thread safe, call it before querying
+     * @param max_nodes nodes of a pool, 2048 by default
+     * @param adaptive resize the pools by the searches observed
+     */
+    void set_node_pool(int max_nodes, bool adaptive = false);
+
+    /**
+     * receive node pool resize and DT_OUT_OF_NODES events, see NodePoolSink
+     * @param sink nullptr to drop the events
+     */
+    void set_node_pool_sink(const NodePoolSink &sink);
+
+    /// get the node pool size and the searches statistics
+    void get_node_pool_stat(NodePoolStat &stat) const;
+
+    /**
+     * resolve the start and end points of queries through a 2D grid of the
+     * polys of every tile instead of dtNavMeshQuery::findNearestPoly, points
+     * off the mesh still fall back to it. Built for the current mesh and
+     * every mesh loaded or built later, the grid of a tile is rebuilt when
+     * rebuild or update_obstacles replace it.
+     * Not thread safe, call it before querying
+     * @param cell_size edge length of a cell in world units, 0 to use 8 times
+     *        the cell size of Setting, negative to disable
+     */
+    void set_point_grid(float cell_size = 0);
+
+    /**
+     * hook the allocations of Recast and Detour(rcAllocSetCustom and
+     * dtAllocSetCustom) for the build arenas and MemoryStat, for the whole
+     * process. Opt-in, call it once before any Recast or Detour use(any
+     * RecastNavMesh created or rc/dt call made), else a block allocated
+     * before would be freed through the new hooks. Replace hooks set before
+     */
+    static void install_build_arena();
+
+    /**
+     * get the bytes allocated by Recast and Detour of all RecastNavMesh, by
+     * hint, all zero unless install_build_arena. The intermediate results of
+     * every build(and every tile of a tiled build) are bumped from an arena
+     * of the building thread, released at once when done, so Recast bytes
+     * alive outside builds mean a leak
+     */
+    static void get_memory_stat(MemoryStat &stat);
+
+    /// restart the peaks of MemoryStat from the bytes alive now
+    static void reset_memory_peak();
+
+    /**
+     * use the build arenas or the heap for the builds started from now on,
+     * the bytes are counted either way. No effect unless install_build_arena
+     * @param enable true by default
+     */
+    static void set_build_arena(bool enable);
+
+    /**
+     * set the threads used by batch query and compressed mesh loading,
+     * including the calling thread. Work already running keep the old pool
+     * until it's done
+     * @param threads thread count, 0 to use all hardware threads
+     */
+    void set_threads(int threads);
 
 private:
-    bool raw_build(InputGeom *geom, rcContext *ctx);
-    int smooth(float *m_spos, float *m_epos, unsigned int *m_polys,
+    struct QueryContext;
+
+    /**
+     * everything bound to one nav mesh, published to the queries as a whole.
+     * A query pin the current one from begin to end, a replaced one is freed
+     * once no query pinned it any more, see retire
+     */
+    struct MeshState
+    {
+        dtNavMesh *nav_mesh;
+        void *map_addr; /// file mapping of MESH_FORMAT_MMAP
+        size_t map_size;
+        TileCache *tile_cache;   /// nullptr if mesh not built with tile cache
+        TileStream *tile_stream; /// nullptr if mesh not from load_streaming
+        /// nullptr if not built, load attach it after published
+        std::atomic<ClusterGraph *> cluster_graph;
+        PathCache *path_cache;       /// nullptr if disabled
+        PointGrid *point_grid;       /// nullptr if disabled
+        unsigned int generation;     /// increase every time the mesh replaced
+        unsigned long long retired;  /// epoch replaced at, 0 if current
+    };
+
+    /// query contexts at most, more threads querying at once wait for one
+    static const int QUERY_SLOTS = 256;
+
+    bool raw_build(BuildGeom *geom, BuildContext *ctx);
+    bool raw_build_tiled(BuildGeom *geom, BuildContext *ctx, int threads);
+    /// raw_build from the filters on, with solid shared by build_profiles
+    bool build_profile(BuildGeom *geom, BuildContext *ctx,
+                       rcHeightfield &solid);
+    bool raw_rebuild(BuildGeom *geom, BuildContext *ctx, const float *bmin,
+                     const float *bmax, int threads);
+    /**
+     * build the tile data of tile (tx, ty)
+     * @param empty [out] true if nothing walkable in the tile, the nullptr
+     *        returned is then not an error
+     * @return tile data for dtNavMesh::addTile, nullptr if empty or failed
+     */
+    unsigned char *build_tile_mesh(BuildGeom *geom, BuildContext *ctx,
+                                   const int tx, const int ty,
+                                   const float *bmin, const float *bmax,
+                                   int &data_size, bool &empty) const;
+    static void update_poly_flags(rcPolyMesh *pmesh);
+    /// fill stat from ctx and the current mesh
+    void get_build_stat(const BuildContext &ctx, BuildStat &stat) const;
+
+    bool load_mesh(const char *path, bool use_mmap);
+    bool save_mesh(const char *path, int format);
+    bool load_mmap(const char *path);
+    bool load_compressed(const char *path);
+    bool load_lean(const char *path);
+    bool load_tile_cache(const char *path);
+    /**
+     * replace current mesh, with the file mapping it point into if any, the
+     * tile cache it built from if any and the stream loading it's tiles if
+     * any
+     */
+    void set_nav_mesh(dtNavMesh *mesh, void *map_addr = nullptr,
+                      size_t map_size = 0, TileCache *tile_cache = nullptr,
+                      TileStream *tile_stream = nullptr);
+    /// publish state to the queries and retire the current one
+    void publish(MeshState *state);
+    /// free state once no query pinned an epoch before it replaced
+    void retire(MeshState *state);
+    /// replace the cluster graph of state, the old one is retired
+    void replace_graph(MeshState *state, ClusterGraph *graph);
+    /// free the retired states and graphs no query pinned any more
+    void reclaim();
+    static void free_state(MeshState *state);
+    /// the mesh published now, only for calls not concurrent with publish
+    MeshState *current() const { return _state.load(); }
+    bool smooth_step(dtNavMeshQuery *query, SmoothState &st) const;
+    /// make sure st.polys never truncated by the next smooth_step
+    static void grow_corridor(std::vector<unsigned int> &buffer,
+                              SmoothState &st);
+    /**
+     * @param buffer working corridor, grown as needed
+     * @param truncated [out] size points written before the end reached
+     */
+    int smooth(dtNavMeshQuery *query, std::vector<unsigned int> &buffer,
+               float *m_spos, float *m_epos, const unsigned int *m_polys,
                int m_npolys, unsigned int m_startRef, float *m_smoothPath,
-               int size, float step = 0.5f);
+               int size, float step, bool &truncated) const;
+    /// find the poly of pos, by the point grid of state if enabled
+    void find_nearest_poly(const MeshState *state, dtNavMeshQuery *query,
+                           const float *pos, unsigned int &ref) const;
+    /// find the corridor into polys, grown as needed
+    unsigned int find_path(const MeshState *state, dtNavMeshQuery *query,
+                           unsigned int start_ref, unsigned int end_ref,
+                           const float *spos, const float *epos,
+                           std::vector<unsigned int> &polys,
+                           int &npolys) const;
+    unsigned int raw_follow(QueryContext *ctx, float sx, float sy, float sz,
+                            float ex, float ey, float ez, float *points,
+                            int max_size, int &use_size, float step) const;
+    unsigned int raw_straight(QueryContext *ctx, float sx, float sy,
+                              float sz, float ex, float ey, float ez,
+                              float *points, int max_size, int &use_size,
+                              int option, int *path_size) const;
+
+    int run_batch(
+        int count, float *points, int max_size, int *offsets, int *sizes,
+        unsigned int *status,
+        const std::function<unsigned int(QueryContext *, int, float *, int &)>
+            &query);
+    /// the pool stay alive as long as the returned pointer, see set_threads
+    std::shared_ptr<ThreadPool> thread_pool();
+
+    /// get an idle context and pin the current mesh, nullptr if no mesh
+    QueryContext *acquire_query();
+    /**
+     * pin the current mesh without a query, for the callers keeping their
+     * own dtNavMeshQuery across calls(eg. Crowd). The state returned is not
+     * freed until ctx released by release_query
+     * @param ctx [out] the context holding the pin
+     * @return the current mesh, never nullptr
+     */
+    const MeshState *pin_mesh(QueryContext *&ctx);
+    void release_query(QueryContext *ctx);
+    void clear_query_pool();
 
     const float *default_poly_pick_ext() const;
     const Setting *default_setting() const;
     const dtQueryFilter *default_filter() const;
 
 private:
-    class dtNavMesh *_nav_mesh;
-    class dtNavMeshQuery *_nav_query;
+    std::atomic<MeshState *> _state; /// current mesh, never nullptr
+    std::atomic<unsigned long long> _epoch; /// increase every mesh retired
+
+    /// created on demand, a context is busy from acquire to release
+    std::atomic<QueryContext *> _query_slots[QUERY_SLOTS];
+
+    std::mutex _retire_mutex;
+    std::vector<MeshState *> _retired; /// replaced, pinned by queries
+    /// replaced graphs with the epoch replaced at, pinned by queries
+    std::vector<std::pair<unsigned long long, ClusterGraph *> >
+        _retired_graphs;
+    std::atomic<int> _retired_count;
+    std::atomic<unsigned long long> _swaps;
+    std::atomic<unsigned long long> _reclaimed;
+
+    std::mutex _pool_mutex; /// guard _thread_pool
+    int _threads;
+    std::shared_ptr<ThreadPool> _thread_pool; /// created at first use
+
+    int _path_cache_capacity; /// of every mesh, 0 if disabled
+    float _point_grid_cell;   /// of every mesh, negative if disabled
+    NodePoolTuner *_node_pool; /// size and statistics of node pools
+    BuildGeom *_geom; /// of the last build_tiled or rebuild, nullptr if none
+
+    LogSink _log_sink;
+    std::string _geom_cache; /// directory of the geometry cache, empty if off
 
     const float *_poly_pick_ext;
     const struct Setting *_setting;
@@ -0,0 +1,285 @@
+#include <Recast.h>
+
+#include <cmath>
+#include <cstring>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "build_geom.h"
+#include "stream_geom.h"
+
+/// tris read from the scratch file at a time when bucketing
+static const int BUCKET_READ_TRIS = 64 * 1024;
+
+/// fseek to offset from the beginning, past 2GB where long is 32 bits
+static int seek_set(FILE *fp, long long offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+StreamGeom::StreamGeom(size_t budget)
+{
+    _budget       = budget;
+    _buffered     = 0;
+    _bucket_bytes = 0;
+    _nverts       = 0;
+    _ntris        = 0;
+    _bucket_fp    = nullptr;
+    _bucket_size  = 0;
+    memset(_bmin, 0, sizeof(_bmin));
+    memset(_bmax, 0, sizeof(_bmax));
+}
+
+StreamGeom::~StreamGeom()
+{
+    remove_scratch();
+}
+
+void StreamGeom::remove_scratch()
+{
+    if (_bucket_fp)
+    {
+        fclose(_bucket_fp);
+        _bucket_fp = nullptr;
+    }
+    if (!_verts_path.empty()) remove(_verts_path.c_str());
+    if (!_tris_path.empty()) remove(_tris_path.c_str());
+    if (!_bucket_path.empty()) remove(_bucket_path.c_str());
+}
+
+bool StreamGeom::scan(rcContext *ctx, const char *path, const char *scratch)
+{
+    _verts_path  = std::string(scratch) + ".verts.tmp";
+    _tris_path   = std::string(scratch) + ".tris.tmp";
+    _bucket_path = std::string(scratch) + ".tiles.tmp";
+
+    FILE *vfp = fopen(_verts_path.c_str(), "wb");
+    FILE *tfp = fopen(_tris_path.c_str(), "wb");
+    if (!vfp || !tfp)
+    {
+        if (vfp) fclose(vfp);
+        if (tfp) fclose(tfp);
+        ctx->log(RC_LOG_ERROR, "streamBuild: Could not create scratch '%s'",
+                 scratch);
+        return false;
+    }
+
+    _nverts = 0;
+    _ntris  = 0;
+    bool ok = BuildGeom::scan_obj(
+        ctx, path,
+        [&](const float *v) {
+            if (!_nverts)
+            {
+                rcVcopy(_bmin, v);
+                rcVcopy(_bmax, v);
+            }
+            rcVmin(_bmin, v);
+            rcVmax(_bmax, v);
+            fwrite(v, sizeof(float), 3, vfp);
+            _nverts++;
+        },
+        [&](const int *tri) {
+            fwrite(tri, sizeof(int), 3, tfp);
+            _ntris++;
+        });
+
+    if (ferror(vfp) || ferror(tfp)) ok = false;
+    if (fclose(vfp)) ok = false;
+    if (fclose(tfp)) ok = false;
+    if (!ok)
+    {
+        ctx->log(RC_LOG_ERROR, "streamBuild: Could not scan '%s'", path);
+        return false;
+    }
+
+    ctx->log(RC_LOG_PROGRESS, "streamBuild: '%s' %d verts %d tris", path,
+             _nverts, _ntris);
+    return true;
+}
+
+bool StreamGeom::bucket(rcContext *ctx, float tile_size, float border,
+                        int tw, int th)
+{
+    _buffers.assign(tw * th, std::vector<float>());
+    _blocks.assign(tw * th, std::vector<Block>());
+    _buffered     = 0;
+    _bucket_bytes = 0;
+    _bucket_size  = 0;
+
+    _bucket_fp = fopen(_bucket_path.c_str(), "wb+");
+    if (!_bucket_fp)
+    {
+        ctx->log(RC_LOG_ERROR, "streamBuild: Could not create scratch '%s'",
+                 _bucket_path.c_str());
+        return false;
+    }
+
+    const size_t verts_size = (size_t)_nverts * 3 * sizeof(float);
+#ifndef _WIN32
+    // tris refer to verts anywhere, let the page cache hold them
+    const float *verts = nullptr;
+    if (verts_size)
+    {
+        int fd = open(_verts_path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        void *addr = mmap(nullptr, verts_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == addr)
+        {
+            ctx->log(RC_LOG_ERROR, "streamBuild: Could not map '%s'",
+                     _verts_path.c_str());
+            return false;
+        }
+        verts = (const float *)addr;
+    }
+#else
+    // no mmap here, the verts are resident while bucketing
+    std::vector<float> verts_buf((size_t)_nverts * 3);
+    FILE *vfp = fopen(_verts_path.c_str(), "rb");
+    if (!vfp) return false;
+    const size_t readLen =
+        fread(verts_buf.data(), sizeof(float), verts_buf.size(), vfp);
+    fclose(vfp);
+    if (readLen != verts_buf.size()) return false;
+    const float *verts = verts_buf.data();
+#endif
+
+    bool ok  = true;
+    FILE *fp = fopen(_tris_path.c_str(), "rb");
+    if (!fp) ok = false;
+
+    std::vector<int> tris(BUCKET_READ_TRIS * 3);
+    while (ok)
+    {
+        const size_t n = fread(tris.data(), sizeof(int) * 3, BUCKET_READ_TRIS,
+                               fp);
+        for (size_t i = 0; i < n; i++)
+        {
+            const float *v[3];
+            for (int k = 0; k < 3; k++) v[k] = &verts[tris[i * 3 + k] * 3];
+
+            float minx = v[0][0], maxx = v[0][0];
+            float minz = v[0][2], maxz = v[0][2];
+            for (int k = 1; k < 3; k++)
+            {
+                minx = rcMin(minx, v[k][0]);
+                maxx = rcMax(maxx, v[k][0]);
+                minz = rcMin(minz, v[k][2]);
+                maxz = rcMax(maxz, v[k][2]);
+            }
+
+            // tiles whose bounds expanded by border overlap the triangle
+            const int x0 = rcMax(
+                0, (int)floorf((minx - border - _bmin[0]) / tile_size));
+            const int x1 = rcMin(
+                tw - 1, (int)floorf((maxx + border - _bmin[0]) / tile_size));
+            const int y0 = rcMax(
+                0, (int)floorf((minz - border - _bmin[2]) / tile_size));
+            const int y1 = rcMin(
+                th - 1, (int)floorf((maxz + border - _bmin[2]) / tile_size));
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    std::vector<float> &buf = _buffers[x + y * tw];
+                    for (int k = 0; k < 3; k++)
+                        buf.insert(buf.end(), v[k], v[k] + 3);
+                    _buffered += 9 * sizeof(float);
+                }
+            }
+            if (_buffered >= _budget && !spill()) ok = false;
+        }
+        if (n < (size_t)BUCKET_READ_TRIS)
+        {
+            if (ferror(fp)) ok = false;
+            break;
+        }
+    }
+    if (fp) fclose(fp);
+
+#ifndef _WIN32
+    if (verts) munmap((void *)verts, verts_size);
+#endif
+
+    // the scanned obj is no longer needed
+    remove(_verts_path.c_str());
+    remove(_tris_path.c_str());
+
+    if (!ok || !spill())
+    {
+        ctx->log(RC_LOG_ERROR, "streamBuild: Could not bucket tiles.");
+        return false;
+    }
+
+    ctx->log(RC_LOG_PROGRESS, "streamBuild: %d x %d tiles, %.1fMB bucketed",
+             tw, th, _bucket_bytes / (1024.0f * 1024.0f));
+    return true;
+}
+
+bool StreamGeom::spill()
+{
+    // blocks are appended in tile order, a tile is read sequentially when
+    // the budget hold the whole world
+    if (fseek(_bucket_fp, 0, SEEK_END)) return false;
+    for (size_t i = 0; i < _buffers.size(); i++)
+    {
+        std::vector<float> &buf = _buffers[i];
+        if (buf.empty()) continue;
+
+        if (fwrite(buf.data(), sizeof(float), buf.size(), _bucket_fp)
+            != buf.size())
+            return false;
+
+        Block block;
+        block.offset = _bucket_size;
+        block.count  = (int)buf.size() / 9;
+        _blocks[i].push_back(block);
+
+        const size_t bytes = buf.size() * sizeof(float);
+        _bucket_size += bytes;
+        _bucket_bytes += bytes;
+
+        // release the memory, not only clear
+        std::vector<float>().swap(buf);
+    }
+    _buffered = 0;
+
+    return 0 == fflush(_bucket_fp);
+}
+
+bool StreamGeom::read(int tile, std::vector<float> &verts)
+{
+    verts.clear();
+    if (tile < 0 || tile >= (int)_blocks.size()) return false;
+
+    const std::vector<Block> &blocks = _blocks[tile];
+    size_t count = 0;
+    for (const Block &block : blocks) count += block.count;
+    verts.resize(count * 9);
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    float *dst = verts.data();
+    for (const Block &block : blocks)
+    {
+        const size_t n = (size_t)block.count * 9;
+        if (seek_set(_bucket_fp, block.offset)
+            || fread(dst, sizeof(float), n, _bucket_fp) != n)
+        {
+            verts.clear();
+            return false;
+        }
+        dst += n;
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class rcContext;
+
+/**
+ * geometry of a obj spilled to disk and bucketed by tile, to build worlds
+ * larger than memory. scan stream the obj into scratch files, bucket copy
+ * every triangle into the bucket of every tile it overlap(border included).
+ * Buckets are buffered in memory up to a budget, then appended to a scratch
+ * file as blocks, read gather the blocks of a tile back. The scratch files
+ * are removed when destroyed
+ */
+class StreamGeom
+{
+public:
+    /// @param budget bytes of triangles buffered before spilled to disk
+    explicit StreamGeom(size_t budget);
+    ~StreamGeom();
+
+    /**
+     * stream a obj into scratch files, only the bounds are kept in memory
+     * @param scratch path prefix of the scratch files
+     */
+    bool scan(rcContext *ctx, const char *path, const char *scratch);
+
+    /**
+     * bucket the scanned triangles into tiles, tile(0, 0) start at bmin()
+     * @param tile_size world size of a tile
+     * @param border triangles within border of a tile are bucketed into it
+     */
+    bool bucket(rcContext *ctx, float tile_size, float border, int tw,
+                int th);
+
+    /**
+     * read the triangles of a tile, thread safe
+     * @param verts [out] 9 floats of every triangle
+     */
+    bool read(int tile, std::vector<float> &verts);
+
+    const float *bmin() const { return _bmin; }
+    const float *bmax() const { return _bmax; }
+    int vert_count() const { return _nverts; }
+    int tri_count() const { return _ntris; }
+    /// bytes of all buckets, a triangle is counted once every tile
+    size_t bucket_bytes() const { return _bucket_bytes; }
+
+private:
+    /// a run of triangles of a tile in the bucket file
+    struct Block
+    {
+        long long offset;
+        int count;
+    };
+
+    /// append every buffered bucket to the bucket file
+    bool spill();
+    void remove_scratch();
+
+private:
+    size_t _budget;
+    size_t _buffered;
+    size_t _bucket_bytes;
+    int _nverts;
+    int _ntris;
+    float _bmin[3];
+    float _bmax[3];
+
+    std::string _verts_path;
+    std::string _tris_path;
+    std::string _bucket_path;
+    FILE *_bucket_fp;
+    long long _bucket_size;
+    std::mutex _mutex; /// guard _bucket_fp when read
+
+    std::vector<std::vector<float> > _buffers; /// not spilled yet of tiles
+    std::vector<std::vector<Block> > _blocks;
+};
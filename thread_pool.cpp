@@ -0,0 +1,137 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int threads)
+{
+    _stop   = false;
+    _queued = 0;
+    _next   = 0;
+
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+
+    for (int i = 1; i < threads; i++) _queues.push_back(new Queue());
+    for (int i = 1; i < threads; i++)
+    {
+        _threads.push_back(std::thread(&ThreadPool::work, this, i - 1));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+
+    for (auto &t : _threads) t.join();
+    for (auto q : _queues) delete q;
+}
+
+bool ThreadPool::pop(int index, Task &task)
+{
+    const int size = (int)_queues.size();
+
+    // own queue first, from the back so a worker keep running the chunks it
+    // was given in cache-friendly order
+    if (index >= 0)
+    {
+        Queue *q = _queues[index];
+        std::lock_guard<std::mutex> guard(q->mutex);
+        if (!q->tasks.empty())
+        {
+            task = q->tasks.back();
+            q->tasks.pop_back();
+            _queued--;
+            return true;
+        }
+    }
+
+    // steal from the front of the others
+    for (int i = 1; i <= size; i++)
+    {
+        Queue *q = _queues[(index + i + size) % size];
+        std::lock_guard<std::mutex> guard(q->mutex);
+        if (!q->tasks.empty())
+        {
+            task = q->tasks.front();
+            q->tasks.pop_front();
+            _queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(const Task &task)
+{
+    Job *job = task.job;
+    (*job->fn)(task.begin, task.end);
+
+    // don't touch job after the last chunk done, the caller may have returned
+    if (0 == --job->pending)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done_cond.notify_all();
+    }
+}
+
+void ThreadPool::work(int index)
+{
+    Task task;
+    while (true)
+    {
+        if (pop(index, task))
+        {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this]() { return _stop || _queued > 0; });
+        if (_stop && 0 == _queued) return;
+    }
+}
+
+void ThreadPool::parallel_for(int count, int grain,
+                              const std::function<void(int, int)> &fn)
+{
+    if (count <= 0) return;
+    if (grain <= 0) grain = 1;
+
+    if (_queues.empty() || count <= grain)
+    {
+        fn(0, count);
+        return;
+    }
+
+    Job job;
+    job.fn      = &fn;
+    job.pending = (count + grain - 1) / grain;
+
+    // spread chunks over all worker queues, idle workers will steal the rest
+    const int size = (int)_queues.size();
+    for (int begin = 0; begin < count; begin += grain)
+    {
+        Task task;
+        task.job   = &job;
+        task.begin = begin;
+        task.end   = begin + grain < count ? begin + grain : count;
+
+        Queue *q = _queues[_next++ % size];
+        std::lock_guard<std::mutex> guard(q->mutex);
+        q->tasks.push_back(task);
+        _queued++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+    }
+    _cond.notify_all();
+
+    // help until no more chunk to steal, then wait for those still running
+    Task task;
+    while (job.pending > 0 && pop(-1, task)) run(task);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cond.wait(lock, [&job]() { return job.pending <= 0; });
+}
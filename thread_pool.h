@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * work-stealing thread pool, every worker own a task queue and steal from the
+ * others when it's own queue is empty. Used by tiled build and batch query
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @param threads total threads taking part in parallel_for, including the
+     * calling thread. 0 to use all hardware threads
+     */
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    /**
+     * total threads taking part in parallel_for, including the calling thread
+     */
+    int size() const { return (int)_threads.size() + 1; }
+
+    /**
+     * run fn(begin, end) over [0, count), split into chunks of grain. Block
+     * until all chunks done, the calling thread run chunks too. Safe to call
+     * from many threads at the same time
+     */
+    void parallel_for(int count, int grain,
+                      const std::function<void(int, int)> &fn);
+
+private:
+    struct Job
+    {
+        const std::function<void(int, int)> *fn;
+        std::atomic<int> pending; /// chunks not finished yet
+    };
+    struct Task
+    {
+        Job *job;
+        int begin;
+        int end;
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void work(int index);
+    bool pop(int index, Task &task);
+    void run(const Task &task);
+
+private:
+    bool _stop;
+    std::atomic<int> _queued;    /// tasks waiting in all queues
+    std::atomic<unsigned> _next; /// round-robin queue to push
+
+    std::mutex _mutex;
+    std::condition_variable _cond;      /// wake up idle workers
+    std::condition_variable _done_cond; /// wake up parallel_for caller
+
+    std::vector<Queue *> _queues;
+    std::vector<std::thread> _threads;
+};
@@ -0,0 +1,810 @@
+#include <DetourCommon.h>
+#include <DetourNavMeshBuilder.h>
+#include <DetourTileCacheBuilder.h>
+#include <Recast.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fastlz.h>
+
+#include "build_arena.h"
+#include "build_context.h"
+#include "build_geom.h"
+#include "thread_pool.h"
+#include "tile_cache.h"
+
+static const int TILECACHESET_VERSION = 1;
+
+static const int EXPECTED_LAYERS_PER_TILE = 4;
+static const int MAX_LAYERS               = 32;
+
+struct TileCacheSetHeader
+{
+    int magic;
+    int version;
+    int numTiles;
+    int numOffMeshCons;
+    dtTileCacheParams cacheParams; /// nav mesh params are derived from it
+};
+
+struct TileCacheTileHeader
+{
+    dtCompressedTileRef tileRef;
+    int dataSize;
+};
+
+/// ported from RecastDemo Sample_TempObstacles.cpp
+struct LinearAllocator : public dtTileCacheAlloc
+{
+    unsigned char *buffer;
+    size_t capacity;
+    size_t top;
+    size_t high;
+
+    LinearAllocator(const size_t cap)
+        : buffer(0), capacity(0), top(0), high(0)
+    {
+        resize(cap);
+    }
+
+    ~LinearAllocator() { dtFree(buffer); }
+
+    void resize(const size_t cap)
+    {
+        if (buffer) dtFree(buffer);
+        buffer   = (unsigned char *)dtAlloc(cap, DT_ALLOC_PERM);
+        capacity = cap;
+    }
+
+    virtual void reset()
+    {
+        high = dtMax(high, top);
+        top  = 0;
+    }
+
+    virtual void *alloc(const size_t size)
+    {
+        if (!buffer) return 0;
+        if (top + size > capacity)
+        {
+            // remember what was needed, see TileCache::grow_alloc
+            high = dtMax(high, top + size);
+            return 0;
+        }
+        unsigned char *mem = &buffer[top];
+        top += size;
+        return mem;
+    }
+
+    virtual void free(void * /*ptr*/)
+    {
+        // Empty
+    }
+};
+
+/// ported from RecastDemo Sample_TempObstacles.cpp
+struct FastLZCompressor : public dtTileCacheCompressor
+{
+    virtual int maxCompressedSize(const int bufferSize)
+    {
+        // fastlz need the output 5% larger than input and at least 66 bytes
+        return dtMax(66, (int)(bufferSize * 1.05f));
+    }
+
+    virtual dtStatus compress(const unsigned char *buffer, const int bufferSize,
+                              unsigned char *compressed,
+                              const int /*maxCompressedSize*/,
+                              int *compressedSize)
+    {
+        *compressedSize = fastlz_compress(buffer, bufferSize, compressed);
+        return DT_SUCCESS;
+    }
+
+    virtual dtStatus decompress(const unsigned char *compressed,
+                                const int compressedSize, unsigned char *buffer,
+                                const int maxBufferSize, int *bufferSize)
+    {
+        *bufferSize = fastlz_decompress(compressed, compressedSize, buffer,
+                                        maxBufferSize);
+        return *bufferSize < 0 ? DT_FAILURE : DT_SUCCESS;
+    }
+};
+
+/**
+ * set poly flags like RecastNavMesh::update_poly_flags and attach the
+ * off-mesh connections to every tile built. The connections are copied from
+ * the geometry so they survive save/load
+ */
+struct MeshProcess : public dtTileCacheMeshProcess
+{
+    std::vector<float> verts;
+    std::vector<float> rads;
+    std::vector<unsigned char> dirs;
+    std::vector<unsigned char> areas;
+    std::vector<unsigned short> flags;
+    std::vector<unsigned int> ids;
+
+    void set(BuildGeom *geom)
+    {
+        const int n = geom->getOffMeshConnectionCount();
+        resize(n);
+        if (!n) return;
+
+        memcpy(verts.data(), geom->getOffMeshConnectionVerts(),
+               n * 6 * sizeof(float));
+        memcpy(rads.data(), geom->getOffMeshConnectionRads(), n * sizeof(float));
+        memcpy(dirs.data(), geom->getOffMeshConnectionDirs(), n);
+        memcpy(areas.data(), geom->getOffMeshConnectionAreas(), n);
+        memcpy(flags.data(), geom->getOffMeshConnectionFlags(),
+               n * sizeof(unsigned short));
+        memcpy(ids.data(), geom->getOffMeshConnectionId(),
+               n * sizeof(unsigned int));
+    }
+
+    void resize(int n)
+    {
+        verts.resize(n * 6);
+        rads.resize(n);
+        dirs.resize(n);
+        areas.resize(n);
+        flags.resize(n);
+        ids.resize(n);
+    }
+
+    int count() const { return (int)rads.size(); }
+
+    virtual void process(struct dtNavMeshCreateParams *params,
+                         unsigned char *polyAreas, unsigned short *polyFlags)
+    {
+        // Update poly flags from areas.
+        for (int i = 0; i < params->polyCount; ++i)
+        {
+            if (polyAreas[i] == DT_TILECACHE_WALKABLE_AREA)
+                polyAreas[i] = RecastNavMesh::SAMPLE_POLYAREA_GROUND;
+
+            if (polyAreas[i] == RecastNavMesh::SAMPLE_POLYAREA_GROUND
+                || polyAreas[i] == RecastNavMesh::SAMPLE_POLYAREA_GRASS
+                || polyAreas[i] == RecastNavMesh::SAMPLE_POLYAREA_ROAD)
+            {
+                polyFlags[i] = RecastNavMesh::SAMPLE_POLYFLAGS_WALK;
+            }
+            else if (polyAreas[i] == RecastNavMesh::SAMPLE_POLYAREA_WATER)
+            {
+                polyFlags[i] = RecastNavMesh::SAMPLE_POLYFLAGS_SWIM;
+            }
+            else if (polyAreas[i] == RecastNavMesh::SAMPLE_POLYAREA_DOOR)
+            {
+                polyFlags[i] = RecastNavMesh::SAMPLE_POLYFLAGS_WALK
+                             | RecastNavMesh::SAMPLE_POLYFLAGS_DOOR;
+            }
+        }
+
+        // Pass in off-mesh connections.
+        params->offMeshConVerts  = verts.data();
+        params->offMeshConRad    = rads.data();
+        params->offMeshConDir    = dirs.data();
+        params->offMeshConAreas  = areas.data();
+        params->offMeshConFlags  = flags.data();
+        params->offMeshConUserID = ids.data();
+        params->offMeshConCount  = count();
+    }
+};
+
+/**
+ * intermediate results of rasterizing one tile, released when going out of
+ * scope
+ */
+struct TileLayerData
+{
+    unsigned char *triareas;
+    rcHeightfield *solid;
+    rcCompactHeightfield *chf;
+    rcHeightfieldLayerSet *lset;
+
+    TileLayerData()
+        : triareas(nullptr), solid(nullptr), chf(nullptr), lset(nullptr)
+    {
+    }
+    ~TileLayerData()
+    {
+        rcFree(triareas);
+        rcFreeHeightField(solid);
+        rcFreeCompactHeightfield(chf);
+        rcFreeHeightfieldLayerSet(lset);
+    }
+};
+
+struct TileCacheData
+{
+    unsigned char *data;
+    int dataSize;
+};
+
+/**
+ * ported from RecastDemo int Sample_TempObstacles::rasterizeTileLayers()
+ * @return layers built into tiles, 0 if nothing in the tile, -1 if failed
+ */
+static int rasterizeTileLayers(BuildGeom *m_geom, rcContext *m_ctx,
+                               dtTileCacheCompressor *comp, const int tx,
+                               const int ty, const rcConfig &cfg,
+                               TileCacheData *tiles, const int maxTiles)
+{
+    // released after rc, before the arena
+    BuildArena::Scope arena;
+    TileLayerData rc;
+
+    const float *verts                = m_geom->getMesh()->getVerts();
+    const int nverts                  = m_geom->getMesh()->getVertCount();
+    const rcChunkyTriMesh *chunkyMesh = m_geom->getChunkyMesh();
+
+    // Tile bounds.
+    const float tcs = cfg.tileSize * cfg.cs;
+
+    rcConfig tcfg;
+    memcpy(&tcfg, &cfg, sizeof(tcfg));
+
+    tcfg.bmin[0] = cfg.bmin[0] + tx * tcs;
+    tcfg.bmin[1] = cfg.bmin[1];
+    tcfg.bmin[2] = cfg.bmin[2] + ty * tcs;
+    tcfg.bmax[0] = cfg.bmin[0] + (tx + 1) * tcs;
+    tcfg.bmax[1] = cfg.bmax[1];
+    tcfg.bmax[2] = cfg.bmin[2] + (ty + 1) * tcs;
+    tcfg.bmin[0] -= tcfg.borderSize * tcfg.cs;
+    tcfg.bmin[2] -= tcfg.borderSize * tcfg.cs;
+    tcfg.bmax[0] += tcfg.borderSize * tcfg.cs;
+    tcfg.bmax[2] += tcfg.borderSize * tcfg.cs;
+
+    rc.solid = rcAllocHeightfield();
+    if (!rc.solid)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Out of memory 'solid'.");
+        return -1;
+    }
+    if (!rcCreateHeightfield(m_ctx, *rc.solid, tcfg.width, tcfg.height,
+                             tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildTileCache: Could not create solid heightfield.");
+        return -1;
+    }
+
+    // Allocate array that can hold triangle flags.
+    rc.triareas = (unsigned char *)rcAlloc(chunkyMesh->maxTrisPerChunk,
+                                           RC_ALLOC_TEMP);
+    if (!rc.triareas)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Out of memory 'triareas'.");
+        return -1;
+    }
+
+    float tbmin[2], tbmax[2];
+    tbmin[0] = tcfg.bmin[0];
+    tbmin[1] = tcfg.bmin[2];
+    tbmax[0] = tcfg.bmax[0];
+    tbmax[1] = tcfg.bmax[2];
+    // a tile may overlap any number of chunks, as many as the nodes at most
+    std::vector<int> cid(chunkyMesh->nnodes);
+    const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax,
+                                                cid.data(), (int)cid.size());
+    if (!ncid) return 0; // empty
+
+    for (int i = 0; i < ncid; ++i)
+    {
+        const rcChunkyTriMeshNode &node = chunkyMesh->nodes[cid[i]];
+        const int *tris                 = &chunkyMesh->tris[node.i * 3];
+        const int ntris                 = node.n;
+
+        memset(rc.triareas, 0, ntris * sizeof(unsigned char));
+        rcMarkWalkableTriangles(m_ctx, tcfg.walkableSlopeAngle, verts, nverts,
+                                tris, ntris, rc.triareas);
+        if (!rcRasterizeTriangles(m_ctx, verts, nverts, tris, rc.triareas,
+                                  ntris, *rc.solid, tcfg.walkableClimb))
+        {
+            m_ctx->log(RC_LOG_ERROR, "buildTileCache: Could not rasterize.");
+            return -1;
+        }
+    }
+
+    // Once all geometry is rasterized, we do initial pass of filtering to
+    // remove unwanted overhangs caused by the conservative rasterization
+    // as well as filter spans where the character cannot possibly stand.
+    rcFilterLowHangingWalkableObstacles(m_ctx, tcfg.walkableClimb, *rc.solid);
+    rcFilterLedgeSpans(m_ctx, tcfg.walkableHeight, tcfg.walkableClimb,
+                       *rc.solid);
+    rcFilterWalkableLowHeightSpans(m_ctx, tcfg.walkableHeight, *rc.solid);
+
+    rc.chf = rcAllocCompactHeightfield();
+    if (!rc.chf)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Out of memory 'chf'.");
+        return -1;
+    }
+    if (!rcBuildCompactHeightfield(m_ctx, tcfg.walkableHeight,
+                                   tcfg.walkableClimb, *rc.solid, *rc.chf))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Could not build compact data.");
+        return -1;
+    }
+
+    // Erode the walkable area by agent radius.
+    if (!rcErodeWalkableArea(m_ctx, tcfg.walkableRadius, *rc.chf))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Could not erode.");
+        return -1;
+    }
+
+    // (Optional) Mark areas.
+    const ConvexVolume *vols = m_geom->getConvexVolumes();
+    for (int i = 0; i < m_geom->getConvexVolumeCount(); ++i)
+    {
+        rcMarkConvexPolyArea(m_ctx, vols[i].verts, vols[i].nverts, vols[i].hmin,
+                             vols[i].hmax, (unsigned char)vols[i].area,
+                             *rc.chf);
+    }
+
+    rc.lset = rcAllocHeightfieldLayerSet();
+    if (!rc.lset)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Out of memory 'lset'.");
+        return -1;
+    }
+    if (!rcBuildHeightfieldLayers(m_ctx, *rc.chf, tcfg.borderSize,
+                                  tcfg.walkableHeight, *rc.lset))
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildTileCache: Could not build heighfield layers.");
+        return -1;
+    }
+
+    int ntiles = 0;
+    for (int i = 0; i < rcMin(rc.lset->nlayers, maxTiles); ++i)
+    {
+        TileCacheData *tile              = &tiles[ntiles];
+        const rcHeightfieldLayer *layer = &rc.lset->layers[i];
+
+        // Store header
+        dtTileCacheLayerHeader header;
+        header.magic   = DT_TILECACHE_MAGIC;
+        header.version = DT_TILECACHE_VERSION;
+
+        // Tile layer location in the navmesh.
+        header.tx     = tx;
+        header.ty     = ty;
+        header.tlayer = i;
+        dtVcopy(header.bmin, layer->bmin);
+        dtVcopy(header.bmax, layer->bmax);
+
+        // Tile info.
+        header.width  = (unsigned char)layer->width;
+        header.height = (unsigned char)layer->height;
+        header.minx   = (unsigned char)layer->minx;
+        header.maxx   = (unsigned char)layer->maxx;
+        header.miny   = (unsigned char)layer->miny;
+        header.maxy   = (unsigned char)layer->maxy;
+        header.hmin   = (unsigned short)layer->hmin;
+        header.hmax   = (unsigned short)layer->hmax;
+
+        dtStatus status =
+            dtBuildTileCacheLayer(comp, &header, layer->heights, layer->areas,
+                                  layer->cons, &tile->data, &tile->dataSize);
+        if (dtStatusFailed(status))
+        {
+            // free the layers already built, the caller get nothing
+            for (int j = 0; j < ntiles; ++j) dtFree(tiles[j].data);
+            m_ctx->log(RC_LOG_ERROR, "buildTileCache: Could not build layer.");
+            return -1;
+        }
+        ntiles++;
+    }
+
+    return ntiles;
+}
+
+TileCache::TileCache()
+{
+    _tile_cache = nullptr;
+    _talloc     = new LinearAllocator(32000);
+    _tcomp      = new FastLZCompressor;
+    _tmproc     = new MeshProcess;
+}
+
+TileCache::~TileCache()
+{
+    if (_tile_cache) dtFreeTileCache(_tile_cache);
+    _tile_cache = nullptr;
+
+    delete _talloc;
+    delete _tcomp;
+    delete _tmproc;
+}
+
+bool TileCache::init(const dtTileCacheParams *tcparams,
+                     const dtNavMeshParams *params, dtNavMesh *&mesh)
+{
+    mesh = nullptr;
+
+    // built or loaded again, the old layers go
+    if (_tile_cache) dtFreeTileCache(_tile_cache);
+    _tile_cache = dtAllocTileCache();
+    if (!_tile_cache) return false;
+
+    dtStatus status = _tile_cache->init(tcparams, _talloc, _tcomp, _tmproc);
+    if (dtStatusSucceed(status))
+    {
+        mesh = dtAllocNavMesh();
+        if (mesh && dtStatusSucceed(mesh->init(params))) return true;
+    }
+
+    release(mesh);
+    return false;
+}
+
+bool TileCache::grow_alloc()
+{
+    // only between two tile builds, nothing allocated is in use then
+    if (_talloc->high <= _talloc->capacity) return false;
+    _talloc->resize(_talloc->high);
+    return true;
+}
+
+void TileCache::release(dtNavMesh *&mesh)
+{
+    if (mesh) dtFreeNavMesh(mesh);
+    mesh = nullptr;
+
+    if (_tile_cache) dtFreeTileCache(_tile_cache);
+    _tile_cache = nullptr;
+}
+
+// ported from RecastDemo bool Sample_TempObstacles::handleBuild()
+bool TileCache::build(BuildGeom *m_geom, BuildContext *m_ctx,
+                      const RecastNavMesh::Setting *setting,
+                      int max_obstacles, ThreadPool *pool, dtNavMesh *&mesh)
+{
+    mesh = nullptr;
+    if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Input mesh is not specified.");
+        return false;
+    }
+    if (setting->tileSize <= 0 || setting->tileSize > 255
+        || setting->cellSize <= 0)
+    {
+        // layer width and height are stored in unsigned char
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Invalid tile size.");
+        return false;
+    }
+
+    _tmproc->set(m_geom);
+
+    const float *bmin = m_geom->getNavMeshBoundsMin();
+    const float *bmax = m_geom->getNavMeshBoundsMax();
+    int gw = 0, gh = 0;
+    rcCalcGridSize(bmin, bmax, setting->cellSize, &gw, &gh);
+    const int ts = (int)setting->tileSize;
+    const int tw = (gw + ts - 1) / ts;
+    const int th = (gh + ts - 1) / ts;
+
+    // Generation params.
+    rcConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.cs                     = setting->cellSize;
+    cfg.ch                     = setting->cellHeight;
+    cfg.walkableSlopeAngle     = setting->agentMaxSlope;
+    cfg.walkableHeight         = (int)ceilf(setting->agentHeight / cfg.ch);
+    cfg.walkableClimb          = (int)floorf(setting->agentMaxClimb / cfg.ch);
+    cfg.walkableRadius         = (int)ceilf(setting->agentRadius / cfg.cs);
+    cfg.maxEdgeLen             = (int)(setting->edgeMaxLen / setting->cellSize);
+    cfg.maxSimplificationError = setting->edgeMaxError;
+    cfg.minRegionArea          = (int)rcSqr(setting->regionMinSize);
+    cfg.mergeRegionArea        = (int)rcSqr(setting->regionMergeSize);
+    cfg.maxVertsPerPoly        = (int)setting->vertsPerPoly;
+    cfg.tileSize               = (int)setting->tileSize;
+    cfg.borderSize = cfg.walkableRadius + 3; // Reserve enough padding.
+    cfg.width      = cfg.tileSize + cfg.borderSize * 2;
+    cfg.height     = cfg.tileSize + cfg.borderSize * 2;
+    cfg.detailSampleDist = setting->detailSampleDist < 0.9f
+                             ? 0
+                             : setting->cellSize * setting->detailSampleDist;
+    cfg.detailSampleMaxError = setting->cellHeight * setting->detailSampleMaxError;
+    rcVcopy(cfg.bmin, bmin);
+    rcVcopy(cfg.bmax, bmax);
+
+    // Tile cache params.
+    dtTileCacheParams tcparams;
+    memset(&tcparams, 0, sizeof(tcparams));
+    rcVcopy(tcparams.orig, bmin);
+    tcparams.cs                     = setting->cellSize;
+    tcparams.ch                     = setting->cellHeight;
+    tcparams.width                  = (int)setting->tileSize;
+    tcparams.height                 = (int)setting->tileSize;
+    tcparams.walkableHeight         = setting->agentHeight;
+    tcparams.walkableRadius         = setting->agentRadius;
+    tcparams.walkableClimb          = setting->agentMaxClimb;
+    tcparams.maxSimplificationError = setting->edgeMaxError;
+    tcparams.maxTiles     = tw * th * EXPECTED_LAYERS_PER_TILE;
+    tcparams.maxObstacles = max_obstacles;
+
+    // Max tiles and max polys affect how the tile IDs are caculated.
+    // There are 22 bits available for identifying a tile and a polygon.
+    int tileBits = rcMin(
+        (int)dtIlog2(dtNextPow2(tw * th * EXPECTED_LAYERS_PER_TILE)), 14);
+    int polyBits = 22 - tileBits;
+
+    dtNavMeshParams params;
+    memset(&params, 0, sizeof(params));
+    rcVcopy(params.orig, bmin);
+    params.tileWidth  = setting->tileSize * setting->cellSize;
+    params.tileHeight = setting->tileSize * setting->cellSize;
+    params.maxTiles   = 1 << tileBits;
+    params.maxPolys   = 1 << polyBits;
+
+    if (!init(&tcparams, &params, mesh))
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: Could not init tile cache.");
+        return false;
+    }
+
+    m_ctx->log(RC_LOG_PROGRESS, "Building tile cache:");
+    m_ctx->log(RC_LOG_PROGRESS, " - %d x %d tiles", tw, th);
+
+    // rasterizing is the expensive part and run in parallel, dtTileCache is
+    // not thread safe so the layers are added under a lock. A tile failed
+    // would be a hole in the mesh, so fail the build
+    std::atomic<int> failed(0);
+    std::atomic<int> failed_tiles(0);
+    std::mutex cache_mutex;
+    pool->parallel_for(tw * th, 1, [&](int begin, int end) {
+        BuildContext ctx(m_ctx);
+        for (int i = begin; i < end; i++)
+        {
+            TileCacheData tiles[MAX_LAYERS];
+            memset(tiles, 0, sizeof(tiles));
+            int ntiles = rasterizeTileLayers(m_geom, &ctx, _tcomp, i % tw,
+                                             i / tw, cfg, tiles, MAX_LAYERS);
+            if (ntiles < 0)
+            {
+                failed_tiles++;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> guard(cache_mutex);
+            for (int j = 0; j < ntiles; ++j)
+            {
+                TileCacheData *tile = &tiles[j];
+                dtStatus status     = _tile_cache->addTile(
+                    tile->data, tile->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+                if (dtStatusFailed(status))
+                {
+                    dtFree(tile->data);
+                    tile->data = 0;
+                    failed++;
+                }
+            }
+        }
+    });
+
+    if (failed || failed_tiles)
+    {
+        m_ctx->log(RC_LOG_ERROR,
+                   "buildTileCache: %d tiles not rasterized, %d layers not "
+                   "added.",
+                   failed_tiles.load(), failed.load());
+        release(mesh);
+        return false;
+    }
+
+    // Build initial meshes, the shared allocator make this sequential
+    int failed_meshes = 0;
+    for (int y = 0; y < th; ++y)
+    {
+        for (int x = 0; x < tw; ++x)
+        {
+            dtStatus status;
+            do
+            {
+                status = _tile_cache->buildNavMeshTilesAt(x, y, mesh);
+            } while (dtStatusDetail(status, DT_OUT_OF_MEMORY) && grow_alloc());
+            if (dtStatusFailed(status)) failed_meshes++;
+        }
+    }
+    if (failed_meshes)
+    {
+        m_ctx->log(RC_LOG_ERROR, "buildTileCache: %d tiles not built.",
+                   failed_meshes);
+        release(mesh);
+        return false;
+    }
+
+    return true;
+}
+
+// ported from RecastDemo void Sample_TempObstacles::saveAll()
+bool TileCache::save(FILE *fp) const
+{
+    if (!_tile_cache) return false;
+
+    // Store header.
+    TileCacheSetHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic          = TILECACHESET_MAGIC;
+    header.version        = TILECACHESET_VERSION;
+    header.numTiles       = 0;
+    header.numOffMeshCons = _tmproc->count();
+    for (int i = 0; i < _tile_cache->getTileCount(); ++i)
+    {
+        const dtCompressedTile *tile = _tile_cache->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+        header.numTiles++;
+    }
+    memcpy(&header.cacheParams, _tile_cache->getParams(),
+           sizeof(dtTileCacheParams));
+    if (fwrite(&header, sizeof(TileCacheSetHeader), 1, fp) != 1)
+        return false;
+
+    // Store off-mesh connections.
+    const int n = header.numOffMeshCons;
+    if (n > 0)
+    {
+        if (fwrite(_tmproc->verts.data(), sizeof(float), n * 6, fp)
+                != (size_t)n * 6
+            || fwrite(_tmproc->rads.data(), sizeof(float), n, fp) != (size_t)n
+            || fwrite(_tmproc->dirs.data(), 1, n, fp) != (size_t)n
+            || fwrite(_tmproc->areas.data(), 1, n, fp) != (size_t)n
+            || fwrite(_tmproc->flags.data(), sizeof(unsigned short), n, fp)
+                   != (size_t)n
+            || fwrite(_tmproc->ids.data(), sizeof(unsigned int), n, fp)
+                   != (size_t)n)
+        {
+            return false;
+        }
+    }
+
+    // Store tiles.
+    for (int i = 0; i < _tile_cache->getTileCount(); ++i)
+    {
+        const dtCompressedTile *tile = _tile_cache->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+
+        TileCacheTileHeader tileHeader;
+        tileHeader.tileRef  = _tile_cache->getTileRef(tile);
+        tileHeader.dataSize = tile->dataSize;
+        if (fwrite(&tileHeader, sizeof(tileHeader), 1, fp) != 1
+            || fwrite(tile->data, tile->dataSize, 1, fp) != 1)
+            return false;
+    }
+
+    return true;
+}
+
+// ported from RecastDemo void Sample_TempObstacles::loadAll()
+bool TileCache::load(FILE *fp, dtNavMesh *&mesh)
+{
+    mesh = nullptr;
+
+    // Read header.
+    TileCacheSetHeader header;
+    if (fread(&header, sizeof(TileCacheSetHeader), 1, fp) != 1) return false;
+    if (header.magic != TILECACHESET_MAGIC) return false;
+    if (header.version != TILECACHESET_VERSION) return false;
+
+    // Read off-mesh connections.
+    const int n = header.numOffMeshCons;
+    if (n < 0) return false;
+    _tmproc->resize(n);
+    if (n > 0)
+    {
+        if (fread(_tmproc->verts.data(), sizeof(float), n * 6, fp)
+                != (size_t)n * 6
+            || fread(_tmproc->rads.data(), sizeof(float), n, fp) != (size_t)n
+            || fread(_tmproc->dirs.data(), 1, n, fp) != (size_t)n
+            || fread(_tmproc->areas.data(), 1, n, fp) != (size_t)n
+            || fread(_tmproc->flags.data(), sizeof(unsigned short), n, fp)
+                   != (size_t)n
+            || fread(_tmproc->ids.data(), sizeof(unsigned int), n, fp)
+                   != (size_t)n)
+        {
+            return false;
+        }
+    }
+
+    // same as TileCache::build
+    const dtTileCacheParams &tcparams = header.cacheParams;
+    int tileBits = rcMin((int)dtIlog2(dtNextPow2(tcparams.maxTiles)), 14);
+    int polyBits = 22 - tileBits;
+
+    dtNavMeshParams params;
+    memset(&params, 0, sizeof(params));
+    dtVcopy(params.orig, tcparams.orig);
+    params.tileWidth  = tcparams.width * tcparams.cs;
+    params.tileHeight = tcparams.height * tcparams.cs;
+    params.maxTiles   = 1 << tileBits;
+    params.maxPolys   = 1 << polyBits;
+
+    if (!init(&tcparams, &params, mesh)) return false;
+
+    // Read tiles, a short file leave nothing half loaded
+    for (int i = 0; i < header.numTiles; ++i)
+    {
+        TileCacheTileHeader tileHeader;
+        if (fread(&tileHeader, sizeof(tileHeader), 1, fp) != 1
+            || !tileHeader.tileRef || tileHeader.dataSize <= 0)
+        {
+            release(mesh);
+            return false;
+        }
+
+        unsigned char *data =
+            (unsigned char *)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
+        if (!data || fread(data, tileHeader.dataSize, 1, fp) != 1)
+        {
+            dtFree(data);
+            release(mesh);
+            return false;
+        }
+
+        // a layer not added or not built would be a hole in the mesh
+        dtCompressedTileRef tile = 0;
+        dtStatus addTileStatus   = _tile_cache->addTile(
+            data, tileHeader.dataSize, DT_COMPRESSEDTILE_FREE_DATA, &tile);
+        if (dtStatusFailed(addTileStatus))
+        {
+            dtFree(data);
+            release(mesh);
+            return false;
+        }
+        dtStatus status;
+        do
+        {
+            status = _tile_cache->buildNavMeshTile(tile, mesh);
+        } while (dtStatusDetail(status, DT_OUT_OF_MEMORY) && grow_alloc());
+        if (dtStatusFailed(status))
+        {
+            release(mesh);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+dtStatus TileCache::add_obstacle(const float *pos, float radius, float height,
+                                 dtObstacleRef &ref)
+{
+    ref = 0;
+    return _tile_cache->addObstacle(pos, radius, height, &ref);
+}
+
+dtStatus TileCache::add_box_obstacle(const float *bmin, const float *bmax,
+                                     dtObstacleRef &ref)
+{
+    ref = 0;
+    return _tile_cache->addBoxObstacle(bmin, bmax, &ref);
+}
+
+dtStatus TileCache::remove_obstacle(dtObstacleRef ref)
+{
+    return _tile_cache->removeObstacle(ref);
+}
+
+dtStatus TileCache::update(dtNavMesh *mesh, int budget_us)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline =
+        Clock::now() + std::chrono::microseconds(budget_us);
+
+    // dtTileCache::update rebuild at most one tile per call
+    bool up_to_date = false;
+    do
+    {
+        dtStatus status = _tile_cache->update(0, mesh, &up_to_date);
+        if (dtStatusFailed(status)) return status;
+    } while (!up_to_date && Clock::now() < deadline);
+
+    return up_to_date ? DT_SUCCESS : DT_SUCCESS | DT_IN_PROGRESS;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdio>
+
+#include <DetourNavMesh.h>
+#include <DetourTileCache.h>
+
+#include "recast_navmesh.h"
+
+class BuildGeom;
+class BuildContext;
+class ThreadPool;
+struct LinearAllocator;
+struct FastLZCompressor;
+struct MeshProcess;
+
+/// magic of MESH_FORMAT_TILE_CACHE file
+static const int TILECACHESET_MAGIC =
+    'T' << 24 | 'S' << 16 | 'E' << 8 | 'T'; //'TSET';
+
+/**
+ * dtTileCache with the allocator, compressor and mesh process it need, ported
+ * from RecastDemo Sample_TempObstacles. Keep the compressed heightfield layers
+ * of every tile, so tiles touched by an obstacle are rebuilt from the layers
+ * instead of the geometry
+ */
+class TileCache
+{
+public:
+    TileCache();
+    ~TileCache();
+
+    /**
+     * rasterize geom into heightfield layers on pool, then build every tile
+     * of a new nav mesh from the layers. Fail if any tile failed, rather
+     * than a mesh with holes
+     * @param mesh [out] the nav mesh built, owned by the caller
+     */
+    bool build(BuildGeom *geom, BuildContext *ctx,
+               const RecastNavMesh::Setting *setting, int max_obstacles,
+               ThreadPool *pool, dtNavMesh *&mesh);
+
+    /**
+     * write params, off-mesh connections and the compressed layers
+     * @return false if a write failed, the file is then truncated
+     */
+    bool save(FILE *fp) const;
+
+    /**
+     * read a file written by save and build a new nav mesh from it
+     * @param mesh [out] the nav mesh built, owned by the caller
+     */
+    bool load(FILE *fp, dtNavMesh *&mesh);
+
+    dtStatus add_obstacle(const float *pos, float radius, float height,
+                          dtObstacleRef &ref);
+    dtStatus add_box_obstacle(const float *bmin, const float *bmax,
+                              dtObstacleRef &ref);
+    dtStatus remove_obstacle(dtObstacleRef ref);
+
+    /**
+     * apply obstacle changes to mesh, one tile at a time until all tiles up
+     * to date or budget used up
+     * @return DT_SUCCESS if up to date, with DT_IN_PROGRESS if changes left
+     */
+    dtStatus update(dtNavMesh *mesh, int budget_us);
+
+private:
+    /// a new dtTileCache and mesh, the old dtTileCache if any is freed
+    bool init(const dtTileCacheParams *tcparams,
+              const dtNavMeshParams *params, dtNavMesh *&mesh);
+    /// free mesh and the dtTileCache after a failed init or load
+    void release(dtNavMesh *&mesh);
+    /**
+     * grow the allocator to what a failed tile build needed
+     * @return false if it was not the allocator that ran out
+     */
+    bool grow_alloc();
+
+private:
+    dtTileCache *_tile_cache;
+    LinearAllocator *_talloc;
+    FastLZCompressor *_tcomp;
+    MeshProcess *_tmproc; /// hold the off-mesh connections too
+};
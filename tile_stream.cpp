@@ -0,0 +1,399 @@
+#include <DetourAlloc.h>
+#include <DetourCommon.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include "tile_stream.h"
+
+/// fseek to offset from the beginning, past 2GB where long is 32 bits
+static int seek_set(FILE *fp, unsigned long long offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (long long)offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+TileStream::TileStream()
+{
+    memset(_orig, 0, sizeof(_orig));
+    _tile_width  = 0;
+    _tile_height = 0;
+    _minx        = 0;
+    _miny        = 0;
+    _width       = 0;
+    _height      = 0;
+
+    _tick    = 0;
+    _stamps  = nullptr;
+    _states  = nullptr;
+    _pending = 0;
+
+    _resident_bytes = 0;
+    _budget         = 0;
+    _loads          = 0;
+    _evictions      = 0;
+    _failures       = 0;
+    _failed_count   = 0;
+
+    _fp   = nullptr;
+    _stop = false;
+}
+
+TileStream::~TileStream()
+{
+    if (_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _stop = true;
+        }
+        _cond.notify_one();
+        _thread.join();
+    }
+
+    // read but never added
+    for (auto &ready : _ready) dtFree(ready.second);
+
+    if (_fp) fclose(_fp);
+    delete[] _stamps;
+    delete[] _states;
+}
+
+bool TileStream::open(const char *path, const dtNavMesh *mesh,
+                      const std::vector<Entry> &entries, size_t budget)
+{
+    const dtNavMeshParams *params = mesh->getParams();
+    _fp = fopen(path, "rb");
+    if (!_fp) return false;
+
+    dtVcopy(_orig, params->orig);
+    _tile_width  = params->tileWidth;
+    _tile_height = params->tileHeight;
+    _budget      = budget;
+
+    // only the header of every tile is read, for it's coordinates
+    std::vector<int> xs(entries.size()), ys(entries.size());
+    int minx = INT_MAX, miny = INT_MAX, maxx = INT_MIN, maxy = INT_MIN;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const Entry &entry = entries[i];
+        dtMeshHeader header;
+        if (entry.size < (int)sizeof(dtMeshHeader)
+            || seek_set(_fp, entry.offset)
+            || 1 != fread(&header, sizeof(header), 1, _fp)
+            || header.magic != DT_NAVMESH_MAGIC)
+        {
+            return false;
+        }
+
+        xs[i] = header.x;
+        ys[i] = header.y;
+        minx  = std::min(minx, header.x);
+        miny  = std::min(miny, header.y);
+        maxx  = std::max(maxx, header.x);
+        maxy  = std::max(maxy, header.y);
+    }
+
+    if (!entries.empty())
+    {
+        _minx   = minx;
+        _miny   = miny;
+        _width  = maxx - minx + 1;
+        _height = maxy - miny + 1;
+    }
+    _grid.assign(_width * _height, -1);
+    _by_index.assign(mesh->getMaxTiles(), -1);
+    _tiles.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        Tile &tile  = _tiles[i];
+        tile.ref    = entries[i].ref;
+        tile.size   = entries[i].size;
+        tile.offset = entries[i].offset;
+        tile.failures   = 0;
+        tile.retry_tick = 0;
+
+        int &first = _grid[(xs[i] - _minx) + (ys[i] - _miny) * _width];
+        tile.next  = first;
+        first      = (int)i;
+
+        // added with this ref, polys on it decode to the same tile index
+        const unsigned int it = mesh->decodePolyIdTile(tile.ref);
+        if (it >= _by_index.size()) return false;
+        _by_index[it] = (int)i;
+    }
+
+    _stamps = new std::atomic<unsigned int>[_tiles.size()];
+    _states = new std::atomic<int>[_tiles.size()];
+    for (size_t i = 0; i < _tiles.size(); i++)
+    {
+        _stamps[i] = 0;
+        _states[i] = TILE_UNLOADED;
+    }
+
+    _thread = std::thread(&TileStream::io_main, this);
+    return true;
+}
+
+void TileStream::touch(const float *pos, const float *ext)
+{
+    touch_rect(pos[0] - ext[0], pos[2] - ext[2], pos[0] + ext[0],
+               pos[2] + ext[2], _tick.load(std::memory_order_relaxed));
+}
+
+void TileStream::touch_segment(const float *spos, const float *epos)
+{
+    const unsigned int stamp = _tick.load(std::memory_order_relaxed);
+
+    // sample at half a tile, no tile crossed by the segment is skipped
+    const float dx   = epos[0] - spos[0];
+    const float dz   = epos[2] - spos[2];
+    const float step = std::min(_tile_width, _tile_height) * 0.5f;
+    const int n =
+        step > 0 ? (int)ceilf(sqrtf(dx * dx + dz * dz) / step) : 0;
+    for (int k = 0; k <= n; k++)
+    {
+        const float t = n ? (float)k / n : 0;
+        const float x = spos[0] + dx * t;
+        const float z = spos[2] + dz * t;
+        touch_rect(x, z, x, z, stamp);
+    }
+}
+
+void TileStream::touch_polys(const dtNavMesh *mesh, const dtPolyRef *polys,
+                             int npolys)
+{
+    const unsigned int stamp = _tick.load(std::memory_order_relaxed);
+
+    // consecutive polys are mostly on the same tile
+    unsigned int last = (unsigned int)-1;
+    for (int i = 0; i < npolys; i++)
+    {
+        const unsigned int it = mesh->decodePolyIdTile(polys[i]);
+        if (it == last || it >= _by_index.size()) continue;
+
+        last = it;
+        if (_by_index[it] != -1) request(_by_index[it], stamp);
+    }
+}
+
+void TileStream::touch_rect(float minx, float minz, float maxx, float maxz,
+                            unsigned int stamp)
+{
+    if (_tiles.empty()) return;
+
+    const int x0 = std::max(
+        _minx, (int)floorf((minx - _orig[0]) / _tile_width));
+    const int x1 = std::min(
+        _minx + _width - 1, (int)floorf((maxx - _orig[0]) / _tile_width));
+    const int y0 = std::max(
+        _miny, (int)floorf((minz - _orig[2]) / _tile_height));
+    const int y1 = std::min(
+        _miny + _height - 1, (int)floorf((maxz - _orig[2]) / _tile_height));
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            int i = _grid[(x - _minx) + (y - _miny) * _width];
+            for (; i != -1; i = _tiles[i].next) request(i, stamp);
+        }
+    }
+}
+
+void TileStream::request(int tile, unsigned int stamp)
+{
+    _stamps[tile].store(stamp, std::memory_order_relaxed);
+
+    int expected = TILE_UNLOADED;
+    if (!_states[tile].compare_exchange_strong(expected, TILE_REQUESTED))
+        return;
+
+    _pending++;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _requests.push_back(tile);
+    }
+    _cond.notify_one();
+}
+
+void TileStream::io_main()
+{
+    while (true)
+    {
+        int i = -1;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return _stop || !_requests.empty(); });
+            if (_stop) return;
+
+            i = _requests.front();
+            _requests.pop_front();
+        }
+
+        // a tile requested long ago may be cold now, load it anyway and let
+        // update evict it if needed
+        const Tile &tile = _tiles[i];
+        unsigned char *data =
+            (unsigned char *)dtAlloc(tile.size, DT_ALLOC_PERM);
+        if (data
+            && (seek_set(_fp, tile.offset)
+                || 1 != fread(data, tile.size, 1, _fp)))
+        {
+            dtFree(data);
+            data = nullptr;
+        }
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        _ready.push_back(std::make_pair(i, data));
+    }
+}
+
+int TileStream::add_interest(const float *pos, float radius)
+{
+    Interest interest;
+    dtVcopy(interest.pos, pos);
+    interest.radius = radius;
+    interest.used   = true;
+
+    for (size_t i = 0; i < _interests.size(); i++)
+    {
+        if (_interests[i].used) continue;
+
+        _interests[i] = interest;
+        return (int)i;
+    }
+
+    _interests.push_back(interest);
+    return (int)_interests.size() - 1;
+}
+
+bool TileStream::move_interest(int id, const float *pos)
+{
+    if (id < 0 || id >= (int)_interests.size() || !_interests[id].used)
+        return false;
+
+    dtVcopy(_interests[id].pos, pos);
+    return true;
+}
+
+bool TileStream::remove_interest(int id)
+{
+    if (id < 0 || id >= (int)_interests.size() || !_interests[id].used)
+        return false;
+
+    _interests[id].used = false;
+    return true;
+}
+
+void TileStream::fail(int i, unsigned int tick)
+{
+    Tile &tile = _tiles[i];
+    tile.failures++;
+    _failures++;
+    _states[i] = TILE_FAILED;
+
+    // wait 2, 4, 8.. updates before the next try, a bad tile must not be
+    // read again on every touch
+    if (tile.failures >= TILE_STREAM_RETRIES)
+    {
+        _failed_count++;
+        return;
+    }
+    tile.retry_tick = tick + (1u << tile.failures);
+    _retries.push_back(i);
+}
+
+int TileStream::update(dtNavMesh *mesh)
+{
+    // queries since the last update stamped tick - 1, keep those tiles
+    const unsigned int tick = ++_tick;
+
+    // failed tiles due are requested again when touched next time
+    size_t nretries = 0;
+    for (int i : _retries)
+    {
+        if ((int)(tick - _tiles[i].retry_tick) >= 0)
+            _states[i] = TILE_UNLOADED;
+        else
+            _retries[nretries++] = i;
+    }
+    _retries.resize(nretries);
+    for (const Interest &interest : _interests)
+    {
+        if (!interest.used) continue;
+
+        const float *pos = interest.pos;
+        const float r    = interest.radius;
+        touch_rect(pos[0] - r, pos[2] - r, pos[0] + r, pos[2] + r, tick);
+    }
+
+    std::vector<std::pair<int, unsigned char *> > ready;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        ready.swap(_ready);
+    }
+
+    int changed = 0;
+    for (auto &r : ready)
+    {
+        _pending--;
+
+        Tile &tile = _tiles[r.first];
+        if (!r.second)
+        {
+            fail(r.first, tick);
+            continue;
+        }
+
+        dtStatus status =
+            mesh->addTile(r.second, tile.size, DT_TILE_FREE_DATA, tile.ref, 0);
+        if (dtStatusFailed(status))
+        {
+            dtFree(r.second);
+            fail(r.first, tick);
+            continue;
+        }
+
+        tile.failures    = 0;
+        _states[r.first] = TILE_RESIDENT;
+        _resident.push_back(r.first);
+        _resident_bytes += tile.size;
+        _loads++;
+        changed++;
+    }
+
+    if (_resident_bytes <= _budget) return changed;
+
+    // evict the coldest first, may stay over budget if all tiles are hot
+    std::sort(_resident.begin(), _resident.end(), [this](int a, int b) {
+        return _stamps[a].load(std::memory_order_relaxed)
+               < _stamps[b].load(std::memory_order_relaxed);
+    });
+
+    std::vector<int> kept;
+    kept.reserve(_resident.size());
+    for (int i : _resident)
+    {
+        const Tile &tile = _tiles[i];
+        if (_resident_bytes <= _budget
+            || _stamps[i].load(std::memory_order_relaxed) + 1 >= tick)
+        {
+            kept.push_back(i);
+            continue;
+        }
+
+        mesh->removeTile(tile.ref, 0, 0);
+        _states[i] = TILE_UNLOADED;
+        _resident_bytes -= tile.size;
+        _evictions++;
+        changed++;
+    }
+    _resident.swap(kept);
+
+    return changed;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <DetourNavMesh.h>
+
+/// a tile failed to read this many times in a row is never requested again
+static const int TILE_STREAM_RETRIES = 5;
+
+/**
+ * load the tiles of a MESH_FORMAT_MMAP file on demand. Only the tile offset
+ * table and the tile coordinates are resident, tiles touched by queries or
+ * inside an interest region are read by a background io thread and added to
+ * the mesh at update, the coldest tiles are removed when the tiles resident
+ * exceed the memory budget. A tile is always added with the ref it was saved
+ * with, so refs stay valid across an evict and reload
+ */
+class TileStream
+{
+public:
+    /// a tile in the file
+    struct Entry
+    {
+        dtTileRef ref;
+        int size;
+        unsigned long long offset; /// from the beginning of file
+    };
+
+public:
+    TileStream();
+    ~TileStream();
+
+    /**
+     * read the coordinates of every tile and start the io thread
+     * @param mesh the mesh the tiles are added to, init but empty
+     * @param budget bytes of tiles resident at most, interest regions and
+     *        tiles touched since the last update are never evicted
+     */
+    bool open(const char *path, const dtNavMesh *mesh,
+              const std::vector<Entry> &entries, size_t budget);
+
+    /**
+     * request the tiles overlapping pos +- ext, thread safe and never block
+     * on disk
+     */
+    void touch(const float *pos, const float *ext);
+    /// request the tiles along a segment, thread safe
+    void touch_segment(const float *spos, const float *epos);
+    /// keep the tiles of a corridor hot, thread safe
+    void touch_polys(const dtNavMesh *mesh, const dtPolyRef *polys,
+                     int npolys);
+
+    /**
+     * keep the tiles within radius of pos resident
+     * @return interest id
+     */
+    int add_interest(const float *pos, float radius);
+    bool move_interest(int id, const float *pos);
+    bool remove_interest(int id);
+
+    /**
+     * add the tiles read by the io thread and evict the cold ones, must not
+     * run concurrently with queries
+     * @return tiles added and removed
+     */
+    int update(dtNavMesh *mesh);
+
+    int tile_count() const { return (int)_tiles.size(); }
+    int resident_count() const { return (int)_resident.size(); }
+    size_t resident_bytes() const { return _resident_bytes; }
+    size_t budget() const { return _budget; }
+    /// tiles requested but not added yet
+    int pending() const { return _pending.load(); }
+    unsigned long long loads() const { return _loads; }
+    unsigned long long evictions() const { return _evictions; }
+    /// reads or adds failed, every retry counted
+    unsigned long long failures() const { return _failures; }
+    /// tiles given up after failing TILE_STREAM_RETRIES times
+    int failed_count() const { return _failed_count; }
+
+private:
+    enum TileState
+    {
+        TILE_UNLOADED,
+        TILE_REQUESTED, /// queued or being read by the io thread
+        TILE_RESIDENT,
+        TILE_FAILED, /// not requested until retry_tick, or ever if given up
+    };
+
+    struct Tile
+    {
+        dtTileRef ref;
+        int size;
+        unsigned long long offset;
+        int next; /// next tile(layer) at the same x, y, -1 if none
+        int failures;            /// in a row, only the update thread
+        unsigned int retry_tick; /// TILE_FAILED until the tick reach it
+    };
+
+    struct Interest
+    {
+        float pos[3];
+        float radius;
+        bool used;
+    };
+
+    void touch_rect(float minx, float minz, float maxx, float maxz,
+                    unsigned int stamp);
+    void request(int tile, unsigned int stamp);
+    /// mark a tile failed to read or add, retried later with a backoff
+    void fail(int tile, unsigned int tick);
+    void io_main();
+
+private:
+    float _orig[3];
+    float _tile_width;
+    float _tile_height;
+    int _minx; /// tile coordinates covered by _grid
+    int _miny;
+    int _width;
+    int _height;
+    std::vector<int> _grid; /// first tile of every x, y, -1 if none
+    std::vector<Tile> _tiles;
+    std::vector<int> _by_index; /// tile of every mesh tile index, -1 if none
+
+    // touched by query threads
+    std::atomic<unsigned int> _tick;    /// increase every update
+    std::atomic<unsigned int> *_stamps; /// tick the tile last touched
+    std::atomic<int> *_states;          /// TileState of every tile
+    std::atomic<int> _pending;
+
+    // only the update thread
+    std::vector<int> _resident;
+    size_t _resident_bytes;
+    size_t _budget;
+    unsigned long long _loads;
+    unsigned long long _evictions;
+    unsigned long long _failures;
+    int _failed_count;
+    std::vector<int> _retries; /// TILE_FAILED tiles to be retried
+    std::vector<Interest> _interests;
+
+    // shared with the io thread
+    FILE *_fp; /// read by the io thread only
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<int> _requests;
+    std::vector<std::pair<int, unsigned char *> > _ready; /// nullptr if fail
+    std::thread _thread;
+};
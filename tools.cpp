@@ -2,16 +2,66 @@
  * Command line tools for nav mesh
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <thread>
+#include <vector>
 
+#include "crowd.h"
+#include "path_cache.h"
+#include "path_scheduler.h"
 #include "recast_navmesh.h"
 
 int build(const char *from, const char *to);
+int build_tiled(const char *from, const char *to, int threads);
+int build_streaming(const char *from, const char *to, int threads,
+                    int budget);
+int build_tile_cache(const char *from, const char *to, int threads);
+int build_profiles(const char *from, const char *prefix);
+int memory(const char *from, int threads);
+int geom_cache(const char *from, const char *dir);
+int convert(const char *from, const char *to, int format);
+int lean(const char *file, const char *to, float sx, float sy, float sz,
+         float ex, float ey, float ez);
+int rebuild(const char *file, const char *from, const char *to,
+            const float *bmin, const float *bmax);
+int cluster_graph(const char *from, const char *to, float cluster_size);
 int follow(const char *file, float sx, float sy, float sz, float ex, float ey,
            float ez);
 int straight(const char *file, float sx, float sy, float sz, float ex, float ey,
              float ez);
+int poly_flags(const char *file, float sx, float sy, float sz, float ex,
+               float ey, float ez);
+int concurrent(const char *file, int threads, float sx, float sy, float sz,
+               float ex, float ey, float ez);
+int batch(const char *file, int count, float sx, float sy, float sz, float ex,
+          float ey, float ez);
+int path_cache(const char *file, int count, float sx, float sy, float sz,
+               float ex, float ey, float ez);
+int follow_iter(const char *file, float sx, float sy, float sz, float ex,
+                float ey, float ez);
+int node_pool(const char *file, int max_nodes, int count, float sx, float sy,
+              float sz, float ex, float ey, float ez);
+int schedule(const char *file, int count, int budget_us, float sx, float sy,
+             float sz, float ex, float ey, float ez);
+int point_grid(const char *file, int count, float sx, float sy, float sz,
+               float ex, float ey, float ez);
+int raycast(const char *file, int count, float sx, float sy, float sz,
+            float ex, float ey, float ez);
+int crowd(const char *file, int agents, int ticks, float sx, float sy,
+          float sz, float ex, float ey, float ez);
+int obstacle(const char *file, float sx, float sy, float sz, float ex,
+             float ey, float ez);
+int stream(const char *file, int budget, float sx, float sy, float sz,
+           float ex, float ey, float ez);
+int hot_swap(const char *file, int threads, float sx, float sy, float sz,
+             float ex, float ey, float ez);
 
 int main(int argc, char *argv[])
 {
@@ -32,6 +82,132 @@ int main(int argc, char *argv[])
 
         return build(argv[2], argc > 3 ? argv[3] : nullptr);
     }
+    // tools build_tiled nav_test.obj nav_test_tiled.mesh 4
+    else if (0 == strcmp(argv[1], "build_tiled"))
+    {
+        if (argc < 3)
+        {
+            std::cerr << "build_tiled missing file path" << std::endl;
+            return -1;
+        }
+
+        return build_tiled(argv[2], argc > 3 ? argv[3] : nullptr,
+                           argc > 4 ? atoi(argv[4]) : 0);
+    }
+    // tools build_streaming nav_test.obj nav_test_streaming.mesh 4 65536
+    else if (0 == strcmp(argv[1], "build_streaming"))
+    {
+        if (argc < 4)
+        {
+            std::cerr << "build_streaming missing file path" << std::endl;
+            return -1;
+        }
+
+        return build_streaming(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 0,
+                               argc > 5 ? atoi(argv[5]) : 0);
+    }
+    // tools build_tile_cache nav_test.obj nav_test_cache.mesh 4
+    else if (0 == strcmp(argv[1], "build_tile_cache"))
+    {
+        if (argc < 3)
+        {
+            std::cerr << "build_tile_cache missing file path" << std::endl;
+            return -1;
+        }
+
+        return build_tile_cache(argv[2], argc > 3 ? argv[3] : nullptr,
+                                argc > 4 ? atoi(argv[4]) : 0);
+    }
+    // tools build_profiles nav_test.obj nav_test_profile
+    else if (0 == strcmp(argv[1], "build_profiles"))
+    {
+        if (argc < 3)
+        {
+            std::cerr << "build_profiles missing file path" << std::endl;
+            return -1;
+        }
+
+        return build_profiles(argv[2], argc > 3 ? argv[3] : nullptr);
+    }
+    // tools memory nav_test.obj 4
+    else if (0 == strcmp(argv[1], "memory"))
+    {
+        if (argc < 3)
+        {
+            std::cerr << "memory missing file path" << std::endl;
+            return -1;
+        }
+
+        return memory(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+    }
+    // tools geom_cache nav_test.obj .
+    else if (0 == strcmp(argv[1], "geom_cache"))
+    {
+        if (argc < 4)
+        {
+            std::cerr << "geom_cache missing file path" << std::endl;
+            return -1;
+        }
+
+        return geom_cache(argv[2], argv[3]);
+    }
+    // tools convert nav_test.mesh nav_test_mmap.mesh 2
+    else if (0 == strcmp(argv[1], "convert"))
+    {
+        if (argc < 4)
+        {
+            std::cerr << "convert missing file path" << std::endl;
+            return -1;
+        }
+
+        return convert(argv[2], argv[3],
+                       argc > 4 ? atoi(argv[4])
+                                : RecastNavMesh::MESH_FORMAT_SET);
+    }
+    // tools lean nav_test_tiled.mesh nav_test_lean.mesh 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "lean"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "lean missing file path" << std::endl;
+            return -1;
+        }
+
+        return lean(argv[2], argv[3], strtof(argv[4], nullptr),
+                    strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                    strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                    strtof(argv[9], nullptr));
+    }
+    // tools rebuild nav_test_tiled.mesh nav_test.obj nav_test_rebuild.mesh
+    //       -5 -5 -5 5 5 5
+    else if (0 == strcmp(argv[1], "rebuild"))
+    {
+        if (argc < 11)
+        {
+            std::cerr << "rebuild missing file path" << std::endl;
+            return -1;
+        }
+
+        float bmin[3], bmax[3];
+        for (int i = 0; i < 3; i++)
+        {
+            bmin[i] = strtof(argv[5 + i], nullptr);
+            bmax[i] = strtof(argv[8 + i], nullptr);
+        }
+        return rebuild(argv[2], argv[3], argv[4], bmin, bmax);
+    }
+    // tools cluster_graph nav_test_tiled.mesh nav_test_cluster.mesh 10
+    else if (0 == strcmp(argv[1], "cluster_graph"))
+    {
+        if (argc < 4)
+        {
+            std::cerr << "cluster_graph missing file path" << std::endl;
+            return -1;
+        }
+
+        return cluster_graph(argv[2], argv[3],
+                             argc > 4 ? strtof(argv[4], nullptr) : 0);
+    }
     // tools follow nav_test.mesh 19 -2 -23 -21 -2 29
     else if (0 == strcmp(argv[1], "follow"))
     {
@@ -45,6 +221,20 @@ int main(int argc, char *argv[])
                       strtof(argv[5], nullptr), strtof(argv[6], nullptr),
                       strtof(argv[7], nullptr), strtof(argv[8], nullptr));
     }
+    // tools follow_iter nav_test.mesh 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "follow_iter"))
+    {
+        if (argc < 9)
+        {
+            std::cerr << "follow_iter missing file path" << std::endl;
+            return -1;
+        }
+
+        return follow_iter(argv[2], strtof(argv[3], nullptr),
+                           strtof(argv[4], nullptr), strtof(argv[5], nullptr),
+                           strtof(argv[6], nullptr), strtof(argv[7], nullptr),
+                           strtof(argv[8], nullptr));
+    }
     else if (0 == strcmp(argv[1], "straight"))
     {
         if (argc < 9)
@@ -58,6 +248,174 @@ int main(int argc, char *argv[])
                         strtof(argv[6], nullptr), strtof(argv[7], nullptr),
                         strtof(argv[8], nullptr));
     }
+    // tools poly_flags nav_test_cluster.mesh 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "poly_flags"))
+    {
+        if (argc < 9)
+        {
+            std::cerr << "poly_flags missing file path" << std::endl;
+            return -1;
+        }
+
+        return poly_flags(argv[2], strtof(argv[3], nullptr),
+                          strtof(argv[4], nullptr), strtof(argv[5], nullptr),
+                          strtof(argv[6], nullptr), strtof(argv[7], nullptr),
+                          strtof(argv[8], nullptr));
+    }
+    // tools concurrent nav_test.mesh 4 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "concurrent"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "concurrent missing file path" << std::endl;
+            return -1;
+        }
+
+        return concurrent(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                          strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                          strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                          strtof(argv[9], nullptr));
+    }
+    // tools batch nav_test.mesh 1000 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "batch"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "batch missing file path" << std::endl;
+            return -1;
+        }
+
+        return batch(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                     strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                     strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                     strtof(argv[9], nullptr));
+    }
+    // tools path_cache nav_test.mesh 100 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "path_cache"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "path_cache missing file path" << std::endl;
+            return -1;
+        }
+
+        return path_cache(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                          strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                          strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                          strtof(argv[9], nullptr));
+    }
+    // tools node_pool nav_test.mesh 64 100 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "node_pool"))
+    {
+        if (argc < 11)
+        {
+            std::cerr << "node_pool missing file path" << std::endl;
+            return -1;
+        }
+
+        return node_pool(argv[2], atoi(argv[3]), atoi(argv[4]),
+                         strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                         strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                         strtof(argv[9], nullptr), strtof(argv[10], nullptr));
+    }
+    // tools point_grid nav_test.mesh 100 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "point_grid"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "point_grid missing file path" << std::endl;
+            return -1;
+        }
+
+        return point_grid(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                          strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                          strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                          strtof(argv[9], nullptr));
+    }
+    // tools raycast nav_test.mesh 1000 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "raycast"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "raycast missing file path" << std::endl;
+            return -1;
+        }
+
+        return raycast(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                       strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                       strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                       strtof(argv[9], nullptr));
+    }
+    // tools crowd nav_test.mesh 20 300 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "crowd"))
+    {
+        if (argc < 11)
+        {
+            std::cerr << "crowd missing file path" << std::endl;
+            return -1;
+        }
+
+        return crowd(argv[2], atoi(argv[3]), atoi(argv[4]),
+                     strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                     strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                     strtof(argv[9], nullptr), strtof(argv[10], nullptr));
+    }
+    // tools schedule nav_test.mesh 100 200 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "schedule"))
+    {
+        if (argc < 11)
+        {
+            std::cerr << "schedule missing file path" << std::endl;
+            return -1;
+        }
+
+        return schedule(argv[2], atoi(argv[3]), atoi(argv[4]),
+                        strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                        strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                        strtof(argv[9], nullptr), strtof(argv[10], nullptr));
+    }
+    // tools obstacle nav_test_cache.mesh 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "obstacle"))
+    {
+        if (argc < 9)
+        {
+            std::cerr << "obstacle missing file path" << std::endl;
+            return -1;
+        }
+
+        return obstacle(argv[2], strtof(argv[3], nullptr),
+                        strtof(argv[4], nullptr), strtof(argv[5], nullptr),
+                        strtof(argv[6], nullptr), strtof(argv[7], nullptr),
+                        strtof(argv[8], nullptr));
+    }
+    // tools stream nav_test_tiled_mmap.mesh 65536 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "stream"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "stream missing file path" << std::endl;
+            return -1;
+        }
+
+        return stream(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                      strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                      strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                      strtof(argv[9], nullptr));
+    }
+    // tools hot_swap nav_test.mesh 4 19 -2 -23 -21 -2 29
+    else if (0 == strcmp(argv[1], "hot_swap"))
+    {
+        if (argc < 10)
+        {
+            std::cerr << "hot_swap missing file path" << std::endl;
+            return -1;
+        }
+
+        return hot_swap(argv[2], atoi(argv[3]), strtof(argv[4], nullptr),
+                        strtof(argv[5], nullptr), strtof(argv[6], nullptr),
+                        strtof(argv[7], nullptr), strtof(argv[8], nullptr),
+                        strtof(argv[9], nullptr));
+    }
     else
     {
         std::cerr << "Unknow command" << argv[1] << std::endl;
@@ -66,15 +424,40 @@ int main(int argc, char *argv[])
     return 0;
 }
 
+static void print_build_stat(const RecastNavMesh::BuildStat &stat)
+{
+    std::cout << "load " << stat.load_ms << "ms"
+              << (stat.geom_cached ? " from geometry cache" : "") << std::endl;
+    std::cout << "build " << stat.total_ms << "ms: rasterize "
+              << stat.rasterize_ms << ", filter " << stat.filter_ms
+              << ", compact " << stat.compact_ms << ", erode " << stat.erode_ms
+              << ", distance field " << stat.distance_field_ms << ", regions "
+              << stat.regions_ms << ", contours " << stat.contours_ms
+              << ", polymesh " << stat.polymesh_ms << ", detail "
+              << stat.detail_ms << std::endl;
+    std::cout << "peak intermediate " << stat.peak_bytes / 1024 << "KB, "
+              << stat.verts << " verts, " << stat.polys << " polys, "
+              << stat.tiles << " tiles" << std::endl;
+}
+
+static void print_build_log(int category, const char *msg)
+{
+    // progress logs are too verbose for tools
+    if (category > 1) std::cerr << msg << std::endl;
+}
+
 int build(const char *from, const char *to)
 {
     RecastNavMesh rnm;
+    rnm.set_log_sink(print_build_log);
 
-    if (!rnm.build(from))
+    RecastNavMesh::BuildStat stat;
+    if (!rnm.build(from, &stat))
     {
         std::cerr << "build mesh data from " << from << " fail" << std::endl;
         return -1;
     }
+    print_build_stat(stat);
 
     std::string path(to ? to : from);
     if (!to)
@@ -95,74 +478,1521 @@ int build(const char *from, const char *to)
     return 0;
 }
 
-int follow(const char *file, float sx, float sy, float sz, float ex, float ey,
-           float ez)
+/**
+ * build twice, parsing the obj then reading the geometry cache, the two
+ * builds must be the same
+ */
+int geom_cache(const char *from, const char *dir)
 {
-    RecastNavMesh rnm;
+    // start from a parse, named obj name + GEOM_CACHE_SUFFIX of build_geom.h
+    std::string name(from);
+    name = name.substr(name.find_last_of("/\\") + 1);
+    std::string cache_path(dir);
+    cache_path.append("/").append(name).append(".geom");
+    remove(cache_path.c_str());
 
-    if (!rnm.load(file))
+    RecastNavMesh::BuildStat stat[2];
+    for (int i = 0; i < 2; i++)
     {
-        std::cerr << "load mesh data from " << file << " fail" << std::endl;
-        return -1;
+        RecastNavMesh rnm;
+        rnm.set_log_sink(print_build_log);
+        rnm.set_geom_cache(dir);
+        if (!rnm.build(from, &stat[i]))
+        {
+            std::cerr << "build mesh data from " << from << " fail"
+                      << std::endl;
+            return -1;
+        }
     }
 
-    int use_size              = 0;
-    static const int max_size = 256;
-    float points[max_size]    = {0};
-
-    unsigned int status =
-        rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size, use_size, 5.0);
-    std::cout << "path follow from (" << sx << "," << sy << "," << sz
-              << ") to (" << ex << "," << ey << "," << ez << ")" << std::endl;
-    if (!RecastNavMesh::is_succeed(status))
+    std::cout << "parse " << stat[0].load_ms << "ms, cache "
+              << stat[1].load_ms << "ms" << std::endl;
+    if (stat[0].geom_cached || !stat[1].geom_cached)
     {
-        std::cerr << "    FAIL" << std::endl;
+        std::cerr << "geometry cache not used" << std::endl;
         return -1;
     }
-
-    std::cout.precision(3);
-    for (int i = 0; i < use_size; i++)
+    if (stat[0].verts != stat[1].verts || stat[0].polys != stat[1].polys)
     {
-        float *point = &points[i * 3];
-        std::cout << "    " << point[0] << "," << point[1] << "," << point[2]
+        std::cerr << "build from cache mismatch: " << stat[1].verts
+                  << " verts " << stat[1].polys << " polys, expect "
+                  << stat[0].verts << " verts " << stat[0].polys << " polys"
                   << std::endl;
+        return -1;
     }
+    return 0;
+}
 
-    return RecastNavMesh::is_partia(status) ? 1 : 0;
+/// the default setting of RecastNavMesh
+static void default_setting(RecastNavMesh::Setting &s)
+{
+    s.tileSize             = 64;
+    s.cellSize             = 0.3f;
+    s.cellHeight           = 0.2f;
+    s.agentMaxSlope        = 45.f;
+    s.agentRadius          = 0.6f;
+    s.agentHeight          = 2.f;
+    s.agentMaxClimb        = 0.9f;
+    s.edgeMaxLen           = 12.f;
+    s.edgeMaxError         = 1.3f;
+    s.regionMinSize        = 8.f;
+    s.regionMergeSize      = 20.f;
+    s.vertsPerPoly         = 6.f;
+    s.detailSampleDist     = 6.f;
+    s.detailSampleMaxError = 1.f;
+    s.partitionType        = RecastNavMesh::SAMPLE_PARTITION_WATERSHED;
 }
 
-int straight(const char *file, float sx, float sy, float sz, float ex, float ey,
-             float ez)
+/**
+ * build a small, the default and a large agent in one pass, then every one
+ * alone. The meshes of the profiles with the smallest climb must be the same
+ * as built alone, the spans of the shared pass are merged within it so a
+ * profile of a larger climb may differ and only need a mesh. Saved to
+ * prefix + "_<profile>.mesh"
+ */
+int build_profiles(const char *from, const char *prefix)
 {
-    RecastNavMesh rnm;
+    static const int count = 4;
+    // only the agent differs, cell size, cell height and slope are shared
+    static const float agents[count][3] = {
+        // radius, height, climb
+        {0.3f, 1.f, 0.9f},
+        {0.6f, 2.f, 0.9f},
+        {1.2f, 3.f, 0.9f},
+        {0.6f, 2.f, 1.8f},
+    };
+    float min_climb = agents[0][2];
+    for (int i = 1; i < count; i++)
+        min_climb = std::min(min_climb, agents[i][2]);
 
-    if (!rnm.load(file))
+    RecastNavMesh::Setting settings[count];
+    RecastNavMesh *meshes[count];
+    for (int i = 0; i < count; i++)
     {
-        std::cerr << "load mesh data from " << file << " fail" << std::endl;
-        return -1;
+        RecastNavMesh::Setting &s = settings[i];
+        default_setting(s);
+        s.agentRadius   = agents[i][0];
+        s.agentHeight   = agents[i][1];
+        s.agentMaxClimb = agents[i][2];
+
+        meshes[i] = new RecastNavMesh(nullptr, &s, nullptr);
+        meshes[i]->set_log_sink(print_build_log);
     }
 
-    int use_size              = 0;
-    static const int max_size = 256;
-    float points[max_size]    = {0};
+    int ret = 0;
+    RecastNavMesh::BuildStat stats[count];
+    auto begin = std::chrono::steady_clock::now();
+    if (!RecastNavMesh::build_profiles(from, meshes, count, stats))
+    {
+        std::cerr << "build profiles from " << from << " fail" << std::endl;
+        ret = -1;
+    }
+    float shared_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count()
+                      / 1000.0f;
 
-    unsigned int status =
-        rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size, use_size, 5.0);
-    std::cout << "path straight from (" << sx << "," << sy << "," << sz
-              << ") to (" << ex << "," << ey << "," << ez << ")" << std::endl;
-    if (!RecastNavMesh::is_succeed(status))
+    float alone_ms = 0;
+    for (int i = 0; 0 == ret && i < count; i++)
     {
-        std::cerr << "    FAIL" << std::endl;
-        return -1;
+        print_build_stat(stats[i]);
+
+        RecastNavMesh alone(nullptr, &settings[i], nullptr);
+        alone.set_log_sink(print_build_log);
+
+        RecastNavMesh::BuildStat stat;
+        begin = std::chrono::steady_clock::now();
+        if (!alone.build(from, &stat))
+        {
+            std::cerr << "build mesh data from " << from << " fail"
+                      << std::endl;
+            ret = -1;
+            break;
+        }
+        alone_ms += std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count()
+                    / 1000.0f;
+
+        if (!stats[i].polys)
+        {
+            std::cerr << "profile " << i << " has no polys" << std::endl;
+            ret = -1;
+            break;
+        }
+        if (agents[i][2] == min_climb
+            && (stat.verts != stats[i].verts || stat.polys != stats[i].polys))
+        {
+            std::cerr << "profile " << i << " mismatch: " << stats[i].verts
+                      << " verts " << stats[i].polys << " polys, expect "
+                      << stat.verts << " verts " << stat.polys << " polys"
+                      << std::endl;
+            ret = -1;
+            break;
+        }
+
+        if (!prefix) continue;
+
+        std::string path(prefix);
+        path.append("_").append(std::to_string(i)).append(".mesh");
+        if (!meshes[i]->save(path.c_str()))
+        {
+            std::cerr << "save mesh data to " << path << " fail" << std::endl;
+            ret = -1;
+        }
     }
 
-    std::cout.precision(3);
-    for (int i = 0; i < use_size; i++)
+    if (0 == ret)
     {
-        float *point = &points[i * 3];
-        std::cout << "    " << point[0] << "," << point[1] << "," << point[2]
-                  << std::endl;
+        std::cout << count << " profiles shared " << shared_ms
+                  << "ms, alone " << alone_ms << "ms" << std::endl;
     }
 
-    return RecastNavMesh::is_partia(status) ? 1 : 0;
+    for (int i = 0; i < count; i++) delete meshes[i];
+    return ret;
+}
+
+static void print_memory_stat(const RecastNavMesh::MemoryStat &stat)
+{
+    static const char *hints[RecastNavMesh::MEMORY_HINTS] = {
+        "rc perm", "rc temp", "dt perm", "dt temp"};
+
+    for (int i = 0; i < RecastNavMesh::MEMORY_HINTS; i++)
+    {
+        std::cout << hints[i] << " alive " << stat.bytes[i] / 1024
+                  << "KB, peak " << stat.peak[i] / 1024 << "KB" << std::endl;
+    }
+    std::cout << "peak " << stat.total_peak / 1024 << "KB, arena peak "
+              << stat.arena_peak / 1024 << "KB, " << stat.arena_allocs << "/"
+              << stat.allocs << " allocs from arena, "
+              << stat.reclaimed / 1024 << "KB reclaimed" << std::endl;
+}
+
+/**
+ * build solo and tiled with the build arenas, then tiled on the heap. No
+ * Recast bytes may stay alive after a build
+ */
+int memory(const char *from, int threads)
+{
+    // nothing allocated by Recast or Detour yet
+    RecastNavMesh::install_build_arena();
+
+    RecastNavMesh::MemoryStat base;
+    RecastNavMesh::get_memory_stat(base);
+
+    for (int i = 0; i < 3; i++)
+    {
+        const bool arena = i < 2;
+        const bool tiled = i > 0;
+        RecastNavMesh::set_build_arena(arena);
+
+        RecastNavMesh rnm;
+        rnm.set_log_sink(print_build_log);
+        RecastNavMesh::reset_memory_peak();
+
+        RecastNavMesh::BuildStat stat;
+        bool ok = tiled ? rnm.build_tiled(from, threads, &stat)
+                        : rnm.build(from, &stat);
+        if (!ok)
+        {
+            std::cerr << "build mesh data from " << from << " fail"
+                      << std::endl;
+            return -1;
+        }
+
+        RecastNavMesh::MemoryStat mem;
+        RecastNavMesh::get_memory_stat(mem);
+        std::cout << (tiled ? "tiled" : "solo") << " build "
+                  << (arena ? "with arena " : "on heap ") << stat.total_ms
+                  << "ms" << std::endl;
+        print_memory_stat(mem);
+
+        const size_t leaked =
+            mem.bytes[RecastNavMesh::MEMORY_RC_PERM]
+            + mem.bytes[RecastNavMesh::MEMORY_RC_TEMP]
+            + mem.bytes[RecastNavMesh::MEMORY_DT_TEMP]
+            - base.bytes[RecastNavMesh::MEMORY_RC_PERM]
+            - base.bytes[RecastNavMesh::MEMORY_RC_TEMP]
+            - base.bytes[RecastNavMesh::MEMORY_DT_TEMP];
+        if (leaked)
+        {
+            std::cerr << leaked << " bytes leaked by the build" << std::endl;
+            return -1;
+        }
+    }
+
+    RecastNavMesh::set_build_arena(true);
+    return 0;
+}
+
+static long file_size(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static float path_length(const float *points, int size)
+{
+    float length = 0;
+    for (int i = 1; i < size; i++)
+    {
+        const float *a = &points[(i - 1) * 3];
+        const float *b = &points[i * 3];
+        length += sqrtf((b[0] - a[0]) * (b[0] - a[0])
+                        + (b[1] - a[1]) * (b[1] - a[1])
+                        + (b[2] - a[2]) * (b[2] - a[2]));
+    }
+    return length;
+}
+
+int lean(const char *file, const char *to, float sx, float sy, float sz,
+         float ex, float ey, float ez)
+{
+    // the heights of a path come from the detail mesh, so do the lengths
+    static const float max_deviation = 0.05f;
+    static const int max_size        = 256;
+
+    RecastNavMesh full;
+    if (!full.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    RecastNavMesh::MeshStat full_stat;
+    full.get_mesh_stat(full_stat);
+    const long full_size = file_size(file);
+    if (!full_stat.tiles || full_size <= 0) return -1;
+
+    int expect_size = 0;
+    float expect[max_size * 3];
+    unsigned int status =
+        full.straight(sx, sy, sz, ex, ey, ez, expect, max_size, expect_size);
+    if (!RecastNavMesh::is_succeed(status))
+    {
+        std::cerr << "no path on " << file << std::endl;
+        return -1;
+    }
+    const float expect_length = path_length(expect, expect_size);
+
+    std::cout << file << ": " << full_stat.tiles << " tiles, " << full_size
+              << " bytes in file, " << full_stat.data_bytes
+              << " bytes in memory, path length " << expect_length
+              << std::endl;
+
+    // the plain lean file is the last one saved, kept at to
+    static const int formats[] = {RecastNavMesh::MESH_FORMAT_LEAN_DETAIL,
+                                  RecastNavMesh::MESH_FORMAT_LEAN};
+    for (int format : formats)
+    {
+        const char *name =
+            format == RecastNavMesh::MESH_FORMAT_LEAN ? "lean" : "lean_detail";
+        if (!full.save(to, format))
+        {
+            std::cerr << "save " << name << " mesh to " << to << " fail"
+                      << std::endl;
+            return -1;
+        }
+
+        RecastNavMesh rnm;
+        if (!rnm.load(to))
+        {
+            std::cerr << "load " << name << " mesh from " << to << " fail"
+                      << std::endl;
+            return -1;
+        }
+
+        RecastNavMesh::MeshStat stat;
+        rnm.get_mesh_stat(stat);
+        const long size = file_size(to);
+        if (stat.tiles != full_stat.tiles || stat.polys != full_stat.polys)
+        {
+            std::cerr << name << " mesh has " << stat.tiles << " tiles "
+                      << stat.polys << " polys, expect " << full_stat.tiles
+                      << " tiles " << full_stat.polys << " polys"
+                      << std::endl;
+            return -1;
+        }
+
+        int use_size = 0;
+        float points[max_size * 3];
+        status = rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size,
+                              use_size);
+        if (!RecastNavMesh::is_succeed(status))
+        {
+            std::cerr << "no straight path on " << name << " mesh"
+                      << std::endl;
+            return -1;
+        }
+        const float length    = path_length(points, use_size);
+        const float deviation = fabsf(length - expect_length) / expect_length;
+
+        int follow_size = 0;
+        status = rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size,
+                            follow_size, 5.0);
+        if (!RecastNavMesh::is_succeed(status))
+        {
+            std::cerr << "no follow path on " << name << " mesh" << std::endl;
+            return -1;
+        }
+
+        std::cout << name << ": " << size << " bytes in file("
+                  << (full_size - size) / full_stat.tiles
+                  << " saved per tile), " << stat.data_bytes
+                  << " bytes in memory("
+                  << ((long)full_stat.data_bytes - (long)stat.data_bytes)
+                         / full_stat.tiles
+                  << " saved per tile), path length " << length
+                  << ", deviation " << deviation * 100 << "%" << std::endl;
+        if (deviation > max_deviation) return -1;
+    }
+
+    // the poly verts are off the grid of another cell height, the save must
+    // fail rather than move them, and leave no file
+    RecastNavMesh::Setting setting;
+    default_setting(setting);
+    setting.cellHeight = 0.3f;
+    RecastNavMesh other(nullptr, &setting, nullptr);
+    std::string bad_path(to);
+    bad_path.append(".bad");
+    if (!other.load(file)
+        || other.save(bad_path.c_str(), RecastNavMesh::MESH_FORMAT_LEAN)
+        || file_size(bad_path.c_str()) >= 0)
+    {
+        std::cerr << "lean mesh saved at a cell height it's not built with"
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int build_tiled(const char *from, const char *to, int threads)
+{
+    RecastNavMesh rnm;
+    rnm.set_log_sink(print_build_log);
+
+    RecastNavMesh::BuildStat stat;
+    if (!rnm.build_tiled(from, threads, &stat))
+    {
+        std::cerr << "build tiled mesh data from " << from << " fail"
+                  << std::endl;
+        return -1;
+    }
+    print_build_stat(stat);
+
+    std::string path(to ? to : from);
+    if (!to)
+    {
+        size_t pos = path.find_last_of(".");
+        if (pos != std::string::npos)
+        {
+            path = path.substr(0, pos);
+        }
+        path.append(".mesh");
+    }
+
+    if (!rnm.save(path.c_str()))
+    {
+        std::cerr << "save mesh data to " << path << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int build_streaming(const char *from, const char *to, int threads,
+                    int budget)
+{
+    RecastNavMesh rnm;
+    rnm.set_log_sink(print_build_log);
+
+    RecastNavMesh::BuildStat stat;
+    if (!rnm.build_streaming(from, to, threads, budget > 0 ? budget : 0,
+                             &stat))
+    {
+        std::cerr << "build streaming mesh data from " << from << " fail"
+                  << std::endl;
+        return -1;
+    }
+    print_build_stat(stat);
+
+    // the output must load as a normal tiled mesh
+    if (!rnm.load(to))
+    {
+        std::cerr << "load mesh data from " << to << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int build_tile_cache(const char *from, const char *to, int threads)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.build_tile_cache(from, 128, threads))
+    {
+        std::cerr << "build tile cache from " << from << " fail" << std::endl;
+        return -1;
+    }
+
+    std::string path(to ? to : from);
+    if (!to)
+    {
+        size_t pos = path.find_last_of(".");
+        if (pos != std::string::npos)
+        {
+            path = path.substr(0, pos);
+        }
+        path.append(".mesh");
+    }
+
+    if (!rnm.save(path.c_str(), RecastNavMesh::MESH_FORMAT_TILE_CACHE))
+    {
+        std::cerr << "save mesh data to " << path << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int rebuild(const char *file, const char *from, const char *to,
+            const float *bmin, const float *bmax)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    if (!rnm.rebuild(bmin, bmax, from))
+    {
+        std::cerr << "rebuild mesh data from " << from << " fail" << std::endl;
+        return -1;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+    std::cout << "rebuild (" << bmin[0] << "," << bmin[1] << "," << bmin[2]
+              << ") to (" << bmax[0] << "," << bmax[1] << "," << bmax[2]
+              << ") in " << elapsed << "ms" << std::endl;
+
+    if (!rnm.save(to))
+    {
+        std::cerr << "save mesh data to " << to << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int convert(const char *from, const char *to, int format)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(from))
+    {
+        std::cerr << "load mesh data from " << from << " fail" << std::endl;
+        return -1;
+    }
+
+    if (!rnm.save(to, format))
+    {
+        std::cerr << "save mesh data to " << to << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int cluster_graph(const char *from, const char *to, float cluster_size)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(from))
+    {
+        std::cerr << "load mesh data from " << from << " fail" << std::endl;
+        return -1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    if (!rnm.build_cluster_graph(cluster_size))
+    {
+        std::cerr << "build cluster graph of " << from << " fail" << std::endl;
+        return -1;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+    std::cout << "build cluster graph of " << from << " in " << elapsed << "ms"
+              << std::endl;
+
+    if (!rnm.save(to))
+    {
+        std::cerr << "save mesh data to " << to << " fail" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int follow(const char *file, float sx, float sy, float sz, float ex, float ey,
+           float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file, true))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    int use_size               = 0;
+    static const int max_size  = 256;
+    float points[max_size * 3] = {0};
+
+    unsigned int status =
+        rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size, use_size, 5.0);
+    std::cout << "path follow from (" << sx << "," << sy << "," << sz
+              << ") to (" << ex << "," << ey << "," << ez << ")" << std::endl;
+    if (!RecastNavMesh::is_succeed(status))
+    {
+        std::cerr << "    FAIL" << std::endl;
+        return -1;
+    }
+
+    std::cout.precision(3);
+    for (int i = 0; i < use_size; i++)
+    {
+        float *point = &points[i * 3];
+        std::cout << "    " << point[0] << "," << point[1] << "," << point[2]
+                  << std::endl;
+    }
+    if (RecastNavMesh::is_truncated(status))
+    {
+        std::cout << "    ... truncated at " << use_size << " points"
+                  << std::endl;
+    }
+
+    return RecastNavMesh::is_partia(status) ? 1 : 0;
+}
+
+int straight(const char *file, float sx, float sy, float sz, float ex, float ey,
+             float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file, true))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    int use_size               = 0;
+    static const int max_size  = 256;
+    float points[max_size * 3] = {0};
+
+    int path_size = 0;
+    unsigned int status = rnm.straight(sx, sy, sz, ex, ey, ez, points,
+                                       max_size, use_size, 0, &path_size);
+    std::cout << "path straight from (" << sx << "," << sy << "," << sz
+              << ") to (" << ex << "," << ey << "," << ez << ")" << std::endl;
+    if (!RecastNavMesh::is_succeed(status))
+    {
+        std::cerr << "    FAIL" << std::endl;
+        return -1;
+    }
+
+    std::cout.precision(3);
+    for (int i = 0; i < use_size; i++)
+    {
+        float *point = &points[i * 3];
+        std::cout << "    " << point[0] << "," << point[1] << "," << point[2]
+                  << std::endl;
+    }
+    if (RecastNavMesh::is_truncated(status))
+    {
+        std::cout << "    ... truncated, " << path_size << " points in total"
+                  << std::endl;
+    }
+
+    return RecastNavMesh::is_partia(status) ? 1 : 0;
+}
+
+/**
+ * disable the polys in the middle of the corridor one at a time, the corridor
+ * planned again must go around(or stop before) the disabled one
+ */
+int poly_flags(const char *file, float sx, float sy, float sz, float ex,
+               float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_polys = 4096;
+    std::vector<unsigned int> expect(max_polys), polys(max_polys);
+    int nexpect = 0;
+    unsigned int status = rnm.corridor(sx, sy, sz, ex, ey, ez, expect.data(),
+                                       max_polys, nexpect);
+    if (!RecastNavMesh::is_succeed(status) || nexpect < 3)
+    {
+        std::cerr << "corridor from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    // a poly may be the only way through, so only count the detours found
+    int detours = 0;
+    for (int i = nexpect / 2; i < nexpect - 1; ++i)
+    {
+        const unsigned int ref = expect[i];
+        if (!RecastNavMesh::is_succeed(rnm.set_poly_flags(
+                ref, RecastNavMesh::SAMPLE_POLYFLAGS_DISABLED)))
+        {
+            std::cerr << "set flags of poly " << ref << " fail" << std::endl;
+            return -1;
+        }
+
+        int npolys = 0;
+        status     = rnm.corridor(sx, sy, sz, ex, ey, ez, polys.data(),
+                                  max_polys, npolys);
+        // any flags but disabled pass the default filter
+        rnm.set_poly_flags(ref, RecastNavMesh::SAMPLE_POLYFLAGS_WALK);
+        if (!RecastNavMesh::is_succeed(status)) continue;
+
+        if (std::find(polys.begin(), polys.begin() + npolys, ref)
+            != polys.begin() + npolys)
+        {
+            std::cerr << "corridor go through disabled poly " << ref
+                      << std::endl;
+            return -1;
+        }
+        if (!RecastNavMesh::is_partia(status)
+            && polys[npolys - 1] == expect[nexpect - 1])
+            detours++;
+    }
+
+    std::cout << "corridor of " << nexpect << " polys, " << detours
+              << " detours around a disabled poly" << std::endl;
+    return detours > 0 ? 0 : -1;
+}
+
+int concurrent(const char *file, int threads, float sx, float sy, float sz,
+               float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    // the single thread result, every thread must get exactly the same
+    static const int max_size = 256;
+    int follow_size           = 0;
+    int straight_size         = 0;
+    float follow_points[max_size * 3];
+    float straight_points[max_size * 3];
+    rnm.follow(sx, sy, sz, ex, ey, ez, follow_points, max_size, follow_size,
+               5.0);
+    rnm.straight(sx, sy, sz, ex, ey, ez, straight_points, max_size,
+                 straight_size);
+    if (!follow_size || !straight_size)
+    {
+        std::cerr << "    FAIL" << std::endl;
+        return -1;
+    }
+
+    std::atomic<int> mismatch(0);
+    auto worker = [&]() {
+        float points[max_size * 3];
+        for (int i = 0; i < 100; i++)
+        {
+            int use_size = 0;
+            rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size, use_size, 5.0);
+            if (use_size != follow_size
+                || memcmp(points, follow_points, use_size * 3 * sizeof(float)))
+                mismatch++;
+
+            rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size, use_size);
+            if (use_size != straight_size
+                || memcmp(points, straight_points,
+                          use_size * 3 * sizeof(float)))
+                mismatch++;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) pool.push_back(std::thread(worker));
+    for (auto &t : pool) t.join();
+
+    std::cout << "concurrent query on " << threads << " threads, "
+              << mismatch.load() << " mismatch" << std::endl;
+
+    return mismatch ? -1 : 0;
+}
+
+int batch(const char *file, int count, float sx, float sy, float sz, float ex,
+          float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+    if (count <= 0) return -1;
+
+    static const int max_size = 256;
+    int follow_size           = 0;
+    int straight_size         = 0;
+    float follow_points[max_size * 3];
+    float straight_points[max_size * 3];
+    rnm.follow(sx, sy, sz, ex, ey, ez, follow_points, max_size, follow_size,
+               5.0);
+    rnm.straight(sx, sy, sz, ex, ey, ez, straight_points, max_size,
+                 straight_size);
+
+    std::vector<float> starts, ends;
+    for (int i = 0; i < count; i++)
+    {
+        starts.push_back(sx), starts.push_back(sy), starts.push_back(sz);
+        ends.push_back(ex), ends.push_back(ey), ends.push_back(ez);
+    }
+
+    std::vector<float> points(count * max_size * 3);
+    std::vector<int> offsets(count), sizes(count);
+    std::vector<unsigned int> status(count);
+
+    int mismatch = 0;
+    auto check   = [&](int use_size, const float *expect) {
+        for (int i = 0; i < count; i++)
+        {
+            if (!RecastNavMesh::is_succeed(status[i]) || sizes[i] != use_size
+                || memcmp(&points[offsets[i] * 3], expect,
+                          use_size * 3 * sizeof(float)))
+                mismatch++;
+        }
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    rnm.follow_batch(count, starts.data(), ends.data(), points.data(), max_size,
+                     offsets.data(), sizes.data(), status.data(), 5.0);
+    auto end = std::chrono::steady_clock::now();
+    check(follow_size, follow_points);
+    std::cout << "follow_batch " << count << " queries in "
+              << std::chrono::duration<double, std::milli>(end - begin).count()
+              << "ms" << std::endl;
+
+    begin = std::chrono::steady_clock::now();
+    rnm.straight_batch(count, starts.data(), ends.data(), points.data(),
+                       max_size, offsets.data(), sizes.data(), status.data());
+    end = std::chrono::steady_clock::now();
+    check(straight_size, straight_points);
+    std::cout << "straight_batch " << count << " queries in "
+              << std::chrono::duration<double, std::milli>(end - begin).count()
+              << "ms" << std::endl;
+
+    std::cout << mismatch << " mismatch" << std::endl;
+    return mismatch ? -1 : 0;
+}
+
+int path_cache(const char *file, int count, float sx, float sy, float sz,
+               float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+    rnm.follow(sx, sy, sz, ex, ey, ez, expect, max_size, expect_size, 5.0);
+
+    rnm.set_path_cache(64);
+
+    int mismatch = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int use_size = 0;
+        float points[max_size * 3];
+        rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size, use_size, 5.0);
+        if (use_size != expect_size
+            || memcmp(points, expect, use_size * 3 * sizeof(float)))
+            mismatch++;
+    }
+
+    RecastNavMesh::PathCacheStat stat;
+    rnm.get_path_cache_stat(stat);
+    std::cout << "path cache hit " << stat.hit << " miss " << stat.miss
+              << " size " << stat.size << "/" << stat.capacity << ", "
+              << mismatch << " mismatch" << std::endl;
+
+    // only the first query miss
+    if (mismatch || count <= 0 || stat.miss != 1) return -1;
+
+    // never more entries than the capacity, whatever the shards
+    const int capacities[] = {1, 5, 20, 33};
+    for (int capacity : capacities)
+    {
+        PathCache cache(capacity);
+        for (dtPolyRef ref = 1; ref <= 200; ref++)
+            cache.put(ref, ref + 1, nullptr, &ref, 1, DT_SUCCESS);
+        if (cache.size() > capacity)
+        {
+            std::cerr << "path cache of " << capacity << " hold "
+                      << cache.size() << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int node_pool(const char *file, int max_nodes, int count, float sx, float sy,
+              float sz, float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+    rnm.follow(sx, sy, sz, ex, ey, ez, expect, max_size, expect_size, 5.0);
+
+    // start small, the pool should grow until the path found in full
+    rnm.set_node_pool(max_nodes, true);
+    rnm.set_node_pool_sink([](int event, int max_nodes, int used_nodes) {
+        std::cout << (RecastNavMesh::NODE_POOL_RESIZED == event
+                          ? "    resized to "
+                          : "    out of nodes, pool ")
+                  << max_nodes << ", " << used_nodes << " nodes used"
+                  << std::endl;
+    });
+
+    int use_size        = 0;
+    unsigned int status = 0;
+    float points[max_size * 3];
+    for (int i = 0; i < count; i++)
+    {
+        status = rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size,
+                            use_size, 5.0);
+    }
+
+    RecastNavMesh::NodePoolStat stat;
+    rnm.get_node_pool_stat(stat);
+    std::cout << "node pool " << stat.max_nodes << ", high water "
+              << stat.high_water << ", " << stat.searches << " searches, "
+              << stat.out_of_nodes << " out of nodes, " << stat.resizes
+              << " resizes" << std::endl;
+
+    // the last query same as the one with the default pool
+    if (count <= 0 || !RecastNavMesh::is_succeed(status)
+        || RecastNavMesh::is_partia(status) || use_size != expect_size
+        || memcmp(points, expect, use_size * 3 * sizeof(float)))
+        return -1;
+    return 0;
+}
+
+int point_grid(const char *file, int count, float sx, float sy, float sz,
+               float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        rnm.follow(sx, sy, sz, ex, ey, ez, expect, max_size, expect_size,
+                   5.0);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+    std::cout << "findNearestPoly " << count << " queries " << elapsed
+              << "ms" << std::endl;
+
+    rnm.set_point_grid();
+
+    int use_size        = 0;
+    unsigned int status = 0;
+    float points[max_size * 3];
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        status = rnm.follow(sx, sy, sz, ex, ey, ez, points, max_size,
+                            use_size, 5.0);
+    }
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+    std::cout << "point grid " << count << " queries " << elapsed << "ms"
+              << std::endl;
+
+    // the grid resolve the same polys as findNearestPoly
+    if (count <= 0 || !RecastNavMesh::is_succeed(status)
+        || use_size != expect_size
+        || memcmp(points, expect, use_size * 3 * sizeof(float)))
+        return -1;
+    return 0;
+}
+
+int raycast(const char *file, int count, float sx, float sy, float sz,
+            float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+    if (count <= 0) return -1;
+
+    // fan the rays around start, as far as end
+    const float dx = ex - sx, dz = ez - sz;
+    std::vector<float> starts(count * 3), ends(count * 3);
+    for (int i = 0; i < count; i++)
+    {
+        const float a = 6.2831853f * i / count;
+        starts[i]             = sx;
+        starts[count + i]     = sy;
+        starts[count * 2 + i] = sz;
+        ends[i]               = sx + dx * cosf(a) - dz * sinf(a);
+        ends[count + i]       = ey;
+        ends[count * 2 + i]   = sz + dx * sinf(a) + dz * cosf(a);
+    }
+
+    std::vector<float> t(count), normals(count * 3);
+    std::vector<unsigned int> last_refs(count), status(count);
+
+    auto begin = std::chrono::steady_clock::now();
+    int succeed = rnm.raycast_batch(count, starts.data(), ends.data(),
+                                    t.data(), normals.data(),
+                                    last_refs.data(), status.data());
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+    std::cout << "raycast_batch " << succeed << "/" << count << " rays "
+              << elapsed << "ms" << std::endl;
+
+    // every ray same as the scalar raycast
+    int mismatch = 0;
+    int hits     = 0;
+    begin        = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        float expect_t = 0;
+        float normal[3];
+        unsigned int last_ref = 0;
+        unsigned int st       = rnm.raycast(
+            starts[i], starts[count + i], starts[count * 2 + i], ends[i],
+            ends[count + i], ends[count * 2 + i], expect_t, normal, &last_ref);
+
+        if (RecastNavMesh::is_succeed(st) && expect_t <= 1) hits++;
+        if (RecastNavMesh::is_succeed(st)
+                != RecastNavMesh::is_succeed(status[i])
+            || expect_t != t[i] || last_ref != last_refs[i]
+            || normal[0] != normals[i] || normal[1] != normals[count + i]
+            || normal[2] != normals[count * 2 + i])
+            mismatch++;
+    }
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+    std::cout << "raycast " << count << " rays " << elapsed << "ms, " << hits
+              << " hit a wall, " << mismatch << " mismatch" << std::endl;
+
+    if (mismatch || succeed <= 0) return -1;
+    return 0;
+}
+
+int crowd(const char *file, int agents, int ticks, float sx, float sy,
+          float sz, float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    Crowd::AgentParams params;
+    params.radius    = 0.6f;
+    params.max_speed = 3.5f;
+    params.max_accel = 8.0f;
+
+    // a square of agents around start, all heading for end
+    Crowd crowd(&rnm, agents, params.radius);
+    const float end[3] = {ex, ey, ez};
+    const int side     = (int)ceilf(sqrtf((float)agents));
+    std::vector<float> start_dist;
+    for (int i = 0; i < agents; i++)
+    {
+        const float pos[3] = {sx + (i % side - side / 2) * 1.5f, sy,
+                              sz + (i / side - side / 2) * 1.5f};
+        const int id       = crowd.add_agent(pos, params);
+        if (id < 0) continue;
+
+        float at[3];
+        crowd.get_agent(id, at, nullptr);
+        crowd.set_target(id, end);
+        start_dist.resize(id + 1, 0);
+        start_dist[id] = sqrtf((at[0] - ex) * (at[0] - ex)
+                               + (at[2] - ez) * (at[2] - ez));
+    }
+    if (!crowd.agent_count()) return -1;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) crowd.update(0.1f);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+
+    // every agent should have a path and got closer
+    int arrived = 0, failed = 0;
+    for (int id = 0; id < (int)start_dist.size(); id++)
+    {
+        float pos[3];
+        int state = crowd.get_agent(id, pos, nullptr);
+        if (Crowd::AGENT_INVALID == state) continue;
+
+        const float dist = sqrtf((pos[0] - ex) * (pos[0] - ex)
+                                 + (pos[2] - ez) * (pos[2] - ez));
+        if (Crowd::AGENT_ARRIVED == state) arrived++;
+        if (Crowd::AGENT_FAILED == state || dist >= start_dist[id]) failed++;
+    }
+    std::cout << crowd.agent_count() << " agents " << ticks << " ticks "
+              << elapsed << "ms, " << arrived << " arrived, " << failed
+              << " failed" << std::endl;
+
+    return failed ? -1 : 0;
+}
+
+int follow_iter(const char *file, float sx, float sy, float sz, float ex,
+                float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+    rnm.follow(sx, sy, sz, ex, ey, ez, expect, max_size, expect_size, 5.0);
+
+    RecastNavMesh::PathIterator iter;
+    unsigned int status = rnm.follow(sx, sy, sz, ex, ey, ez, iter, 5.0);
+    std::cout << "path follow_iter from (" << sx << "," << sy << "," << sz
+              << ") to (" << ex << "," << ey << "," << ez << ")" << std::endl;
+    if (!RecastNavMesh::is_succeed(status))
+    {
+        std::cerr << "    FAIL" << std::endl;
+        return -1;
+    }
+
+    // pull a few points at a time, as an agent would do
+    std::cout.precision(3);
+    int size = 0, mismatch = 0;
+    while (!iter.done())
+    {
+        float points[3 * 3];
+        int n = iter.next(points, 3);
+        for (int i = 0; i < n; i++, size++)
+        {
+            float *point = &points[i * 3];
+            std::cout << "    " << point[0] << "," << point[1] << ","
+                      << point[2] << std::endl;
+            if (size < expect_size && memcmp(point, &expect[size * 3], 12))
+                mismatch++;
+        }
+    }
+
+    if (size < expect_size || mismatch)
+    {
+        std::cerr << "    MISMATCH " << size << "/" << expect_size << std::endl;
+        return -1;
+    }
+    return RecastNavMesh::is_partia(status) ? 1 : 0;
+}
+
+int schedule(const char *file, int count, int budget_us, float sx, float sy,
+             float sz, float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int follow_size = 0, straight_size = 0;
+    float follow_expect[max_size * 3], straight_expect[max_size * 3];
+    rnm.follow(sx, sy, sz, ex, ey, ez, follow_expect, max_size, follow_size,
+               5.0);
+    rnm.straight(sx, sy, sz, ex, ey, ez, straight_expect, max_size,
+                 straight_size);
+
+    PathScheduler scheduler(&rnm, 8);
+    scheduler.set_follow_step(5.0);
+
+    // even requests are fetched, odd ones are delivered by callback
+    int mismatch = 0, callbacks = 0;
+    std::vector<PathScheduler::Handle> handles;
+    for (int i = 0; i < count; i++)
+    {
+        int type = i % 4 < 2 ? PathScheduler::REQUEST_FOLLOW
+                             : PathScheduler::REQUEST_STRAIGHT;
+        const float *expect =
+            type == PathScheduler::REQUEST_FOLLOW ? follow_expect
+                                                  : straight_expect;
+        int expect_size =
+            type == PathScheduler::REQUEST_FOLLOW ? follow_size : straight_size;
+
+        PathScheduler::Callback callback = nullptr;
+        if (i % 2)
+        {
+            callback = [&, expect, expect_size](PathScheduler::Handle,
+                                                const PathScheduler::Result &r) {
+                callbacks++;
+                if ((int)r.points.size() != expect_size * 3
+                    || memcmp(r.points.data(), expect,
+                              expect_size * 3 * sizeof(float)))
+                    mismatch++;
+            };
+        }
+        handles.push_back(scheduler.request(type, sx, sy, sz, ex, ey, ez,
+                                            i % 3, max_size, callback));
+    }
+
+    int ticks = 0, max_depth = 0;
+    while (scheduler.queue_depth() > 0)
+    {
+        max_depth = std::max(max_depth, scheduler.queue_depth());
+
+        auto begin = std::chrono::steady_clock::now();
+        scheduler.update(budget_us);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - begin)
+                           .count();
+        ticks++;
+        // a swap in the middle, the running request is planned again
+        if (2 == ticks && !rnm.load(file)) return -1;
+        if (0 == ticks % 10)
+        {
+            std::cout << "tick " << ticks << " " << elapsed << "us, depth "
+                      << scheduler.queue_depth() << std::endl;
+        }
+    }
+
+    for (int i = 0; i < count; i += 2)
+    {
+        const float *expect = i % 4 < 2 ? follow_expect : straight_expect;
+        int expect_size     = i % 4 < 2 ? follow_size : straight_size;
+
+        int use_size = 0;
+        float points[max_size * 3];
+        unsigned int status =
+            scheduler.fetch(handles[i], points, max_size, use_size);
+        if (!RecastNavMesh::is_succeed(status) || use_size != expect_size
+            || memcmp(points, expect, use_size * 3 * sizeof(float)))
+            mismatch++;
+    }
+
+    std::cout << "schedule " << count << " requests in " << ticks
+              << " ticks, max depth " << max_depth << ", avg ticks "
+              << scheduler.avg_ticks() << ", " << callbacks << " callbacks, "
+              << mismatch << " mismatch" << std::endl;
+
+    if (mismatch || callbacks != count / 2) return -1;
+    return 0;
+}
+
+int obstacle(const char *file, float sx, float sy, float sz, float ex,
+             float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+    unsigned int status = rnm.straight(sx, sy, sz, ex, ey, ez, expect,
+                                       max_size, expect_size);
+    if (!RecastNavMesh::is_succeed(status) || expect_size < 3)
+    {
+        std::cerr << "no path to block" << std::endl;
+        return -1;
+    }
+
+    // block the path at a corner in the middle
+    const float *corner = &expect[(expect_size / 2) * 3];
+    const float bmin[3] = {corner[0] - 1.f, corner[1] - 1.f, corner[2] - 1.f};
+    const float bmax[3] = {corner[0] + 1.f, corner[1] + 2.f, corner[2] + 1.f};
+
+    unsigned int ref = 0;
+    status           = rnm.add_box_obstacle(bmin, bmax, ref);
+    if (!RecastNavMesh::is_succeed(status))
+    {
+        std::cerr << "add obstacle fail" << std::endl;
+        return -1;
+    }
+
+    // a failed update or one never done would spin forever
+    static const int max_frames = 1000;
+    int frames = 0;
+    status     = rnm.update_obstacles(1000);
+    while (RecastNavMesh::is_in_progress(status) && ++frames < max_frames)
+        status = rnm.update_obstacles(1000);
+    if (!RecastNavMesh::is_succeed(status)
+        || RecastNavMesh::is_in_progress(status))
+    {
+        std::cerr << "add obstacle not applied in " << frames + 1
+                  << " frames" << std::endl;
+        return -1;
+    }
+
+    int use_size = 0;
+    float points[max_size * 3];
+    status = rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size, use_size);
+    bool changed = !RecastNavMesh::is_succeed(status)
+                || RecastNavMesh::is_partia(status) || use_size != expect_size
+                || memcmp(points, expect, use_size * 3 * sizeof(float));
+    std::cout << "obstacle at (" << corner[0] << "," << corner[1] << ","
+              << corner[2] << ") applied in " << frames + 1 << " frames, path "
+              << (changed ? "changed" : "unchanged") << std::endl;
+
+    rnm.remove_obstacle(ref);
+    frames = 0;
+    status = rnm.update_obstacles(1000);
+    while (RecastNavMesh::is_in_progress(status) && ++frames < max_frames)
+        status = rnm.update_obstacles(1000);
+    if (!RecastNavMesh::is_succeed(status)
+        || RecastNavMesh::is_in_progress(status))
+    {
+        std::cerr << "remove obstacle not applied in " << frames + 1
+                  << " frames" << std::endl;
+        return -1;
+    }
+
+    status = rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size, use_size);
+    bool restored = RecastNavMesh::is_succeed(status)
+                 && use_size == expect_size
+                 && 0 == memcmp(points, expect, use_size * 3 * sizeof(float));
+    std::cout << "obstacle removed, path "
+              << (restored ? "restored" : "not restored") << std::endl;
+
+    if (!changed || !restored) return -1;
+    return 0;
+}
+
+static void print_stream_stat(const RecastNavMesh::StreamStat &stat)
+{
+    std::cout << "    resident " << stat.resident << "/" << stat.tiles
+              << " tiles, " << stat.resident_bytes << "/" << stat.budget
+              << " bytes, pending " << stat.pending << ", loads " << stat.loads
+              << ", evictions " << stat.evictions << ", failures "
+              << stat.failures << ", failed " << stat.failed << std::endl;
+}
+
+int stream(const char *file, int budget, float sx, float sy, float sz,
+           float ex, float ey, float ez)
+{
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+    {
+        RecastNavMesh full;
+        if (!full.load(file))
+        {
+            std::cerr << "load mesh data from " << file << " fail"
+                      << std::endl;
+            return -1;
+        }
+
+        unsigned int status = full.straight(sx, sy, sz, ex, ey, ez, expect,
+                                            max_size, expect_size);
+        if (!RecastNavMesh::is_succeed(status))
+        {
+            std::cerr << "no path with all tiles loaded" << std::endl;
+            return -1;
+        }
+    }
+
+    RecastNavMesh rnm;
+    if (!rnm.load_streaming(file, budget))
+    {
+        std::cerr << "load streaming from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    // nothing resident at first, every query request the tiles it need and
+    // get further after the next update
+    static const int max_frames = 1000;
+    int use_size = 0;
+    float points[max_size * 3];
+    int frames          = 0;
+    unsigned int status = 0;
+    while (true)
+    {
+        status = rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size,
+                              use_size);
+        if (RecastNavMesh::is_succeed(status)
+            && !RecastNavMesh::is_partia(status))
+            break;
+        if (++frames > max_frames) break;
+
+        rnm.update_streaming();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    RecastNavMesh::StreamStat stat;
+    rnm.get_stream_stat(stat);
+    bool same = RecastNavMesh::is_succeed(status) && use_size == expect_size
+             && 0 == memcmp(points, expect, use_size * 3 * sizeof(float));
+    std::cout << "stream path from (" << sx << "," << sy << "," << sz
+              << ") to (" << ex << "," << ey << "," << ez << ") in "
+              << frames << " frames, "
+              << (same ? "same as" : "differ from") << " all tiles loaded"
+              << std::endl;
+    print_stream_stat(stat);
+
+    // only the end stay hot, the tiles of the path are evicted if over budget
+    const float end[3] = {ex, ey, ez};
+    int id             = rnm.add_interest(end, 1.f);
+    for (int i = 0; i < 3; i++) rnm.update_streaming();
+
+    rnm.get_stream_stat(stat);
+    std::cout << "interest at end only" << std::endl;
+    print_stream_stat(stat);
+    rnm.remove_interest(id);
+
+    if (!same || stat.resident_bytes > stat.budget || stat.failures)
+        return -1;
+    return 0;
+}
+
+int hot_swap(const char *file, int threads, float sx, float sy, float sz,
+             float ex, float ey, float ez)
+{
+    RecastNavMesh rnm;
+
+    if (!rnm.load(file))
+    {
+        std::cerr << "load mesh data from " << file << " fail" << std::endl;
+        return -1;
+    }
+
+    static const int max_size = 256;
+    int expect_size           = 0;
+    float expect[max_size * 3];
+    rnm.straight(sx, sy, sz, ex, ey, ez, expect, max_size, expect_size);
+    if (!expect_size)
+    {
+        std::cerr << "    FAIL" << std::endl;
+        return -1;
+    }
+
+    // the same file is swapped in again and again, every query must get the
+    // same path whichever mesh it ran on
+    std::atomic<bool> stop(false);
+    std::atomic<int> queries(0);
+    std::atomic<int> mismatch(0);
+    auto worker = [&]() {
+        float points[max_size * 3];
+        while (!stop)
+        {
+            int use_size = 0;
+            rnm.straight(sx, sy, sz, ex, ey, ez, points, max_size, use_size);
+            if (use_size != expect_size
+                || memcmp(points, expect, use_size * 3 * sizeof(float)))
+                mismatch++;
+            queries++;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) pool.push_back(std::thread(worker));
+
+    // load in place and load aside then swap_mesh, in turn
+    static const int swaps = 20;
+    int failed             = 0;
+    for (int i = 0; i < swaps; i++)
+    {
+        if (i & 1)
+        {
+            RecastNavMesh next;
+            if (!next.load(file) || !rnm.swap_mesh(next)) failed++;
+        }
+        else if (!rnm.load(file))
+        {
+            failed++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    stop = true;
+    for (auto &t : pool) t.join();
+
+    RecastNavMesh::SwapStat stat;
+    rnm.get_swap_stat(stat);
+    std::cout << "hot swap " << swaps << " times under " << threads
+              << " threads, " << queries.load() << " queries "
+              << mismatch.load() << " mismatch, " << failed
+              << " swap failed" << std::endl;
+    std::cout << "    " << stat.swaps << " published, " << stat.reclaimed
+              << " reclaimed, " << stat.retired << " retired" << std::endl;
+
+    // every replaced mesh is either freed or still waiting, never lost
+    if (mismatch || failed || stat.reclaimed + stat.retired != stat.swaps)
+        return -1;
+
+    // queries never free a mesh, the waiting ones go once no query is left
+    rnm.reclaim_retired();
+    rnm.get_swap_stat(stat);
+    if (stat.retired || stat.reclaimed != stat.swaps)
+    {
+        std::cerr << stat.retired << " meshes left after reclaim" << std::endl;
+        return -1;
+    }
+    return 0;
 }